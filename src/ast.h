@@ -119,6 +119,8 @@ struct ast_schema {
 		KWS_SINGLETON_ITEMS	  = 1 << 11, /* .items was not an array */
 
 		KWS_HAS_REF		  = 1 << 12, /* .ref, must ignore everything else */
+
+		KWS_CONST		  = 1 << 13, /* .xenum is from "const" */
 	} kws;
 
 	struct json_string ref;
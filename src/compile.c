@@ -1,8 +1,13 @@
 #include "validate.h"
+
+#include <stdlib.h>
+
+#include "xalloc.h"
 #include "validate_constraints.h"
 #include "validate_ir.h"
 #include "validate_op.h"
 #include "validate_vm.h"
+#include "validate_link.h"
 
 struct jvst_vm_program *
 jvst_compile_schema(const struct ast_schema *schema)
@@ -20,4 +25,73 @@ jvst_compile_schema(const struct ast_schema *schema)
 	return prog;
 }
 
+struct jvst_vm_program *
+jvst_compile_schemas(const struct ast_schema *const *schemas, size_t n)
+{
+	struct jvst_cnode_forest **ctrees;
+	struct jvst_ir_forest **ir_forests, *combined;
+	struct jvst_ir_stmt *linearized, *flattened;
+	struct jvst_op_program *opasm;
+	struct jvst_vm_program *prog;
+	size_t i;
+
+	ctrees = xcalloc(n, sizeof ctrees[0]);
+	ir_forests = xcalloc(n, sizeof ir_forests[0]);
+
+	for (i=0; i < n; i++) {
+		ctrees[i] = jvst_cnode_translate_ast_with_ids(schemas[i]);
+		jvst_cnode_prune_forest(ctrees[i]);
+		jvst_cnode_simplify_forest(ctrees[i]);
+		jvst_cnode_canonify_forest(ctrees[i]);
+
+		ir_forests[i] = jvst_ir_translate_forest(ctrees[i]);
+	}
+
+	combined = jvst_ir_combine_forests(ir_forests, n);
+	linearized = jvst_ir_linearize_forest(combined);
+	flattened = jvst_ir_flatten(linearized);
+
+	// sub-schemas shared between the schemas compile to identical
+	// procs, which the encoder keeps one copy of
+	opasm = jvst_op_assemble(flattened);
+	prog = jvst_op_encode(opasm);
+	prog->nschema = n;
+
+	jvst_ir_forest_free(combined);
+	for (i=0; i < n; i++) {
+		jvst_ir_forest_free(ir_forests[i]);
+		jvst_cnode_forest_delete(ctrees[i]);
+	}
+	free(ir_forests);
+	free(ctrees);
+
+	return prog;
+}
+
+struct jvst_vm_module *
+jvst_compile_module(const struct ast_schema *schema)
+{
+	struct jvst_cnode_forest *ctrees;
+	struct jvst_ir_forest *ir_forest;
+	struct jvst_ir_stmt *linearized, *flattened;
+	struct jvst_op_program *opasm;
+	struct jvst_vm_module *mod;
+
+	ctrees = jvst_cnode_translate_module(schema);
+	jvst_cnode_simplify_forest(ctrees);
+	jvst_cnode_canonify_forest(ctrees);
+
+	ir_forest = jvst_ir_translate_forest(ctrees);
+	linearized = jvst_ir_linearize_module(ir_forest);
+	flattened = jvst_ir_flatten(linearized);
+
+	opasm = jvst_op_assemble(flattened);
+	mod = jvst_op_encode_module(opasm);
+
+	jvst_ir_forest_free(ir_forest);
+	jvst_cnode_forest_delete(ctrees);
+
+	return mod;
+}
+
 /* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -22,6 +22,10 @@ enum {
 	DEBUG_VMPROG           = 1 << 11,
         DEBUG_VMOP             = 1 << 12,
         DEBUG_VMTOK            = 1 << 13,
+        DEBUG_VMSTATS          = 1 << 14,
+        DEBUG_VMPROF           = 1 << 15,
+        DEBUG_VMPROF_TIME      = 1 << 16,
+        DEBUG_VMPROF_JSON      = 1 << 17,
 };
 
 extern unsigned debug;
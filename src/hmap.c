@@ -225,6 +225,21 @@ hmap_free(struct hmap *m)
 	free(m);
 }
 
+void
+hmap_clear(struct hmap *m)
+{
+	size_t i;
+
+	for (i=0; i < m->nbuckets; i++) {
+		m->khb[i].hash = 0;
+		m->khb[i].key  = NULL;
+
+		m->vb[i].p = NULL;
+	}
+
+	m->nitems = 0;
+}
+
 union hmap_value *
 hmap_get(const struct hmap *m, const void *k)
 {
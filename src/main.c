@@ -10,6 +10,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -31,6 +32,10 @@
 #include "validate_ir.h"
 #include "validate_op.h"
 #include "validate_vm.h"
+#include "validate_jit.h"
+#include "validate_verify.h"
+#include "validate_prof.h"
+#include "validate_explain.h"
 
 unsigned debug;
 
@@ -94,7 +99,8 @@ debug_flags(const char *s)
 		case '+': v = 1; continue;
 		case '-': v = 0; continue;
 
-		case 'a': e = ~0U;                    break;
+		// the profiler changes how the VM runs, so it isn't in 'a'
+		case 'a': e = ~0U & ~(DEBUG_VMPROF | DEBUG_VMPROF_TIME | DEBUG_VMPROF_JSON); break;
 		case 's': e = DEBUG_SJP;              break;
 		case 'l': e = DEBUG_LEX;              break;
 		case 'c': e = DEBUG_ACT;              break;
@@ -109,6 +115,10 @@ debug_flags(const char *s)
 		case 'p': e = DEBUG_VMPROG;           break;
 		case 'v': e = DEBUG_VMOP;             break;
 		case 'T': e = DEBUG_VMTOK;            break;
+		case 'V': e = DEBUG_VMSTATS;          break;
+		case 'P': e = DEBUG_VMPROF;           break;
+		case 't': e = DEBUG_VMPROF_TIME;      break;
+		case 'J': e = DEBUG_VMPROF_JSON;      break;
 
 		default:
 			fprintf(stderr, "-d: unrecognised flag '%c'\n", *s);
@@ -168,18 +178,24 @@ main(int argc, char *argv[])
 	static const struct json_string szero;
 	static const struct ast_schema ast_default;
 	int r;
-	int compile=0, runvm=0;
+	int compile=0, runvm=0, jit=0, explain=0, lazy=0;
 	struct jvst_vm_program *prog = NULL;
 	struct jvst_ir_forest *ir_forest;
 	enum jvst_lang lang = JVST_LANG_VM;
+	enum jvst_vm_input input = JVST_VM_INPUT_JSON;
+	enum jvst_vm_early_exit early_exit = JVST_VM_EXIT_AT_END;
 	struct json_string base_uri;
 
+	// lazy programs compile from the schema as they run, so it
+	// outlives the compile below
+	struct ast_schema ast = ast_default;
+
 	base_uri = szero;
 
 	{
 		int c;
 
-		while (c = getopt(argc, argv, "b:l:rcd:"), c != -1) {
+		while (c = getopt(argc, argv, "b:e:f:l:rcjxLd:"), c != -1) {
 			switch (c) {
 			case 'b':
 				base_uri.s = xstrdup(optarg);
@@ -190,6 +206,30 @@ main(int argc, char *argv[])
 				compile = 1;
 				break;
 
+			case 'e':
+				if (strcmp(optarg,"check") == 0) {
+					early_exit = JVST_VM_EXIT_DECIDED;
+				} else if (strcmp(optarg,"nocheck") == 0) {
+					early_exit = JVST_VM_EXIT_DECIDED_NOCHECK;
+				} else {
+					fprintf(stderr, "unknown early exit mode: %s\n", optarg);
+					goto usage;
+				}
+				break;
+
+			case 'f':
+				if (strcmp(optarg,"json") == 0) {
+					input = JVST_VM_INPUT_JSON;
+				} else if (strcmp(optarg,"cbor") == 0) {
+					input = JVST_VM_INPUT_CBOR;
+				} else if (strcmp(optarg,"msgpack") == 0) {
+					input = JVST_VM_INPUT_MSGPACK;
+				} else {
+					fprintf(stderr, "unknown input format: %s\n", optarg);
+					goto usage;
+				}
+				break;
+
 			case 'l':
 				if (strcmp(optarg,"c") == 0) {
 					lang = JVST_LANG_C;
@@ -211,6 +251,18 @@ main(int argc, char *argv[])
 				runvm = 1;
 				break;
 
+			case 'j':
+				jit = 1;
+				break;
+
+			case 'x':
+				explain = 1;
+				break;
+
+			case 'L':
+				lazy = 1;
+				break;
+
 			default:
 				goto usage;
 			}
@@ -220,6 +272,11 @@ main(int argc, char *argv[])
 		argv += optind;
 	}
 
+	if (lazy && lang == JVST_LANG_C) {
+		fprintf(stderr, "-L cannot be used to generate C\n");
+		goto usage;
+	}
+
 	if (compile) {
 		/* Prepare IR tree (all output languages) */
 
@@ -245,8 +302,6 @@ main(int argc, char *argv[])
 		}
 
 		struct sjp_lexer l;
-		struct ast_schema ast = ast_default;
-		struct jvst_cnode_forest *ctrees;
 
 		{
 			char *p;
@@ -288,6 +343,17 @@ main(int argc, char *argv[])
 
 			free(p);
 		}
+	}
+
+	if (compile && lazy) {
+		prog = jvst_compile_lazy(&ast);
+		if (debug & DEBUG_VMPROG) {
+			printf("Initial VM program:\n");
+			jvst_vm_program_print(stdout, prog);
+			printf("\n");
+		}
+	} else if (compile) {
+		struct jvst_cnode_forest *ctrees;
 
 		ctrees = jvst_cnode_translate_ast_with_ids(&ast);
 		if (debug & DEBUG_INITIAL_CNODE) {
@@ -296,6 +362,8 @@ main(int argc, char *argv[])
 			printf("\n");
 		}
 
+		jvst_cnode_prune_forest(ctrees);
+
 		jvst_cnode_simplify_forest(ctrees);
 		if (debug & DEBUG_SIMPLIFIED_CNODE) {
 			printf("Simplified cnode tree\n");
@@ -319,9 +387,10 @@ main(int argc, char *argv[])
 	}
 
 	/* compile IR into VM opcodes */
-	if (compile) {
+	if (compile && !lazy) {
 		switch (lang) {
 		case JVST_LANG_VM:
+		case JVST_LANG_C:
 			{
 				struct jvst_ir_stmt *linearized, *flattened;
 				struct jvst_op_program *op_prog;
@@ -357,11 +426,12 @@ main(int argc, char *argv[])
 				// TODO: add bit where the vm program is saved, possibly
 				// if runvm is false
 			}
-			break;
 
-		case JVST_LANG_C:
-			fprintf(stderr, "C output needs to be implemented\n");
-			exit(EXIT_FAILURE);
+			if (lang == JVST_LANG_C && jvst_vm_program_genc(stdout, prog) != 0) {
+				perror("writing C output");
+				exit(EXIT_FAILURE);
+			}
+			break;
 
 		default:
 			fprintf(stderr, "internal error: unknown language %d\n", lang);
@@ -370,13 +440,31 @@ main(int argc, char *argv[])
 	}
 
 	if (runvm) {
-		char *p;
+		static char buf[65536];
 		size_t n;
+		char *kept = NULL;
+		size_t nkept = 0, maxkept = 0;
 		FILE *f_data;
 		struct jvst_vm vm = { 0 };
 		enum jvst_result ret;
 
+		if (prog != NULL) {
+			struct jvst_vm_verify_error verr;
+
+			if (jvst_vm_verify(prog, &verr) != 0) {
+				fprintf(stderr, "VM program failed verification at pc %" PRIu32 ": %s\n",
+					verr.pc, verr.msg);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if (jit && prog != NULL && jvst_vm_jit(prog) != 0) {
+			fprintf(stderr, "JIT is not available, interpreting the VM program\n");
+		}
+
 		jvst_vm_init_defaults(&vm, prog);
+		jvst_vm_set_input(&vm, input);
+		jvst_vm_set_early_exit(&vm, early_exit);
 
 		if (prog == NULL) {
 			// TODO: add bit where we load the vm program
@@ -384,6 +472,21 @@ main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
+		if (debug & (DEBUG_VMPROF | DEBUG_VMPROF_TIME | DEBUG_VMPROF_JSON)) {
+			unsigned pflags = 0;
+
+			if (debug & DEBUG_VMPROF_TIME) {
+				pflags |= JVST_VM_PROF_TIME;
+			}
+
+			if (debug & DEBUG_VMPROF_JSON) {
+				pflags |= JVST_VM_PROF_JSON;
+			}
+
+			// reported by jvst_vm_finalize()
+			jvst_vm_set_profile(&vm, pflags, stderr);
+		}
+
 		if (argc < 1) {
 			f_data = stdin;
 		} else {
@@ -395,21 +498,55 @@ main(int argc, char *argv[])
 			}
 		}
 
-		// FIXME: should stream this!
-		p = readfile(f_data, &n);
-		if (f_data != stdin) {
-			fclose(f_data);
+		// stop reading once the result is decided, with -e
+		ret = JVST_VALID;
+		while (!JVST_IS_INVALID(ret) && !jvst_vm_decided(&vm) &&
+				(n = fread(buf, 1, sizeof buf, f_data)) > 0) {
+			ret = jvst_vm_more(&vm, buf, n);
+
+			// -x validates invalid documents again, so keep them
+			if (explain) {
+				if (nkept + n > maxkept) {
+					kept = xenlargevec(kept, &maxkept, nkept + n - maxkept, 1);
+				}
+				memcpy(&kept[nkept], buf, n);
+				nkept += n;
+			}
 		}
-		if (p == NULL) {
-			perror("readfile");
+
+		if (ferror(f_data)) {
+			perror("reading json");
 			exit(EXIT_FAILURE);
 		}
 
-		// XXX - can't do this if we're streaming
-		(void) jvst_vm_more(&vm, p, n);
+		if (f_data != stdin) {
+			fclose(f_data);
+		}
+
 		ret = jvst_vm_close(&vm);
 
-		// TODO - better diagnostics!
+		if (debug & DEBUG_VMSTATS) {
+			size_t hits, misses;
+
+			jvst_vm_mcache_stats(&vm, &hits, &misses);
+			fprintf(stderr, "match cache: %zu hits, %zu misses\n", hits, misses);
+		}
+
+		jvst_vm_finalize(&vm);
+
+		if (ret == JVST_INVALID && explain) {
+			struct jvst_vm_explain ex = { 0 };
+
+			if (input != JVST_VM_INPUT_JSON) {
+				fprintf(stderr, "-x can only explain JSON text\n");
+			} else if (jvst_vm_explain(prog, NULL, kept, nkept, &ex) == JVST_INVALID) {
+				jvst_vm_explain_print(stderr, &ex);
+			}
+
+			jvst_vm_explain_finalize(&ex);
+		}
+		free(kept);
+
 		if (ret == JVST_INVALID) {
 			exit(EXIT_FAILURE);
 		} else {
@@ -422,7 +559,7 @@ main(int argc, char *argv[])
 usage:
 
 	fprintf(stderr, "usage: jvst [-d +-aslc] [-l <lang>] -c <schema> [<compiled>]\n"
-			"       jvst [-d +-aslc] -c -r <schema> [<json>]\n"
+			"       jvst [-d +-aslc] [-f <format>] [-e <trailing>] -c -r [-j] [-x] [-L] <schema> [<json>]\n"
 			// "       jvst [-d +-aslc] -r <compiled> [<json>]\n"
 			"\n"
 			"  -l <lang>\n"
@@ -438,9 +575,35 @@ usage:
 			"\n"
 			"  -r       run jvst VM code on json\n"
 			"\n"
+			"  -j       compile the VM code to machine code before running\n"
+			"           it (x86-64 only)\n"
+			"\n"
+			"  -x       explains why the document given to -r is invalid:\n"
+			"           where in the document and the schema it failed\n"
+			"\n"
+			"  -L       compiles each definition of the schema the first\n"
+			"           time the document given to -r gets to it, rather\n"
+			"           than all of them before the run\n"
+			"\n"
+			"  -e <trailing>\n"
+			"           stops reading the document given to -r once its\n"
+			"           validity is decided\n"
+			"           current options:\n"
+			"             check       the rest of a valid document must\n"
+			"                         still be well formed JSON\n"
+			"             nocheck     the rest of a valid document isn't\n"
+			"                         read either\n"
+			"\n"
+			"  -f <format>\n"
+			"           specifies the encoding of the document given to -r\n"
+			"           current options:\n"
+			"             json        JSON text (default)\n"
+			"             cbor        CBOR (RFC 7049)\n"
+			"             msgpack     MessagePack\n"
+			"\n"
 			"  -d       debug flags\n"
 			"       +/- enables/disables\n"
-			"           a   all\n"
+			"           a   all but the profiler (P, t and J)\n"
 			"           s   sjp parser\n"
 			"           l   schema lexer\n"
 			"           c   schema actions\n"
@@ -455,6 +618,10 @@ usage:
 			"           p   print final VM program\n"
 			"           v   print VM instructions while executing\n"
 			"           T   print tokens as read (during VM run)\n"
+			"           V   print VM statistics after the run\n"
+			"           P   print a VM profile after the run\n"
+			"           t   print a VM profile with times\n"
+			"           J   print the VM profile as JSON\n"
 			"\n");
 
 	return 1;
@@ -67,6 +67,25 @@ struct jvst_vm_program;
 struct jvst_vm_program *
 jvst_compile_schema(const struct ast_schema *schema);
 
+// Compiles several schemas into one program, which validates a document
+// against all of them in a single pass.  The document is valid if it's
+// well-formed JSON, and jvst_vm_matches() gives the schemas it matched.
+struct jvst_vm_program *
+jvst_compile_schemas(const struct ast_schema *const *schemas, size_t n);
+
+struct jvst_vm_module;
+
+// Compiles one schema document as a module, to be linked with the
+// modules of the documents it refers to by jvst_vm_link().
+struct jvst_vm_module *
+jvst_compile_module(const struct ast_schema *schema);
+
+// Compiles the root of a schema, and leaves each of its definitions to
+// be compiled the first time a document gets to it (see
+// validate_lazy.h).  The schema has to outlive the program.
+struct jvst_vm_program *
+jvst_compile_lazy(const struct ast_schema *schema);
+
 #endif /* JVST_VALIDATE_H */
 
 /* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
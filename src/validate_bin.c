@@ -0,0 +1,762 @@
+#include "validate_bin.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xalloc.h"
+
+#define WHEREFMT "%s:%d (%s) "
+#define WHEREARGS __FILE__, __LINE__, __func__
+
+#define SHOULD_NOT_REACH() do {				\
+	fprintf(stderr, WHEREFMT "SHOULD NOT REACH\n",	\
+		WHEREARGS);				\
+	abort(); } while (0)
+
+// CBOR major types
+enum {
+	CBOR_UINT   = 0,
+	CBOR_NINT   = 1,
+	CBOR_BYTES  = 2,
+	CBOR_TEXT   = 3,
+	CBOR_ARRAY  = 4,
+	CBOR_MAP    = 5,
+	CBOR_TAG    = 6,
+	CBOR_SIMPLE = 7,
+};
+
+// CBOR additional information values
+enum {
+	CBOR_AI_1BYTE  = 24,
+	CBOR_AI_8BYTE  = 27,
+	CBOR_AI_INDEF  = 31,
+
+	CBOR_FALSE     = 20,
+	CBOR_TRUE      = 21,
+	CBOR_NULL      = 22,
+	CBOR_HALF      = 25,
+	CBOR_SINGLE    = 26,
+	CBOR_DOUBLE    = 27,
+};
+
+static void
+bin_buf_reserve(struct jvst_bin_buf *b, size_t n);
+
+void
+jvst_bin_decoder_init(struct jvst_bin_decoder *d, enum jvst_bin_format fmt)
+{
+	static const struct jvst_bin_decoder zero;
+
+	*d = zero;
+	d->fmt = fmt;
+}
+
+void
+jvst_bin_decoder_finalize(struct jvst_bin_decoder *d)
+{
+	static const struct jvst_bin_decoder zero;
+
+	free(d->carry.ptr);
+	free(d->str.ptr);
+	free(d->stack);
+
+	*d = zero;
+}
+
+void
+jvst_bin_decoder_more(struct jvst_bin_decoder *d, const char *data, size_t n)
+{
+	// The decoder moves the start of an unfinished item to the carry
+	// buffer before it asks for more input, so bytes are only left
+	// over here if the document has already ended.  Keep them so
+	// they are reported as trailing data.
+	if (d->off < d->sz) {
+		size_t nleft = d->sz - d->off;
+		bin_buf_reserve(&d->carry, d->carry.len + nleft);
+		memcpy(d->carry.ptr + d->carry.len, d->data + d->off, nleft);
+		d->carry.len += nleft;
+	}
+
+	d->data = (const unsigned char *)data;
+	d->sz   = n;
+	d->off  = 0;
+}
+
+int
+jvst_bin_decoder_close(struct jvst_bin_decoder *d)
+{
+	if (!d->done || d->in_str || d->top > 0) {
+		return JVST_BIN_ERR_UNFINISHED;
+	}
+
+	if (d->carry.len > 0 || d->off < d->sz) {
+		return JVST_BIN_ERR_TRAILING;
+	}
+
+	return SJP_OK;
+}
+
+int
+jvst_bin_decoder_int(const struct jvst_bin_decoder *d, int64_t *ip)
+{
+	if (!d->isint) {
+		return 0;
+	}
+
+	*ip = d->ival;
+	return 1;
+}
+
+const char *
+jvst_bin_errname(int err)
+{
+	switch (err) {
+	case JVST_BIN_ERR_SYNTAX:	return "SYNTAX";
+	case JVST_BIN_ERR_TYPE:		return "TYPE";
+	case JVST_BIN_ERR_KEY:		return "KEY";
+	case JVST_BIN_ERR_DEPTH:	return "DEPTH";
+	case JVST_BIN_ERR_TRAILING:	return "TRAILING";
+	case JVST_BIN_ERR_UNFINISHED:	return "UNFINISHED";
+	case JVST_BIN_ERR_UTF8:		return "UTF8";
+	default:			return "UNKNOWN";
+	}
+}
+
+static void
+bin_buf_reserve(struct jvst_bin_buf *b, size_t n)
+{
+	if (n > b->cap) {
+		b->ptr = xenlargevec(b->ptr, &b->cap, n - b->cap, 1);
+	}
+}
+
+/* Makes the first n bytes of the current item available in *pp.
+ *
+ * The current item starts at the beginning of the carry buffer if the
+ * carry buffer is not empty, and at the current chunk offset
+ * otherwise.  If the chunk does not hold all n bytes, the bytes that
+ * are available are moved into the carry buffer and 0 is returned.
+ */
+static int
+bin_need(struct jvst_bin_decoder *d, size_t n, const unsigned char **pp)
+{
+	struct jvst_bin_buf *c = &d->carry;
+
+	if (c->len == 0 && d->sz - d->off >= n) {
+		*pp = d->data + d->off;
+		return 1;
+	}
+
+	if (n > c->len && d->off < d->sz) {
+		size_t want, avail;
+
+		want  = n - c->len;
+		avail = d->sz - d->off;
+		if (want > avail) {
+			want = avail;
+		}
+
+		bin_buf_reserve(c, c->len + want);
+		memcpy(c->ptr + c->len, d->data + d->off, want);
+		c->len += want;
+		d->off += want;
+	}
+
+	if (c->len < n) {
+		return 0;
+	}
+
+	*pp = (const unsigned char *)c->ptr;
+	return 1;
+}
+
+// Marks the n bytes of the current item as consumed
+static void
+bin_consume(struct jvst_bin_decoder *d, size_t n)
+{
+	if (d->carry.len > 0) {
+		assert(d->carry.len == n);
+		d->carry.len = 0;
+	} else {
+		assert(d->sz - d->off >= n);
+		d->off += n;
+	}
+}
+
+static uint64_t
+bin_be(const unsigned char *p, size_t n)
+{
+	uint64_t v;
+	size_t i;
+
+	v = 0;
+	for (i=0; i < n; i++) {
+		v = (v << 8) | p[i];
+	}
+
+	return v;
+}
+
+static double
+bin_half(uint16_t h)
+{
+	int e = (h >> 10) & 0x1f;
+	int m = h & 0x3ff;
+	double v;
+
+	if (e == 0) {
+		v = ldexp(m, -24);
+	} else if (e != 31) {
+		v = ldexp(m + 1024, e - 25);
+	} else {
+		v = (m == 0) ? INFINITY : NAN;
+	}
+
+	return (h & 0x8000) ? -v : v;
+}
+
+static double
+bin_single(uint32_t u)
+{
+	float f;
+
+	memcpy(&f, &u, sizeof f);
+	return f;
+}
+
+static double
+bin_double(uint64_t u)
+{
+	double d;
+
+	memcpy(&d, &u, sizeof d);
+	return d;
+}
+
+static int
+bin_expect_key(const struct jvst_bin_decoder *d)
+{
+	const struct jvst_bin_frame *fr;
+
+	if (d->top == 0) {
+		return 0;
+	}
+
+	fr = &d->stack[d->top-1];
+	return fr->map && (fr->nitems % 2) == 0;
+}
+
+// Records that an item (scalar or whole container) has been read
+static void
+bin_item_done(struct jvst_bin_decoder *d)
+{
+	struct jvst_bin_frame *fr;
+
+	d->started = 1;
+
+	if (d->top == 0) {
+		d->done = 1;
+		return;
+	}
+
+	fr = &d->stack[d->top-1];
+	fr->nitems++;
+	if (!fr->indef) {
+		assert(fr->remaining > 0);
+		fr->remaining--;
+	}
+}
+
+static int
+bin_open(struct jvst_bin_decoder *d, struct sjp_event *evt, int map, int indef, uint64_t count)
+{
+	struct jvst_bin_frame *fr;
+
+	if (bin_expect_key(d)) {
+		return JVST_BIN_ERR_KEY;
+	}
+
+	if (d->top >= JVST_BIN_MAXDEPTH) {
+		return JVST_BIN_ERR_DEPTH;
+	}
+
+	if (map && count > UINT64_MAX/2) {
+		return JVST_BIN_ERR_SYNTAX;
+	}
+
+	if (d->top >= d->maxstack) {
+		d->stack = xenlargevec(d->stack, &d->maxstack, 1, sizeof d->stack[0]);
+	}
+
+	d->started = 1;
+
+	fr = &d->stack[d->top++];
+	fr->remaining = map ? 2*count : count;
+	fr->nitems = 0;
+	fr->map = !!map;
+	fr->indef = !!indef;
+
+	evt->type = map ? SJP_OBJECT_BEG : SJP_ARRAY_BEG;
+	return SJP_OK;
+}
+
+static int
+bin_close(struct jvst_bin_decoder *d, struct sjp_event *evt)
+{
+	struct jvst_bin_frame *fr;
+
+	assert(d->top > 0);
+	fr = &d->stack[--d->top];
+
+	if (fr->map && (fr->nitems % 2) != 0) {
+		// key without a value
+		return JVST_BIN_ERR_SYNTAX;
+	}
+
+	evt->type = fr->map ? SJP_OBJECT_END : SJP_ARRAY_END;
+	bin_item_done(d);
+	return SJP_OK;
+}
+
+static int
+bin_number(struct jvst_bin_decoder *d, struct sjp_event *evt, double v)
+{
+	if (bin_expect_key(d)) {
+		return JVST_BIN_ERR_KEY;
+	}
+
+	if (!isfinite(v)) {
+		return JVST_BIN_ERR_TYPE;
+	}
+
+	evt->type = SJP_NUMBER;
+	evt->extra.d = v;
+	d->isint = 0;
+	bin_item_done(d);
+	return SJP_OK;
+}
+
+// Integer items also keep their exact value, the double in the event
+// is rounded past 2^53
+static int
+bin_int(struct jvst_bin_decoder *d, struct sjp_event *evt, int64_t v)
+{
+	int ret;
+
+	ret = bin_number(d, evt, (double)v);
+	if (ret == SJP_OK) {
+		d->ival = v;
+		d->isint = 1;
+	}
+
+	return ret;
+}
+
+static int
+bin_uint(struct jvst_bin_decoder *d, struct sjp_event *evt, uint64_t u)
+{
+	if (u > INT64_MAX) {
+		return bin_number(d, evt, (double)u);
+	}
+
+	return bin_int(d, evt, (int64_t)u);
+}
+
+static int
+bin_literal(struct jvst_bin_decoder *d, struct sjp_event *evt, enum SJP_EVENT type)
+{
+	if (bin_expect_key(d)) {
+		return JVST_BIN_ERR_KEY;
+	}
+
+	evt->type = type;
+	bin_item_done(d);
+	return SJP_OK;
+}
+
+static int
+bin_string_event(struct jvst_bin_decoder *d, struct sjp_event *evt, const unsigned char *s, size_t n, size_t ncp)
+{
+	evt->type = SJP_STRING;
+	evt->text = (const char *)s;
+	evt->n = n;
+	evt->extra.ncp = ncp;
+	bin_item_done(d);
+	return SJP_OK;
+}
+
+static int
+bin_string(struct jvst_bin_decoder *d, struct sjp_event *evt, const unsigned char *s, size_t n)
+{
+	struct jvst_utf8 u;
+
+	jvst_utf8_init(&u);
+	if (!jvst_utf8_feed(&u, (const char *)s, n) || !jvst_utf8_complete(&u)) {
+		return JVST_BIN_ERR_UTF8;
+	}
+
+	return bin_string_event(d, evt, s, n, u.ncp);
+}
+
+/* Reads the CBOR item header at the current position.  Returns 1 if the
+ * header was read, 0 if more input is needed, or a negative error.
+ */
+static int
+cbor_header(struct jvst_bin_decoder *d, const unsigned char **pp,
+	unsigned *majorp, unsigned *infop, uint64_t *argp, size_t *hlenp)
+{
+	const unsigned char *p;
+	unsigned info;
+	size_t hlen;
+
+	if (!bin_need(d, 1, &p)) {
+		return 0;
+	}
+
+	*majorp = p[0] >> 5;
+	*infop = info = p[0] & 0x1f;
+
+	if (info < CBOR_AI_1BYTE || info == CBOR_AI_INDEF) {
+		*argp  = info;
+		*hlenp = 1;
+		*pp = p;
+		return 1;
+	}
+
+	if (info > CBOR_AI_8BYTE) {
+		return JVST_BIN_ERR_SYNTAX;
+	}
+
+	hlen = 1 + ((size_t)1 << (info - CBOR_AI_1BYTE));
+	if (!bin_need(d, hlen, &p)) {
+		return 0;
+	}
+
+	*argp  = bin_be(p+1, hlen-1);
+	*hlenp = hlen;
+	*pp = p;
+	return 1;
+}
+
+static int
+cbor_next(struct jvst_bin_decoder *d, struct sjp_event *evt)
+{
+	for (;;) {
+		const unsigned char *p;
+		unsigned major, info;
+		uint64_t arg;
+		size_t hlen;
+		int ret;
+
+		ret = cbor_header(d, &p, &major, &info, &arg, &hlen);
+		if (ret <= 0) {
+			return (ret == 0) ? SJP_MORE : ret;
+		}
+
+		if (d->in_str) {
+			// only definite-length text chunks and the
+			// break are allowed inside an indefinite-length
+			// text string
+			if (major == CBOR_SIMPLE && info == CBOR_AI_INDEF) {
+				bin_consume(d, hlen);
+				d->in_str = 0;
+				return bin_string_event(d, evt, (const unsigned char *)d->str.ptr,
+					d->str.len, d->strutf8.ncp);
+			}
+
+			if (major != CBOR_TEXT || info == CBOR_AI_INDEF) {
+				return JVST_BIN_ERR_SYNTAX;
+			}
+
+			if (arg > SIZE_MAX - hlen) {
+				return JVST_BIN_ERR_SYNTAX;
+			}
+
+			if (!bin_need(d, hlen + arg, &p)) {
+				return SJP_MORE;
+			}
+
+			// each chunk must be a complete UTF-8 string
+			if (!jvst_utf8_feed(&d->strutf8, (const char *)p + hlen, arg) ||
+				!jvst_utf8_complete(&d->strutf8)) {
+				return JVST_BIN_ERR_UTF8;
+			}
+
+			if (arg > 0) {
+				bin_buf_reserve(&d->str, d->str.len + arg);
+				memcpy(d->str.ptr + d->str.len, p + hlen, arg);
+				d->str.len += arg;
+			}
+			bin_consume(d, hlen + arg);
+			continue;
+		}
+
+		if (info == CBOR_AI_INDEF) {
+			switch (major) {
+			case CBOR_TEXT:
+				bin_consume(d, hlen);
+				d->in_str = 1;
+				d->str.len = 0;
+				jvst_utf8_init(&d->strutf8);
+				continue;
+
+			case CBOR_ARRAY:
+			case CBOR_MAP:
+				bin_consume(d, hlen);
+				return bin_open(d, evt, major == CBOR_MAP, 1, 0);
+
+			case CBOR_SIMPLE:
+				// break
+				if (d->top == 0 || !d->stack[d->top-1].indef) {
+					return JVST_BIN_ERR_SYNTAX;
+				}
+
+				bin_consume(d, hlen);
+				return bin_close(d, evt);
+
+			case CBOR_BYTES:
+				return JVST_BIN_ERR_TYPE;
+
+			default:
+				return JVST_BIN_ERR_SYNTAX;
+			}
+		}
+
+		switch (major) {
+		case CBOR_UINT:
+			bin_consume(d, hlen);
+			return bin_uint(d, evt, arg);
+
+		case CBOR_NINT:
+			bin_consume(d, hlen);
+			if (arg > INT64_MAX) {
+				return bin_number(d, evt, -1.0 - (double)arg);
+			}
+			return bin_int(d, evt, -1 - (int64_t)arg);
+
+		case CBOR_BYTES:
+			return JVST_BIN_ERR_TYPE;
+
+		case CBOR_TEXT:
+			if (arg > SIZE_MAX - hlen) {
+				return JVST_BIN_ERR_SYNTAX;
+			}
+
+			if (!bin_need(d, hlen + arg, &p)) {
+				return SJP_MORE;
+			}
+
+			// the event points into the chunk or the carry
+			// buffer, both of which stay put until the next
+			// call
+			bin_consume(d, hlen + arg);
+			return bin_string(d, evt, p + hlen, arg);
+
+		case CBOR_ARRAY:
+		case CBOR_MAP:
+			bin_consume(d, hlen);
+			return bin_open(d, evt, major == CBOR_MAP, 0, arg);
+
+		case CBOR_TAG:
+			// tags only annotate the item that follows
+			bin_consume(d, hlen);
+			continue;
+
+		case CBOR_SIMPLE:
+			bin_consume(d, hlen);
+			switch (info) {
+			case CBOR_FALSE:  return bin_literal(d, evt, SJP_FALSE);
+			case CBOR_TRUE:   return bin_literal(d, evt, SJP_TRUE);
+			case CBOR_NULL:   return bin_literal(d, evt, SJP_NULL);
+			case CBOR_HALF:   return bin_number(d, evt, bin_half((uint16_t)arg));
+			case CBOR_SINGLE: return bin_number(d, evt, bin_single((uint32_t)arg));
+			case CBOR_DOUBLE: return bin_number(d, evt, bin_double(arg));
+			default:
+				// undefined and other simple values
+				return JVST_BIN_ERR_TYPE;
+			}
+		}
+
+		SHOULD_NOT_REACH();
+	}
+}
+
+static int
+msgpack_next(struct jvst_bin_decoder *d, struct sjp_event *evt)
+{
+	const unsigned char *p;
+	unsigned b;
+	size_t hlen;
+	uint64_t len;
+
+	if (!bin_need(d, 1, &p)) {
+		return SJP_MORE;
+	}
+
+	b = p[0];
+
+	// single byte encodings
+	if (b <= 0x7f) {
+		bin_consume(d, 1);
+		return bin_int(d, evt, b);
+	}
+
+	if (b >= 0xe0) {
+		bin_consume(d, 1);
+		return bin_int(d, evt, (int)b - 0x100);
+	}
+
+	if (b >= 0x80 && b <= 0x8f) {
+		bin_consume(d, 1);
+		return bin_open(d, evt, 1, 0, b & 0x0f);
+	}
+
+	if (b >= 0x90 && b <= 0x9f) {
+		bin_consume(d, 1);
+		return bin_open(d, evt, 0, 0, b & 0x0f);
+	}
+
+	if (b >= 0xa0 && b <= 0xbf) {
+		hlen = 1;
+		len = b & 0x1f;
+		goto string;
+	}
+
+	switch (b) {
+	case 0xc0:
+		bin_consume(d, 1);
+		return bin_literal(d, evt, SJP_NULL);
+
+	case 0xc2:
+		bin_consume(d, 1);
+		return bin_literal(d, evt, SJP_FALSE);
+
+	case 0xc3:
+		bin_consume(d, 1);
+		return bin_literal(d, evt, SJP_TRUE);
+
+	case 0xca:
+	case 0xcb:
+		hlen = (b == 0xca) ? 5 : 9;
+		if (!bin_need(d, hlen, &p)) {
+			return SJP_MORE;
+		}
+
+		bin_consume(d, hlen);
+		if (b == 0xca) {
+			return bin_number(d, evt, bin_single((uint32_t)bin_be(p+1, 4)));
+		}
+		return bin_number(d, evt, bin_double(bin_be(p+1, 8)));
+
+	case 0xcc: case 0xcd: case 0xce: case 0xcf:
+		hlen = 1 + ((size_t)1 << (b - 0xcc));
+		if (!bin_need(d, hlen, &p)) {
+			return SJP_MORE;
+		}
+
+		bin_consume(d, hlen);
+		return bin_uint(d, evt, bin_be(p+1, hlen-1));
+
+	case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+		{
+			uint64_t u, sign;
+			int64_t v;
+
+			hlen = 1 + ((size_t)1 << (b - 0xd0));
+			if (!bin_need(d, hlen, &p)) {
+				return SJP_MORE;
+			}
+
+			// sign extend, without negating INT64_MIN
+			u = bin_be(p+1, hlen-1);
+			if (hlen == 9) {
+				v = (int64_t)u;
+			} else {
+				sign = (uint64_t)1 << (8*(hlen-1) - 1);
+				v = (int64_t)(u ^ sign) - (int64_t)sign;
+			}
+
+			bin_consume(d, hlen);
+			return bin_int(d, evt, v);
+		}
+
+	case 0xd9: case 0xda: case 0xdb:
+		hlen = 1 + ((size_t)1 << (b - 0xd9));
+		if (!bin_need(d, hlen, &p)) {
+			return SJP_MORE;
+		}
+
+		len = bin_be(p+1, hlen-1);
+		goto string;
+
+	case 0xdc: case 0xdd: case 0xde: case 0xdf:
+		hlen = (b == 0xdc || b == 0xde) ? 3 : 5;
+		if (!bin_need(d, hlen, &p)) {
+			return SJP_MORE;
+		}
+
+		bin_consume(d, hlen);
+		return bin_open(d, evt, b >= 0xde, 0, bin_be(p+1, hlen-1));
+
+	case 0xc1:
+		// never used
+		return JVST_BIN_ERR_SYNTAX;
+
+	default:
+		// bin and ext types
+		return JVST_BIN_ERR_TYPE;
+	}
+
+string:
+	if (len > SIZE_MAX - hlen) {
+		return JVST_BIN_ERR_SYNTAX;
+	}
+
+	if (!bin_need(d, hlen + len, &p)) {
+		return SJP_MORE;
+	}
+
+	bin_consume(d, hlen + len);
+	return bin_string(d, evt, p + hlen, len);
+}
+
+int
+jvst_bin_decoder_next(struct jvst_bin_decoder *d, struct sjp_event *evt)
+{
+	static const struct sjp_event zero;
+
+	*evt = zero;
+	evt->type = SJP_NONE;
+
+	// finished definite-length containers are closed without
+	// reading any input
+	if (d->top > 0) {
+		const struct jvst_bin_frame *fr = &d->stack[d->top-1];
+		if (!fr->indef && fr->remaining == 0) {
+			return bin_close(d, evt);
+		}
+	}
+
+	if (d->done) {
+		if (d->carry.len > 0 || d->off < d->sz) {
+			return JVST_BIN_ERR_TRAILING;
+		}
+
+		return SJP_MORE;
+	}
+
+	switch (d->fmt) {
+	case JVST_BIN_CBOR:
+		return cbor_next(d, evt);
+
+	case JVST_BIN_MSGPACK:
+		return msgpack_next(d, evt);
+	}
+
+	SHOULD_NOT_REACH();
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -0,0 +1,134 @@
+#ifndef VALIDATE_BIN_H
+#define VALIDATE_BIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sjp_parser.h"
+
+#include "validate_utf8.h"
+
+/* Binary input front end.
+ *
+ * Decodes CBOR (RFC 7049) and MessagePack buffers into the same event
+ * stream that the sjp parser produces for JSON text, so the VM can
+ * validate binary documents without transcoding them to JSON first.
+ *
+ * The decoder follows the sjp_parser interface: data is supplied in
+ * chunks with jvst_bin_decoder_more(), and jvst_bin_decoder_next()
+ * returns one event at a time.  Items that straddle a chunk boundary
+ * are carried over in an internal buffer, so events are always
+ * complete (the decoder never returns SJP_PARTIAL).
+ *
+ * Events differ from the sjp events in two respects:
+ *
+ *   1. SJP_NUMBER events have their value in extra.d and carry no
+ *      text (text is NULL and n is 0).  Integer items that fit in an
+ *      int64_t also keep their exact value, which
+ *      jvst_bin_decoder_int() returns.
+ *
+ *   2. SJP_STRING events point at the raw string payload, and
+ *      extra.ncp holds the number of code points in the string.
+ *
+ * Items without a JSON equivalent (byte strings, CBOR undefined and
+ * simple values, MessagePack ext types, non-finite floats, and map
+ * keys that are not strings) are rejected, as are strings that are
+ * not valid UTF-8.
+ */
+
+enum jvst_bin_format {
+	JVST_BIN_CBOR = 0,
+	JVST_BIN_MSGPACK,
+};
+
+// Error results.  These are negative so SJP_ERROR() treats them as
+// errors, and are chosen to stay clear of the sjp error codes.
+enum jvst_bin_error {
+	JVST_BIN_ERR_SYNTAX     = -64,	// malformed or reserved encoding
+	JVST_BIN_ERR_TYPE       = -65,	// item has no JSON equivalent
+	JVST_BIN_ERR_KEY        = -66,	// map key is not a text string
+	JVST_BIN_ERR_DEPTH      = -67,	// containers nested too deeply
+	JVST_BIN_ERR_TRAILING   = -68,	// data after the top-level item
+	JVST_BIN_ERR_UNFINISHED = -69,	// input closed in the middle of an item
+	JVST_BIN_ERR_UTF8       = -70,	// text string is not valid UTF-8
+};
+
+enum {
+	JVST_BIN_MAXDEPTH = 4096,
+};
+
+struct jvst_bin_frame {
+	uint64_t remaining;	// items left in a definite-length container
+	uint64_t nitems;	// items seen so far (keys and values count separately)
+	unsigned map:1;
+	unsigned indef:1;
+};
+
+struct jvst_bin_buf {
+	char *ptr;
+	size_t len;
+	size_t cap;
+};
+
+struct jvst_bin_decoder {
+	enum jvst_bin_format fmt;
+
+	// current chunk
+	const unsigned char *data;
+	size_t sz;
+	size_t off;
+
+	// bytes of an item that straddles the end of a chunk
+	struct jvst_bin_buf carry;
+
+	// CBOR indefinite-length text strings are gathered here
+	struct jvst_bin_buf str;
+	struct jvst_utf8 strutf8;
+	unsigned in_str:1;
+
+	unsigned started:1;
+	unsigned done:1;
+
+	// exact value of the last SJP_NUMBER event, if it was an integer
+	int64_t ival;
+	unsigned isint:1;
+
+	struct jvst_bin_frame *stack;
+	size_t top;
+	size_t maxstack;
+};
+
+void
+jvst_bin_decoder_init(struct jvst_bin_decoder *d, enum jvst_bin_format fmt);
+
+void
+jvst_bin_decoder_more(struct jvst_bin_decoder *d, const char *data, size_t n);
+
+/* Returns SJP_OK with an event, SJP_MORE with an SJP_NONE event if
+ * more input is required, or a negative jvst_bin_error.
+ */
+int
+jvst_bin_decoder_next(struct jvst_bin_decoder *d, struct sjp_event *evt);
+
+/* Returns SJP_OK if exactly one complete document was decoded,
+ * JVST_BIN_ERR_UNFINISHED if the input ended in the middle of the
+ * document, or JVST_BIN_ERR_TRAILING if data followed it.
+ */
+int
+jvst_bin_decoder_close(struct jvst_bin_decoder *d);
+
+/* Returns 1 and sets *ip if the last SJP_NUMBER event was an integer
+ * item that fits in an int64_t.
+ */
+int
+jvst_bin_decoder_int(const struct jvst_bin_decoder *d, int64_t *ip);
+
+void
+jvst_bin_decoder_finalize(struct jvst_bin_decoder *d);
+
+const char *
+jvst_bin_errname(int err);
+
+#endif /* VALIDATE_BIN_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
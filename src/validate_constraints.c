@@ -59,6 +59,11 @@
 enum {
 	JVST_CNODE_CHUNKSIZE = 1024,
 	JVST_CNODE_NUMROOTS  = 32,
+
+	// limit on the number of terms that boolean rewrites (distributing
+	// AND over OR, expanding XOR) may produce.  Past the limit the
+	// nodes are left alone and compiled as a SPLIT.
+	JVST_CNODE_MAXTERMS  = 256,
 };
 
 enum {
@@ -1111,6 +1116,54 @@ cnode_enum_translate_arr(struct json_value *v)
 	return cons;
 }
 
+// Sets the keyword of every node of the trees for an enum or const
+static void
+cnode_enum_set_kw(struct jvst_cnode *node, struct jvst_cnode_kw kw)
+{
+	size_t i, n;
+
+	for (; node != NULL; node = node->next) {
+		node->kw = kw;
+
+		switch (node->type) {
+		case JVST_CNODE_SWITCH:
+			for (i = 0, n = ARRAYLEN(node->u.sw); i < n; i++) {
+				cnode_enum_set_kw(node->u.sw[i], kw);
+			}
+			break;
+
+		case JVST_CNODE_AND:
+		case JVST_CNODE_OR:
+			cnode_enum_set_kw(node->u.ctrl, kw);
+			break;
+
+		case JVST_CNODE_OBJ_PROP_DEFAULT:
+			cnode_enum_set_kw(node->u.prop_default, kw);
+			break;
+
+		case JVST_CNODE_OBJ_PROP_SET:
+			cnode_enum_set_kw(node->u.prop_set, kw);
+			break;
+
+		case JVST_CNODE_OBJ_PROP_MATCH:
+			cnode_enum_set_kw(node->u.prop_match.constraint, kw);
+			break;
+
+		case JVST_CNODE_ARR_ITEM:
+			cnode_enum_set_kw(node->u.items.items, kw);
+			cnode_enum_set_kw(node->u.items.additional, kw);
+			break;
+
+		case JVST_CNODE_NUM_RANGE:
+			node->u.num_range.kw_max = kw;
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
 static struct jvst_cnode *
 cnode_enum_translate(struct json_value *v)
 {
@@ -1169,6 +1222,82 @@ cnode_enum_translate(struct json_value *v)
 	return jvst_cnode_alloc(JVST_CNODE_INVALID);
 }
 
+// Returns where ast is in its document, as a URI fragment.  The parser
+// gives each schema an id for its path from the root of the document
+// and from each enclosing schema with an "$id".  The path from the
+// root is the longest.
+static struct json_string
+ast_location(const struct ast_schema *ast)
+{
+	static const struct json_string zero;
+	struct json_string loc;
+	struct ast_string_set *ss;
+
+	loc = zero;
+	for (ss = ast->all_ids; ss != NULL; ss = ss->next) {
+		const char *frag;
+		size_t len;
+
+		frag = memchr(ss->str.s, '#', ss->str.len);
+		if (frag == NULL) {
+			continue;
+		}
+
+		len = ss->str.len - (frag - ss->str.s);
+		if (len > loc.len) {
+			loc.s = frag;
+			loc.len = len;
+		}
+	}
+
+	return loc;
+}
+
+static struct jvst_cnode_kw
+cnode_kw(struct json_string loc, const char *name)
+{
+	struct jvst_cnode_kw kw;
+
+	kw.loc = loc;
+	kw.name = name;
+
+	return kw;
+}
+
+// Returns an INVALID node that fails with the keyword of node, for
+// simplifications that find node can't be satisfied
+static struct jvst_cnode *
+cnode_invalid_kw(const struct jvst_cnode *node)
+{
+	struct jvst_cnode *inv;
+
+	inv = jvst_cnode_alloc(JVST_CNODE_INVALID);
+	inv->kw = node->kw;
+
+	return inv;
+}
+
+// Sets the keyword of the INVALID cases of a switch, which are where
+// its types fail.  ARRAY_END and OBJECT_END never start a value, so
+// they're left alone.
+static void
+cnode_switch_set_kw(struct jvst_cnode *sw, struct jvst_cnode_kw kw)
+{
+	size_t i, n;
+
+	assert(sw->type == JVST_CNODE_SWITCH);
+
+	for (i = 0, n = ARRAYLEN(sw->u.sw); i < n; i++) {
+		if (i == SJP_ARRAY_END || i == SJP_OBJECT_END) {
+			continue;
+		}
+
+		if (sw->u.sw[i]->type == JVST_CNODE_INVALID) {
+			sw->u.sw[i]->kw = kw;
+		}
+	}
+}
+
 static
 void add_cnode_ids(struct jvst_cnode_id_table *tbl, const struct ast_schema *ast, struct jvst_cnode *n)
 {
@@ -1193,6 +1322,9 @@ void add_cnode_ids(struct jvst_cnode_id_table *tbl, const struct ast_schema *ast
 struct ast_translator {
 	struct jvst_cnode_forest forest;
 
+	// translating a module: unmatched references are imports
+	int module;
+
 	struct {
 		size_t len;
 		size_t cap;
@@ -1264,9 +1396,12 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 {
 	struct jvst_cnode *node;
 	enum json_valuetype types;
+	struct json_string loc;
 
 	assert(ast != NULL);
 
+	loc = ast_location(ast);
+
 	if (ast->kws & KWS_VALUE) {
 	       	if (ast->value.type != JSON_VALUE_BOOL) {
 			fprintf(stderr, "Invalid JSON value type.  Schemas must be objects or booleans.\n");
@@ -1274,6 +1409,10 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		}
 
 		node = cnode_new_switch(ast->value.u.v);
+		node->loc = loc;
+
+		// a false schema fails by itself, not by a keyword
+		cnode_switch_set_kw(node, cnode_kw(loc, NULL));
 		add_cnode_ids(xl->forest.all_ids, ast, node);
 
 		return node;
@@ -1344,6 +1483,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		if (types & JSON_VALUE_INTEGER) {
 			node->u.sw[SJP_NUMBER] = jvst_cnode_alloc(JVST_CNODE_NUM_INTEGER);
+			node->u.sw[SJP_NUMBER]->kw = cnode_kw(loc, "type");
 		}
 
 		if (types & JSON_VALUE_BOOL) {
@@ -1354,8 +1494,12 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		if (types & JSON_VALUE_NULL) {
 			node->u.sw[SJP_NULL] = valid;
 		}
+
+		cnode_switch_set_kw(node, cnode_kw(loc, "type"));
 	}
 
+	node->loc = loc;
+
 	if (ast->kws & (KWS_MINIMUM | KWS_MAXIMUM)) {
 		enum jvst_cnode_rangeflags flags = 0;
 		double min = 0, max = 0;
@@ -1378,6 +1522,14 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		range->u.num_range.min = min;
 		range->u.num_range.max = max;
 
+		if (ast->kws & KWS_MINIMUM) {
+			range->kw = cnode_kw(loc, ast->exclusive_minimum ? "exclusiveMinimum" : "minimum");
+		}
+
+		if (ast->kws & KWS_MAXIMUM) {
+			range->u.num_range.kw_max = cnode_kw(loc, ast->exclusive_maximum ? "exclusiveMaximum" : "maximum");
+		}
+
 		add_ast_constraint(node, SJP_NUMBER, range);
 	}
 
@@ -1387,6 +1539,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		multiple_of = jvst_cnode_alloc(JVST_CNODE_NUM_MULTIPLE_OF);
 		multiple_of->u.multiple_of = ast->multiple_of;
+		multiple_of->kw = cnode_kw(loc, "multipleOf");
 
 		add_ast_constraint(node, SJP_NUMBER, multiple_of);
 	}
@@ -1397,6 +1550,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		strmatch = jvst_cnode_alloc(JVST_CNODE_STR_MATCH);
 		// FIXME: I think this will leak!
 		strmatch->u.str_match = ast->pattern;
+		strmatch->kw = cnode_kw(loc, "pattern");
 
 		add_ast_constraint(node, SJP_STRING, strmatch);
 	}
@@ -1410,6 +1564,9 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		range->u.counts.upper = !!(ast->kws & KWS_MAX_LENGTH);
 
+		range->kw = cnode_kw(loc, "minLength");
+		range->u.counts.kw_max = cnode_kw(loc, "maxLength");
+
 		add_ast_constraint(node, SJP_STRING, range);
 	}
 
@@ -1419,6 +1576,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		assert(ast->items != NULL);
 
 		items_constraint = jvst_cnode_alloc(JVST_CNODE_ARR_ITEM);
+		items_constraint->kw = cnode_kw(loc, "items");
 
 		if (ast->kws & KWS_SINGLETON_ITEMS) {
 			struct jvst_cnode *constraint;
@@ -1459,6 +1617,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		constraint = cnode_translate_ast_with_ids(ast->contains, xl);
 		contains = jvst_cnode_alloc(JVST_CNODE_ARR_CONTAINS);
 		contains->u.contains = constraint;
+		contains->kw = cnode_kw(loc, "contains");
 
 		add_ast_constraint(node, SJP_ARRAY_BEG, contains);
 	}
@@ -1467,6 +1626,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		struct jvst_cnode *uniq;
 
 		uniq = jvst_cnode_alloc(JVST_CNODE_ARR_UNIQUE);
+		uniq->kw = cnode_kw(loc, "uniqueItems");
 		add_ast_constraint(node, SJP_ARRAY_BEG, uniq);
 	}
 
@@ -1479,6 +1639,9 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		range->u.counts.upper = !!(ast->kws & KWS_MAX_ITEMS);
 
+		range->kw = cnode_kw(loc, "minItems");
+		range->u.counts.kw_max = cnode_kw(loc, "maxItems");
+
 		add_ast_constraint(node, SJP_ARRAY_BEG, range);
 	}
 
@@ -1516,6 +1679,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		pdft = jvst_cnode_alloc(JVST_CNODE_OBJ_PROP_DEFAULT);
 		pdft->u.prop_default = constraint;
+		pdft->kw = cnode_kw(loc, "additionalProperties");
 
 		add_ast_constraint(node, SJP_OBJECT_BEG, pdft);
 	}
@@ -1541,6 +1705,9 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		range->u.counts.upper = !!(ast->kws & KWS_MAX_PROPERTIES);
 
+		range->kw = cnode_kw(loc, "minProperties");
+		range->u.counts.kw_max = cnode_kw(loc, "maxProperties");
+
 		add_ast_constraint(node, SJP_OBJECT_BEG, range);
 	}
 
@@ -1549,6 +1716,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		req = jvst_cnode_alloc(JVST_CNODE_OBJ_REQUIRED);
 		req->u.required = ast->required.set;
+		req->kw = cnode_kw(loc, "required");
 
 		add_ast_constraint(node, SJP_OBJECT_BEG, req);
 	}
@@ -1570,10 +1738,12 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 			// build required stringset for the dependency pair
 			assert(pnames->pattern.dialect == RE_LITERAL);
 			req->u.required = cnode_strset(pnames->pattern.str, cnode_strset_copy(pnames->set));
+			req->kw = cnode_kw(loc, "dependencies");
 
 			pm = jvst_cnode_alloc(JVST_CNODE_OBJ_PROP_MATCH);
 			pm->u.prop_match.match = pnames->pattern;
 			pm->u.prop_match.constraint = jvst_cnode_alloc(JVST_CNODE_INVALID);
+			pm->u.prop_match.constraint->kw = cnode_kw(loc, "dependencies");
 
 			pset = jvst_cnode_alloc(JVST_CNODE_OBJ_PROP_SET);
 			pset->u.prop_set = pm;
@@ -1581,6 +1751,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 			req->next = pset;
 			jxn = jvst_cnode_alloc(JVST_CNODE_OR);
 			jxn->u.ctrl = req;
+			jxn->kw = cnode_kw(loc, "dependencies");
 
 			*tpp = jxn;
 			tpp  = &jxn->next;
@@ -1610,6 +1781,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 			jxn  = jvst_cnode_alloc(JVST_CNODE_OR);
 			jpp  = &jxn->u.ctrl;
 			*jpp = NULL;
+			jxn->kw = cnode_kw(loc, "dependencies");
 
 			andjxn = jvst_cnode_alloc(JVST_CNODE_AND);
 
@@ -1617,6 +1789,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 			// build required stringset for the dependency pair
 			assert(pschema->pattern.dialect == RE_LITERAL);
 			req->u.required = cnode_strset(pschema->pattern.str, NULL);
+			req->kw = cnode_kw(loc, "dependencies");
 
 			sw = cnode_new_switch(false);
 			sw->u.sw[SJP_OBJECT_BEG] = req;
@@ -1631,6 +1804,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 			pm = jvst_cnode_alloc(JVST_CNODE_OBJ_PROP_MATCH);
 			pm->u.prop_match.match = pschema->pattern;
 			pm->u.prop_match.constraint = jvst_cnode_alloc(JVST_CNODE_INVALID);
+			pm->u.prop_match.constraint->kw = cnode_kw(loc, "dependencies");
 
 			pset = jvst_cnode_alloc(JVST_CNODE_OBJ_PROP_SET);
 			pset->u.prop_set = pm;
@@ -1655,6 +1829,8 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 		}
 
 		some_jxn = jvst_cnode_alloc(op);
+		some_jxn->kw = cnode_kw(loc,
+			(op == JVST_CNODE_XOR) ? "oneOf" : (op == JVST_CNODE_OR) ? "anyOf" : "allOf");
 		conds = &some_jxn->u.ctrl;
 		some_jxn->u.ctrl = NULL;
 		for (sset = ast->some_of.set; sset != NULL; sset = sset->next) {
@@ -1676,6 +1852,7 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 
 		not_jxn = jvst_cnode_alloc(JVST_CNODE_NOT);
 		not_jxn->u.ctrl = cnode_translate_ast_with_ids(ast->not, xl);
+		not_jxn->kw = cnode_kw(loc, "not");
 
 		top_jxn = jvst_cnode_alloc(JVST_CNODE_AND);
 		top_jxn->u.ctrl = not_jxn;
@@ -1695,6 +1872,8 @@ cnode_translate_ast_with_ids(const struct ast_schema *ast, struct ast_translator
 			jpp = &(*jpp)->next;
 		}
 
+		cnode_enum_set_kw(cons, cnode_kw(loc, (ast->kws & KWS_CONST) ? "const" : "enum"));
+
 		top_jxn = jvst_cnode_alloc(JVST_CNODE_AND);
 		assert(cons != NULL);
 		if (cons->next == NULL) {
@@ -1730,6 +1909,10 @@ cnode_reroot_referred_ids(void *opaque, struct json_string *id, struct jvst_cnod
 
 	orig = jvst_cnode_id_table_lookup(xl->forest.all_ids, *id);
 
+	if (orig == NULL && xl->module) {
+		return 1;
+	}
+
 	if (orig == NULL) {
 		if (id->len <= INT_MAX) {
 			fprintf(stderr, "WARNING: cannot match $ref(%.*s) with a node\n",
@@ -1781,14 +1964,15 @@ cnode_reroot_referred_ids(void *opaque, struct json_string *id, struct jvst_cnod
 	return 1;
 }
 
-struct jvst_cnode_forest *
-jvst_cnode_translate_ast_with_ids(const struct ast_schema *ast)
+static struct jvst_cnode_forest *
+cnode_translate_forest(const struct ast_schema *ast, int module)
 {
 	struct ast_translator xl;
 	struct jvst_cnode_forest *forest;
 	struct jvst_cnode *ctree;
 
 	xlator_initialize(&xl);
+	xl.module = module;
 	ctree = cnode_translate_ast_with_ids(ast, &xl);
 
 	assert(ctree != NULL);
@@ -1796,6 +1980,19 @@ jvst_cnode_translate_ast_with_ids(const struct ast_schema *ast)
 	// add the main tree
 	xlator_add_tree(&xl, ctree);
 
+	// other modules may refer to any of the definitions, so they
+	// become trees of their own as if they were referred to here
+	if (module) {
+		const struct ast_schema_set *def;
+		const struct ast_string_set *ss;
+
+		for (def = ast->definitions; def != NULL; def = def->next) {
+			for (ss = def->schema->all_ids; ss != NULL; ss = ss->next) {
+				jvst_cnode_id_table_add(xl.forest.ref_ids, ss->str, NULL);
+			}
+		}
+	}
+
 	// now iterate through the entries of the ref_ids table,
 	// splitting them into separate trees
 	jvst_cnode_id_table_foreach(xl.forest.ref_ids, cnode_reroot_referred_ids, &xl);
@@ -1804,6 +2001,16 @@ jvst_cnode_translate_ast_with_ids(const struct ast_schema *ast)
 	{
 		assert(ast->all_ids != NULL);
 		jvst_cnode_id_table_add(xl.forest.ref_ids, ast->all_ids->str, ctree);
+
+		// other modules may refer to the root by any of its ids,
+		// such as with or without an empty fragment
+		if (module) {
+			const struct ast_string_set *ss;
+
+			for (ss = ast->all_ids->next; ss != NULL; ss = ss->next) {
+				jvst_cnode_id_table_add(xl.forest.ref_ids, ss->str, ctree);
+			}
+		}
 		// struct json_string root_id = { .s = "#", .len = 1 };
 		// jvst_cnode_id_table_add(xl.forest.ref_ids, root_id, ctree);
 	}
@@ -1816,6 +2023,18 @@ jvst_cnode_translate_ast_with_ids(const struct ast_schema *ast)
 	return forest;
 }
 
+struct jvst_cnode_forest *
+jvst_cnode_translate_ast_with_ids(const struct ast_schema *ast)
+{
+	return cnode_translate_forest(ast, 0);
+}
+
+struct jvst_cnode_forest *
+jvst_cnode_translate_module(const struct ast_schema *ast)
+{
+	return cnode_translate_forest(ast, 1);
+}
+
 struct jvst_cnode *
 jvst_cnode_translate_ast(const struct ast_schema *ast)
 {
@@ -1975,7 +2194,7 @@ cnode_mswitch_copy(struct jvst_cnode *node)
 }
 
 static struct jvst_cnode *
-cnode_deep_copy(struct jvst_cnode *node)
+cnode_deep_copy_node(struct jvst_cnode *node)
 {
 	struct jvst_cnode *tree;
 
@@ -2015,6 +2234,7 @@ cnode_deep_copy(struct jvst_cnode *node)
 		{
 			size_t i, n;
 			tree = jvst_cnode_alloc(node->type);
+			tree->loc = node->loc;
 			for (i = 0, n = ARRAYLEN(node->u.sw); i < n; i++) {
 				tree->u.sw[i] = NULL;
 				if (node->u.sw[i] != NULL) {
@@ -2132,6 +2352,17 @@ cnode_deep_copy(struct jvst_cnode *node)
 	SHOULD_NOT_REACH();
 }
 
+static struct jvst_cnode *
+cnode_deep_copy(struct jvst_cnode *node)
+{
+	struct jvst_cnode *tree;
+
+	tree = cnode_deep_copy_node(node);
+	tree->kw = node->kw;
+
+	return tree;
+}
+
 struct jvst_cnode *
 cnode_list_end(struct jvst_cnode *node)
 {
@@ -2178,6 +2409,22 @@ cnode_find_type(struct jvst_cnode *node, enum jvst_cnode_type type)
 	return NULL;
 }
 
+// Location for a SWITCH that combines the SWITCHes in the list: the
+// first that has one
+static struct json_string
+cnode_switch_loc(const struct jvst_cnode *sw)
+{
+	static const struct json_string zero;
+
+	for (; sw != NULL; sw = sw->next) {
+		if (sw->loc.len > 0) {
+			return sw->loc;
+		}
+	}
+
+	return zero;
+}
+
 static struct jvst_cnode *
 cnode_simplify_andor_switches(struct jvst_cnode *top)
 {
@@ -2195,10 +2442,12 @@ cnode_simplify_andor_switches(struct jvst_cnode *top)
 
 	// all nodes are switch nodes...
 	sw = jvst_cnode_alloc(JVST_CNODE_SWITCH);
+	sw->loc = cnode_switch_loc(top->u.ctrl);
 	for (i = 0, n = ARRAYLEN(sw->u.sw); i < n; i++) {
 		struct jvst_cnode *jxn, **cpp;
 
 		jxn = jvst_cnode_alloc(top->type);
+		jxn->kw = top->kw;
 		cpp = &jxn->u.ctrl;
 
 		for (node = top->u.ctrl; node != NULL; node = node->next) {
@@ -2232,10 +2481,12 @@ cnode_simplify_xor_switches(struct jvst_cnode *top)
 
 	// all nodes are switch nodes...
 	sw = jvst_cnode_alloc(JVST_CNODE_SWITCH);
+	sw->loc = cnode_switch_loc(top->u.ctrl);
 	for (i = 0, n = ARRAYLEN(sw->u.sw); i < n; i++) {
 		struct jvst_cnode *jxn, **cpp;
 
 		jxn = jvst_cnode_alloc(top->type);
+		jxn->kw = top->kw;
 		cpp = &jxn->u.ctrl;
 
 		for (node = top->u.ctrl; node != NULL; node = node->next) {
@@ -2491,8 +2742,10 @@ cnode_simplify_and_required(struct jvst_cnode *top)
 		*rpp = NULL;
 	}
 
-	// merge all REQUIRED cases into one REQUIRED set
+	// merge all REQUIRED cases into one REQUIRED set, which
+	// reports the first
 	comb = jvst_cnode_alloc(JVST_CNODE_OBJ_REQUIRED);
+	comb->kw = reqs->kw;
 	sspp = &comb->u.required;
 	for (node=reqs; node != NULL; node = node->next) {
 		*sspp = cnode_strset_copy(node->u.required);
@@ -3522,6 +3775,7 @@ cnode_simplify_ored_count_range(struct jvst_cnode *rlist)
 				(*ccnpp)->u.counts.upper = false;
 			} else if (node_arr[i]->u.counts.max > (*ccnpp)->u.counts.max) {
 				(*ccnpp)->u.counts.max = node_arr[i]->u.counts.max;
+				(*ccnpp)->u.counts.kw_max = node_arr[i]->u.counts.kw_max;
 			}
 
 			continue;
@@ -3568,6 +3822,7 @@ and_range_pair(struct jvst_cnode *lhs, const struct jvst_cnode *rhs)
 
 	if (rhs->u.counts.min > lhs->u.counts.min) {
 		lhs->u.counts.min = rhs->u.counts.min;
+		lhs->kw = rhs->kw;
 	}
 
 	if (!rhs->u.counts.upper) {
@@ -3577,8 +3832,10 @@ and_range_pair(struct jvst_cnode *lhs, const struct jvst_cnode *rhs)
 	if (!lhs->u.counts.upper) {
 		lhs->u.counts.upper = true;
 		lhs->u.counts.max = rhs->u.counts.max;
+		lhs->u.counts.kw_max = rhs->u.counts.kw_max;
 	} else if (rhs->u.counts.max < lhs->u.counts.max) {
 		lhs->u.counts.max = rhs->u.counts.max;
+		lhs->u.counts.kw_max = rhs->u.counts.kw_max;
 	}
 }
 
@@ -3605,6 +3862,7 @@ cnode_simplify_anded_count_range(struct jvst_cnode *rlist)
 
 	ret = jvst_cnode_alloc(rlist->type);
 	ret->u.counts = rlist->u.counts;
+	ret->kw = rlist->kw;
 
 	for (rn=rlist->next; rn != NULL; rn = rn->next) {
 		assert(rn->type == type);  // all nodes should be the same type
@@ -3613,6 +3871,7 @@ cnode_simplify_anded_count_range(struct jvst_cnode *rlist)
 
 	if (ret->u.counts.upper && ret->u.counts.max < ret->u.counts.min) {
 		ret->type = JVST_CNODE_INVALID;
+		ret->kw = ret->u.counts.kw_max;
 	}
 
 	return ret;
@@ -3659,6 +3918,25 @@ all_children_of_type(struct jvst_cnode *top, enum jvst_cnode_type type)
 	}
 }
 
+// number of terms in an OR, or one for any other node
+static size_t
+cnode_nterms(const struct jvst_cnode *n)
+{
+	const struct jvst_cnode *c;
+	size_t nt;
+
+	if (n->type != JVST_CNODE_OR) {
+		return 1;
+	}
+
+	nt = 0;
+	for (c = n->u.ctrl; c != NULL; c = c->next) {
+		nt++;
+	}
+
+	return nt;
+}
+
 static struct jvst_cnode *
 cnode_simplify_and_ored_ranges(enum jvst_cnode_type rtype, struct jvst_cnode *and)
 {
@@ -3695,9 +3973,10 @@ cnode_simplify_and_ored_ranges(enum jvst_cnode_type rtype, struct jvst_cnode *an
 	// term.
 	//
 
-	// TODO: There's a change that this expansion results in a lot more terms than the
-	// original.  So we need to keep track of the number of operations in the original
-	// and the new versions and choose the one that has the least terms.
+	// Each step produces at most m*n terms before they are merged back
+	// into disjoint ranges.  If a step would produce more than
+	// JVST_CNODE_MAXTERMS terms, the remaining nodes are left in the
+	// AND unexpanded.
 	//
 	// TODO: Can we be smarter about this if we structure this as a dynamic
 	// programming problem?
@@ -3750,8 +4029,13 @@ cnode_simplify_and_ored_ranges(enum jvst_cnode_type rtype, struct jvst_cnode *an
 	//         combining terms
 	nl = wl;
 
-	for (n = wl->next; n != NULL; n = n->next) {
+	for (n = wl->next; n != NULL && nl != NULL; n = n->next) {
 		struct jvst_cnode *terms1, *terms2, *t1, *t2, *terms3, **t3pp;
+
+		if (cnode_nterms(nl) * cnode_nterms(n) > JVST_CNODE_MAXTERMS) {
+			break;
+		}
+
 		if (nl->type == JVST_CNODE_OR) {
 			terms1 = nl->u.ctrl;
 		} else if (nl->type == rtype) {
@@ -3770,14 +4054,16 @@ cnode_simplify_and_ored_ranges(enum jvst_cnode_type rtype, struct jvst_cnode *an
 
 		terms3 = NULL;
 		t3pp = &terms3;
-		for (t1 = terms1; t1 != NULL; t1 = t1->next) {
+		// a bare node is a single term, even if it is linked to
+		// the rest of the working list
+		for (t1 = terms1; t1 != NULL; t1 = (terms1 == nl) ? NULL : t1->next) {
 			struct jvst_cnode **partial;
 
 			assert(t1->type == JVST_CNODE_LENGTH_RANGE ||
 				t1->type == JVST_CNODE_PROP_RANGE  ||
 				t1->type == JVST_CNODE_ITEM_RANGE);
 
-			for (t2 = terms2; t2 != NULL; t2 = t2->next) {
+			for (t2 = terms2; t2 != NULL; t2 = (terms2 == n) ? NULL : t2->next) {
 				struct jvst_cnode *t3;
 
 				assert(t2->type == JVST_CNODE_LENGTH_RANGE ||
@@ -3788,6 +4074,7 @@ cnode_simplify_and_ored_ranges(enum jvst_cnode_type rtype, struct jvst_cnode *an
 
 				t3 = jvst_cnode_alloc(t1->type);
 				t3->u.counts = t1->u.counts;
+				t3->kw = t1->kw;
 				and_range_pair(t3, t2);
 
 				if (t3->u.counts.upper && t3->u.counts.min > t3->u.counts.max) {
@@ -3819,6 +4106,10 @@ cnode_simplify_and_ored_ranges(enum jvst_cnode_type rtype, struct jvst_cnode *an
 		return jvst_cnode_alloc(JVST_CNODE_INVALID);
 	}
 
+	// if the term limit was reached, n is the first node that was not
+	// combined.  Keep it and the nodes after it.
+	nl->next = n;
+
 	*npp = nl;
 	return and;
 }
@@ -3915,6 +4206,7 @@ static struct jvst_cnode *
 cnode_simplify_and_num_ranges(struct jvst_cnode *top)
 {
 	struct jvst_cnode *ranges, **rpp, **npp, *n;
+	struct jvst_cnode_kw lo_kw, hi_kw;
 	double lo, hi;
 	unsigned lo_flags;
 	unsigned hi_flags;
@@ -3953,7 +4245,9 @@ cnode_simplify_and_num_ranges(struct jvst_cnode *top)
 	// node
 	lo = hi = 0.0;
 	lo_flags = hi_flags = 0;
+	lo_kw = hi_kw = ranges->kw;
 
+	// the merged range keeps the keyword of each bound that wins
 	for (n = ranges; n != NULL; n = n->next) {
 		double min,max;
 		unsigned flags;
@@ -3968,11 +4262,13 @@ cnode_simplify_and_num_ranges(struct jvst_cnode *top)
 			if ((lo_flags & FLAG_HAS) == 0 || lo < min) {
 				lo = min;
 				lo_flags = FLAG_HAS;
+				lo_kw = n->kw;
 			}
 		} else if (flags & JVST_CNODE_RANGE_EXCL_MIN) {
 			if ((lo_flags & FLAG_HAS) == 0 || lo <= min) {
 				lo = min;
 				lo_flags = FLAG_HAS | FLAG_EXCL;
+				lo_kw = n->kw;
 			}
 		}
 
@@ -3980,11 +4276,13 @@ cnode_simplify_and_num_ranges(struct jvst_cnode *top)
 			if ((hi_flags & FLAG_HAS) == 0 || hi > max) {
 				hi = max;
 				hi_flags = FLAG_HAS;
+				hi_kw = n->u.num_range.kw_max;
 			}
 		} else if (flags & JVST_CNODE_RANGE_EXCL_MAX) {
 			if ((hi_flags & FLAG_HAS) == 0 || hi >= max) {
 				hi = max;
 				hi_flags = FLAG_HAS | FLAG_EXCL;
+				hi_kw = n->u.num_range.kw_max;
 			}
 		}
 	}
@@ -3995,8 +4293,10 @@ cnode_simplify_and_num_ranges(struct jvst_cnode *top)
 	if ((lo_flags & FLAG_HAS) && (hi_flags & FLAG_HAS)) {
 		if (lo > hi) {
 			ranges = jvst_cnode_alloc(JVST_CNODE_INVALID);
+			ranges->kw = hi_kw;
 		} else if (lo == hi && ((lo_flags & FLAG_EXCL) || (hi_flags & FLAG_EXCL))) {
 			ranges = jvst_cnode_alloc(JVST_CNODE_INVALID);
+			ranges->kw = hi_kw;
 		}
 	}
 
@@ -4005,6 +4305,8 @@ cnode_simplify_and_num_ranges(struct jvst_cnode *top)
 		ranges->u.num_range.min = lo;
 		ranges->u.num_range.max = hi;
 		ranges->u.num_range.flags = 0;
+		ranges->kw = lo_kw;
+		ranges->u.num_range.kw_max = hi_kw;
 
 		if (lo_flags & FLAG_HAS) {
 			if (lo_flags & FLAG_EXCL) {
@@ -4087,6 +4389,7 @@ cnode_simplify_and_items(struct jvst_cnode *top)
 	}
 
 	item_comb = jvst_cnode_alloc(JVST_CNODE_ARR_ITEM);
+	item_comb->kw = items->kw;
 	{
 		struct jvst_cnode **combpp, *addn;
 		size_t i;
@@ -4218,15 +4521,15 @@ cnode_simplify_and_unique(struct jvst_cnode *top)
 	return top;
 }
 
+// simplifies an AND or OR node whose children have already been
+// simplified
 static struct jvst_cnode *
-cnode_simplify_andor(struct jvst_cnode *top)
+cnode_simplify_andor_top(struct jvst_cnode *top)
 {
 	struct jvst_cnode *node, *next, **pp;
 	enum jvst_cnode_type snt; // short circuit node type
 	enum jvst_cnode_type rnt; // remove node type
 
-	cnode_simplify_ctrl_children(top);
-
 	// pass 1: remove VALID/INVALID nodes
 	switch (top->type) {
 	case JVST_CNODE_AND:
@@ -4259,9 +4562,11 @@ cnode_simplify_andor(struct jvst_cnode *top)
 		pp = &(*pp)->next;
 	}
 
-	// all nodes were valid
+	// all nodes were valid (AND) or invalid (OR)
 	if (top->u.ctrl == NULL) {
-		return jvst_cnode_alloc(rnt);
+		node = jvst_cnode_alloc(rnt);
+		node->kw = top->kw;
+		return node;
 	}
 
 	assert(top->u.ctrl != NULL);
@@ -4327,7 +4632,16 @@ cnode_simplify_andor(struct jvst_cnode *top)
 }
 
 static struct jvst_cnode *
-cnode_negate_range(struct jvst_cnode *range)
+cnode_simplify_andor(struct jvst_cnode *top)
+{
+	cnode_simplify_ctrl_children(top);
+	return cnode_simplify_andor_top(top);
+}
+
+// Returns the ranges of counts not in range, which fail with the
+// keyword kw of the junction that negates it
+static struct jvst_cnode *
+cnode_negate_range(struct jvst_cnode *range, struct jvst_cnode_kw kw)
 {
 	struct jvst_cnode *ret;
 
@@ -4350,6 +4664,7 @@ cnode_negate_range(struct jvst_cnode *range)
 		lower->u.counts.min = 0;
 		lower->u.counts.max = range->u.counts.min-1;
 		lower->u.counts.upper = true;
+		lower->kw = lower->u.counts.kw_max = kw;
 
 		ret = lower;
 	}
@@ -4361,12 +4676,14 @@ cnode_negate_range(struct jvst_cnode *range)
 		upper->u.counts.min = range->u.counts.max+1;
 		upper->u.counts.max = 0;
 		upper->u.counts.upper = false;
+		upper->kw = upper->u.counts.kw_max = kw;
 
 		if (ret == NULL) {
 			ret = upper;
 		} else {
 			struct jvst_cnode *jxn;
 			jxn = jvst_cnode_alloc(JVST_CNODE_OR);
+			jxn->kw = kw;
 			ret->next = upper;
 			jxn->u.ctrl = ret;
 			ret = jxn;
@@ -4397,118 +4714,492 @@ cnode_is_range(struct jvst_cnode *n)
 static struct jvst_cnode *
 cnode_simplify_xor_ranges(struct jvst_cnode *top)
 {
-	struct jvst_cnode *lhs, *rhs, *and, *not, *or, *dup, *newlhs;
+	struct jvst_cnode *n, *m, *or, **opp;
+	size_t nchild;
 
 	// FIXME: we can probably do more efficiently (allocating fewer temporary nodes)
-	// FIXME: also, support more than two children!
 	// FIXME: also, support control nodes
 
 	assert(top->type == JVST_CNODE_XOR);
 	assert(top->u.ctrl != NULL);
 
-	lhs = top->u.ctrl;
-	rhs = top->u.ctrl->next;
-	if (rhs == NULL) {
-		return lhs;
+	if (top->u.ctrl->next == NULL) {
+		return top->u.ctrl;
 	}
 
-	if (rhs->next != NULL) {
-		// XXX - current limitation is two child nodes
-		return top;
+	nchild = 0;
+	for (n = top->u.ctrl; n != NULL; n = n->next) {
+		if (!cnode_is_range(n) || n->type != top->u.ctrl->type) {
+			return top;
+		}
+		nchild++;
 	}
 
-	if (!cnode_is_range(lhs) || !cnode_is_range(rhs)) {
+	// the rewrite has nchild ANDs of nchild terms each
+	if (nchild * nchild > JVST_CNODE_MAXTERMS) {
 		return top;
 	}
 
-	// construct OR(AND(lhs,NOT(rhs)), AND(NOT(lhs),rhs)) and simplify
-	dup = cnode_deep_copy(lhs);
-	not = cnode_negate_range(rhs);
-	and = jvst_cnode_alloc(JVST_CNODE_AND);
-	dup->next = not;
-	and->u.ctrl = dup;
-	newlhs = jvst_cnode_simplify(and);
+	// exactly one child is valid:
+	//
+	//   XOR(R1, ..., Rn) --> OR(AND(R1, NOT(R2), ..., NOT(Rn)),
+	//                           ...,
+	//                           AND(NOT(R1), ..., NOT(Rn-1), Rn))
+	//
+	// with the negated ranges expanded, then simplify
+	or = jvst_cnode_alloc(JVST_CNODE_OR);
+	or->kw = top->kw;
+	opp = &or->u.ctrl;
+	for (n = top->u.ctrl; n != NULL; n = n->next) {
+		struct jvst_cnode *and, **app;
+
+		and = jvst_cnode_alloc(JVST_CNODE_AND);
+		and->kw = top->kw;
+		app = &and->u.ctrl;
+		for (m = top->u.ctrl; m != NULL; m = m->next) {
+			struct jvst_cnode *term;
+
+			if (m == n) {
+				term = cnode_deep_copy(m);
+				term->kw = term->u.counts.kw_max = top->kw;
+			} else {
+				term = cnode_negate_range(m, top->kw);
+				if (term == NULL) {
+					// m matches every count
+					term = jvst_cnode_alloc(JVST_CNODE_INVALID);
+					term->kw = top->kw;
+				}
+			}
 
-	dup = cnode_deep_copy(rhs);
-	not = cnode_negate_range(lhs);
-	and = jvst_cnode_alloc(JVST_CNODE_AND);
-	dup->next = not;
-	and->u.ctrl = dup;
-	rhs = jvst_cnode_simplify(and);
+			*app = term;
+			app = &term->next;
+		}
 
-	or = jvst_cnode_alloc(JVST_CNODE_OR);
-	newlhs->next = rhs;
-	or->u.ctrl = newlhs;
+		*opp = jvst_cnode_simplify(and);
+		opp = &(*opp)->next;
+	}
 
 	return jvst_cnode_simplify(or);
 }
 
-static struct jvst_cnode *
-cnode_simplify_xor(struct jvst_cnode *top)
+/* Branch disjointness
+ *
+ * cnode_disjoint() tries to prove that no JSON value satisfies both of
+ * two simplified constraint trees.  The analysis is conservative: a
+ * zero result only means that no proof was found.
+ *
+ * If the children of an XOR are pairwise disjoint, at most one of them
+ * can be valid, so the XOR can be replaced by an OR.  This matters for
+ * the usual oneOf idioms (branches that differ in type, in a const or
+ * enum, or in a "kind" property): OR nodes can be merged into a single
+ * switch, string match or number range, while an XOR is lowered to a
+ * SPLIT that runs every branch over every token.
+ */
+
+static int
+cnode_disjoint(const struct jvst_cnode *a, const struct jvst_cnode *b);
+
+static int
+json_string_equal(const struct json_string *a, const struct json_string *b)
 {
-	struct jvst_cnode *node, *next, **pp;
-	size_t num_valid;
+	return a->len == b->len && memcmp(a->s, b->s, a->len) == 0;
+}
 
-	cnode_simplify_ctrl_children(top);
+static int
+cnode_literal_match(const struct ast_regexp *re, const struct json_string *name)
+{
+	return re->dialect == RE_LITERAL && json_string_equal(&re->str, name);
+}
 
-	// pass 1: remove VALID/INVALID nodes
-	//
-	// We have to handle this differently for XOR than for AND/OR.
-	//
-	// INVALID nodes are removed.  VALID nodes are removed and counted.
-	//
-	//   If we have no VALID nodes, then proceed normally.
-	// 
-	//   If we have one VALID node and any other nodes, then the VALID
-	//   node is removed and all the other nodes are placed under and
-	//   NOT(OR(...)).
-	//
-	//   If we have two or more VALID nodes, then the entire XOR becomes
-	//   INVALID.
-	num_valid = 0;
-	for (pp = &top->u.ctrl; *pp != NULL;) {
-		switch ((*pp)->type) {
-		case JVST_CNODE_INVALID:
-			// remove
-			*pp = (*pp)->next;
-			break;
+static int
+cnode_requires_prop(const struct jvst_cnode *node, const struct json_string *name)
+{
+	const struct jvst_cnode *c;
+	const struct ast_string_set *ss;
 
-		case JVST_CNODE_VALID:
-			num_valid++;
-			// remove
-			*pp = (*pp)->next;
-			break;
+	switch (node->type) {
+	case JVST_CNODE_OBJ_REQUIRED:
+		for (ss = node->u.required; ss != NULL; ss = ss->next) {
+			if (json_string_equal(&ss->str, name)) {
+				return 1;
+			}
+		}
+		return 0;
 
-		default:
-			pp = &(*pp)->next;
-			break;
+	case JVST_CNODE_AND:
+		for (c = node->u.ctrl; c != NULL; c = c->next) {
+			if (cnode_requires_prop(c, name)) {
+				return 1;
+			}
 		}
+		return 0;
+
+	default:
+		return 0;
 	}
+}
 
-	switch (num_valid) {
-	case 0:
-		// normal
-		break;
+// Returns non-zero if node rejects every object that has a property
+// with the given name.
+static int
+cnode_rejects_prop(const struct jvst_cnode *node, const struct json_string *name)
+{
+	const struct jvst_cnode *c;
+	int dft_invalid, matched;
 
-	case 1:
-		if (top->u.ctrl == NULL) {
-			// no remaining nodes... so VALID
-			return jvst_cnode_alloc(JVST_CNODE_VALID);
-		} else {
-			struct jvst_cnode *not, *or;
+	switch (node->type) {
+	case JVST_CNODE_OBJ_PROP_DEFAULT:
+		return node->u.prop_default->type == JVST_CNODE_INVALID;
 
-			// remaining nodes.  For the XOR to be VALID, none of these
-			// nodes may be valid, so replace this construct
-			// with a NOT(OR(...))
-			//
-			// special case: if there's only one remaining node, then the OR
-			// isn't necessary
+	case JVST_CNODE_OBJ_PROP_SET:
+		dft_invalid = 0;
+		matched = 0;
+		for (c = node->u.prop_set; c != NULL; c = c->next) {
+			switch (c->type) {
+			case JVST_CNODE_OBJ_PROP_DEFAULT:
+				if (c->u.prop_default->type == JVST_CNODE_INVALID) {
+					dft_invalid = 1;
+				}
+				break;
 
-			not = jvst_cnode_alloc(JVST_CNODE_NOT);
-			if (top->u.ctrl->next == NULL) {
-				not->u.ctrl = top->u.ctrl;
+			case JVST_CNODE_OBJ_PROP_MATCH:
+				if (c->u.prop_match.match.dialect != RE_LITERAL) {
+					// can't tell if the pattern matches the name
+					matched = 1;
+				} else if (cnode_literal_match(&c->u.prop_match.match, name)) {
+					if (c->u.prop_match.constraint->type == JVST_CNODE_INVALID) {
+						return 1;
+					}
+					matched = 1;
+				}
+				break;
+
+			default:
+				break;
+			}
+		}
+		return dft_invalid && !matched;
+
+	case JVST_CNODE_AND:
+		for (c = node->u.ctrl; c != NULL; c = c->next) {
+			if (cnode_rejects_prop(c, name)) {
+				return 1;
+			}
+		}
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+// Returns non-zero if some literal property constraint for name in node
+// is disjoint from cons.
+static int
+cnode_prop_disjoint(const struct jvst_cnode *node, const struct json_string *name,
+	const struct jvst_cnode *cons)
+{
+	const struct jvst_cnode *c;
+
+	switch (node->type) {
+	case JVST_CNODE_OBJ_PROP_SET:
+		for (c = node->u.prop_set; c != NULL; c = c->next) {
+			if (c->type != JVST_CNODE_OBJ_PROP_MATCH) {
+				continue;
+			}
+
+			if (cnode_literal_match(&c->u.prop_match.match, name) &&
+				cnode_disjoint(c->u.prop_match.constraint, cons)) {
+				return 1;
+			}
+		}
+		return 0;
+
+	case JVST_CNODE_AND:
+		for (c = node->u.ctrl; c != NULL; c = c->next) {
+			if (cnode_prop_disjoint(c, name, cons)) {
+				return 1;
+			}
+		}
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+// Returns non-zero if both nodes have literal constraints on the
+// property name and some pair of them is disjoint.
+static int
+cnode_props_disjoint(const struct jvst_cnode *a, const struct jvst_cnode *b,
+	const struct json_string *name)
+{
+	const struct jvst_cnode *c;
+
+	switch (b->type) {
+	case JVST_CNODE_OBJ_PROP_SET:
+		for (c = b->u.prop_set; c != NULL; c = c->next) {
+			if (c->type != JVST_CNODE_OBJ_PROP_MATCH) {
+				continue;
+			}
+
+			if (cnode_literal_match(&c->u.prop_match.match, name) &&
+				cnode_prop_disjoint(a, name, c->u.prop_match.constraint)) {
+				return 1;
+			}
+		}
+		return 0;
+
+	case JVST_CNODE_AND:
+		for (c = b->u.ctrl; c != NULL; c = c->next) {
+			if (cnode_props_disjoint(a, c, name)) {
+				return 1;
+			}
+		}
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+// Objects valid for a must have every property that a requires.  The
+// two nodes are disjoint if b rejects one of those properties, or if b
+// also requires it and the two constrain its value in disjoint ways.
+static int
+cnode_objects_disjoint(const struct jvst_cnode *a, const struct jvst_cnode *b)
+{
+	const struct jvst_cnode *c;
+	const struct ast_string_set *ss;
+
+	switch (a->type) {
+	case JVST_CNODE_OBJ_REQUIRED:
+		for (ss = a->u.required; ss != NULL; ss = ss->next) {
+			if (cnode_rejects_prop(b, &ss->str)) {
+				return 1;
+			}
+		}
+		return 0;
+
+	case JVST_CNODE_AND:
+		break;
+
+	default:
+		return 0;
+	}
+
+	for (c = a->u.ctrl; c != NULL; c = c->next) {
+		if (c->type != JVST_CNODE_OBJ_REQUIRED) {
+			continue;
+		}
+
+		for (ss = c->u.required; ss != NULL; ss = ss->next) {
+			if (cnode_rejects_prop(b, &ss->str)) {
+				return 1;
+			}
+
+			if (cnode_requires_prop(b, &ss->str) &&
+				cnode_props_disjoint(a, b, &ss->str)) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+cnode_num_ranges_disjoint(const struct jvst_cnode *a, const struct jvst_cnode *b)
+{
+	enum jvst_cnode_rangeflags fa, fb;
+
+	fa = a->u.num_range.flags;
+	fb = b->u.num_range.flags;
+
+	if (!(fa & (JVST_CNODE_RANGE_MAX|JVST_CNODE_RANGE_EXCL_MAX))) {
+		return 0;
+	}
+
+	if (!(fb & (JVST_CNODE_RANGE_MIN|JVST_CNODE_RANGE_EXCL_MIN))) {
+		return 0;
+	}
+
+	if (a->u.num_range.max < b->u.num_range.min) {
+		return 1;
+	}
+
+	return a->u.num_range.max == b->u.num_range.min &&
+		((fa & JVST_CNODE_RANGE_EXCL_MAX) || (fb & JVST_CNODE_RANGE_EXCL_MIN));
+}
+
+static int
+cnode_disjoint(const struct jvst_cnode *a, const struct jvst_cnode *b)
+{
+	const struct jvst_cnode *c;
+	size_t i;
+
+	if (a->type == JVST_CNODE_INVALID || b->type == JVST_CNODE_INVALID) {
+		return 1;
+	}
+
+	// every alternative must be disjoint
+	if (a->type == JVST_CNODE_OR || b->type == JVST_CNODE_OR) {
+		const struct jvst_cnode *alts, *other;
+
+		alts  = (a->type == JVST_CNODE_OR) ? a : b;
+		other = (a->type == JVST_CNODE_OR) ? b : a;
+		for (c = alts->u.ctrl; c != NULL; c = c->next) {
+			if (!cnode_disjoint(c, other)) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	if (cnode_objects_disjoint(a, b) || cnode_objects_disjoint(b, a)) {
+		return 1;
+	}
+
+	// one disjoint conjunct is enough
+	if (a->type == JVST_CNODE_AND || b->type == JVST_CNODE_AND) {
+		const struct jvst_cnode *conj, *other;
+
+		conj  = (a->type == JVST_CNODE_AND) ? a : b;
+		other = (a->type == JVST_CNODE_AND) ? b : a;
+		for (c = conj->u.ctrl; c != NULL; c = c->next) {
+			if (cnode_disjoint(c, other)) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if (a->type != b->type) {
+		return 0;
+	}
+
+	switch (a->type) {
+	case JVST_CNODE_SWITCH:
+		for (i=0; i < ARRAYLEN(a->u.sw); i++) {
+			if (a->u.sw[i] == NULL || b->u.sw[i] == NULL) {
+				return 0;
+			}
+
+			if (!cnode_disjoint(a->u.sw[i], b->u.sw[i])) {
+				return 0;
+			}
+		}
+		return 1;
+
+	case JVST_CNODE_STR_MATCH:
+		return a->u.str_match.dialect == RE_LITERAL &&
+			b->u.str_match.dialect == RE_LITERAL &&
+			!json_string_equal(&a->u.str_match.str, &b->u.str_match.str);
+
+	case JVST_CNODE_NUM_RANGE:
+		return cnode_num_ranges_disjoint(a, b) || cnode_num_ranges_disjoint(b, a);
+
+	case JVST_CNODE_LENGTH_RANGE:
+	case JVST_CNODE_PROP_RANGE:
+	case JVST_CNODE_ITEM_RANGE:
+		return (a->u.counts.upper && a->u.counts.max < b->u.counts.min) ||
+			(b->u.counts.upper && b->u.counts.max < a->u.counts.min);
+
+	default:
+		return 0;
+	}
+}
+
+// If the children of an XOR are pairwise disjoint, returns an OR of
+// them instead.
+static struct jvst_cnode *
+cnode_simplify_xor_disjoint(struct jvst_cnode *top)
+{
+	struct jvst_cnode *n0, *n1;
+
+	assert(top->type == JVST_CNODE_XOR);
+
+	for (n0 = top->u.ctrl; n0 != NULL; n0 = n0->next) {
+		for (n1 = n0->next; n1 != NULL; n1 = n1->next) {
+			if (!cnode_disjoint(n0, n1)) {
+				return top;
+			}
+		}
+	}
+
+	// the children have already been simplified
+	top->type = JVST_CNODE_OR;
+	return cnode_simplify_andor_top(top);
+}
+
+static struct jvst_cnode *
+cnode_simplify_xor(struct jvst_cnode *top)
+{
+	struct jvst_cnode *node, *next, **pp;
+	size_t num_valid;
+
+	cnode_simplify_ctrl_children(top);
+
+	// pass 1: remove VALID/INVALID nodes
+	//
+	// We have to handle this differently for XOR than for AND/OR.
+	//
+	// INVALID nodes are removed.  VALID nodes are removed and counted.
+	//
+	//   If we have no VALID nodes, then proceed normally.
+	// 
+	//   If we have one VALID node and any other nodes, then the VALID
+	//   node is removed and all the other nodes are placed under and
+	//   NOT(OR(...)).
+	//
+	//   If we have two or more VALID nodes, then the entire XOR becomes
+	//   INVALID.
+	num_valid = 0;
+	for (pp = &top->u.ctrl; *pp != NULL;) {
+		switch ((*pp)->type) {
+		case JVST_CNODE_INVALID:
+			// remove
+			*pp = (*pp)->next;
+			break;
+
+		case JVST_CNODE_VALID:
+			num_valid++;
+			// remove
+			*pp = (*pp)->next;
+			break;
+
+		default:
+			pp = &(*pp)->next;
+			break;
+		}
+	}
+
+	switch (num_valid) {
+	case 0:
+		// normal
+		break;
+
+	case 1:
+		if (top->u.ctrl == NULL) {
+			// no remaining nodes... so VALID
+			return jvst_cnode_alloc(JVST_CNODE_VALID);
+		} else {
+			struct jvst_cnode *not, *or;
+
+			// remaining nodes.  For the XOR to be VALID, none of these
+			// nodes may be valid, so replace this construct
+			// with a NOT(OR(...))
+			//
+			// special case: if there's only one remaining node, then the OR
+			// isn't necessary
+
+			not = jvst_cnode_alloc(JVST_CNODE_NOT);
+			not->kw = top->kw;
+			if (top->u.ctrl->next == NULL) {
+				not->u.ctrl = top->u.ctrl;
 			} else {
 				or = jvst_cnode_alloc(JVST_CNODE_OR);
+				or->kw = top->kw;
 				or->u.ctrl = top->u.ctrl;
 
 				not->u.ctrl = or;
@@ -4519,12 +5210,12 @@ cnode_simplify_xor(struct jvst_cnode *top)
 
 	default:
 		// more than one... entire XOR is invalid
-		return jvst_cnode_alloc(JVST_CNODE_INVALID);
+		return cnode_invalid_kw(top);
 	}
 
 	// all nodes were invalid
 	if (top->u.ctrl == NULL) {
-		return jvst_cnode_alloc(JVST_CNODE_INVALID);
+		return cnode_invalid_kw(top);
 	}
 
 	assert(top->u.ctrl != NULL);
@@ -4543,6 +5234,10 @@ cnode_simplify_xor(struct jvst_cnode *top)
 		top = cnode_simplify_xor_ranges(top);
 	}
 
+	if (top->type == JVST_CNODE_XOR) {
+		top = cnode_simplify_xor_disjoint(top);
+	}
+
 	if (top->type == JVST_CNODE_XOR) {
 		// need to limit when we do this.  otherwise it causes
 		// problems...
@@ -4578,7 +5273,7 @@ cnode_simplify_not_range(struct jvst_cnode *top)
 		return top;
 	}
 
-	return cnode_negate_range(range);
+	return cnode_negate_range(range, top->kw);
 }
 
 static struct jvst_cnode *
@@ -4596,6 +5291,7 @@ cnode_simplify_not_switch(struct jvst_cnode *top)
 	}
 
 	sw = jvst_cnode_alloc(JVST_CNODE_SWITCH);
+	sw->loc = sw0->loc;
 	for (i = 0, n = ARRAYLEN(sw->u.sw); i < n; i++) {
 		struct jvst_cnode *not, *n;
 
@@ -4606,6 +5302,7 @@ cnode_simplify_not_switch(struct jvst_cnode *top)
 		}
 
 		not = jvst_cnode_alloc(JVST_CNODE_NOT);
+		not->kw = top->kw;
 		not->u.ctrl = sw0->u.sw[i];
 
 		sw->u.sw[i] = jvst_cnode_simplify(not);
@@ -4649,7 +5346,7 @@ cnode_simplify_not(struct jvst_cnode *top)
 			return jvst_cnode_alloc(JVST_CNODE_VALID);
 
 		case JVST_CNODE_VALID:
-			return jvst_cnode_alloc(JVST_CNODE_INVALID);
+			return cnode_invalid_kw(top);
 
 		default:
 			/* nop */
@@ -4661,6 +5358,7 @@ cnode_simplify_not(struct jvst_cnode *top)
 		struct jvst_cnode *simplified;
 
 		simplified = jvst_cnode_alloc(JVST_CNODE_NOT);
+		simplified->kw = top->kw;
 		simplified->u.ctrl = jvst_cnode_simplify(top->u.ctrl);
 
 		return simplified;
@@ -5415,6 +6113,71 @@ cnode_canonify_propset(struct jvst_cnode *top)
 	}
 }
 
+struct jvst_cnode *
+jvst_cnode_literal_mswitch(const struct json_string *strs, size_t n)
+{
+	struct jvst_cnode *msw, *mcases;
+	struct fsm_options *opts;
+	struct fsm *matches;
+	size_t i;
+
+	assert(n > 0);
+
+	// FIXME: this is a leak, as in cnode_canonify_propset
+	opts = xmalloc(sizeof *opts);
+	*opts = (struct fsm_options) {
+		.tidy = false,
+		.anonymous_states = false,
+		.consolidate_edges = true,
+		.fragment = true,
+		.comments = true,
+		.case_ranges = true,
+
+		.io = FSM_IO_GETC,
+		.prefix = NULL,
+		.carryopaque = NULL,
+	};
+
+	matches = NULL;
+	for (i=0; i < n; i++) {
+		struct jvst_cnode *mcase;
+		struct ast_regexp re = { 0 };
+		struct fsm *pat;
+
+		re.dialect = RE_LITERAL;
+		re.str = strs[i];
+
+		mcase = cnode_new_mcase(cnode_matchset_new(re, NULL),
+			jvst_cnode_alloc(JVST_CNODE_VALID));
+		pat = mcase_re_compile(&re, opts, mcase);
+
+		if (matches == NULL) {
+			matches = pat;
+		} else {
+			matches = fsm_union(matches, pat);
+			assert(matches != NULL);
+		}
+	}
+
+	// the strings are distinct, so no two cases share an end state
+	// and the carryopaque function never has to merge anything
+	opts->carryopaque = merge_mcases_with_and;
+	if (!fsm_determinise(matches)) {
+		perror("cannot determinise fsm");
+		abort();
+	}
+
+	collect_mcases(matches, &mcases);
+
+	msw = jvst_cnode_alloc(JVST_CNODE_MATCH_SWITCH);
+	msw->u.mswitch.dfa = matches;
+	msw->u.mswitch.opts = opts;
+	msw->u.mswitch.cases = mcases;
+	msw->u.mswitch.dft_case = cnode_new_mcase(NULL, jvst_cnode_alloc(JVST_CNODE_VALID));
+
+	return msw;
+}
+
 // replaces REQUIRED nodes with REQMASK and REQBIT nodes
 //
 // XXX - should this be in the translation phase?
@@ -5432,6 +6195,7 @@ cnode_canonify_required(struct jvst_cnode *req)
 	npp = &jxn->u.ctrl;
 
 	mask = jvst_cnode_alloc(JVST_CNODE_OBJ_REQMASK);
+	mask->kw = req->kw;
 	*npp = mask;
 	npp = &(*npp)->next;
 
@@ -5503,7 +6267,7 @@ cnode_canonify_strmatch(struct jvst_cnode *top)
 	msw->u.mswitch.dfa = match;
 	msw->u.mswitch.opts = opts;
 	msw->u.mswitch.cases = mcase;
-	msw->u.mswitch.dft_case = cnode_new_mcase(NULL, jvst_cnode_alloc(JVST_CNODE_INVALID));
+	msw->u.mswitch.dft_case = cnode_new_mcase(NULL, cnode_invalid_kw(top));
 
 	return msw;
 }
@@ -5609,6 +6373,7 @@ cnode_canonify_pass1(struct jvst_cnode *tree, int namecons)
 			msw = jvst_cnode_alloc(JVST_CNODE_MATCH_SWITCH);
 			cons = jvst_cnode_alloc(JVST_CNODE_LENGTH_RANGE);
 			cons->u.counts = tree->u.counts;
+			cons->kw = tree->kw;
 			mc = cnode_new_mcase(NULL,cons);
 			msw->u.mswitch.dft_case = mc;
 
@@ -5887,7 +6652,9 @@ jvst_cnode_canonify(struct jvst_cnode *tree)
 void
 jvst_cnode_forest_add_tree(struct jvst_cnode_forest *forest, struct jvst_cnode *tree)
 {
-	forest->trees = xenlargevec(forest->trees, &forest->cap, 1, sizeof forest->trees[0]);
+	if (forest->len >= forest->cap) {
+		forest->trees = xenlargevec(forest->trees, &forest->cap, 1, sizeof forest->trees[0]);
+	}
 
 	assert(forest->cap > 0);
 	assert(forest->len < forest->cap);
@@ -5986,6 +6753,190 @@ cnode_update_forest(struct jvst_cnode_forest *forest, struct jvst_cnode *(*updat
 	return forest;
 }
 
+/* Unreachable definitions
+ *
+ * A schema that pulls in a large registry of definitions usually only
+ * refers to a few of them.  Every rerooted definition is a tree in the
+ * forest, and each tree is simplified, canonified, translated to IR
+ * and assembled whether or not anything refers to it.  Pruning the
+ * trees that cannot be reached from the root before any of that work
+ * means only definitions that are actually used are compiled.
+ *
+ * This is decided when the schema is compiled: every definition the
+ * root can reach is still compiled up front.  To put off compiling a
+ * definition until a document first calls into it, see validate_lazy.h.
+ */
+
+static void
+cnode_prune_mark(struct jvst_cnode_forest *forest, struct hmap *live, struct jvst_cnode *node);
+
+static void
+cnode_prune_mark_list(struct jvst_cnode_forest *forest, struct hmap *live, struct jvst_cnode *node)
+{
+	for (; node != NULL; node = node->next) {
+		cnode_prune_mark(forest, live, node);
+	}
+}
+
+static void
+cnode_prune_mark(struct jvst_cnode_forest *forest, struct hmap *live, struct jvst_cnode *node)
+{
+	struct jvst_cnode *tree;
+	size_t i;
+
+	if (node == NULL) {
+		return;
+	}
+
+	switch (node->type) {
+	case JVST_CNODE_AND:
+	case JVST_CNODE_OR:
+	case JVST_CNODE_XOR:
+	case JVST_CNODE_NOT:
+		cnode_prune_mark_list(forest, live, node->u.ctrl);
+		return;
+
+	case JVST_CNODE_SWITCH:
+		for (i=0; i < ARRAYLEN(node->u.sw); i++) {
+			cnode_prune_mark(forest, live, node->u.sw[i]);
+		}
+		return;
+
+	case JVST_CNODE_OBJ_PROP_SET:
+		cnode_prune_mark_list(forest, live, node->u.prop_set);
+		return;
+
+	case JVST_CNODE_OBJ_PROP_MATCH:
+		cnode_prune_mark(forest, live, node->u.prop_match.constraint);
+		return;
+
+	case JVST_CNODE_OBJ_PROP_DEFAULT:
+		cnode_prune_mark(forest, live, node->u.prop_default);
+		return;
+
+	case JVST_CNODE_OBJ_PROP_NAMES:
+		cnode_prune_mark(forest, live, node->u.prop_names);
+		return;
+
+	case JVST_CNODE_ARR_ITEM:
+		cnode_prune_mark_list(forest, live, node->u.items.items);
+		cnode_prune_mark(forest, live, node->u.items.additional);
+		return;
+
+	case JVST_CNODE_ARR_CONTAINS:
+		cnode_prune_mark(forest, live, node->u.contains);
+		return;
+
+	case JVST_CNODE_MATCH_SWITCH:
+		cnode_prune_mark(forest, live, node->u.mswitch.dft_case);
+		cnode_prune_mark_list(forest, live, node->u.mswitch.cases);
+		return;
+
+	case JVST_CNODE_MATCH_CASE:
+		cnode_prune_mark(forest, live, node->u.mcase.constraint);
+		return;
+
+	case JVST_CNODE_REF:
+		tree = jvst_cnode_id_table_lookup(forest->ref_ids, node->u.ref);
+		if (tree == NULL || hmap_getptr(live, tree) != NULL) {
+			return;
+		}
+
+		if (!hmap_setptr(live, tree, tree)) {
+			fprintf(stderr, "could not add entry to cnode prune table\n");
+			abort();
+		}
+
+		cnode_prune_mark(forest, live, tree);
+		return;
+
+	case JVST_CNODE_INVALID:
+	case JVST_CNODE_VALID:
+	case JVST_CNODE_LENGTH_RANGE:
+	case JVST_CNODE_PROP_RANGE:
+	case JVST_CNODE_ITEM_RANGE:
+	case JVST_CNODE_STR_MATCH:
+	case JVST_CNODE_STR_LENGTH:
+	case JVST_CNODE_NUM_RANGE:
+	case JVST_CNODE_NUM_INTEGER:
+	case JVST_CNODE_NUM_MULTIPLE_OF:
+	case JVST_CNODE_OBJ_REQUIRED:
+	case JVST_CNODE_ARR_UNIQUE:
+	case JVST_CNODE_OBJ_REQMASK:
+	case JVST_CNODE_OBJ_REQBIT:
+		return;
+	}
+
+	UNKNOWN_NODE_TYPE(node);
+}
+
+struct cnode_prune_refs {
+	struct hmap *live;
+	struct jvst_cnode_id_table *ref_ids;
+};
+
+static int
+cnode_prune_ref(void *opaque, struct json_string *k, struct jvst_cnode **ctreep)
+{
+	struct cnode_prune_refs *pr = opaque;
+
+	assert(k != NULL);
+	assert(ctreep != NULL);
+
+	if (*ctreep != NULL && hmap_getptr(pr->live, *ctreep) == NULL) {
+		return 1;
+	}
+
+	if (!jvst_cnode_id_table_add(pr->ref_ids, *k, *ctreep)) {
+		fprintf(stderr, "could not add entry to cnode ID table\n");
+		abort();
+	}
+
+	return 1;
+}
+
+struct jvst_cnode_forest *
+jvst_cnode_prune_forest(struct jvst_cnode_forest *forest)
+{
+	struct cnode_prune_refs pr;
+	struct hmap *live;
+	size_t i,n;
+
+	if (forest->len == 0) {
+		return forest;
+	}
+
+	live = hmap_create_pointer(
+			jvst_cnode_id_table_nbuckets(forest->ref_ids),
+			jvst_cnode_id_table_maxload(forest->ref_ids));
+
+	// trees[0] is always the root
+	if (!hmap_setptr(live, forest->trees[0], forest->trees[0])) {
+		fprintf(stderr, "could not add entry to cnode prune table\n");
+		abort();
+	}
+	cnode_prune_mark(forest, live, forest->trees[0]);
+
+	for (i=0, n=0; i < forest->len; i++) {
+		if (hmap_getptr(live, forest->trees[i]) != NULL) {
+			forest->trees[n++] = forest->trees[i];
+		}
+	}
+	forest->len = n;
+
+	// rebuild the ref table without the pruned trees so later stages
+	// don't go looking for them
+	pr.live = live;
+	pr.ref_ids = jvst_cnode_id_table_new();
+	jvst_cnode_id_table_foreach(forest->ref_ids, cnode_prune_ref, &pr);
+	jvst_cnode_id_table_delete(forest->ref_ids);
+	forest->ref_ids = pr.ref_ids;
+
+	hmap_free(live);
+
+	return forest;
+}
+
 struct jvst_cnode_forest *
 jvst_cnode_simplify_forest(struct jvst_cnode_forest *forest)
 {
@@ -89,6 +89,15 @@ enum jvst_cnode_type {
 	JVST_CNODE_MATCH_CASE,
 };
 
+// A keyword of a schema: the location of the schema (see struct
+// jvst_cnode) and the name of the keyword.  Both are empty if the
+// keyword isn't known.  The VM's source map gives the keyword whose
+// check failed a document.
+struct jvst_cnode_kw {
+	struct json_string loc;
+	const char *name;
+};
+
 struct jvst_cnode_matchset {
 	struct jvst_cnode_matchset *next;
 	struct ast_regexp match;
@@ -99,6 +108,17 @@ struct jvst_cnode {
 
 	struct jvst_cnode *next;
 
+	// where the schema the node was translated from is in its
+	// document, as a URI fragment ("#/properties/foo").  Only set on
+	// SWITCH nodes, and empty if it isn't known.  Points into the
+	// ids of the AST.
+	struct json_string loc;
+
+	// the keyword the node checks, for constraints and for the
+	// INVALID cases of a type switch.  For ranges, the keyword of
+	// the lower bound; the upper bound has its own.
+	struct jvst_cnode_kw kw;
+
 	union {
 		/* type switch node */
 		struct jvst_cnode *sw[SJP_EVENT_MAX];
@@ -114,6 +134,8 @@ struct jvst_cnode {
 			size_t max;
 
 			unsigned upper:1; // indicates if max is an upper bound
+
+			struct jvst_cnode_kw kw_max;
 		} counts;
 
 		/* for string pattern matching or matching string sets */
@@ -124,6 +146,8 @@ struct jvst_cnode {
 			enum jvst_cnode_rangeflags flags;
 			double min;
 			double max;
+
+			struct jvst_cnode_kw kw_max;
 		} num_range;
 
 		/* for multipleOf constraints */
@@ -220,6 +244,14 @@ jvst_cnode_from_ast(const struct ast_schema *ast);
 struct jvst_cnode_forest *
 jvst_cnode_translate_ast_with_ids(const struct ast_schema *ast);
 
+// Translates a schema document that is compiled as a module and linked
+// with the modules of the documents it refers to.  References that
+// can't be matched in the document are imports rather than errors,
+// and each definition becomes a tree in the forest so other modules
+// can refer to it.  The forest shouldn't be pruned.
+struct jvst_cnode_forest *
+jvst_cnode_translate_module(const struct ast_schema *ast);
+
 // Backwards-compatible version of the above while we migrate code/tests
 struct jvst_cnode *
 jvst_cnode_translate_ast(const struct ast_schema *ast);
@@ -232,6 +264,13 @@ jvst_cnode_simplify(struct jvst_cnode *tree);
 struct jvst_cnode *
 jvst_cnode_canonify(struct jvst_cnode *tree);
 
+// Builds a MATCH_SWITCH with one case for each of the n literal
+// strings, and a default case.  The strings must be distinct.  Every
+// case, and the default, has a VALID constraint; the caller tells the
+// cases apart by their matchset.
+struct jvst_cnode *
+jvst_cnode_literal_mswitch(const struct json_string *strs, size_t n);
+
 // Writes a textual represetnation of the cnode into the buffer,
 // returns 0 if the representation fit, non-zero otherwise
 int
@@ -268,6 +307,12 @@ jvst_cnode_forest_finalize(struct jvst_cnode_forest *forest);
 void
 jvst_cnode_forest_add_tree(struct jvst_cnode_forest *forest, struct jvst_cnode *tree);
 
+// Removes the trees that can't be reached from the root tree through
+// REF nodes, along with their entries in ref_ids.  Should be called
+// before simplifying the forest, so unused definitions aren't compiled.
+struct jvst_cnode_forest *
+jvst_cnode_prune_forest(struct jvst_cnode_forest *forest);
+
 // Simplifies the cnode forest.  Replaces each tree in the forest with a
 // simplified one.
 struct jvst_cnode_forest *
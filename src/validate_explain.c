@@ -0,0 +1,342 @@
+#include "validate_explain.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sjp_parser.h"
+
+#include "xalloc.h"
+#include "validate_ir.h"
+
+// an object or array that the path is in
+struct path_frame {
+	int obj;
+	int haskey;	// objects: the next string is a value, not a key
+	size_t len;	// length of the pointer to the object or array
+	size_t index;	// arrays: index of the next item
+};
+
+// Follows a document and keeps the JSON Pointer of the last token
+struct explain_path {
+	struct sjp_parser parser;
+	char pstack[JVST_VM_PARSER_STKSIZE];
+	char pbuf[JVST_VM_PARSER_BUFSIZE];
+
+	char *ptr;
+	size_t len;
+	size_t max;
+
+	struct path_frame *frames;
+	size_t nframes;
+	size_t maxframes;
+
+	// the last string was partial, and the rest of it is still to
+	// come.  Its pieces are added to the pointer if it's a key.
+	int partial;
+	int partial_key;
+
+	int error;
+};
+
+static void
+path_init(struct explain_path *p)
+{
+	memset(p, 0, sizeof *p);
+	(void)sjp_parser_init(&p->parser, &p->pstack[0], sizeof p->pstack,
+		&p->pbuf[0], sizeof p->pbuf);
+
+	p->max = 64;
+	p->ptr = xmalloc(p->max);
+	p->ptr[0] = '\0';
+}
+
+static void
+path_append(struct explain_path *p, const char *s, size_t n)
+{
+	if (p->len + n + 1 > p->max) {
+		p->ptr = xenlargevec(p->ptr, &p->max, p->len + n + 1 - p->max, 1);
+	}
+
+	memcpy(&p->ptr[p->len], s, n);
+	p->len += n;
+	p->ptr[p->len] = '\0';
+}
+
+static void
+path_truncate(struct explain_path *p, size_t len)
+{
+	assert(len <= p->len);
+	p->len = len;
+	p->ptr[len] = '\0';
+}
+
+// adds a piece of a key, escaped as RFC 6901 requires
+static void
+path_append_key(struct explain_path *p, const char *s, size_t n)
+{
+	size_t i;
+
+	for (i=0; i < n; i++) {
+		switch (s[i]) {
+		case '~': path_append(p, "~0", 2);  break;
+		case '/': path_append(p, "~1", 2);  break;
+		default:  path_append(p, &s[i], 1); break;
+		}
+	}
+}
+
+static void
+path_event(struct explain_path *p, enum SJP_RESULT pret, const struct sjp_event *evt)
+{
+	struct path_frame *top;
+
+	if (p->partial) {
+		if (p->partial_key) {
+			path_append_key(p, evt->text, evt->n);
+		}
+		p->partial = (pret == SJP_PARTIAL);
+		return;
+	}
+
+	top = (p->nframes > 0) ? &p->frames[p->nframes-1] : NULL;
+
+	switch (evt->type) {
+	case SJP_OBJECT_END:
+	case SJP_ARRAY_END:
+		// the pointer is to the object or array that ended
+		assert(top != NULL);
+		path_truncate(p, top->len);
+		p->nframes--;
+		return;
+
+	case SJP_STRING:
+		if (top != NULL && top->obj && !top->haskey) {
+			path_truncate(p, top->len);
+			path_append(p, "/", 1);
+			path_append_key(p, evt->text, evt->n);
+			top->haskey = 1;
+
+			p->partial = (pret == SJP_PARTIAL);
+			p->partial_key = 1;
+			return;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	// the start of a value
+	if (top != NULL && top->obj) {
+		top->haskey = 0;
+	} else if (top != NULL) {
+		char idx[32];
+
+		path_truncate(p, top->len);
+		snprintf(idx, sizeof idx, "/%zu", top->index++);
+		path_append(p, idx, strlen(idx));
+	}
+
+	switch (evt->type) {
+	case SJP_OBJECT_BEG:
+	case SJP_ARRAY_BEG:
+		if (p->nframes >= p->maxframes) {
+			p->frames = xenlargevec(p->frames, &p->maxframes, 1, sizeof p->frames[0]);
+		}
+
+		top = &p->frames[p->nframes++];
+		top->obj = (evt->type == SJP_OBJECT_BEG);
+		top->haskey = 0;
+		top->len = p->len;
+		top->index = 0;
+		break;
+
+	case SJP_STRING:
+		p->partial = (pret == SJP_PARTIAL);
+		p->partial_key = 0;
+		break;
+
+	default:
+		break;
+	}
+}
+
+// Follows the next n bytes of the document, stopping once the parser
+// reaches offset stop of them
+static void
+path_more(struct explain_path *p, char *data, size_t n, size_t stop)
+{
+	if (p->error) {
+		return;
+	}
+
+	sjp_parser_more(&p->parser, data, n);
+
+	while (p->parser.lex.off < stop) {
+		struct sjp_event evt = { 0 };
+		enum SJP_RESULT pret;
+
+		pret = sjp_parser_next(&p->parser, &evt);
+		if (SJP_ERROR(pret)) {
+			p->error = 1;
+			return;
+		}
+
+		if (evt.type == SJP_NONE) {
+			return;
+		}
+
+		path_event(p, pret, &evt);
+	}
+}
+
+static void
+path_finalize(struct explain_path *p)
+{
+	free(p->frames);
+}
+
+// Fills in ex from the VM that failed
+static void
+explain_failure(struct jvst_vm_explain *ex, const struct jvst_vm_program *prog,
+	const struct jvst_vm *vm, struct explain_path *path)
+{
+	ex->code = vm->error;
+	ex->pc = vm->r_pc;
+
+	// the VM's error is the parser's for malformed documents, and
+	// there's no error if the document ended early
+	if (ex->code <= 0) {
+		ex->code = JVST_INVALID_JSON;
+	} else if (ex->code != JVST_INVALID_JSON) {
+		ex->schema = jvst_vm_program_srcloc(prog, ex->pc);
+		ex->keyword = jvst_vm_program_keyword(prog, ex->pc);
+	}
+
+	ex->msg = jvst_invalid_msg(ex->code);
+
+	// hand the pointer over
+	ex->instance = path->ptr;
+	path->ptr = NULL;
+}
+
+enum jvst_result
+jvst_vm_explain_read(const struct jvst_vm_program *prog, const struct jvst_vm_limits *limits,
+	size_t (*read)(void *opaque, char **bufp), void *opaque, struct jvst_vm_explain *ex)
+{
+	static const struct jvst_vm_explain zero;
+	struct jvst_vm_program interp;
+	struct explain_path *path;
+	struct jvst_vm vm;
+	enum jvst_result ret;
+	size_t off, n;
+	char *data;
+
+	*ex = zero;
+
+	// the pc of a failure is only kept by the interpreter
+	interp = *prog;
+	interp.native = NULL;
+	interp.jit = NULL;
+
+	jvst_vm_init_defaults(&vm, &interp);
+	if (limits != NULL) {
+		jvst_vm_set_limits(&vm, limits);
+	}
+
+	path = xmalloc(sizeof *path);
+	path_init(path);
+
+	ret = JVST_VALID;
+	off = 0;
+	while (n = read(opaque, &data), n > 0) {
+		ret = jvst_vm_more(&vm, data, n);
+
+		// the VM's parser stopped at the end of the token that
+		// failed, stop the path there too
+		path_more(path, data, n, JVST_IS_INVALID(ret) ? vm.parser.lex.off : SIZE_MAX);
+
+		if (JVST_IS_INVALID(ret)) {
+			off += vm.parser.lex.off;
+			break;
+		}
+
+		off += n;
+	}
+
+	if (!JVST_IS_INVALID(ret)) {
+		ret = jvst_vm_close(&vm);
+	}
+
+	if (JVST_IS_INVALID(ret)) {
+		ex->offset = off;
+		// a lazy program may have grown into another one
+		explain_failure(ex, vm.prog, &vm, path);
+		ret = JVST_INVALID;
+	}
+
+	jvst_vm_finalize(&vm);
+	path_finalize(path);
+	free(path->ptr);
+	free(path);
+
+	return ret;
+}
+
+struct explain_buf {
+	char *buf;
+	size_t n;
+};
+
+static size_t
+read_buf(void *opaque, char **bufp)
+{
+	struct explain_buf *b = opaque;
+	size_t n = b->n;
+
+	*bufp = b->buf;
+	b->n = 0;
+
+	return n;
+}
+
+enum jvst_result
+jvst_vm_explain(const struct jvst_vm_program *prog, const struct jvst_vm_limits *limits,
+	char *buf, size_t n, struct jvst_vm_explain *ex)
+{
+	struct explain_buf b;
+
+	b.buf = buf;
+	b.n = n;
+
+	return jvst_vm_explain_read(prog, limits, read_buf, &b, ex);
+}
+
+void
+jvst_vm_explain_print(FILE *f, const struct jvst_vm_explain *ex)
+{
+	fprintf(f, "invalid: %s\n", ex->msg);
+	fprintf(f, "  instance: \"%s\"\n", ex->instance != NULL ? ex->instance : "");
+
+	if (ex->schema != NULL) {
+		fprintf(f, "  schema:   %s\n", ex->schema);
+	}
+
+	if (ex->keyword != NULL) {
+		fprintf(f, "  keyword:  %s\n", ex->keyword);
+	}
+
+	fprintf(f, "  offset:   %zu\n", ex->offset);
+}
+
+void
+jvst_vm_explain_finalize(struct jvst_vm_explain *ex)
+{
+	free(ex->instance);
+	ex->instance = NULL;
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
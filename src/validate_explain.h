@@ -0,0 +1,75 @@
+#ifndef VALIDATE_EXPLAIN_H
+#define VALIDATE_EXPLAIN_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "validate_vm.h"
+
+/* Explanations of invalid documents.
+ *
+ * The VM doesn't keep track of where it is in the document, so valid
+ * documents don't pay for it.  Once a document is found invalid, it can
+ * be validated again by jvst_vm_explain(), which runs the interpreter,
+ * even for programs with native code, alongside a second parser that
+ * follows the document.  When the VM fails, the parser has read up to
+ * the same token, and its position is the JSON Pointer of the value
+ * that failed.  The pc of the failure gives the schema location and
+ * the keyword, from the program's source map (see
+ * jvst_vm_program_srcloc() and jvst_vm_program_keyword()).
+ *
+ * Only JSON text can be explained.
+ */
+
+struct jvst_vm_explain {
+	// the enum jvst_invalid_code of the failure, or JVST_INVALID_JSON
+	// if the document isn't well formed
+	int code;
+	const char *msg;
+
+	// JSON Pointer (RFC 6901) of the value that failed, "" for the
+	// whole document.  For failures at the end of an object or array,
+	// such as missing required properties, the object or array.
+	char *instance;
+
+	// location of the schema that failed, or NULL if the program has
+	// no source map.  Points into the program.
+	const char *schema;
+
+	// the keyword that failed, or NULL if the program has no source
+	// map or the failure isn't a single keyword's.  Points into the
+	// program.
+	const char *keyword;
+
+	// pc of the instruction that failed
+	uint32_t pc;
+
+	// offset of the end of the token that failed
+	size_t offset;
+};
+
+// Validates the document in buf again and explains why it's invalid.
+// Returns JVST_INVALID and fills in ex, or JVST_VALID if the document
+// is valid after all, for instance if it failed a resource limit.
+// limits, if not NULL, limits the replay (see jvst_vm_set_limits()).
+// ex must be released with jvst_vm_explain_finalize() either way.
+enum jvst_result
+jvst_vm_explain(const struct jvst_vm_program *prog, const struct jvst_vm_limits *limits,
+	char *buf, size_t n, struct jvst_vm_explain *ex);
+
+// As jvst_vm_explain(), reading the document from read(), which
+// returns the size of the next piece of the document in *bufp, or 0
+// at the end.  Each piece must be valid until the next call to read().
+enum jvst_result
+jvst_vm_explain_read(const struct jvst_vm_program *prog, const struct jvst_vm_limits *limits,
+	size_t (*read)(void *opaque, char **bufp), void *opaque, struct jvst_vm_explain *ex);
+
+void
+jvst_vm_explain_print(FILE *f, const struct jvst_vm_explain *ex);
+
+void
+jvst_vm_explain_finalize(struct jvst_vm_explain *ex);
+
+#endif /* VALIDATE_EXPLAIN_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -0,0 +1,687 @@
+#include "validate_vm.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xalloc.h"
+
+/* Generates C source for a validator from a VM program.
+ *
+ * The code of the program becomes a single function that the VM calls
+ * in place of the interpreter (see the native field of struct
+ * jvst_vm_program).  Each instruction becomes a few lines of C with its
+ * arguments resolved: slots are indexes into the current frame and
+ * constants from the constant pools are inlined.  Branches and calls
+ * become gotos.
+ *
+ * Procs don't become C functions of their own.  A VM that stops for a
+ * token returns out of the generated code with its call stack kept in
+ * the VM's stack, and resumes in the middle of a proc, possibly one
+ * that a split VM started in.  A RETURN then continues after the CALL
+ * that the VM's stack records, which is a pc to resume at rather than
+ * a C caller to return to.
+ *
+ * The VM returns to its caller whenever it needs another token, so the
+ * function has to be resumable.  It begins with a switch on the pc that
+ * jumps to the instruction to resume with.  The cases are the places
+ * the VM can stop (TOKEN, CONSUME, MATCH, RETURN, SPLIT and UNIQUE),
+ * the places a RETURN goes back to and the entry points of split procs.
+ *
+ * DFAs become functions that walk the input with a goto per
+ * transition.  The rest of the program (splits, the DFA tables used to
+ * look up end states, the code itself) is emitted as data, so the
+ * generated program also works with the parts of the runtime that look
+ * at those.
+ *
+ * The generated file is compiled and linked with the jvst runtime,
+ * which provides the JSON parser and the rest of the VM.
+ */
+
+enum {
+	GEN_TARGET = 0x01,	// needs a label
+	GEN_RESUME = 0x02,	// needs a case in the resume switch
+};
+
+static void
+gen_int64(FILE *f, int64_t v)
+{
+	if (v == INT64_MIN) {
+		fprintf(f, "(-INT64_C(%" PRId64 ")-1)", INT64_MAX);
+	} else {
+		fprintf(f, "INT64_C(%" PRId64 ")", v);
+	}
+}
+
+static void
+gen_double(FILE *f, double v)
+{
+	if (isnan(v)) {
+		fprintf(f, "NAN");
+	} else if (isinf(v)) {
+		fprintf(f, "%sHUGE_VAL", (v < 0) ? "-" : "");
+	} else {
+		// hex floats are exact
+		fprintf(f, "%a", v);
+	}
+}
+
+static void
+gen_string(FILE *f, const char *s, size_t n)
+{
+	size_t i;
+
+	fputc('"', f);
+	for (i=0; i < n; i++) {
+		unsigned char c = s[i];
+
+		// octal escapes always have three digits, so they can't run
+		// into the following character
+		if (c == '"' || c == '\\' || c == '?' || c < 0x20 || c >= 0x7f) {
+			fprintf(f, "\\%03o", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+// value of an integer argument: a literal, or a slot of the current frame
+static void
+gen_ival(FILE *f, uint32_t arg)
+{
+	if (jvst_vm_arg_islit(arg)) {
+		gen_int64(f, jvst_vm_arg_tolit(arg));
+	} else {
+		fprintf(f, "sl[%d].i", jvst_vm_arg_toslot(arg));
+	}
+}
+
+static int
+is_tnum(uint32_t arg)
+{
+	return arg == VMREG(JVST_VM_TNUM);
+}
+
+static void
+gen_u32_array(FILE *f, const char *name, const uint32_t *v, size_t n)
+{
+	size_t i;
+
+	fprintf(f, "static uint32_t %s[] = {", name);
+	for (i=0; i < n; i++) {
+		fprintf(f, "%s0x%08" PRIx32 ",", (i%8 == 0) ? "\n\t" : " ", v[i]);
+	}
+	fprintf(f, "\n};\n\n");
+}
+
+static size_t
+nsdata(const struct jvst_vm_program *prog)
+{
+	if (prog->nsplit == 0) {
+		return 0;
+	}
+
+	return prog->nsplit + 1 + prog->sdata[prog->nsplit];
+}
+
+static void
+gen_data(FILE *f, const struct jvst_vm_program *prog)
+{
+	size_t i;
+
+	gen_u32_array(f, "code", prog->code, prog->ncode);
+
+	if (prog->nfloat > 0) {
+		fprintf(f, "static double fdata[] = {\n");
+		for (i=0; i < prog->nfloat; i++) {
+			fprintf(f, "\t");
+			gen_double(f, prog->fdata[i]);
+			fprintf(f, ",\n");
+		}
+		fprintf(f, "};\n\n");
+	}
+
+	if (prog->nconst > 0) {
+		fprintf(f, "static int64_t cdata[] = {\n");
+		for (i=0; i < prog->nconst; i++) {
+			fprintf(f, "\t");
+			gen_int64(f, prog->cdata[i]);
+			fprintf(f, ",\n");
+		}
+		fprintf(f, "};\n\n");
+	}
+
+	if (prog->nsplit > 0) {
+		gen_u32_array(f, "sdata", prog->sdata, nsdata(prog));
+	}
+}
+
+static void
+gen_dfa_run(FILE *f, size_t ind, const struct jvst_vm_dfa *dfa)
+{
+	size_t st;
+	int e;
+
+	fprintf(f, "static int\ndfa%zu_run(int st0, const char *buf, size_t n)\n{\n", ind);
+	fprintf(f, "\tconst unsigned char *p = (const unsigned char *)buf, *end = p + n;\n\n");
+
+	fprintf(f, "\tswitch (st0) {\n");
+	for (st=0; st < dfa->nstates; st++) {
+		fprintf(f, "\tcase %zu: goto S%zu;\n", st, st);
+	}
+	fprintf(f, "\tdefault: return JVST_VM_DFA_BADSTATE;\n\t}\n\n");
+
+	for (st=0; st < dfa->nstates; st++) {
+		fprintf(f, "S%zu:\n", st);
+		fprintf(f, "\tif (p == end) {\n\t\treturn %zu;\n\t}\n\n", st);
+
+		if (dfa->offs[st] == dfa->offs[st+1]) {
+			fprintf(f, "\treturn JVST_VM_DFA_NOMATCH;\n\n");
+			continue;
+		}
+
+		fprintf(f, "\tswitch (*p++) {\n");
+		for (e=dfa->offs[st]; e < dfa->offs[st+1]; e++) {
+			fprintf(f, "\tcase %d: goto S%d;\n",
+				dfa->transitions[2*e], dfa->transitions[2*e+1]);
+		}
+		fprintf(f, "\tdefault: return JVST_VM_DFA_NOMATCH;\n\t}\n\n");
+	}
+
+	fprintf(f, "}\n\n");
+}
+
+static void
+gen_dfas(FILE *f, const struct jvst_vm_program *prog)
+{
+	size_t i, j, nelts;
+
+	for (i=0; i < prog->ndfa; i++) {
+		const struct jvst_vm_dfa *dfa = &prog->dfas[i];
+		const struct jvst_vm_strtab *tab = dfa->strtab;
+
+		// the tables are still used to look up end states
+		nelts = (dfa->nstates+1) + 2*dfa->nedges + 2*dfa->nends;
+		fprintf(f, "static int dfa%zu_tab[] = {", i);
+		for (j=0; j < nelts; j++) {
+			fprintf(f, "%s%d,", (j%16 == 0) ? "\n\t" : " ", dfa->offs[j]);
+		}
+		fprintf(f, "\n};\n\n");
+
+		if (dfa->lit_kind != JVST_VM_DFA_LIT_NONE) {
+			fprintf(f, "static char dfa%zu_lit[] = ", i);
+			gen_string(f, dfa->lit, dfa->nlit);
+			fprintf(f, ";\n\n");
+		}
+
+		if (tab != NULL) {
+			fprintf(f, "static uint32_t dfa%zu_disp[] = {", i);
+			for (j=0; j < tab->nbuckets; j++) {
+				fprintf(f, "%s%" PRIu32 ",", (j%16 == 0) ? "\n\t" : " ", tab->disp[j]);
+			}
+			fprintf(f, "\n};\n\n");
+
+			fprintf(f, "static struct jvst_vm_strtab_slot dfa%zu_slots[] = {\n", i);
+			for (j=0; j < tab->nslots; j++) {
+				fprintf(f, "\t{ %" PRIu32 ", %" PRIu32 ", %d },\n",
+					tab->slots[j].off, tab->slots[j].len, tab->slots[j].which);
+			}
+			fprintf(f, "};\n\n");
+
+			fprintf(f, "static char dfa%zu_keys[] = ", i);
+			gen_string(f, tab->keys, tab->keylen);
+			fprintf(f, ";\n\n");
+
+			fprintf(f, "static struct jvst_vm_strtab dfa%zu_strtab = {\n", i);
+			fprintf(f, "\t.nkeys = %zu,\n", tab->nkeys);
+			fprintf(f, "\t.nbuckets = %" PRIu32 ",\n", tab->nbuckets);
+			fprintf(f, "\t.nslots = %" PRIu32 ",\n", tab->nslots);
+			fprintf(f, "\t.disp = dfa%zu_disp,\n", i);
+			fprintf(f, "\t.slots = dfa%zu_slots,\n", i);
+			fprintf(f, "\t.keys = dfa%zu_keys,\n", i);
+			fprintf(f, "\t.keylen = %zu,\n", tab->keylen);
+			fprintf(f, "};\n\n");
+		}
+
+		gen_dfa_run(f, i, dfa);
+	}
+
+	if (prog->ndfa == 0) {
+		return;
+	}
+
+	fprintf(f, "static struct jvst_vm_dfa dfas[] = {\n");
+	for (i=0; i < prog->ndfa; i++) {
+		const struct jvst_vm_dfa *dfa = &prog->dfas[i];
+
+		fprintf(f, "\t{\n");
+		fprintf(f, "\t\t.nstates = %zu,\n", dfa->nstates);
+		fprintf(f, "\t\t.nedges = %zu,\n", dfa->nedges);
+		fprintf(f, "\t\t.nends = %zu,\n", dfa->nends);
+		fprintf(f, "\t\t.offs = &dfa%zu_tab[0],\n", i);
+		fprintf(f, "\t\t.transitions = &dfa%zu_tab[%zu],\n", i, dfa->nstates+1);
+		fprintf(f, "\t\t.endstates = &dfa%zu_tab[%zu],\n", i, dfa->nstates+1 + 2*dfa->nedges);
+		fprintf(f, "\t\t.lit_kind = %d,\n", (int)dfa->lit_kind);
+		fprintf(f, "\t\t.lit_result = %d,\n", dfa->lit_result);
+		if (dfa->lit_kind != JVST_VM_DFA_LIT_NONE) {
+			fprintf(f, "\t\t.nlit = %zu,\n", dfa->nlit);
+			fprintf(f, "\t\t.lit = dfa%zu_lit,\n", i);
+		}
+		if (dfa->strtab != NULL) {
+			fprintf(f, "\t\t.strtab = &dfa%zu_strtab,\n", i);
+		}
+		fprintf(f, "\t\t.run = dfa%zu_run,\n", i);
+		fprintf(f, "\t},\n");
+	}
+	fprintf(f, "};\n\n");
+}
+
+// Finds the instructions that need a label or a resume case
+static unsigned char *
+mark_targets(const struct jvst_vm_program *prog)
+{
+	unsigned char *marks;
+	size_t pc, i;
+
+	marks = xcalloc(prog->ncode + 1, sizeof marks[0]);
+	marks[0] = GEN_TARGET | GEN_RESUME;
+
+	// split VMs start with the first instruction of their proc
+	if (prog->nsplit > 0) {
+		size_t off = prog->nsplit + 1;
+		for (i=0; i < prog->sdata[prog->nsplit]; i++) {
+			marks[prog->sdata[off+i]] |= GEN_TARGET | GEN_RESUME;
+		}
+	}
+
+	for (pc=0; pc < prog->ncode; pc++) {
+		uint32_t opcode = prog->code[pc];
+
+		switch (jvst_vm_decode_op(opcode)) {
+		case JVST_OP_JMP:
+			marks[pc + jvst_vm_tobarg(jvst_vm_decode_barg(opcode))] |= GEN_TARGET;
+			break;
+
+		case JVST_OP_CALL:
+			marks[pc + jvst_vm_tobarg(jvst_vm_decode_barg(opcode))] |= GEN_TARGET;
+
+			// RETURN continues after the CALL
+			marks[pc+1] |= GEN_TARGET | GEN_RESUME;
+			break;
+
+		case JVST_OP_TOKEN:
+		case JVST_OP_CONSUME:
+		case JVST_OP_RETURN:
+		case JVST_OP_MATCH:
+		case JVST_OP_SPLIT:
+		case JVST_OP_SPLITV:
+		case JVST_OP_UNIQUE:
+			marks[pc] |= GEN_TARGET | GEN_RESUME;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return marks;
+}
+
+// condition of a conditional branch on the flag
+static void
+gen_cond(FILE *f, enum jvst_vm_br_cond brc)
+{
+	const char *sep = "";
+
+	if (brc & JVST_VM_BR_LT) {
+		fprintf(f, "%sflag < 0", sep);
+		sep = " || ";
+	}
+
+	if (brc & JVST_VM_BR_GT) {
+		fprintf(f, "%sflag > 0", sep);
+		sep = " || ";
+	}
+
+	if (brc & JVST_VM_BR_EQ) {
+		fprintf(f, "%sflag == 0", sep);
+	}
+}
+
+// stores the pc and flag before an instruction that can stop the VM
+static void
+gen_save(FILE *f, size_t pc)
+{
+	fprintf(f, "\tvm->r_pc = %zu;\n", pc);
+	fprintf(f, "\tvm->r_flag = flag;\n");
+}
+
+static void
+gen_op(FILE *f, const struct jvst_vm_program *prog, size_t pc)
+{
+	uint32_t opcode, a0, a1;
+	enum jvst_vm_op op;
+	long br;
+
+	opcode = prog->code[pc];
+	op = jvst_vm_decode_op(opcode);
+	a0 = jvst_vm_decode_arg0(opcode);
+	a1 = jvst_vm_decode_arg1(opcode);
+
+	switch (op) {
+	case JVST_OP_NOP:
+		return;
+
+	case JVST_OP_PROC:
+		assert(jvst_vm_arg_islit(a0));
+		assert(jvst_vm_arg_islit(a1));
+		fprintf(f, "\tif ((ret = jvst_vm_native_proc(vm, %d, 0x%x)) != JVST_VALID) {\n\t\treturn ret;\n\t}\n",
+			jvst_vm_arg_tolit(a0), (unsigned)jvst_vm_arg_tolit(a1));
+		fprintf(f, "\tsl = &vm->stack[vm->r_fp];\n");
+		return;
+
+	case JVST_OP_ICMP:
+		fprintf(f, "\t{\n\t\tint64_t a = ");
+		gen_ival(f, a0);
+		fprintf(f, ", b = ");
+		gen_ival(f, a1);
+		fprintf(f, ";\n\t\tflag = (a > b) - (a < b);\n\t}\n");
+		return;
+
+	case JVST_OP_FCMP:
+		assert(jvst_vm_arg_isslot(a0) && jvst_vm_arg_isslot(a1));
+		if (is_tnum(a0) || is_tnum(a1)) {
+			fprintf(f, "\tflag = jvst_vm_native_fcmp(vm, 0x%08" PRIx32 ");\n", opcode);
+			return;
+		}
+
+		fprintf(f, "\t{\n\t\tdouble a = sl[%d].f, b = sl[%d].f;\n",
+			jvst_vm_arg_toslot(a0), jvst_vm_arg_toslot(a1));
+		fprintf(f, "\t\tflag = (a > b) - (a < b);\n\t}\n");
+		return;
+
+	case JVST_OP_FINT:
+		assert(jvst_vm_arg_isslot(a0));
+		if (is_tnum(a0)) {
+			fprintf(f, "\tflag = jvst_vm_native_fint(vm, 0x%08" PRIx32 ");\n", opcode);
+			return;
+		}
+
+		fprintf(f, "\t{\n\t\tdouble v = sl[%d].f;\n", jvst_vm_arg_toslot(a0));
+		if (a1 != 0 && jvst_vm_arg_isslot(a1)) {
+			fprintf(f, "\t\tv /= sl[%d].f;\n", jvst_vm_arg_toslot(a1));
+		} else if (a1 != 0) {
+			fprintf(f, "\t\tv /= %d;\n", jvst_vm_arg_tolit(a1));
+		}
+		fprintf(f, "\t\tflag = isfinite(v) && (v == ceil(v));\n\t}\n");
+		return;
+
+	case JVST_OP_JMP:
+		br = jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+		switch (jvst_vm_decode_bcond(opcode)) {
+		case JVST_VM_BR_NEVER:
+			return;
+
+		case JVST_VM_BR_ALWAYS:
+			fprintf(f, "\tgoto L%ld;\n", (long)pc + br);
+			return;
+
+		default:
+			fprintf(f, "\tif (");
+			gen_cond(f, jvst_vm_decode_bcond(opcode));
+			fprintf(f, ") {\n\t\tgoto L%ld;\n\t}\n", (long)pc + br);
+			return;
+		}
+
+	case JVST_OP_TOKEN:
+		if (jvst_vm_arg_tolit(a1) == -1) {
+			fprintf(f, "\tjvst_vm_native_unget(vm);\n");
+			return;
+		}
+
+		gen_save(f, pc);
+		fprintf(f, "\tif (jvst_vm_native_token(vm)) {\n\t\treturn JVST_NEXT;\n\t}\n");
+		return;
+
+	case JVST_OP_CONSUME:
+		gen_save(f, pc);
+		fprintf(f, "\tif ((ret = jvst_vm_native_consume(vm)) != JVST_VALID) {\n\t\treturn ret;\n\t}\n");
+		return;
+
+	case JVST_OP_RETURN:
+		assert(jvst_vm_arg_islit(a0));
+		gen_save(f, pc);
+		if (a0 != 0) {
+			fprintf(f, "\tvm->error = %d;\n", jvst_vm_arg_tolit(a0));
+			fprintf(f, "\treturn JVST_INVALID;\n");
+			return;
+		}
+
+		fprintf(f, "\tif ((ret = jvst_vm_native_return(vm, &pc)) != JVST_INDETERMINATE) {\n"
+			"\t\treturn ret;\n\t}\n");
+		fprintf(f, "\tgoto resume;\n");
+		return;
+
+	case JVST_OP_MOVE:
+		assert(jvst_vm_arg_isslot(a0));
+		if (jvst_vm_arg_islit(a1)) {
+			fprintf(f, "\tsl[%d].i = %d;\n", jvst_vm_arg_toslot(a0), jvst_vm_arg_tolit(a1));
+		} else {
+			fprintf(f, "\tsl[%d] = sl[%d];\n", jvst_vm_arg_toslot(a0), jvst_vm_arg_toslot(a1));
+		}
+		return;
+
+	case JVST_OP_FLOAD:
+		assert(jvst_vm_arg_isslot(a0) && jvst_vm_arg_islit(a1));
+		assert((size_t)jvst_vm_arg_tolit(a1) < prog->nfloat);
+		fprintf(f, "\tsl[%d].f = ", jvst_vm_arg_toslot(a0));
+		gen_double(f, prog->fdata[jvst_vm_arg_tolit(a1)]);
+		fprintf(f, ";\n");
+		return;
+
+	case JVST_OP_ILOAD:
+		assert(jvst_vm_arg_isslot(a0) && jvst_vm_arg_islit(a1));
+		assert((size_t)jvst_vm_arg_tolit(a1) < prog->nconst);
+		fprintf(f, "\tsl[%d].i = ", jvst_vm_arg_toslot(a0));
+		gen_int64(f, prog->cdata[jvst_vm_arg_tolit(a1)]);
+		fprintf(f, ";\n");
+		return;
+
+	case JVST_OP_INCR:
+		assert(jvst_vm_arg_isslot(a0));
+		fprintf(f, "\tsl[%d].i += ", jvst_vm_arg_toslot(a0));
+		gen_ival(f, a1);
+		fprintf(f, ";\n");
+		return;
+
+	case JVST_OP_MATCH:
+		gen_save(f, pc);
+		fprintf(f, "\tif ((ret = jvst_vm_native_match(vm, ");
+		gen_ival(f, a0);
+		fprintf(f, ")) != JVST_VALID) {\n\t\treturn ret;\n\t}\n");
+		return;
+
+	case JVST_OP_CALL:
+		br = jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+		assert(jvst_vm_decode_op(prog->code[pc+br]) == JVST_OP_PROC);
+		fprintf(f, "\tif ((ret = jvst_vm_native_call(vm, %zu)) != JVST_VALID) {\n\t\treturn ret;\n\t}\n", pc);
+		fprintf(f, "\tgoto L%ld;\n", (long)pc + br);
+		return;
+
+	case JVST_OP_BSET:
+		assert(jvst_vm_arg_isslot(a0));
+		if (jvst_vm_arg_islit(a1)) {
+			int bit = jvst_vm_arg_tolit(a1);
+			assert(bit >= 0);
+			fprintf(f, "\tsl[%d].u |= UINT64_C(0x%" PRIx64 ");\n",
+				jvst_vm_arg_toslot(a0) + bit/64, (uint64_t)1 << (bit%64));
+		} else {
+			fprintf(f, "\t{\n\t\tint64_t bit = sl[%d].i;\n", jvst_vm_arg_toslot(a1));
+			fprintf(f, "\t\tsl[%d + bit/64].u |= (uint64_t)1 << (bit%%64);\n\t}\n",
+				jvst_vm_arg_toslot(a0));
+		}
+		return;
+
+	case JVST_OP_BAND:
+		assert(jvst_vm_arg_isslot(a0));
+		fprintf(f, "\tsl[%d].u &= ", jvst_vm_arg_toslot(a0));
+		if (jvst_vm_arg_islit(a1)) {
+			fprintf(f, "(uint64_t)%d;\n", jvst_vm_arg_tolit(a1));
+		} else {
+			fprintf(f, "sl[%d].u;\n", jvst_vm_arg_toslot(a1));
+		}
+		return;
+
+	case JVST_OP_BCOUNT:
+		assert(jvst_vm_arg_isslot(a0) && jvst_vm_arg_isslot(a1));
+		fprintf(f, "\tsl[%d].u = jvst_vm_native_bcount(vm, &sl[%d], sl[%d].u);\n",
+			jvst_vm_arg_toslot(a0), jvst_vm_arg_toslot(a1), jvst_vm_arg_toslot(a0));
+		return;
+
+	case JVST_OP_SPLIT:
+	case JVST_OP_SPLITV:
+		assert(jvst_vm_arg_isslot(a1));
+		gen_save(f, pc);
+		fprintf(f, "\tif ((ret = jvst_vm_native_split(vm, ");
+		gen_ival(f, a0);
+		fprintf(f, ", %d, %d)) != JVST_VALID) {\n\t\treturn ret;\n\t}\n",
+			jvst_vm_arg_toslot(a1), op == JVST_OP_SPLITV);
+		return;
+
+	case JVST_OP_UNIQUE:
+		gen_save(f, pc);
+		fprintf(f, "\tif ((ret = jvst_vm_native_unique(vm, %d)) != JVST_INDETERMINATE) {\n"
+			"\t\treturn ret;\n\t}\n", jvst_vm_arg_tolit(a0));
+		return;
+
+	default:
+		gen_save(f, pc);
+		fprintf(f, "\tvm->error = JVST_INVALID_VM_INVALID_OP;\n");
+		fprintf(f, "\treturn JVST_INVALID;\n");
+		return;
+	}
+}
+
+static void
+gen_code(FILE *f, const struct jvst_vm_program *prog)
+{
+	unsigned char *marks;
+	size_t pc;
+
+	marks = mark_targets(prog);
+
+	fprintf(f, "static enum jvst_result\nrun(struct jvst_vm *vm)\n{\n");
+	fprintf(f, "\tunion jvst_vm_stackval *sl;\n");
+	fprintf(f, "\tenum jvst_result ret;\n");
+	fprintf(f, "\tint64_t flag;\n");
+	fprintf(f, "\tuint32_t pc;\n\n");
+	fprintf(f, "\tflag = vm->r_flag;\n");
+	fprintf(f, "\tpc = vm->r_pc;\n\n");
+
+	fprintf(f, "resume:\n");
+	fprintf(f, "\tsl = &vm->stack[vm->r_fp];\n");
+	fprintf(f, "\tswitch (pc) {\n");
+	for (pc=0; pc <= prog->ncode; pc++) {
+		if (marks[pc] & GEN_RESUME) {
+			fprintf(f, "\tcase %zu: goto L%zu;\n", pc, pc);
+		}
+	}
+	fprintf(f, "\tdefault:\n\t\tvm->error = JVST_INVALID_VM_BAD_PC;\n\t\treturn JVST_INVALID;\n\t}\n\n");
+
+	for (pc=0; pc < prog->ncode; pc++) {
+		if (marks[pc] & GEN_TARGET) {
+			fprintf(f, "L%zu:\n", pc);
+		}
+
+		fprintf(f, "\t// %s\n", jvst_op_name(jvst_vm_decode_op(prog->code[pc])));
+		gen_op(f, prog, pc);
+	}
+
+	// as in the interpreter, running off the end of the code is an error
+	if (marks[prog->ncode] & GEN_TARGET) {
+		fprintf(f, "L%zu:\n", prog->ncode);
+	}
+	gen_save(f, prog->ncode);
+	fprintf(f, "\tvm->error = JVST_INVALID_VM_BAD_PC;\n");
+	fprintf(f, "\treturn JVST_INVALID;\n");
+	fprintf(f, "}\n\n");
+
+	free(marks);
+}
+
+static const char gen_main[] =
+	"#ifdef JVST_GEN_MAIN\n"
+	"// debug flags of the runtime, see debug.h\n"
+	"unsigned debug;\n"
+	"\n"
+	"// validates stdin, exits with 0 if it is valid\n"
+	"int\n"
+	"main(void)\n"
+	"{\n"
+	"\tstatic char buf[65536];\n"
+	"\tstruct jvst_vm vm;\n"
+	"\tenum jvst_result ret;\n"
+	"\tsize_t n;\n"
+	"\n"
+	"\tjvst_vm_init_defaults(&vm, jvst_validator());\n"
+	"\n"
+	"\tret = JVST_VALID;\n"
+	"\twhile (!JVST_IS_INVALID(ret) && (n = fread(buf, 1, sizeof buf, stdin)) > 0) {\n"
+	"\t\tret = jvst_vm_more(&vm, buf, n);\n"
+	"\t}\n"
+	"\n"
+	"\tif (!JVST_IS_INVALID(ret)) {\n"
+	"\t\tret = jvst_vm_close(&vm);\n"
+	"\t}\n"
+	"\n"
+	"\tjvst_vm_finalize(&vm);\n"
+	"\n"
+	"\treturn (ret == JVST_VALID) ? 0 : 1;\n"
+	"}\n"
+	"#endif /* JVST_GEN_MAIN */\n";
+
+int
+jvst_vm_program_genc(FILE *f, const struct jvst_vm_program *prog)
+{
+	fprintf(f, "/* Generated by jvst -l c */\n\n");
+	fprintf(f, "#include <math.h>\n");
+	fprintf(f, "#include <stddef.h>\n");
+	fprintf(f, "#include <stdint.h>\n");
+	fprintf(f, "#include <stdio.h>\n\n");
+	fprintf(f, "#include \"validate_native.h\"\n\n");
+
+	gen_data(f, prog);
+	gen_dfas(f, prog);
+	gen_code(f, prog);
+
+	fprintf(f, "static struct jvst_vm_program program = {\n");
+	fprintf(f, "\t.ncode = %zu,\n", prog->ncode);
+	fprintf(f, "\t.nfloat = %zu,\n", prog->nfloat);
+	fprintf(f, "\t.nconst = %zu,\n", prog->nconst);
+	fprintf(f, "\t.nsplit = %zu,\n", prog->nsplit);
+	fprintf(f, "\t.ndfa = %zu,\n", prog->ndfa);
+	fprintf(f, "\t.fdata = %s,\n", (prog->nfloat > 0) ? "fdata" : "NULL");
+	fprintf(f, "\t.cdata = %s,\n", (prog->nconst > 0) ? "cdata" : "NULL");
+	fprintf(f, "\t.sdata = %s,\n", (prog->nsplit > 0) ? "sdata" : "NULL");
+	fprintf(f, "\t.dfas = %s,\n", (prog->ndfa > 0) ? "dfas" : "NULL");
+	fprintf(f, "\t.code = code,\n");
+	fprintf(f, "\t.nschema = %zu,\n", prog->nschema);
+	fprintf(f, "\t.maxstack = %zu,\n", prog->maxstack);
+	fprintf(f, "\t.native = run,\n");
+	fprintf(f, "};\n\n");
+
+	fprintf(f, "// The program is static and must not be passed to\n");
+	fprintf(f, "// jvst_vm_program_free()\n");
+	fprintf(f, "struct jvst_vm_program *\njvst_validator(void)\n{\n\treturn &program;\n}\n\n");
+
+	fprintf(f, "%s", gen_main);
+
+	return ferror(f) ? -1 : 0;
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
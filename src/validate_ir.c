@@ -121,6 +121,21 @@ jvst_invalid_msg(enum jvst_invalid_code code)
 	case JVST_INVALID_VM_INVALID_OP:
 		return "VM invalid op";
 
+	case JVST_INVALID_VM_INSTR_LIMIT:
+		return "VM instruction limit exceeded";
+
+	case JVST_INVALID_VM_DEPTH_LIMIT:
+		return "document nesting limit exceeded";
+
+	case JVST_INVALID_VM_SPLIT_LIMIT:
+		return "VM split limit exceeded";
+
+	case JVST_INVALID_VM_UNIQUE_LIMIT:
+		return "uniqueItems memory limit exceeded";
+
+	case JVST_INVALID_VM_MEMORY_LIMIT:
+		return "VM memory limit exceeded";
+
 	case JVST_INVALID_LENGTH_TOO_SHORT:
 		return "length is too short";
 
@@ -224,6 +239,39 @@ ir_stmt_invalid(enum jvst_invalid_code code)
 	return stmt;
 }
 
+// INVALID for a failed keyword
+static struct jvst_ir_stmt *
+ir_stmt_invalid_kw(enum jvst_invalid_code code, const struct jvst_cnode_kw *kw)
+{
+	struct jvst_ir_stmt *stmt;
+
+	stmt = ir_stmt_invalid(code);
+	stmt->u.invalid.loc = kw->loc;
+	stmt->u.invalid.kw = kw->name;
+
+	return stmt;
+}
+
+static int
+ir_loc_equal(struct json_string a, struct json_string b)
+{
+	return a.len == b.len && (a.len == 0 || memcmp(a.s, b.s, a.len) == 0);
+}
+
+static int
+ir_kw_equal(const struct jvst_cnode_kw *a, const struct jvst_cnode_kw *b)
+{
+	if ((a->name == NULL) != (b->name == NULL)) {
+		return 0;
+	}
+
+	if (a->name != NULL && strcmp(a->name, b->name) != 0) {
+		return 0;
+	}
+
+	return ir_loc_equal(a->loc, b->loc);
+}
+
 static inline struct jvst_ir_stmt *
 ir_stmt_valid(void)
 {
@@ -1751,6 +1799,121 @@ ir_translate_number_expr(struct jvst_cnode *top)
 	}
 }
 
+// Returns the keyword of all the checks of a number constraint, or NULL
+// if they come from different keywords
+static const struct jvst_cnode_kw *
+ir_number_kw(const struct jvst_cnode *n)
+{
+	const struct jvst_cnode_kw *kw, *ckw;
+	const struct jvst_cnode *c;
+
+	switch (n->type) {
+	case JVST_CNODE_AND:
+		kw = NULL;
+		for (c = n->u.ctrl; c != NULL; c = c->next) {
+			ckw = ir_number_kw(c);
+			if (ckw == NULL || (kw != NULL && !ir_kw_equal(kw, ckw))) {
+				return NULL;
+			}
+			kw = ckw;
+		}
+		return (kw != NULL) ? kw : &n->kw;
+
+	case JVST_CNODE_NUM_RANGE:
+		if ((n->u.num_range.flags & (JVST_CNODE_RANGE_MAX|JVST_CNODE_RANGE_EXCL_MAX)) == 0) {
+			return &n->kw;
+		}
+
+		if ((n->u.num_range.flags & (JVST_CNODE_RANGE_MIN|JVST_CNODE_RANGE_EXCL_MIN)) == 0) {
+			return &n->u.num_range.kw_max;
+		}
+
+		return ir_kw_equal(&n->kw, &n->u.num_range.kw_max) ? &n->kw : NULL;
+
+	default:
+		return &n->kw;
+	}
+}
+
+static struct jvst_ir_stmt *
+ir_translate_number_check(struct jvst_cnode *n, struct jvst_ir_stmt *br_valid);
+
+// Checks each constraint in the list, in order
+static struct jvst_ir_stmt *
+ir_translate_number_checks(struct jvst_cnode *n, struct jvst_ir_stmt *br_valid)
+{
+	if (n == NULL) {
+		return br_valid;
+	}
+
+	return ir_translate_number_check(n, ir_translate_number_checks(n->next, br_valid));
+}
+
+// Checks that the number satisfies the constraint n, and continues with
+// br_valid if it does.  Checks from different keywords, like the
+// checks of an AND or the bounds of a range, fail separately so the
+// INVALID says which keyword failed.
+static struct jvst_ir_stmt *
+ir_translate_number_check(struct jvst_cnode *n, struct jvst_ir_stmt *br_valid)
+{
+	const struct jvst_cnode_kw *kw;
+	enum jvst_invalid_code ecode;
+	struct jvst_cnode bound;
+
+	kw = ir_number_kw(n);
+	if (kw != NULL) {
+		goto single;
+	}
+
+	switch (n->type) {
+	case JVST_CNODE_AND:
+		return ir_translate_number_checks(n->u.ctrl, br_valid);
+
+	case JVST_CNODE_NUM_RANGE:
+		{
+			enum jvst_cnode_rangeflags lo, hi;
+
+			lo = n->u.num_range.flags & (JVST_CNODE_RANGE_MIN|JVST_CNODE_RANGE_EXCL_MIN);
+			hi = n->u.num_range.flags & (JVST_CNODE_RANGE_MAX|JVST_CNODE_RANGE_EXCL_MAX);
+
+			// equality is one check
+			if (n->u.num_range.min == n->u.num_range.max &&
+					n->u.num_range.flags == (JVST_CNODE_RANGE_MIN|JVST_CNODE_RANGE_MAX)) {
+				kw = &n->kw;
+				goto single;
+			}
+
+			// check the upper bound in its own range
+			bound = *n;
+			bound.next = NULL;
+			bound.u.num_range.flags = hi;
+			bound.kw = n->u.num_range.kw_max;
+			br_valid = ir_translate_number_check(&bound, br_valid);
+
+			bound.u.num_range.flags = lo;
+			bound.kw = n->kw;
+			return ir_translate_number_check(&bound, br_valid);
+		}
+
+	default:
+		kw = &n->kw;
+		break;
+	}
+
+single:
+	if (n->type == JVST_CNODE_NUM_INTEGER) {
+		ecode = JVST_INVALID_NOT_INTEGER;
+	} else if (n->type == JVST_CNODE_NUM_MULTIPLE_OF) {
+		ecode = JVST_INVALID_NOT_MULTIPLE;
+	} else {
+		ecode = JVST_INVALID_NUMBER;
+	}
+
+	return ir_stmt_if(ir_translate_number_expr(n),
+		br_valid,
+		ir_stmt_invalid_kw(ecode, kw));
+}
+
 static struct jvst_ir_stmt *
 ir_translate_number(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 {
@@ -1767,7 +1930,7 @@ ir_translate_number(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 		break;
 
 	case JVST_CNODE_INVALID:
-		*spp = ir_stmt_invalid(JVST_INVALID_UNEXPECTED_TOKEN);
+		*spp = ir_stmt_invalid_kw(JVST_INVALID_UNEXPECTED_TOKEN, &top->kw);
 		break;
 
 	case JVST_CNODE_NOT:
@@ -1784,7 +1947,7 @@ ir_translate_number(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 
 			br = ir_stmt_if(cond,
 				// ir_stmt_valid(),
-				ir_stmt_invalid(ecode),
+				ir_stmt_invalid_kw(ecode, &top->kw),
 				ir_consume_and_valid());
 			*spp = br;
 		}
@@ -1795,26 +1958,7 @@ ir_translate_number(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 	case JVST_CNODE_NUM_INTEGER:
 	case JVST_CNODE_NUM_MULTIPLE_OF:
 	case JVST_CNODE_NUM_RANGE:
-		{
-			struct jvst_ir_stmt *br;
-			struct jvst_ir_expr *cond;
-			enum jvst_invalid_code ecode;
-
-			cond = ir_translate_number_expr(top);
-			if (top->type == JVST_CNODE_NUM_INTEGER) {
-				ecode = JVST_INVALID_NOT_INTEGER;
-			} else if (top->type == JVST_CNODE_NUM_MULTIPLE_OF) {
-				ecode = JVST_INVALID_NOT_MULTIPLE;
-			} else {
-				ecode = JVST_INVALID_NUMBER;
-			}
-
-			br = ir_stmt_if(cond,
-				// ir_stmt_valid(),
-				ir_consume_and_valid(),
-				ir_stmt_invalid(ecode));
-			*spp = br;
-		}
+		*spp = ir_translate_number_check(top, ir_consume_and_valid());
 		break;
 
 	case JVST_CNODE_XOR:
@@ -1850,7 +1994,7 @@ ir_translate_number(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 
 				br = ir_stmt_if(cond,
 					ir_stmt_valid(),
-					ir_stmt_invalid(JVST_INVALID_NUMBER));
+					ir_stmt_invalid_kw(JVST_INVALID_NUMBER, &top->kw));
 				*spp = br;
 			}
 
@@ -1974,7 +2118,7 @@ obj_mcase_translate_inner(struct jvst_cnode *ctree, struct ir_object_builder *bu
 	case JVST_CNODE_INVALID:
 		// XXX - better error message!
 		builder->consumed = true;
-		return ir_stmt_invalid(JVST_INVALID_BAD_PROPERTY_NAME);
+		return ir_stmt_invalid_kw(JVST_INVALID_BAD_PROPERTY_NAME, &ctree->kw);
 
 	default:
 		builder->consumed = true; // XXX - is this correct?
@@ -2262,7 +2406,7 @@ ir_translate_obj_inner(struct jvst_cnode *top, struct ir_object_builder *builder
 						ir_expr_count(counter),
 						ir_expr_size(top->u.counts.min)),
 					NULL,
-					ir_stmt_invalid(JVST_INVALID_TOO_FEW_PROPS));
+					ir_stmt_invalid_kw(JVST_INVALID_TOO_FEW_PROPS, &top->kw));
 				checkpp = &(*checkpp)->u.if_.br_true;
 			}
 
@@ -2272,7 +2416,7 @@ ir_translate_obj_inner(struct jvst_cnode *top, struct ir_object_builder *builder
 						ir_expr_count(counter),
 						ir_expr_size(top->u.counts.max)),
 					NULL,
-					ir_stmt_invalid(JVST_INVALID_TOO_MANY_PROPS));
+					ir_stmt_invalid_kw(JVST_INVALID_TOO_MANY_PROPS, &top->u.counts.kw_max));
 				checkpp = &(*checkpp)->u.if_.br_true;
 			}
 
@@ -2305,7 +2449,7 @@ ir_translate_obj_inner(struct jvst_cnode *top, struct ir_object_builder *builder
 			checkpp = builder->post_loop;
 			*checkpp = ir_stmt_if(allbits,
 					NULL,
-					ir_stmt_invalid(JVST_INVALID_MISSING_REQUIRED_PROPERTIES));
+					ir_stmt_invalid_kw(JVST_INVALID_MISSING_REQUIRED_PROPERTIES, &top->kw));
 			checkpp = &(*checkpp)->u.if_.br_true;
 
 			builder->post_loop = checkpp;
@@ -2727,8 +2871,6 @@ split_gather_and_or(struct jvst_cnode *top, struct split_gather_data *data,
 	expr = NULL;
 	epp = &expr;
 
-	top->u.ctrl = other;
-
 	// 2. Create a single frame for all non-control nodes.
 	//    - Create a temporary AND junction for the IR frame
 	//    - Create the IR frame
@@ -2759,8 +2901,11 @@ split_gather_and_or(struct jvst_cnode *top, struct split_gather_data *data,
 		}
 	}
 
-	// don't lose children of AND node
+	// don't lose children of AND node.  If all of them are control
+	// nodes, opp points to other.  The tree can be translated again
+	// (see ir_translate_split), so it must keep all of them.
 	*opp = ctrl;
+	top->u.ctrl = other;
 
 	// 3. Create separate frames for all control nodes.
 	epp = split_gather_control_children(ctrl, data, jxntype, epp, xlatefunc);
@@ -2854,6 +2999,7 @@ split_gather_xor(struct jvst_cnode *top, struct split_gather_data *data,
 		struct jvst_ir_stmt *fr;
 
 		data->boff++;
+		data->nframe++;
 
 		fr = ir_stmt_frame();
 		fr->u.frame.stmts = xlatefunc(node, fr);
@@ -2994,139 +3140,971 @@ ir_translate_split(struct jvst_cnode *top, struct jvst_ir_stmt *frame,
 			cmp = ir_expr_op(JVST_IR_EXPR_EQ, split, ir_expr_size(0));
 			break;
 
-		case JVST_CNODE_XOR:
-			cmp = ir_expr_op(JVST_IR_EXPR_EQ, split, ir_expr_size(1));
-			break;
+		case JVST_CNODE_XOR:
+			cmp = ir_expr_op(JVST_IR_EXPR_EQ, split, ir_expr_size(1));
+			break;
+
+		default:
+			fprintf(stderr, "%s:%d invalid cnode type for %s: %s\n",
+					__FILE__, __LINE__, __func__, jvst_cnode_type_name(top->type));
+			abort();
+		}
+
+		cond = ir_stmt_if(cmp,
+			ir_stmt_valid(),
+			ir_stmt_invalid_kw(JVST_INVALID_SPLIT_CONDITION, &top->kw));  // XXX - improve error message!
+
+		return cond;
+	}
+
+	// needs full bitvec logic
+	cond = ir_stmt_new(JVST_IR_STMT_SEQ);
+	spp = &cond->u.stmt_list;
+
+	gather.bvec->u.bitvec.nbits = gather.nframe;
+	assert(gather.boff == gather.nframe);
+
+	*spp = ir_stmt_new(JVST_IR_STMT_SPLITVEC);
+	(*spp)->u.splitvec.split_frames = frames;
+
+	(*spp)->u.splitvec.frame = frame;
+	(*spp)->u.splitvec.bitvec = gather.bvec;
+
+	spp = &(*spp)->next;
+	*spp = ir_stmt_new(JVST_IR_STMT_IF);
+	*spp = ir_stmt_if(split,
+		ir_stmt_valid(),
+		ir_stmt_invalid_kw(JVST_INVALID_SPLIT_CONDITION, &top->kw));  // XXX - improve error message!
+
+	return cond;
+}
+
+static struct jvst_ir_stmt *
+ir_translate_object_inner(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
+{
+	struct jvst_ir_stmt *stmt, *pseq, **spp, **pseqpp, **matchpp;
+	struct jvst_cnode *pmatch;
+	struct fsm_options *opts;
+	const char *loopname;
+	size_t nreqs;
+	
+	struct ir_object_builder builder = { 0 };
+
+	builder.frame = frame;
+
+	stmt = ir_stmt_new(JVST_IR_STMT_SEQ);
+	spp = &stmt->u.stmt_list;
+	builder.pre_loop = spp;
+
+	builder.oloop = ir_stmt_loop(frame,"L_OBJ");
+	*spp = builder.oloop;
+	builder.post_loop = &builder.oloop->next;
+
+	spp = &(*spp)->u.loop.stmts;
+
+	*spp = ir_stmt_new(JVST_IR_STMT_TOKEN);
+	spp = &(*spp)->next;
+
+	pseq = ir_stmt_new(JVST_IR_STMT_SEQ);
+	*spp = ir_stmt_if(
+		ir_expr_istok(SJP_OBJECT_END),
+		ir_stmt_break(builder.oloop),
+		pseq);
+
+	builder.pre_match = &pseq->u.stmt_list;
+	pseqpp = &pseq->u.stmt_list;
+
+	builder.match = ir_stmt_new(JVST_IR_STMT_MATCH);
+	builder.mcpp = &builder.match->u.match.cases;
+
+	*pseqpp = builder.match;
+	// builder.match->u.match.default_case = obj_default_case();
+	matchpp = pseqpp;
+	pseqpp = &(*pseqpp)->next;
+
+	builder.post_match = pseqpp;
+	assert(pseqpp != NULL);
+	assert(*pseqpp == NULL);
+
+	builder.matcher = NULL;
+
+	ir_translate_obj_inner(top, &builder);
+
+	if (builder.match->u.match.default_case == NULL) {
+		builder.match->u.match.default_case = obj_default_case();
+	}
+
+	// no matches... replacing matcher with a consume followed by
+	// the empty matcher's default case
+	if (builder.match->u.match.dfa == NULL) {
+		struct jvst_ir_stmt *consume, **npp;
+
+		assert(matchpp != NULL);
+		assert(*matchpp == builder.match);
+		assert(builder.match->u.match.default_case != NULL);
+
+		for (npp = &builder.match->u.match.default_case; *npp != NULL; npp = &(*npp)->next) {
+			continue;
+		}
+
+		assert(npp != &builder.match->u.match.default_case);
+		assert(*npp == NULL);
+
+		*npp = builder.match->next;
+		// ensure that we consume the property's name token
+		*matchpp = ir_stmt_new(JVST_IR_STMT_CONSUME);
+		matchpp = &(*matchpp)->next;
+		*matchpp = builder.match->u.match.default_case;
+	}
+
+	// handle post-loop constraints
+	if (*builder.post_loop == NULL) {
+		*builder.post_loop = ir_stmt_valid();
+	}
+
+	return stmt;
+}
+
+/* Objects that must match one of several object schemas, where each
+ * schema only checks the names of the properties and the values of
+ * scalar properties, and the schemas are told apart by the literal
+ * strings they accept for some property (a oneOf discriminated by a
+ * const or enum), are validated in a single pass over the object
+ * instead of a SPLIT.
+ *
+ * Each branch gets a bit in a "fail" bitvector that's set as soon as
+ * the branch is known to fail, and a range of bits in a shared
+ * reqmask for its required properties.  Values are checked inline,
+ * without calling a frame, so they must only depend on the value's
+ * first token: its type, a number check, or a set of literal strings.
+ */
+
+struct ir_union_branch {
+	struct jvst_cnode *mswitch;
+	size_t reqbase;
+	size_t nreqs;
+};
+
+struct ir_union_builder {
+	struct jvst_ir_stmt *frame;
+	struct jvst_ir_stmt *fail;
+	struct jvst_ir_stmt *reqmask;
+
+	struct ir_union_branch *br;
+	size_t nbr;
+
+	// scratch space, one entry per branch
+	struct jvst_cnode **cons;
+};
+
+static const enum SJP_EVENT union_nonstr_types[] = {
+	SJP_NULL, SJP_TRUE, SJP_FALSE, SJP_NUMBER, SJP_OBJECT_BEG, SJP_ARRAY_BEG,
+};
+
+static bool
+union_isbool(const struct jvst_cnode *n)
+{
+	return n->type == JVST_CNODE_VALID || n->type == JVST_CNODE_INVALID;
+}
+
+static bool
+union_literals_ok(const struct jvst_cnode *msw)
+{
+	const struct jvst_cnode *mc;
+
+	for (mc = msw->u.mswitch.cases; mc != NULL; mc = mc->next) {
+		const struct jvst_cnode_matchset *ms;
+
+		for (ms = mc->u.mcase.matchset; ms != NULL; ms = ms->next) {
+			if (ms->match.dialect != RE_LITERAL) {
+				return false;
+			}
+		}
+	}
+
+	return msw->u.mswitch.cases == NULL || msw->u.mswitch.dfa != NULL;
+}
+
+static bool
+union_numexpr_ok(const struct jvst_cnode *n)
+{
+	switch (n->type) {
+	case JVST_CNODE_NUM_INTEGER:
+	case JVST_CNODE_NUM_MULTIPLE_OF:
+	case JVST_CNODE_NUM_RANGE:
+		return true;
+
+	case JVST_CNODE_AND:
+	case JVST_CNODE_OR:
+		for (n = n->u.ctrl; n != NULL; n = n->next) {
+			if (!union_numexpr_ok(n)) {
+				return false;
+			}
+		}
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// a set of literal strings: a MATCH_SWITCH, or the OR of several that
+// an enum canonifies to
+static bool
+union_strset_ok(const struct jvst_cnode *n)
+{
+	const struct jvst_cnode *mc;
+
+	if (n->type == JVST_CNODE_OR) {
+		for (n = n->u.ctrl; n != NULL; n = n->next) {
+			if (n->type != JVST_CNODE_MATCH_SWITCH || !union_strset_ok(n)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	if (n->type != JVST_CNODE_MATCH_SWITCH || !union_literals_ok(n)) {
+		return false;
+	}
+
+	for (mc = n->u.mswitch.cases; mc != NULL; mc = mc->next) {
+		if (!union_isbool(mc->u.mcase.constraint)) {
+			return false;
+		}
+	}
+
+	return union_isbool(n->u.mswitch.dft_case->u.mcase.constraint);
+}
+
+// constraints on a value that depend only on its first token
+static bool
+union_value_ok(const struct jvst_cnode *n)
+{
+	size_t i;
+
+	if (union_isbool(n)) {
+		return true;
+	}
+
+	if (n->type != JVST_CNODE_SWITCH) {
+		return false;
+	}
+
+	for (i=0; i < ARRAYLEN(union_nonstr_types); i++) {
+		const struct jvst_cnode *c = n->u.sw[union_nonstr_types[i]];
+
+		if (union_isbool(c)) {
+			continue;
+		}
+
+		if (union_nonstr_types[i] != SJP_NUMBER || !union_numexpr_ok(c)) {
+			return false;
+		}
+	}
+
+	return union_isbool(n->u.sw[SJP_STRING]) || union_strset_ok(n->u.sw[SJP_STRING]);
+}
+
+// REQBITs and at most one value constraint
+static bool
+union_cons_ok(const struct jvst_cnode *n)
+{
+	const struct jvst_cnode *c;
+	int nvalue;
+
+	if (n->type == JVST_CNODE_OBJ_REQBIT) {
+		return true;
+	}
+
+	if (n->type != JVST_CNODE_AND) {
+		return union_value_ok(n);
+	}
+
+	nvalue = 0;
+	for (c = n->u.ctrl; c != NULL; c = c->next) {
+		if (c->type == JVST_CNODE_OBJ_REQBIT) {
+			continue;
+		}
+
+		if (!union_value_ok(c) || ++nvalue > 1) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// returns the MATCH_SWITCH of a branch, or NULL if the branch can't be
+// part of a union
+static struct jvst_cnode *
+union_branch_mswitch(struct jvst_cnode *n, size_t *nreqsp)
+{
+	struct jvst_cnode *msw, *c, *mc;
+
+	*nreqsp = 0;
+	msw = NULL;
+
+	if (n->type == JVST_CNODE_MATCH_SWITCH) {
+		msw = n;
+	} else if (n->type == JVST_CNODE_AND) {
+		for (c = n->u.ctrl; c != NULL; c = c->next) {
+			if (c->type == JVST_CNODE_MATCH_SWITCH && msw == NULL) {
+				msw = c;
+			} else if (c->type == JVST_CNODE_OBJ_REQMASK && *nreqsp == 0) {
+				*nreqsp = c->u.reqmask.nbits;
+			} else {
+				return NULL;
+			}
+		}
+	}
+
+	if (msw == NULL || !union_literals_ok(msw)) {
+		return NULL;
+	}
+
+	for (mc = msw->u.mswitch.cases; mc != NULL; mc = mc->next) {
+		if (!union_cons_ok(mc->u.mcase.constraint)) {
+			return NULL;
+		}
+	}
+
+	return union_cons_ok(msw->u.mswitch.dft_case->u.mcase.constraint) ? msw : NULL;
+}
+
+static bool
+union_str_eq(const struct json_string *a, const struct json_string *b)
+{
+	return a->len == b->len && memcmp(a->s, b->s, a->len) == 0;
+}
+
+// returns the constraint a MATCH_SWITCH applies to the literal string
+static struct jvst_cnode *
+union_mswitch_lookup(struct jvst_cnode *msw, const struct json_string *str)
+{
+	struct jvst_cnode *mc;
+
+	for (mc = msw->u.mswitch.cases; mc != NULL; mc = mc->next) {
+		struct jvst_cnode_matchset *ms;
+
+		for (ms = mc->u.mcase.matchset; ms != NULL; ms = ms->next) {
+			if (union_str_eq(&ms->match.str, str)) {
+				return mc->u.mcase.constraint;
+			}
+		}
+	}
+
+	return msw->u.mswitch.dft_case->u.mcase.constraint;
+}
+
+// adds the literals of a MATCH_SWITCH, or of an OR of them, to the
+// list, skipping duplicates
+static void
+union_add_literals(struct jvst_cnode *msw, struct json_string **strsp, size_t *np, size_t *capp)
+{
+	struct jvst_cnode *mc;
+
+	if (msw->type == JVST_CNODE_OR) {
+		for (mc = msw->u.ctrl; mc != NULL; mc = mc->next) {
+			union_add_literals(mc, strsp, np, capp);
+		}
+		return;
+	}
+
+	for (mc = msw->u.mswitch.cases; mc != NULL; mc = mc->next) {
+		struct jvst_cnode_matchset *ms;
+
+		for (ms = mc->u.mcase.matchset; ms != NULL; ms = ms->next) {
+			size_t i;
+
+			for (i=0; i < *np; i++) {
+				if (union_str_eq(&(*strsp)[i], &ms->match.str)) {
+					break;
+				}
+			}
+
+			if (i < *np) {
+				continue;
+			}
+
+			if (*np >= *capp) {
+				*strsp = xenlargevec(*strsp, capp, 1, sizeof **strsp);
+			}
+			(*strsp)[(*np)++] = ms->match.str;
+		}
+	}
+}
+
+// true if a set of literal strings accepts the string
+static bool
+union_strset_accepts(struct jvst_cnode *s, const struct json_string *str)
+{
+	struct jvst_cnode *n;
+
+	if (s->type == JVST_CNODE_OR) {
+		for (n = s->u.ctrl; n != NULL; n = n->next) {
+			if (union_strset_accepts(n, str)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	return union_mswitch_lookup(s, str)->type == JVST_CNODE_VALID;
+}
+
+// true if a set of literal strings rejects strings that aren't among
+// its literals
+static bool
+union_strset_closed(struct jvst_cnode *s)
+{
+	struct jvst_cnode *n;
+
+	if (s->type == JVST_CNODE_OR) {
+		for (n = s->u.ctrl; n != NULL; n = n->next) {
+			if (!union_strset_closed(n)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	return s->u.mswitch.dft_case->u.mcase.constraint->type == JVST_CNODE_INVALID;
+}
+
+static struct jvst_ir_stmt *
+union_bset(struct jvst_ir_stmt *bitvec, size_t bit)
+{
+	struct jvst_ir_stmt *setbit;
+
+	setbit = ir_stmt_new(JVST_IR_STMT_BSET);
+	setbit->u.bitop.frame = bitvec->u.bitvec.frame;
+	setbit->u.bitop.bitvec = bitvec;
+	setbit->u.bitop.bit = bit;
+
+	return setbit;
+}
+
+static struct jvst_ir_expr *
+union_btest(enum jvst_ir_expr_type type, struct jvst_ir_stmt *bitvec, size_t b0, size_t b1)
+{
+	struct jvst_ir_expr *expr;
+
+	expr = ir_expr_new(type);
+	expr->u.btest.frame = bitvec->u.bitvec.frame;
+	expr->u.btest.bitvec = bitvec;
+	expr->u.btest.b0 = b0;
+	expr->u.btest.b1 = b1;
+
+	return expr;
+}
+
+static struct jvst_ir_stmt *
+union_seq_or_nop(struct jvst_ir_stmt *stmts)
+{
+	struct jvst_ir_stmt *seq;
+
+	if (stmts == NULL) {
+		return ir_stmt_new(JVST_IR_STMT_NOP);
+	}
+
+	seq = ir_stmt_new(JVST_IR_STMT_SEQ);
+	seq->u.stmt_list = stmts;
+	return seq;
+}
+
+// the value constraint of a property constraint, or NULL if it only
+// sets required bits
+static struct jvst_cnode *
+union_cons_value(struct jvst_cnode *n)
+{
+	struct jvst_cnode *c;
+
+	switch (n->type) {
+	case JVST_CNODE_OBJ_REQBIT:
+		return NULL;
+
+	case JVST_CNODE_AND:
+		for (c = n->u.ctrl; c != NULL; c = c->next) {
+			if (c->type != JVST_CNODE_OBJ_REQBIT) {
+				return c;
+			}
+		}
+		return NULL;
+
+	default:
+		return n;
+	}
+}
+
+static struct jvst_ir_stmt **
+union_reqbits(struct jvst_cnode *n, const struct ir_union_branch *br,
+	struct jvst_ir_stmt *reqmask, struct jvst_ir_stmt **spp)
+{
+	struct jvst_cnode *c;
+
+	if (n->type == JVST_CNODE_OBJ_REQBIT) {
+		assert(n->u.reqbit.bit < br->nreqs);
+		*spp = union_bset(reqmask, br->reqbase + n->u.reqbit.bit);
+		return &(*spp)->next;
+	}
+
+	if (n->type == JVST_CNODE_AND) {
+		for (c = n->u.ctrl; c != NULL; c = c->next) {
+			spp = union_reqbits(c, br, reqmask, spp);
+		}
+	}
+
+	return spp;
+}
+
+// the constraint a value constraint places on a token of type tt
+static struct jvst_cnode *
+union_value_for(struct jvst_cnode *v, enum SJP_EVENT tt)
+{
+	if (v == NULL || union_isbool(v)) {
+		return v;
+	}
+
+	assert(v->type == JVST_CNODE_SWITCH);
+	return v->u.sw[tt];
+}
+
+// the set of literal strings a value constraint accepts, or NULL if it
+// accepts all strings or none
+static struct jvst_cnode *
+union_value_strset(struct jvst_cnode *v)
+{
+	struct jvst_cnode *s;
+
+	s = union_value_for(v, SJP_STRING);
+	return (s == NULL || union_isbool(s)) ? NULL : s;
+}
+
+// sets the fail bits of branches that reject strings not among their
+// literals
+static struct jvst_ir_stmt *
+union_strset_default(struct ir_union_builder *ub, struct jvst_cnode **vals)
+{
+	struct jvst_ir_stmt *bits, **bpp;
+	size_t i;
+
+	bits = NULL;
+	bpp = &bits;
+	for (i=0; i < ub->nbr; i++) {
+		struct jvst_cnode *s = union_value_strset(vals[i]);
+
+		if (s != NULL && union_strset_closed(s)) {
+			*bpp = union_bset(ub->fail, i);
+			bpp = &(*bpp)->next;
+		}
+	}
+
+	return bits;
+}
+
+// checks a string value against the value constraints of all branches
+static struct jvst_ir_stmt *
+union_translate_string(struct ir_union_builder *ub, struct jvst_cnode **vals)
+{
+	struct jvst_ir_stmt *stmts, **spp, *match, *matcher;
+	struct jvst_ir_mcase **mcpp;
+	struct jvst_cnode *msw, *mc;
+	struct json_string *strs;
+	size_t i, nstrs, cap, which;
+
+	stmts = NULL;
+	spp = &stmts;
+
+	strs = NULL;
+	nstrs = cap = 0;
+	for (i=0; i < ub->nbr; i++) {
+		struct jvst_cnode *s = union_value_for(vals[i], SJP_STRING);
+
+		if (s != NULL && s->type == JVST_CNODE_INVALID) {
+			*spp = union_bset(ub->fail, i);
+			spp = &(*spp)->next;
+		} else if (union_value_strset(vals[i]) != NULL) {
+			union_add_literals(s, &strs, &nstrs, &cap);
+		}
+	}
+
+	if (nstrs == 0) {
+		*spp = union_strset_default(ub, vals);
+		while (*spp != NULL) {
+			spp = &(*spp)->next;
+		}
+
+		*spp = ir_stmt_new(JVST_IR_STMT_CONSUME);
+		free(strs);
+		return stmts;
+	}
+
+	msw = jvst_cnode_literal_mswitch(strs, nstrs);
+	free(strs);
+
+	// MATCH consumes the string
+	match = ir_stmt_new(JVST_IR_STMT_MATCH);
+	mcpp = &match->u.match.cases;
+
+	which = 0;
+	for (mc = msw->u.mswitch.cases; mc != NULL; mc = mc->next) {
+		struct jvst_ir_stmt *bits, **bpp;
+		struct jvst_ir_mcase *irmc;
+
+		assert(mc->u.mcase.matchset != NULL);
+		assert(mc->u.mcase.matchset->next == NULL);
+
+		bits = NULL;
+		bpp = &bits;
+		for (i=0; i < ub->nbr; i++) {
+			struct jvst_cnode *s = union_value_strset(vals[i]);
+
+			if (s != NULL && !union_strset_accepts(s, &mc->u.mcase.matchset->match.str)) {
+				*bpp = union_bset(ub->fail, i);
+				bpp = &(*bpp)->next;
+			}
+		}
+
+		irmc = ir_mcase_new(++which, union_seq_or_nop(bits));
+		irmc->matchset = mc->u.mcase.matchset;
+		mc->u.mcase.tmp = irmc;
+
+		*mcpp = irmc;
+		mcpp = &irmc->next;
+	}
+
+	match->u.match.default_case = union_seq_or_nop(union_strset_default(ub, vals));
+
+	fsm_walk_states(msw->u.mswitch.dfa, NULL, obj_mcase_update_opaque);
+
+	matcher = ir_stmt_matcher(ub->frame, "dfa", msw->u.mswitch.dfa);
+	match->u.match.dfa = msw->u.mswitch.dfa;
+	match->u.match.name = matcher->u.matcher.name;
+	match->u.match.ind  = matcher->u.matcher.ind;
+
+	*spp = match;
+	return stmts;
+}
+
+// checks a value that isn't a string against the value constraint of
+// one branch
+static struct jvst_ir_stmt *
+union_translate_nonstring(struct ir_union_builder *ub, struct jvst_cnode *v, size_t i)
+{
+	struct jvst_ir_expr *bad;
+	struct jvst_ir_stmt *stmt;
+	struct jvst_cnode *num;
+	size_t k;
+
+	if (v->type == JVST_CNODE_INVALID) {
+		return union_bset(ub->fail, i);
+	}
+
+	assert(v->type == JVST_CNODE_SWITCH);
+
+	bad = NULL;
+	for (k=0; k < ARRAYLEN(union_nonstr_types); k++) {
+		struct jvst_ir_expr *istok;
+
+		if (v->u.sw[union_nonstr_types[k]]->type != JVST_CNODE_INVALID) {
+			continue;
+		}
+
+		istok = ir_expr_istok(union_nonstr_types[k]);
+		bad = (bad == NULL) ? istok : ir_expr_op(JVST_IR_EXPR_OR, bad, istok);
+	}
+
+	stmt = NULL;
+	if (bad != NULL) {
+		stmt = ir_stmt_if(bad, union_bset(ub->fail, i), ir_stmt_new(JVST_IR_STMT_NOP));
+	}
+
+	num = v->u.sw[SJP_NUMBER];
+	if (!union_isbool(num)) {
+		stmt = ir_stmt_if(ir_expr_istok(SJP_NUMBER),
+			ir_stmt_if(ir_translate_number_expr(num),
+				ir_stmt_new(JVST_IR_STMT_NOP),
+				union_bset(ub->fail, i)),
+			(stmt != NULL) ? stmt : ir_stmt_new(JVST_IR_STMT_NOP));
+	}
+
+	return stmt;
+}
+
+// translates the constraints of all branches on a property's value
+static struct jvst_ir_stmt *
+union_translate_value(struct ir_union_builder *ub, struct jvst_cnode **cons)
+{
+	struct jvst_ir_stmt *stmts, **spp, *strs, *others, **opp;
+	struct jvst_cnode **vals;
+	size_t i;
+	bool allvalid;
+
+	stmts = NULL;
+	spp = &stmts;
+
+	// set the required bits
+	vals = ub->cons;
+	allvalid = true;
+	for (i=0; i < ub->nbr; i++) {
+		spp = union_reqbits(cons[i], &ub->br[i], ub->reqmask, spp);
+
+		vals[i] = union_cons_value(cons[i]);
+		if (vals[i] != NULL && vals[i]->type != JVST_CNODE_VALID) {
+			allvalid = false;
+		}
+	}
+
+	if (allvalid) {
+		*spp = ir_stmt_new(JVST_IR_STMT_CONSUME);
+		return union_seq_or_nop(stmts);
+	}
+
+	*spp = ir_stmt_new(JVST_IR_STMT_TOKEN);
+	spp = &(*spp)->next;
+
+	strs = union_translate_string(ub, vals);
+
+	others = NULL;
+	opp = &others;
+	for (i=0; i < ub->nbr; i++) {
+		if (vals[i] == NULL || vals[i]->type == JVST_CNODE_VALID) {
+			continue;
+		}
+
+		*opp = union_translate_nonstring(ub, vals[i], i);
+		if (*opp != NULL) {
+			opp = &(*opp)->next;
+		}
+	}
+	*opp = ir_stmt_new(JVST_IR_STMT_CONSUME);
+
+	*spp = ir_stmt_if(ir_expr_istok(SJP_STRING),
+		union_seq_or_nop(strs),
+		union_seq_or_nop(others));
+
+	return union_seq_or_nop(stmts);
+}
+
+// the literal strings a branch accepts for a property, or NULL if it
+// accepts strings other than the literals
+static struct jvst_cnode *
+union_discriminator_set(struct jvst_cnode *msw, const struct json_string *key)
+{
+	struct jvst_cnode *s;
+
+	s = union_value_strset(union_cons_value(union_mswitch_lookup(msw, key)));
+	return (s != NULL && union_strset_closed(s)) ? s : NULL;
+}
+
+// true if, for this property, each branch only accepts strings from a
+// set of literals, and no two branches accept the same literal
+static bool
+union_is_discriminator(const struct ir_union_builder *ub, const struct json_string *key)
+{
+	struct json_string *strs;
+	size_t i, k, nstrs, cap;
+	bool disjoint;
 
-		default:
-			fprintf(stderr, "%s:%d invalid cnode type for %s: %s\n",
-					__FILE__, __LINE__, __func__, jvst_cnode_type_name(top->type));
-			abort();
-		}
+	strs = NULL;
+	nstrs = cap = 0;
+	for (i=0; i < ub->nbr; i++) {
+		struct jvst_cnode *s;
 
-		cond = ir_stmt_if(cmp,
-			ir_stmt_valid(),
-			ir_stmt_invalid(JVST_INVALID_SPLIT_CONDITION));  // XXX - improve error message!
+		s = union_discriminator_set(ub->br[i].mswitch, key);
+		if (s == NULL) {
+			free(strs);
+			return false;
+		}
 
-		return cond;
+		union_add_literals(s, &strs, &nstrs, &cap);
 	}
 
-	// needs full bitvec logic
-	cond = ir_stmt_new(JVST_IR_STMT_SEQ);
-	spp = &cond->u.stmt_list;
-
-	gather.bvec->u.bitvec.nbits = gather.nframe;
-	assert(gather.boff == gather.nframe);
+	disjoint = true;
+	for (k=0; k < nstrs && disjoint; k++) {
+		size_t naccept = 0;
 
-	*spp = ir_stmt_new(JVST_IR_STMT_SPLITVEC);
-	(*spp)->u.splitvec.split_frames = frames;
+		for (i=0; i < ub->nbr; i++) {
+			struct jvst_cnode *s = union_discriminator_set(ub->br[i].mswitch, key);
 
-	(*spp)->u.splitvec.frame = frame;
-	(*spp)->u.splitvec.bitvec = gather.bvec;
+			if (union_strset_accepts(s, &strs[k])) {
+				naccept++;
+			}
+		}
 
-	spp = &(*spp)->next;
-	*spp = ir_stmt_new(JVST_IR_STMT_IF);
-	*spp = ir_stmt_if(split,
-		ir_stmt_valid(),
-		ir_stmt_invalid(JVST_INVALID_SPLIT_CONDITION));  // XXX - improve error message!
+		disjoint = (naccept <= 1);
+	}
 
-	return cond;
+	free(strs);
+	return disjoint;
 }
 
 static struct jvst_ir_stmt *
-ir_translate_object_inner(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
+ir_translate_object_union(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 {
-	struct jvst_ir_stmt *stmt, *pseq, **spp, **pseqpp, **matchpp;
-	struct jvst_cnode *pmatch;
-	struct fsm_options *opts;
-	const char *loopname;
-	size_t nreqs;
-	
-	struct ir_object_builder builder = { 0 };
+	struct ir_union_builder ub = { 0 };
+	struct jvst_ir_stmt *stmt, *loop, *match, *matcher, **spp;
+	struct jvst_ir_mcase **mcpp;
+	struct jvst_cnode *n, *msw, *mc;
+	struct json_string *keys;
+	size_t i, nkeys, cap, nreqs, which;
 
-	builder.frame = frame;
+	assert(top->type == JVST_CNODE_OR || top->type == JVST_CNODE_XOR);
 
-	stmt = ir_stmt_new(JVST_IR_STMT_SEQ);
-	spp = &stmt->u.stmt_list;
-	builder.pre_loop = spp;
+	for (n = top->u.ctrl; n != NULL; n = n->next) {
+		ub.nbr++;
+	}
 
-	builder.oloop = ir_stmt_loop(frame,"L_OBJ");
-	*spp = builder.oloop;
-	builder.post_loop = &builder.oloop->next;
+	if (ub.nbr < 2) {
+		return NULL;
+	}
 
-	spp = &(*spp)->u.loop.stmts;
+	ub.br = xcalloc(ub.nbr, sizeof ub.br[0]);
 
-	*spp = ir_stmt_new(JVST_IR_STMT_TOKEN);
-	spp = &(*spp)->next;
+	nreqs = 0;
+	for (i=0, n = top->u.ctrl; n != NULL; i++, n = n->next) {
+		ub.br[i].mswitch = union_branch_mswitch(n, &ub.br[i].nreqs);
+		if (ub.br[i].mswitch == NULL) {
+			free(ub.br);
+			return NULL;
+		}
 
-	pseq = ir_stmt_new(JVST_IR_STMT_SEQ);
-	*spp = ir_stmt_if(
-		ir_expr_istok(SJP_OBJECT_END),
-		ir_stmt_break(builder.oloop),
-		pseq);
+		ub.br[i].reqbase = nreqs;
+		nreqs += ub.br[i].nreqs;
+	}
 
-	builder.pre_match = &pseq->u.stmt_list;
-	pseqpp = &pseq->u.stmt_list;
+	keys = NULL;
+	nkeys = cap = 0;
+	for (i=0; i < ub.nbr; i++) {
+		union_add_literals(ub.br[i].mswitch, &keys, &nkeys, &cap);
+	}
 
-	builder.match = ir_stmt_new(JVST_IR_STMT_MATCH);
-	builder.mcpp = &builder.match->u.match.cases;
+	// other unions are left to a SPLIT, which doesn't need to
+	// check every branch against every property
+	for (i=0; i < nkeys; i++) {
+		if (union_is_discriminator(&ub, &keys[i])) {
+			break;
+		}
+	}
 
-	*pseqpp = builder.match;
-	// builder.match->u.match.default_case = obj_default_case();
-	matchpp = pseqpp;
-	pseqpp = &(*pseqpp)->next;
+	if (i == nkeys) {
+		free(keys);
+		free(ub.br);
+		return NULL;
+	}
 
-	builder.post_match = pseqpp;
-	assert(pseqpp != NULL);
-	assert(*pseqpp == NULL);
+	ub.frame = frame;
+	ub.cons = xcalloc(2*ub.nbr, sizeof ub.cons[0]);
+	ub.fail = ir_stmt_bitvec(frame, "fail", ub.nbr);
+	if (nreqs > 0) {
+		ub.reqmask = ir_stmt_bitvec(frame, "reqmask", nreqs);
+	}
 
-	builder.matcher = NULL;
+	// match the property name against the names of all branches
+	msw = jvst_cnode_literal_mswitch(keys, nkeys);
+	free(keys);
 
-	ir_translate_obj_inner(top, &builder);
+	match = ir_stmt_new(JVST_IR_STMT_MATCH);
+	mcpp = &match->u.match.cases;
 
-	if (builder.match->u.match.default_case == NULL) {
-		builder.match->u.match.default_case = obj_default_case();
+	which = 0;
+	for (mc = msw->u.mswitch.cases; mc != NULL; mc = mc->next) {
+		struct jvst_cnode **cons = &ub.cons[ub.nbr];
+		struct jvst_ir_mcase *irmc;
+
+		assert(mc->u.mcase.matchset != NULL);
+		assert(mc->u.mcase.matchset->next == NULL);
+
+		for (i=0; i < ub.nbr; i++) {
+			cons[i] = union_mswitch_lookup(ub.br[i].mswitch, &mc->u.mcase.matchset->match.str);
+		}
+
+		irmc = ir_mcase_new(++which, union_translate_value(&ub, cons));
+		irmc->matchset = mc->u.mcase.matchset;
+		mc->u.mcase.tmp = irmc;
+
+		*mcpp = irmc;
+		mcpp = &irmc->next;
 	}
 
-	// no matches... replacing matcher with a consume followed by
-	// the empty matcher's default case
-	if (builder.match->u.match.dfa == NULL) {
-		struct jvst_ir_stmt *consume, **npp;
+	for (i=0; i < ub.nbr; i++) {
+		ub.cons[ub.nbr + i] = ub.br[i].mswitch->u.mswitch.dft_case->u.mcase.constraint;
+	}
+	match->u.match.default_case = union_translate_value(&ub, &ub.cons[ub.nbr]);
 
-		assert(matchpp != NULL);
-		assert(*matchpp == builder.match);
-		assert(builder.match->u.match.default_case != NULL);
+	fsm_walk_states(msw->u.mswitch.dfa, NULL, obj_mcase_update_opaque);
 
-		for (npp = &builder.match->u.match.default_case; *npp != NULL; npp = &(*npp)->next) {
+	matcher = ir_stmt_matcher(frame, "dfa", msw->u.mswitch.dfa);
+	match->u.match.dfa = msw->u.mswitch.dfa;
+	match->u.match.name = matcher->u.matcher.name;
+	match->u.match.ind  = matcher->u.matcher.ind;
+
+	// loop over the properties
+	stmt = ir_stmt_new(JVST_IR_STMT_SEQ);
+	spp = &stmt->u.stmt_list;
+
+	loop = ir_stmt_loop(frame, "L_OBJ");
+	*spp = loop;
+	spp = &loop->u.loop.stmts;
+
+	*spp = ir_stmt_new(JVST_IR_STMT_TOKEN);
+	spp = &(*spp)->next;
+
+	*spp = ir_stmt_if(ir_expr_istok(SJP_OBJECT_END), ir_stmt_break(loop), match);
+
+	// after the loop, a branch also fails if it's missing required
+	// properties
+	spp = &loop->next;
+	for (i=0; i < ub.nbr; i++) {
+		if (ub.br[i].nreqs == 0) {
 			continue;
 		}
 
-		assert(npp != &builder.match->u.match.default_case);
-		assert(*npp == NULL);
-
-		*npp = builder.match->next;
-		// ensure that we consume the property's name token
-		*matchpp = ir_stmt_new(JVST_IR_STMT_CONSUME);
-		matchpp = &(*matchpp)->next;
-		*matchpp = builder.match->u.match.default_case;
+		*spp = ir_stmt_if(
+			union_btest(JVST_IR_EXPR_BTESTALL, ub.reqmask,
+				ub.br[i].reqbase, ub.br[i].reqbase + ub.br[i].nreqs - 1),
+			ir_stmt_new(JVST_IR_STMT_NOP),
+			union_bset(ub.fail, i));
+		spp = &(*spp)->next;
 	}
 
-	// handle post-loop constraints
-	if (*builder.post_loop == NULL) {
-		*builder.post_loop = ir_stmt_valid();
+	if (top->type == JVST_CNODE_OR) {
+		*spp = ir_stmt_if(union_btest(JVST_IR_EXPR_BTESTALL, ub.fail, 0, ub.nbr-1),
+			ir_stmt_invalid_kw(JVST_INVALID_SPLIT_CONDITION, &top->kw),
+			ir_stmt_valid());
+	} else {
+		*spp = ir_stmt_if(
+			ir_expr_op(JVST_IR_EXPR_EQ,
+				union_btest(JVST_IR_EXPR_BCOUNT, ub.fail, 0, ub.nbr-1),
+				ir_expr_size(ub.nbr-1)),
+			ir_stmt_valid(),
+			ir_stmt_invalid_kw(JVST_INVALID_SPLIT_CONDITION, &top->kw));
 	}
 
+	free(ub.cons);
+	free(ub.br);
+
 	return stmt;
 }
 
 static struct jvst_ir_stmt *
 ir_translate_object(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 {
+	struct jvst_ir_stmt *stmt;
+
 	switch (top->type) {
-	case JVST_CNODE_AND:
 	case JVST_CNODE_OR:
-	case JVST_CNODE_NOT:
 	case JVST_CNODE_XOR:
+		stmt = ir_translate_object_union(top, frame);
+		if (stmt != NULL) {
+			return stmt;
+		}
+
+		/* fallthrough */
+
+	case JVST_CNODE_AND:
+	case JVST_CNODE_NOT:
 		return ir_translate_split(top, frame, ir_translate_object_inner);
 
 	default:
@@ -3360,7 +4338,7 @@ str_translate_split_length_ranges(struct jvst_cnode *top, struct ir_str_builder
 	}
 
 	br = ir_stmt_if(cond, NULL,
-			ir_stmt_invalid(JVST_INVALID_STRING));
+			ir_stmt_invalid_kw(JVST_INVALID_STRING, &top->kw));
 
 	*spp = br;
 	spp = &br->u.if_.br_true;
@@ -3379,7 +4357,7 @@ ir_translate_string_inner(struct jvst_cnode *top, struct ir_str_builder *builder
 		return;
 
 	case JVST_CNODE_INVALID:
-		*builder->ipp = ir_stmt_invalid(JVST_INVALID_STRING);
+		*builder->ipp = ir_stmt_invalid_kw(JVST_INVALID_STRING, &top->kw);
 		return;
 
 	case JVST_CNODE_VALID:
@@ -3411,7 +4389,7 @@ ir_translate_string_inner(struct jvst_cnode *top, struct ir_str_builder *builder
 						ir_expr_new(JVST_IR_EXPR_TOK_LEN),
 						ir_expr_size(top->u.counts.min));
 				br = ir_stmt_if(cond, NULL, 
-					ir_stmt_invalid(JVST_INVALID_LENGTH_TOO_SHORT));
+					ir_stmt_invalid_kw(JVST_INVALID_LENGTH_TOO_SHORT, &top->kw));
 
 				*spp = br;
 				spp = &br->u.if_.br_true;
@@ -3426,7 +4404,7 @@ ir_translate_string_inner(struct jvst_cnode *top, struct ir_str_builder *builder
 						ir_expr_size(top->u.counts.max));
 
 				br = ir_stmt_if(cond, NULL, 
-					ir_stmt_invalid(JVST_INVALID_LENGTH_TOO_LONG));
+					ir_stmt_invalid_kw(JVST_INVALID_LENGTH_TOO_LONG, &top->u.counts.kw_max));
 
 				*spp = br;
 				spp = &br->u.if_.br_true;
@@ -3552,6 +4530,14 @@ struct ir_arr_builder {
 	struct jvst_ir_stmt **postpp;
 
 	int unique_items;
+
+	// keywords of the item, unique and contains constraints, for
+	// the checks of the SPLITV results
+	struct jvst_cnode_kw item_kw;
+	struct jvst_cnode_kw unique_kw;
+	struct jvst_cnode_kw *contains_kw;
+	size_t ncontains_kw;
+	size_t contains_kw_cap;
 };
 
 static struct jvst_ir_stmt *
@@ -3651,7 +4637,7 @@ arr_translate_contains_or_unique(struct jvst_ir_stmt *arr_item, struct ir_arr_bu
 		// that 
 		br = ir_stmt_if(cond,
 			ir_stmt_new(JVST_IR_STMT_NOP),
-			ir_stmt_invalid(JVST_INVALID_ARRAY));
+			ir_stmt_invalid_kw(JVST_INVALID_ARRAY, &builder->item_kw));
 		*ilpp = br;
 		ilpp = &br->next;
 	}
@@ -3670,7 +4656,7 @@ arr_translate_contains_or_unique(struct jvst_ir_stmt *arr_item, struct ir_arr_bu
 
 		br = ir_stmt_if(cond,
 			ir_stmt_new(JVST_IR_STMT_NOP),
-			ir_stmt_invalid(JVST_INVALID_NOT_UNIQUE));
+			ir_stmt_invalid_kw(JVST_INVALID_NOT_UNIQUE, &builder->unique_kw));
 		*ilpp = br;
 		ilpp = &br->next;
 	}
@@ -3726,6 +4712,7 @@ ir_translate_array(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 
 	// simple schema (VALID/INVALID), return directly
 	if (stmt != NULL) {
+		free(builder.contains_kw);
 		return stmt;
 	}
 
@@ -3848,7 +4835,8 @@ ir_translate_array(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 
 			// XXX - ideally we'd capture actual error from condition
 			// and report that 
-			br = ir_stmt_if(cond, NULL, ir_stmt_invalid(JVST_INVALID_UNSATISFIED_CONTAINS));
+			br = ir_stmt_if(cond, NULL,
+				ir_stmt_invalid_kw(JVST_INVALID_UNSATISFIED_CONTAINS, &builder.contains_kw[i]));
 			*seqpp = br;
 
 			// chain constraints together as a cascading
@@ -3982,6 +4970,8 @@ ir_translate_array(struct jvst_cnode *top, struct jvst_ir_stmt *frame)
 		*spp = stmts;
 	}
 
+	free(builder.contains_kw);
+
 	return stmt;
 }
 
@@ -3990,7 +4980,7 @@ ir_translate_array_inner(struct jvst_cnode *top, struct ir_arr_builder *builder)
 {
 	switch (top->type) {
 	case JVST_CNODE_INVALID:
-		return ir_stmt_invalid(JVST_INVALID_ARRAY);
+		return ir_stmt_invalid_kw(JVST_INVALID_ARRAY, &top->kw);
 
 	case JVST_CNODE_VALID:
 		return ir_stmt_valid();
@@ -4000,6 +4990,8 @@ ir_translate_array_inner(struct jvst_cnode *top, struct ir_arr_builder *builder)
 			struct jvst_cnode *it;
 			assert(top->u.items.items != NULL || top->u.items.additional != NULL);
 
+			builder->item_kw = top->kw;
+
 			if (top->u.items.additional != NULL) {
 				struct jvst_ir_stmt *additional;
 
@@ -4033,6 +5025,12 @@ ir_translate_array_inner(struct jvst_cnode *top, struct ir_arr_builder *builder)
 			*builder->containspp = contains;
 			builder->containspp = &contains->next;
 
+			if (builder->ncontains_kw >= builder->contains_kw_cap) {
+				builder->contains_kw = xenlargevec(builder->contains_kw,
+					&builder->contains_kw_cap, 1, sizeof builder->contains_kw[0]);
+			}
+			builder->contains_kw[builder->ncontains_kw++] = top->kw;
+
 			return NULL;
 		}
 
@@ -4070,7 +5068,7 @@ ir_translate_array_inner(struct jvst_cnode *top, struct ir_arr_builder *builder)
 						ir_expr_count(counter),
 						ir_expr_size(top->u.counts.min)),
 					NULL,
-					ir_stmt_invalid(JVST_INVALID_TOO_FEW_ITEMS));
+					ir_stmt_invalid_kw(JVST_INVALID_TOO_FEW_ITEMS, &top->kw));
 				checkpp = &(*checkpp)->u.if_.br_true;
 			}
 
@@ -4080,7 +5078,7 @@ ir_translate_array_inner(struct jvst_cnode *top, struct ir_arr_builder *builder)
 						ir_expr_count(counter),
 						ir_expr_size(top->u.counts.max)),
 					NULL,
-					ir_stmt_invalid(JVST_INVALID_TOO_MANY_ITEMS));
+					ir_stmt_invalid_kw(JVST_INVALID_TOO_MANY_ITEMS, &top->u.counts.kw_max));
 				checkpp = &(*checkpp)->u.if_.br_true;
 			}
 
@@ -4092,6 +5090,7 @@ ir_translate_array_inner(struct jvst_cnode *top, struct ir_arr_builder *builder)
 
 	case JVST_CNODE_ARR_UNIQUE:
 		builder->unique_items = 1;
+		builder->unique_kw = top->kw;
 		return NULL;
 
 	case JVST_CNODE_OR:
@@ -4178,6 +5177,7 @@ ir_translate(struct jvst_cnode *ctree, bool first_token)
 	struct jvst_ir_stmt *frame, **spp;
 	int count_valid, count_invalid, count_other;
 	enum jvst_cnode_type dft_case;
+	const struct jvst_cnode_kw *dft_kw;
 	size_t i;
 
 	if (ctree->type == JVST_CNODE_REF) {
@@ -4194,6 +5194,7 @@ ir_translate(struct jvst_cnode *ctree, bool first_token)
 	}
 
 	frame = ir_stmt_frame();
+	frame->u.frame.loc = ctree->loc;
 	spp = &frame->u.frame.stmts;
 
 	// 1) Emit TOKEN unless we don't want to...
@@ -4227,17 +5228,37 @@ ir_translate(struct jvst_cnode *ctree, bool first_token)
 	// ARRAY_END)
 	dft_case = (count_valid > count_invalid) ? JVST_CNODE_VALID : JVST_CNODE_INVALID;
 
+	// the default INVALID reports the keyword of the first value
+	// token that fails, the end tokens don't come from a keyword
+	dft_kw = NULL;
+	for (i=0; i < ARRAYLEN(ctree->u.sw); i++) {
+		if (i == SJP_ARRAY_END || i == SJP_OBJECT_END) {
+			continue;
+		}
+
+		if (ctree->u.sw[i]->type == JVST_CNODE_INVALID) {
+			dft_kw = &ctree->u.sw[i]->kw;
+			break;
+		}
+	}
+
 	// 4) write IF tree, descending for each type
 	for (i=0; i < ARRAYLEN(ctree->u.sw); i++) {
 		struct jvst_ir_stmt *stmt, *br_true;
 
 		if (ctree->u.sw[i]->type == dft_case) {
-			continue;
+			// INVALIDs from another keyword need their own
+			// branch to report it
+			if (dft_case != JVST_CNODE_INVALID || dft_kw == NULL ||
+					i == SJP_ARRAY_END || i == SJP_OBJECT_END ||
+					ir_kw_equal(&ctree->u.sw[i]->kw, dft_kw)) {
+				continue;
+			}
 		}
 
 		switch (ctree->u.sw[i]->type) {
 		case JVST_CNODE_INVALID:
-			br_true = ir_stmt_invalid(JVST_INVALID_UNEXPECTED_TOKEN);
+			br_true = ir_stmt_invalid_kw(JVST_INVALID_UNEXPECTED_TOKEN, &ctree->u.sw[i]->kw);
 			break;
 
 		case JVST_CNODE_VALID:
@@ -4255,6 +5276,8 @@ ir_translate(struct jvst_cnode *ctree, bool first_token)
 
 	*spp = (dft_case == JVST_CNODE_VALID)
 		? ir_consume_and_valid()
+		: (dft_kw != NULL)
+		? ir_stmt_invalid_kw(JVST_INVALID_UNEXPECTED_TOKEN, dft_kw)
 		: ir_stmt_invalid(JVST_INVALID_UNEXPECTED_TOKEN)
 		;
 
@@ -4649,6 +5672,9 @@ jvst_ir_stmt_copy_inner(struct jvst_ir_stmt *ir, struct addr_fixup_list *fixups,
 
 	case JVST_IR_STMT_PROGRAM:
 		copy->u.program.frames = ir_deepcopy_stmtlist(ir->u.program.frames, fixups, nl);
+		// exported frames are identified by their frame index, which
+		// the copy keeps
+		copy->u.program.exports = ir->u.program.exports;
 		return copy;
 
 	case JVST_IR_STMT_SEQ:
@@ -5335,6 +6361,12 @@ ir_linearize_frame(struct op_linearizer *oplin, struct jvst_ir_stmt *fr)
 	copy->u.frame.frame_ind = ++oplin->frame_ind;
 	assert(copy->u.frame.frame_ind > 0);
 
+	// frames made during IR translation, such as those for a split,
+	// are part of the schema of the frame they're in
+	if (copy->u.frame.loc.len == 0 && oplin->orig_frame != NULL) {
+		copy->u.frame.loc = oplin->frame->u.frame.loc;
+	}
+
 	copy->u.frame.matchers = ir_copy_stmtlist(fr->u.frame.matchers);
 
 	ir_frame_copy_counters(&copy->u.frame.counters, fr->u.frame.counters);
@@ -5578,7 +6610,17 @@ ir_linearize_operand(struct op_linearizer *oplin, struct jvst_ir_expr *expr)
 		return ir_linearize_split_expr(oplin, expr);
 
 	case JVST_IR_EXPR_BCOUNT:
-		/* need to handle remapping things here ... */
+		{
+			struct jvst_ir_expr *eseq, *tmp;
+			struct jvst_ir_stmt *mv;
+
+			tmp = ir_expr_itemp(oplin->frame);
+			mv = ir_stmt_move(tmp, expr);
+
+			eseq = ir_expr_seq(mv, tmp);
+
+			return eseq;
+		}
 
 	case JVST_IR_EXPR_NONE:
 		fprintf(stderr, "%s:%d (%s) expression %s is not yet implemented\n",
@@ -5811,6 +6853,18 @@ ir_linearize_rewrite_expr(struct jvst_ir_stmt *frame, struct jvst_ir_expr *expr)
 				return ir_linearize_rewrite_expr(frame, copy);
 			}
 
+			// the token registers only change at TOKEN, so the
+			// statements on the right can't change TOK_NUM.  The
+			// VM compares the token itself, which keeps integer
+			// tokens exact.
+			if (rhs->type == JVST_IR_EXPR_SEQ && lhs->type == JVST_IR_EXPR_TOK_NUM) {
+				cmp = ir_expr_op(expr->type, lhs, rhs->u.seq.expr);
+				cmp = ir_linearize_rewrite_expr(frame, cmp);
+
+				copy = ir_expr_seq(rhs->u.seq.stmt, cmp);
+				return ir_linearize_rewrite_expr(frame, copy);
+			}
+
 			if (rhs->type == JVST_IR_EXPR_SEQ) {
 				struct jvst_ir_expr *tmp, *eseq1, *cmp;
 				struct jvst_ir_stmt *mv;
@@ -5960,8 +7014,11 @@ ir_jump_valid_block(struct op_linearizer *oplin, struct jvst_ir_stmt *stmt)
 	oplin->ipp = &jmp->next;
 }
 
+// Returns the block for INVALID ecode, failing keyword kw (or NULL) at
+// loc.  INVALIDs with the same code share a block unless they come
+// from different keywords.
 static struct jvst_ir_stmt *
-ir_add_invalid_block(struct op_linearizer *oplin, int ecode)
+ir_add_invalid_block(struct op_linearizer *oplin, int ecode, struct json_string loc, const char *kw)
 {
 	struct jvst_ir_stmt *invblock, *jmp;
 	struct jvst_ir_stmt *invstmt;
@@ -5975,7 +7032,10 @@ ir_add_invalid_block(struct op_linearizer *oplin, int ecode)
 		assert(inv->type == JVST_IR_STMT_INVALID);
 		assert(inv->next == NULL);
 
-		if (inv->u.invalid.code == ecode) {
+		if (inv->u.invalid.code == ecode &&
+				(inv->u.invalid.kw == NULL) == (kw == NULL) &&
+				(kw == NULL || strcmp(inv->u.invalid.kw, kw) == 0) &&
+				ir_loc_equal(inv->u.invalid.loc, loc)) {
 			return invblock;
 		}
 	}
@@ -5988,6 +7048,8 @@ ir_add_invalid_block(struct op_linearizer *oplin, int ecode)
 
 	invblock = ir_stmt_block(oplin->frame, pfx);
 	invstmt = ir_stmt_invalid(ecode);
+	invstmt->u.invalid.loc = loc;
+	invstmt->u.invalid.kw = kw;
 	assert(invstmt->next == NULL);
 
 	invblock->u.block.stmts = invstmt;
@@ -6004,7 +7066,8 @@ ir_jump_invalid_block(struct op_linearizer *oplin, struct jvst_ir_stmt *stmt)
 
 	assert(stmt->type == JVST_IR_STMT_INVALID);
 
-	invblock = ir_add_invalid_block(oplin, stmt->u.invalid.code);
+	invblock = ir_add_invalid_block(oplin, stmt->u.invalid.code,
+		stmt->u.invalid.loc, stmt->u.invalid.kw);
 
 	jmp = ir_stmt_branch(invblock);
 	*oplin->ipp = jmp;
@@ -6202,8 +7265,9 @@ ir_linearize_stmt(struct op_linearizer *oplin, struct jvst_ir_stmt *stmt)
 			oplin->bpp = &join->u.block.block_next;
 
 			{
+				static const struct json_string zero;
 				struct jvst_ir_stmt *eblk;
-				eblk = ir_add_invalid_block(oplin, JVST_INVALID_MATCH_CASE);
+				eblk = ir_add_invalid_block(oplin, JVST_INVALID_MATCH_CASE, zero, NULL);
 
 				*blkpp = eblk;
 			}
@@ -6368,7 +7432,13 @@ ir_cnode_xlate_update_refs(void *opaque, struct json_string *k, struct jvst_cnod
 	assert(upds->refs != NULL);
 
 	assert(ctreep != NULL);
-	assert(*ctreep != NULL);
+
+	// dangling reference: either an error, which linearizing the
+	// forest reports, or an import of a module, which is resolved
+	// when the module is linked
+	if (*ctreep == NULL) {
+		return 1;
+	}
 
 	ir = hmap_getptr(upds->xl_tbl, *ctreep);
 	if (ir == NULL) {
@@ -6466,9 +7536,34 @@ jvst_ir_forest_free(struct jvst_ir_forest *ir_forest)
 enum { FRAME_MAP_SIZE = 256 };
 #define FRAME_MAP_MAXLOAD 0.65f
 
-// Translates a forest of cnodes into a forest of IR trees
-struct jvst_ir_stmt *
-jvst_ir_linearize_forest(struct jvst_ir_forest *ir_forest)
+struct ir_export_builder {
+	struct hmap *frame_map;
+	struct jvst_ir_id_table *exports;
+};
+
+static int
+ir_add_export(void *opaque, struct json_string *k, struct jvst_ir_stmt **frp)
+{
+	struct ir_export_builder *eb = opaque;
+	struct jvst_ir_stmt *lin_fr;
+
+	assert(frp != NULL);
+	assert(*frp != NULL);
+
+	lin_fr = hmap_getptr(eb->frame_map, *frp);
+	assert(lin_fr != NULL);
+	assert(lin_fr->type == JVST_IR_STMT_FRAME);
+
+	if (!jvst_ir_id_table_add(eb->exports, *k, lin_fr)) {
+		fprintf(stderr, "failed adding export\n");
+		abort();
+	}
+
+	return 1;
+}
+
+static struct jvst_ir_stmt *
+ir_linearize_forest(struct jvst_ir_forest *ir_forest, int module)
 {
 	struct jvst_ir_stmt *prog, *fr;
 	struct op_linearizer oplin = { 0 };
@@ -6499,6 +7594,12 @@ jvst_ir_linearize_forest(struct jvst_ir_forest *ir_forest)
 			s = callid->u.call_id.id;
 			orig_fr = jvst_ir_id_table_lookup(ir_forest->refs, s);
 
+			// imports stay CALL_ID nodes until the module is linked
+			if (orig_fr == NULL && module) {
+				callid->u.call_id.next_call = NULL;
+				continue;
+			}
+
 			if (orig_fr == NULL) {
 				if (s.len < INT_MAX) {
 					fprintf(stderr, "UNRESOLVED reference \"%.*s\", aborting.\n", (int)s.len, s.s);
@@ -6528,15 +7629,128 @@ jvst_ir_linearize_forest(struct jvst_ir_forest *ir_forest)
 		}
 	}
 
-	/* clean up */
-	hmap_free(oplin.frame_map);
-
 	prog = ir_stmt_new(JVST_IR_STMT_PROGRAM);
 	prog->u.program.frames = oplin.frame;
 
+	if (module) {
+		struct ir_export_builder eb;
+
+		eb.frame_map = oplin.frame_map;
+		eb.exports = jvst_ir_id_table_new();
+		jvst_ir_id_table_foreach(ir_forest->refs, ir_add_export, &eb);
+
+		prog->u.program.exports = eb.exports;
+	}
+
+	/* clean up */
+	hmap_free(oplin.frame_map);
+
 	return prog;
 }
 
+// Translates a forest of cnodes into a forest of IR trees
+struct jvst_ir_stmt *
+jvst_ir_linearize_forest(struct jvst_ir_forest *ir_forest)
+{
+	return ir_linearize_forest(ir_forest, 0);
+}
+
+struct jvst_ir_stmt *
+jvst_ir_linearize_module(struct jvst_ir_forest *ir_forest)
+{
+	return ir_linearize_forest(ir_forest, 1);
+}
+
+static int
+ir_combine_ref(void *opaque, struct json_string *k, struct jvst_ir_stmt **frp)
+{
+	struct jvst_ir_id_table *refs = opaque;
+
+	assert(k != NULL);
+	assert(frp != NULL && *frp != NULL);
+
+	// the ids of each schema have to be unique across the set, or
+	// references couldn't tell which schema they refer to
+	if (jvst_ir_id_table_lookup(refs, *k) != NULL) {
+		int len = k->len >= INT_MAX ? INT_MAX : (int)k->len;
+
+		fprintf(stderr, "id \"%.*s\" is defined by more than one schema\n", len, k->s);
+		abort();
+	}
+
+	if (!jvst_ir_id_table_add(refs, *k, *frp)) {
+		fprintf(stderr, "could not add entry to combined refs table\n");
+		abort();
+	}
+
+	return 1;
+}
+
+struct jvst_ir_forest *
+jvst_ir_combine_forests(struct jvst_ir_forest *const *forests, size_t n)
+{
+	static const struct jvst_ir_forest zero;
+
+	struct jvst_ir_forest *combined;
+	struct jvst_ir_stmt *root, *bv, *splv, **fpp;
+	size_t i, len;
+
+	assert(n > 0);
+
+	// the root validates the value against the root of each schema
+	// and records which of them it matched
+	root = ir_stmt_frame();
+	bv = ir_stmt_bitvec(root, "schemas", n);
+
+	splv = ir_stmt_new(JVST_IR_STMT_SPLITVEC);
+	splv->u.splitvec.frame = root;
+	splv->u.splitvec.bitvec = bv;
+	splv->u.splitvec.split_frames = NULL;
+	splv->next = ir_stmt_valid();
+
+	root->u.frame.stmts = splv;
+
+	combined = xmalloc(sizeof *combined);
+	*combined = zero;
+
+	len = 1;
+	for (i=0; i < n; i++) {
+		assert(forests[i]->len > 0);
+		len += forests[i]->len - 1;
+	}
+
+	combined->len = len;
+	combined->trees = xcalloc(len, sizeof combined->trees[0]);
+	combined->refs = jvst_ir_id_table_new();
+
+	combined->trees[0] = root;
+
+	len = 1;
+	fpp = &splv->u.splitvec.split_frames;
+	for (i=0; i < n; i++) {
+		struct jvst_ir_forest *f = forests[i];
+		size_t j;
+
+		// each schema's root is linearized as one of the split
+		// frames, the rest of its trees as they are
+		assert(f->trees[0]->type == JVST_IR_STMT_FRAME);
+		assert(f->trees[0]->next == NULL);
+
+		*fpp = f->trees[0];
+		fpp = &f->trees[0]->next;
+
+		for (j=1; j < f->len; j++) {
+			combined->trees[len++] = f->trees[j];
+		}
+
+		jvst_ir_id_table_foreach(f->refs, ir_combine_ref, combined->refs);
+	}
+
+	assert(len == combined->len);
+
+	return combined;
+}
+
 void
 jvst_ir_debug_forest(struct jvst_ir_forest *ir_forest)
 {
@@ -160,6 +160,13 @@ enum jvst_invalid_code {
 	JVST_INVALID_VM_STACK_OVERFLOW	= 0xD1,
 	JVST_INVALID_VM_INVALID_ARG	= 0xD2,
 	JVST_INVALID_VM_INVALID_OP	= 0xD3,
+
+	// resource limits, see jvst_vm_set_limits()
+	JVST_INVALID_VM_INSTR_LIMIT	= 0xD4,
+	JVST_INVALID_VM_DEPTH_LIMIT	= 0xD5,
+	JVST_INVALID_VM_SPLIT_LIMIT	= 0xD6,
+	JVST_INVALID_VM_UNIQUE_LIMIT	= 0xD7,
+	JVST_INVALID_VM_MEMORY_LIMIT	= 0xD8,
 };
 
 const char *
@@ -178,6 +185,9 @@ struct jvst_ir_mcase {
 
 struct jvst_ir_program {
 	struct jvst_ir_stmt *frames;
+
+	// for modules, maps each id defined in the module to its frame
+	struct jvst_ir_id_table *exports;
 };
 
 struct jvst_ir_frame {
@@ -192,6 +202,11 @@ struct jvst_ir_frame {
 
 	size_t frame_ind;
 
+	// schema location of the frame, see struct jvst_cnode.  Frames
+	// without one take the location of the frame they're
+	// linearized in.
+	struct json_string loc;
+
 	size_t blockind;
 
 	size_t nloops;
@@ -215,6 +230,11 @@ struct jvst_ir_stmt {
 		struct {
 			int code;
 			const char *msg;
+
+			// the keyword that failed, see struct
+			// jvst_cnode_kw.  Empty if it isn't known.
+			struct json_string loc;
+			const char *kw;
 		} invalid;
 
 		struct {
@@ -471,6 +491,22 @@ jvst_ir_translate_forest(struct jvst_cnode_forest *ctrees);
 struct jvst_ir_stmt *
 jvst_ir_linearize_forest(struct jvst_ir_forest *ir);
 
+// Like jvst_ir_linearize_forest, but for a module that is linked with
+// other modules: references to ids that aren't in the forest are left
+// as CALL_ID statements instead of being an error, and the program
+// records the frame of each id in the forest as an export.
+struct jvst_ir_stmt *
+jvst_ir_linearize_module(struct jvst_ir_forest *ir);
+
+// Combines the forests of several schemas into one forest.  Its root
+// validates a value against the root of each schema with a SPLITVEC,
+// and the bit for each schema in the SPLITVEC's bitvector records
+// whether the value matched it.  The ids of the schemas must be
+// distinct.  The combined forest shares the trees of the forests, which
+// must still be freed.
+struct jvst_ir_forest *
+jvst_ir_combine_forests(struct jvst_ir_forest *const *forests, size_t n);
+
 void
 jvst_ir_forest_free(struct jvst_ir_forest *ir_forest);
 
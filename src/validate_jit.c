@@ -0,0 +1,874 @@
+#define _DEFAULT_SOURCE
+
+#include "validate_jit.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xalloc.h"
+#include "validate_vm.h"
+#include "validate_native.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_X86_64 1
+#else
+#define JIT_X86_64 0
+#endif
+
+#if JIT_X86_64
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Code layout.
+ *
+ * The machine code is one function with the signature of the native
+ * field of struct jvst_vm_program.  The VM registers live in machine
+ * registers while the code runs:
+ *
+ *   %rbx   the VM
+ *   %r12   the flag register (r_flag)
+ *   %r13   the current frame (&vm->stack[vm->r_fp])
+ *
+ * %fp and %sp stay in the VM, since only the runtime calls change them.
+ * Before an instruction that can stop the VM, the code stores the pc
+ * and flag in r_pc and r_flag, as the interpreter does.
+ *
+ * The function starts with a jump through a table indexed by r_pc.  The
+ * table has the address of each instruction the VM can resume with, and
+ * the address of an error exit for the others.  RETURN also goes
+ * through the table to continue after the CALL.
+ */
+
+struct jvst_vm_jit {
+	void *mem;
+	size_t len;
+};
+
+enum {
+	RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum {
+	JCC_E  = 0x84,
+	JCC_NE = 0x85,
+	JCC_A  = 0x87,
+	JCC_L  = 0x8C,
+	JCC_GE = 0x8D,
+	JCC_LE = 0x8E,
+	JCC_G  = 0x8F,
+
+	SET_A  = 0x97,
+	SET_L  = 0x9C,
+	SET_G  = 0x9F,
+};
+
+#define JIT_FRAME   R13
+#define JIT_FLAG    R12
+#define JIT_VM      RBX
+
+// a rel32 that needs the offset of a label
+struct jit_fixup {
+	size_t off;
+	size_t label;
+};
+
+struct jit {
+	const struct jvst_vm_program *prog;
+
+	unsigned char *code;
+	size_t len;
+	size_t cap;
+
+	// labels: one per instruction, plus the ones below
+	size_t *labels;
+	size_t nlabels;
+
+	struct jit_fixup *fixups;
+	size_t nfixups;
+	size_t maxfixups;
+
+	// offset of the table address, patched once the code is placed
+	size_t table_imm;
+};
+
+// labels after the instructions
+#define LABEL_EPILOGUE(j) ((j)->prog->ncode + 1)
+#define LABEL_BADPC(j)    ((j)->prog->ncode + 2)
+#define LABEL_DISPATCH(j) ((j)->prog->ncode + 3)
+#define NUM_EXTRA_LABELS  4
+
+static void
+jit_byte(struct jit *j, unsigned b)
+{
+	if (j->len >= j->cap) {
+		j->code = xenlargevec(j->code, &j->cap, 1, sizeof j->code[0]);
+	}
+
+	j->code[j->len++] = (unsigned char)b;
+}
+
+static void
+jit_u32(struct jit *j, uint32_t v)
+{
+	int i;
+
+	for (i=0; i < 4; i++) {
+		jit_byte(j, (v >> (8*i)) & 0xff);
+	}
+}
+
+static void
+jit_u64(struct jit *j, uint64_t v)
+{
+	int i;
+
+	for (i=0; i < 8; i++) {
+		jit_byte(j, (v >> (8*i)) & 0xff);
+	}
+}
+
+static void
+jit_bytes(struct jit *j, const unsigned char *b, size_t n)
+{
+	size_t i;
+
+	for (i=0; i < n; i++) {
+		jit_byte(j, b[i]);
+	}
+}
+
+static void
+jit_rex(struct jit *j, int w, int reg, int base)
+{
+	unsigned rex = 0x40 | (w ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+
+	if (rex != 0x40) {
+		jit_byte(j, rex);
+	}
+}
+
+static void
+jit_opcode(struct jit *j, int pfx, int w, int op1, int op2, int reg, int base)
+{
+	if (pfx != 0) {
+		jit_byte(j, pfx);
+	}
+
+	jit_rex(j, w, reg, base);
+	jit_byte(j, op1);
+	if (op2 >= 0) {
+		jit_byte(j, op2);
+	}
+}
+
+// op reg, [base+disp32]
+static void
+jit_mem(struct jit *j, int pfx, int w, int op1, int op2, int reg, int base, int32_t disp)
+{
+	jit_opcode(j, pfx, w, op1, op2, reg, base);
+	jit_byte(j, 0x80 | ((reg & 7) << 3) | (base & 7));
+	if ((base & 7) == RSP) {
+		jit_byte(j, 0x24);
+	}
+	jit_u32(j, (uint32_t)disp);
+}
+
+// op reg, rm
+static void
+jit_rr(struct jit *j, int pfx, int w, int op1, int op2, int reg, int rm)
+{
+	jit_opcode(j, pfx, w, op1, op2, reg, rm);
+	jit_byte(j, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static int32_t
+slot_disp(int slot)
+{
+	return (int32_t)(slot * sizeof(union jvst_vm_stackval));
+}
+
+static void
+jit_movabs(struct jit *j, int reg, uint64_t v)
+{
+	jit_rex(j, 1, 0, reg);
+	jit_byte(j, 0xB8 + (reg & 7));
+	jit_u64(j, v);
+}
+
+static void
+jit_load_slot(struct jit *j, int reg, int slot)
+{
+	jit_mem(j, 0, 1, 0x8B, -1, reg, JIT_FRAME, slot_disp(slot));
+}
+
+static void
+jit_store_slot(struct jit *j, int slot, int reg)
+{
+	jit_mem(j, 0, 1, 0x89, -1, reg, JIT_FRAME, slot_disp(slot));
+}
+
+// reg = value of an integer argument
+static void
+jit_ival(struct jit *j, int reg, uint32_t arg)
+{
+	if (jvst_vm_arg_islit(arg)) {
+		jit_movabs(j, reg, (uint64_t)(int64_t)jvst_vm_arg_tolit(arg));
+	} else {
+		jit_load_slot(j, reg, jvst_vm_arg_toslot(arg));
+	}
+}
+
+// as jit_ival, but truncated to an int as the interpreter does
+static void
+jit_ival32(struct jit *j, int reg, uint32_t arg)
+{
+	if (jvst_vm_arg_islit(arg)) {
+		jit_movabs(j, reg, (uint64_t)(int64_t)jvst_vm_arg_tolit(arg));
+	} else {
+		jit_mem(j, 0, 1, 0x63, -1, reg, JIT_FRAME, slot_disp(jvst_vm_arg_toslot(arg)));
+	}
+}
+
+static void
+jit_fixup(struct jit *j, size_t label)
+{
+	if (j->nfixups >= j->maxfixups) {
+		j->fixups = xenlargevec(j->fixups, &j->maxfixups, 1, sizeof j->fixups[0]);
+	}
+
+	j->fixups[j->nfixups].off = j->len;
+	j->fixups[j->nfixups].label = label;
+	j->nfixups++;
+
+	jit_u32(j, 0);
+}
+
+static void
+jit_jmp(struct jit *j, size_t label)
+{
+	jit_byte(j, 0xE9);
+	jit_fixup(j, label);
+}
+
+static void
+jit_jcc(struct jit *j, int cc, size_t label)
+{
+	jit_byte(j, 0x0F);
+	jit_byte(j, cc);
+	jit_fixup(j, label);
+}
+
+static void
+jit_call(struct jit *j, void (*fn)(void))
+{
+	jit_movabs(j, RAX, (uint64_t)(uintptr_t)fn);
+	jit_rr(j, 0, 0, 0xFF, -1, 2, RAX);	// call *%rax
+}
+
+#define JIT_CALL(j, fn) jit_call((j), (void (*)(void))(fn))
+
+// first argument of a runtime call is the VM
+static void
+jit_arg_vm(struct jit *j)
+{
+	jit_rr(j, 0, 1, 0x89, -1, JIT_VM, RDI);
+}
+
+// stores the pc and flag before an instruction that can stop the VM
+static void
+jit_save(struct jit *j, size_t pc)
+{
+	jit_mem(j, 0, 0, 0xC7, -1, 0, JIT_VM, offsetof(struct jvst_vm, r_pc));
+	jit_u32(j, (uint32_t)pc);
+	jit_mem(j, 0, 1, 0x89, -1, JIT_FLAG, JIT_VM, offsetof(struct jvst_vm, r_flag));
+}
+
+// returns %eax from the function if it isn't JVST_VALID
+static void
+jit_return_unless_valid(struct jit *j)
+{
+	jit_rr(j, 0, 0, 0x85, -1, RAX, RAX);
+	jit_jcc(j, JCC_NE, LABEL_EPILOGUE(j));
+}
+
+// returns %eax from the function if it isn't JVST_INDETERMINATE
+static void
+jit_return_unless_indeterminate(struct jit *j)
+{
+	jit_byte(j, 0x3D);	// cmp $imm32, %eax
+	jit_u32(j, (uint32_t)(int32_t)JVST_INDETERMINATE);
+	jit_jcc(j, JCC_NE, LABEL_EPILOGUE(j));
+}
+
+static void
+jit_return_error(struct jit *j, int error)
+{
+	jit_mem(j, 0, 0, 0xC7, -1, 0, JIT_VM, offsetof(struct jvst_vm, error));
+	jit_u32(j, (uint32_t)error);
+	jit_byte(j, 0xB8);	// mov $JVST_INVALID, %eax
+	jit_u32(j, (uint32_t)(int32_t)JVST_INVALID);
+	jit_jmp(j, LABEL_EPILOGUE(j));
+}
+
+// flag = (%edx > 0) - (%eax > 0), with %dl and %al set by setcc
+static void
+jit_flag_from_setcc(struct jit *j)
+{
+	jit_rr(j, 0, 0, 0x0F, 0xB6, RDX, RDX);		// movzbl %dl, %edx
+	jit_rr(j, 0, 0, 0x0F, 0xB6, RAX, RAX);		// movzbl %al, %eax
+	jit_rr(j, 0, 0, 0x29, -1, RAX, RDX);		// sub %eax, %edx
+	jit_rr(j, 0, 1, 0x63, -1, JIT_FLAG, RDX);	// movslq %edx, %r12
+}
+
+// %r13 = &vm->stack[vm->r_fp]
+static void
+jit_load_frame(struct jit *j)
+{
+	static const unsigned char lea[] = {
+		0x4C, 0x8D, 0x2C, 0xCA,	// lea (%rdx,%rcx,8), %r13
+	};
+
+	jit_mem(j, 0, 0, 0x8B, -1, RCX, JIT_VM, offsetof(struct jvst_vm, r_fp));
+	jit_mem(j, 0, 1, 0x8B, -1, RDX, JIT_VM, offsetof(struct jvst_vm, stack));
+	jit_bytes(j, lea, sizeof lea);
+}
+
+static void
+jit_prologue(struct jit *j)
+{
+	static const unsigned char push[] = {
+		0x53,			// push %rbx
+		0x41, 0x54,		// push %r12
+		0x41, 0x55,		// push %r13
+		0x48, 0x83, 0xEC, 0x10,	// sub $16, %rsp
+	};
+	static const unsigned char jmp_table[] = {
+		0xFF, 0x24, 0xC2,	// jmp *(%rdx,%rax,8)
+	};
+	static const unsigned char pop[] = {
+		0x48, 0x83, 0xC4, 0x10,	// add $16, %rsp
+		0x41, 0x5D,		// pop %r13
+		0x41, 0x5C,		// pop %r12
+		0x5B,			// pop %rbx
+		0xC3,			// ret
+	};
+
+	// the stack is 16-byte aligned after the pushes, and (%rsp) holds
+	// the pc set by RETURN
+	jit_bytes(j, push, sizeof push);
+	jit_rr(j, 0, 1, 0x89, -1, RDI, JIT_VM);
+	jit_mem(j, 0, 1, 0x8B, -1, JIT_FLAG, JIT_VM, offsetof(struct jvst_vm, r_flag));
+	jit_mem(j, 0, 0, 0x8B, -1, RAX, JIT_VM, offsetof(struct jvst_vm, r_pc));
+
+	// %eax holds the pc to continue with
+	j->labels[LABEL_DISPATCH(j)] = j->len;
+	jit_load_frame(j);
+	jit_byte(j, 0x3D);	// cmp $ncode, %eax
+	jit_u32(j, (uint32_t)j->prog->ncode);
+	jit_jcc(j, JCC_A, LABEL_BADPC(j));
+	j->table_imm = j->len + 2;
+	jit_movabs(j, RDX, 0);
+	jit_bytes(j, jmp_table, sizeof jmp_table);
+
+	// %eax holds the result
+	j->labels[LABEL_EPILOGUE(j)] = j->len;
+	jit_bytes(j, pop, sizeof pop);
+
+	j->labels[LABEL_BADPC(j)] = j->len;
+	jit_return_error(j, JVST_INVALID_VM_BAD_PC);
+}
+
+static int
+is_tnum(uint32_t arg)
+{
+	return arg == VMREG(JVST_VM_TNUM);
+}
+
+static int
+jit_op(struct jit *j, size_t pc)
+{
+	uint32_t opcode, a0, a1;
+	enum jvst_vm_op op;
+	long br;
+
+	opcode = j->prog->code[pc];
+	op = jvst_vm_decode_op(opcode);
+	a0 = jvst_vm_decode_arg0(opcode);
+	a1 = jvst_vm_decode_arg1(opcode);
+
+	switch (op) {
+	case JVST_OP_NOP:
+		return 0;
+
+	case JVST_OP_PROC:
+		if (!jvst_vm_arg_islit(a0) || !jvst_vm_arg_islit(a1)) {
+			return -1;
+		}
+
+		jit_arg_vm(j);
+		jit_movabs(j, RSI, (uint64_t)(int64_t)jvst_vm_arg_tolit(a0));
+		jit_movabs(j, RDX, (uint64_t)(uint32_t)jvst_vm_arg_tolit(a1));
+		JIT_CALL(j, jvst_vm_native_proc);
+		jit_return_unless_valid(j);
+
+		// the stack may have moved
+		jit_load_frame(j);
+		return 0;
+
+	case JVST_OP_ICMP:
+		jit_ival(j, RAX, a0);
+		jit_ival(j, RCX, a1);
+		jit_rr(j, 0, 1, 0x39, -1, RCX, RAX);		// cmp %rcx, %rax
+		jit_rr(j, 0, 0, 0x0F, SET_G, 0, RDX);		// setg %dl
+		jit_rr(j, 0, 0, 0x0F, SET_L, 0, RAX);		// setl %al
+		jit_flag_from_setcc(j);
+		return 0;
+
+	case JVST_OP_FCMP:
+		if (!jvst_vm_arg_isslot(a0) || !jvst_vm_arg_isslot(a1)) {
+			return -1;
+		}
+
+		if (is_tnum(a0) || is_tnum(a1)) {
+			jit_arg_vm(j);
+			jit_movabs(j, RSI, opcode);
+			JIT_CALL(j, jvst_vm_native_fcmp);
+			jit_rr(j, 0, 1, 0x89, -1, RAX, JIT_FLAG);
+			return 0;
+		}
+
+		// NaNs compare unordered, so both setcc give 0
+		jit_mem(j, 0xF2, 0, 0x0F, 0x10, 0, JIT_FRAME, slot_disp(jvst_vm_arg_toslot(a0)));
+		jit_mem(j, 0xF2, 0, 0x0F, 0x10, 1, JIT_FRAME, slot_disp(jvst_vm_arg_toslot(a1)));
+		jit_rr(j, 0x66, 0, 0x0F, 0x2E, 0, 1);		// ucomisd %xmm1, %xmm0
+		jit_rr(j, 0, 0, 0x0F, SET_A, 0, RDX);		// seta %dl
+		jit_rr(j, 0x66, 0, 0x0F, 0x2E, 1, 0);		// ucomisd %xmm0, %xmm1
+		jit_rr(j, 0, 0, 0x0F, SET_A, 0, RAX);		// seta %al
+		jit_flag_from_setcc(j);
+		return 0;
+
+	case JVST_OP_FINT:
+		if (!jvst_vm_arg_isslot(a0)) {
+			return -1;
+		}
+
+		jit_arg_vm(j);
+		jit_movabs(j, RSI, opcode);
+		JIT_CALL(j, jvst_vm_native_fint);
+		jit_rr(j, 0, 1, 0x89, -1, RAX, JIT_FLAG);
+		return 0;
+
+	case JVST_OP_JMP:
+		br = jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+		if ((long)pc + br < 0 || (size_t)((long)pc + br) > j->prog->ncode) {
+			return -1;
+		}
+
+		switch (jvst_vm_decode_bcond(opcode)) {
+		case JVST_VM_BR_NEVER:
+			return 0;
+
+		case JVST_VM_BR_ALWAYS:
+			jit_jmp(j, pc + br);
+			return 0;
+
+		case JVST_VM_BR_LT: jit_rr(j, 0, 1, 0x85, -1, JIT_FLAG, JIT_FLAG); jit_jcc(j, JCC_L,  pc + br); return 0;
+		case JVST_VM_BR_LE: jit_rr(j, 0, 1, 0x85, -1, JIT_FLAG, JIT_FLAG); jit_jcc(j, JCC_LE, pc + br); return 0;
+		case JVST_VM_BR_EQ: jit_rr(j, 0, 1, 0x85, -1, JIT_FLAG, JIT_FLAG); jit_jcc(j, JCC_E,  pc + br); return 0;
+		case JVST_VM_BR_GE: jit_rr(j, 0, 1, 0x85, -1, JIT_FLAG, JIT_FLAG); jit_jcc(j, JCC_GE, pc + br); return 0;
+		case JVST_VM_BR_GT: jit_rr(j, 0, 1, 0x85, -1, JIT_FLAG, JIT_FLAG); jit_jcc(j, JCC_G,  pc + br); return 0;
+		case JVST_VM_BR_NE: jit_rr(j, 0, 1, 0x85, -1, JIT_FLAG, JIT_FLAG); jit_jcc(j, JCC_NE, pc + br); return 0;
+
+		default:
+			return -1;
+		}
+
+	case JVST_OP_TOKEN:
+		if (jvst_vm_arg_tolit(a1) == -1) {
+			jit_arg_vm(j);
+			JIT_CALL(j, jvst_vm_native_unget);
+			return 0;
+		}
+
+		jit_save(j, pc);
+		jit_arg_vm(j);
+		JIT_CALL(j, jvst_vm_native_token);
+		jit_rr(j, 0, 0, 0x85, -1, RAX, RAX);
+		jit_byte(j, 0xB8);	// mov $JVST_NEXT, %eax (leaves the flags alone)
+		jit_u32(j, JVST_NEXT);
+		jit_jcc(j, JCC_NE, LABEL_EPILOGUE(j));
+		return 0;
+
+	case JVST_OP_CONSUME:
+		jit_save(j, pc);
+		jit_arg_vm(j);
+		JIT_CALL(j, jvst_vm_native_consume);
+		jit_return_unless_valid(j);
+		return 0;
+
+	case JVST_OP_RETURN:
+		if (!jvst_vm_arg_islit(a0)) {
+			return -1;
+		}
+
+		jit_save(j, pc);
+		if (a0 != 0) {
+			jit_return_error(j, jvst_vm_arg_tolit(a0));
+			return 0;
+		}
+
+		jit_arg_vm(j);
+		jit_rr(j, 0, 1, 0x89, -1, RSP, RSI);		// mov %rsp, %rsi
+		JIT_CALL(j, jvst_vm_native_return);
+		jit_return_unless_indeterminate(j);
+		jit_byte(j, 0x8B); jit_byte(j, 0x04); jit_byte(j, 0x24);	// mov (%rsp), %eax
+		jit_jmp(j, LABEL_DISPATCH(j));
+		return 0;
+
+	case JVST_OP_MOVE:
+		if (!jvst_vm_arg_isslot(a0)) {
+			return -1;
+		}
+
+		if (jvst_vm_arg_islit(a1)) {
+			jit_mem(j, 0, 1, 0xC7, -1, 0, JIT_FRAME, slot_disp(jvst_vm_arg_toslot(a0)));
+			jit_u32(j, (uint32_t)jvst_vm_arg_tolit(a1));
+		} else {
+			jit_load_slot(j, RAX, jvst_vm_arg_toslot(a1));
+			jit_store_slot(j, jvst_vm_arg_toslot(a0), RAX);
+		}
+		return 0;
+
+	case JVST_OP_FLOAD:
+	case JVST_OP_ILOAD:
+		{
+			uint64_t v;
+			int ind;
+
+			if (!jvst_vm_arg_isslot(a0) || !jvst_vm_arg_islit(a1)) {
+				return -1;
+			}
+
+			ind = jvst_vm_arg_tolit(a1);
+			if (op == JVST_OP_FLOAD) {
+				if (ind < 0 || (size_t)ind >= j->prog->nfloat) {
+					return -1;
+				}
+				memcpy(&v, &j->prog->fdata[ind], sizeof v);
+			} else {
+				if (ind < 0 || (size_t)ind >= j->prog->nconst) {
+					return -1;
+				}
+				v = (uint64_t)j->prog->cdata[ind];
+			}
+
+			jit_movabs(j, RAX, v);
+			jit_store_slot(j, jvst_vm_arg_toslot(a0), RAX);
+		}
+		return 0;
+
+	case JVST_OP_INCR:
+		if (!jvst_vm_arg_isslot(a0)) {
+			return -1;
+		}
+
+		jit_ival32(j, RAX, a1);
+		jit_mem(j, 0, 1, 0x01, -1, RAX, JIT_FRAME, slot_disp(jvst_vm_arg_toslot(a0)));
+		return 0;
+
+	case JVST_OP_MATCH:
+		jit_save(j, pc);
+		jit_ival(j, RSI, a0);
+		jit_arg_vm(j);
+		JIT_CALL(j, jvst_vm_native_match);
+		jit_return_unless_valid(j);
+		return 0;
+
+	case JVST_OP_CALL:
+		br = jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+		if ((long)pc + br < 0 || (size_t)((long)pc + br) >= j->prog->ncode ||
+			jvst_vm_decode_op(j->prog->code[pc+br]) != JVST_OP_PROC) {
+			return -1;
+		}
+
+		jit_arg_vm(j);
+		jit_movabs(j, RSI, pc);
+		JIT_CALL(j, jvst_vm_native_call);
+		jit_return_unless_valid(j);
+		jit_jmp(j, pc + br);
+		return 0;
+
+	case JVST_OP_BSET:
+		if (!jvst_vm_arg_isslot(a0)) {
+			return -1;
+		}
+
+		if (jvst_vm_arg_islit(a1)) {
+			int bit = jvst_vm_arg_tolit(a1);
+			if (bit < 0) {
+				return -1;
+			}
+
+			jit_movabs(j, RAX, (uint64_t)1 << (bit % 64));
+			jit_mem(j, 0, 1, 0x09, -1, RAX, JIT_FRAME,
+				slot_disp(jvst_vm_arg_toslot(a0) + bit/64));
+			return 0;
+		}
+
+		jit_ival32(j, RAX, a1);
+		jit_rr(j, 0, 1, 0x89, -1, RAX, RCX);		// mov %rax, %rcx
+		jit_rr(j, 0, 1, 0xC1, -1, 5, RAX);		// shr $6, %rax
+		jit_byte(j, 6);
+		jit_rr(j, 0, 1, 0xC1, -1, 4, RAX);		// shl $3, %rax
+		jit_byte(j, 3);
+		jit_rr(j, 0, 1, 0x01, -1, JIT_FRAME, RAX);	// add %r13, %rax
+		jit_rr(j, 0, 0, 0x83, -1, 4, RCX);		// and $63, %ecx
+		jit_byte(j, 63);
+		jit_movabs(j, RDX, 1);
+		jit_rr(j, 0, 1, 0xD3, -1, 4, RDX);		// shl %cl, %rdx
+		jit_mem(j, 0, 1, 0x09, -1, RDX, RAX, slot_disp(jvst_vm_arg_toslot(a0)));
+		return 0;
+
+	case JVST_OP_BAND:
+		if (!jvst_vm_arg_isslot(a0)) {
+			return -1;
+		}
+
+		jit_ival(j, RAX, a1);
+		jit_mem(j, 0, 1, 0x21, -1, RAX, JIT_FRAME, slot_disp(jvst_vm_arg_toslot(a0)));
+		return 0;
+
+	case JVST_OP_BCOUNT:
+		if (!jvst_vm_arg_isslot(a0) || !jvst_vm_arg_isslot(a1)) {
+			return -1;
+		}
+
+		jit_arg_vm(j);
+		jit_mem(j, 0, 1, 0x8D, -1, RSI, JIT_FRAME, slot_disp(jvst_vm_arg_toslot(a1)));
+		jit_load_slot(j, RDX, jvst_vm_arg_toslot(a0));
+		JIT_CALL(j, jvst_vm_native_bcount);
+		jit_store_slot(j, jvst_vm_arg_toslot(a0), RAX);
+		return 0;
+
+	case JVST_OP_SPLIT:
+	case JVST_OP_SPLITV:
+		if (!jvst_vm_arg_isslot(a1)) {
+			return -1;
+		}
+
+		jit_save(j, pc);
+		jit_ival(j, RSI, a0);
+		jit_arg_vm(j);
+		jit_movabs(j, RDX, jvst_vm_arg_toslot(a1));
+		jit_movabs(j, RCX, op == JVST_OP_SPLITV);
+		JIT_CALL(j, jvst_vm_native_split);
+		jit_return_unless_valid(j);
+		return 0;
+
+	case JVST_OP_UNIQUE:
+		jit_save(j, pc);
+		jit_arg_vm(j);
+		jit_movabs(j, RSI, (uint64_t)(int64_t)jvst_vm_arg_tolit(a0));
+		JIT_CALL(j, jvst_vm_native_unique);
+		jit_return_unless_indeterminate(j);
+		return 0;
+
+	default:
+		// leave unknown instructions to the interpreter
+		return -1;
+	}
+}
+
+// Returns non-zero if the VM can resume with the instruction at pc
+static unsigned char *
+resume_points(const struct jvst_vm_program *prog)
+{
+	unsigned char *resume;
+	size_t pc, i;
+
+	resume = xcalloc(prog->ncode + 1, sizeof resume[0]);
+	resume[0] = 1;
+
+	if (prog->nsplit > 0) {
+		size_t off = prog->nsplit + 1;
+		for (i=0; i < prog->sdata[prog->nsplit]; i++) {
+			resume[prog->sdata[off+i]] = 1;
+		}
+	}
+
+	for (pc=0; pc < prog->ncode; pc++) {
+		switch (jvst_vm_decode_op(prog->code[pc])) {
+		case JVST_OP_CALL:
+			resume[pc+1] = 1;
+			break;
+
+		case JVST_OP_TOKEN:
+		case JVST_OP_CONSUME:
+		case JVST_OP_RETURN:
+		case JVST_OP_MATCH:
+		case JVST_OP_SPLIT:
+		case JVST_OP_SPLITV:
+		case JVST_OP_UNIQUE:
+			resume[pc] = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return resume;
+}
+
+static struct jvst_vm_jit *
+jit_place(struct jit *j)
+{
+	struct jvst_vm_jit *jit;
+	unsigned char *mem, *resume;
+	uint64_t *table, addr;
+	size_t i, tab_off, len;
+
+	// the table follows the code
+	tab_off = (j->len + 7) & ~(size_t)7;
+	len = tab_off + (j->prog->ncode + 1) * sizeof table[0];
+
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		return NULL;
+	}
+
+	memcpy(mem, j->code, j->len);
+
+	for (i=0; i < j->nfixups; i++) {
+		size_t off = j->fixups[i].off;
+		int32_t rel = (int32_t)(j->labels[j->fixups[i].label] - (off + 4));
+		uint32_t urel = (uint32_t)rel;
+
+		mem[off+0] = urel & 0xff;
+		mem[off+1] = (urel >> 8) & 0xff;
+		mem[off+2] = (urel >> 16) & 0xff;
+		mem[off+3] = (urel >> 24) & 0xff;
+	}
+
+	table = (uint64_t *)(void *)(mem + tab_off);
+	resume = resume_points(j->prog);
+	for (i=0; i <= j->prog->ncode; i++) {
+		size_t label = resume[i] ? i : LABEL_BADPC(j);
+		table[i] = (uint64_t)(uintptr_t)(mem + j->labels[label]);
+	}
+	free(resume);
+
+	addr = (uint64_t)(uintptr_t)table;
+	memcpy(mem + j->table_imm, &addr, sizeof addr);
+
+	if (mprotect(mem, len, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, len);
+		return NULL;
+	}
+
+	jit = xmalloc(sizeof *jit);
+	jit->mem = mem;
+	jit->len = len;
+
+	return jit;
+}
+
+int
+jvst_vm_jit(struct jvst_vm_program *prog)
+{
+	struct jit j = { 0 };
+	struct jvst_vm_jit *jit;
+	size_t pc;
+	int ret;
+
+	if (prog->jit != NULL) {
+		return 0;
+	}
+
+	// generated C validators are already compiled
+	if (prog->native != NULL) {
+		return -1;
+	}
+
+	// lazy programs grow as they run, past the code that would have
+	// been compiled here
+	if (prog->lazy != NULL) {
+		return -1;
+	}
+
+	if (prog->ncode > INT32_MAX / 64) {
+		return -1;
+	}
+
+	j.prog = prog;
+	j.nlabels = prog->ncode + NUM_EXTRA_LABELS;
+	j.labels = xcalloc(j.nlabels, sizeof j.labels[0]);
+
+	jit_prologue(&j);
+
+	ret = 0;
+	for (pc=0; pc < prog->ncode && ret == 0; pc++) {
+		j.labels[pc] = j.len;
+		ret = jit_op(&j, pc);
+	}
+
+	// as in the interpreter, running off the end of the code is an error
+	j.labels[prog->ncode] = j.len;
+	jit_save(&j, prog->ncode);
+	jit_return_error(&j, JVST_INVALID_VM_BAD_PC);
+
+	jit = NULL;
+	if (ret == 0) {
+		jit = jit_place(&j);
+	}
+
+	free(j.code);
+	free(j.labels);
+	free(j.fixups);
+
+	if (jit == NULL) {
+		return -1;
+	}
+
+	prog->jit = jit;
+	prog->native = (enum jvst_result (*)(struct jvst_vm *))(uintptr_t)jit->mem;
+	return 0;
+}
+
+void
+jvst_vm_jit_free(struct jvst_vm_jit *jit)
+{
+	if (jit == NULL) {
+		return;
+	}
+
+	munmap(jit->mem, jit->len);
+	free(jit);
+}
+
+#else /* !JIT_X86_64 */
+
+int
+jvst_vm_jit(struct jvst_vm_program *prog)
+{
+	(void)prog;
+	return -1;
+}
+
+void
+jvst_vm_jit_free(struct jvst_vm_jit *jit)
+{
+	(void)jit;
+}
+
+#endif /* JIT_X86_64 */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -0,0 +1,31 @@
+#ifndef VALIDATE_JIT_H
+#define VALIDATE_JIT_H
+
+/* Compiling VM programs to machine code at load time.
+ *
+ * jvst_vm_jit() translates the code of a program to x86-64 machine code
+ * with a template for each instruction.  The VM then runs the machine
+ * code in place of the interpreter, for every VM started with the
+ * program.  Instructions that need the runtime (TOKEN, MATCH, SPLIT,
+ * UNIQUE, ...) call the functions in validate_native.h.
+ *
+ * The interpreter remains the reference: programs that aren't compiled
+ * run as before.
+ */
+
+struct jvst_vm_program;
+struct jvst_vm_jit;
+
+// Compiles prog.  Returns 0 on success, or -1 if the program can't be
+// compiled (the JIT is only available on x86-64 with POSIX mmap), in
+// which case prog is still interpreted.
+int
+jvst_vm_jit(struct jvst_vm_program *prog);
+
+// Frees the machine code.  Called by jvst_vm_program_free().
+void
+jvst_vm_jit_free(struct jvst_vm_jit *jit);
+
+#endif /* VALIDATE_JIT_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -0,0 +1,349 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "validate_lazy.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xalloc.h"
+#include "hmap.h"
+#include "validate.h"
+#include "validate_constraints.h"
+#include "validate_ir.h"
+#include "validate_op.h"
+#include "validate_vm.h"
+#include "validate_link.h"
+#include "validate_verify.h"
+
+enum { DEF_MAP_SIZE = 256 };
+#define DEF_MAP_MAXLOAD 0.65f
+
+// A tree of the cnode forest: the root, or a definition that something
+// refers to.  Each is compiled as a module of its own.
+struct lazy_def {
+	struct jvst_cnode *tree;
+	struct jvst_vm_module *mod;	// NULL until compiled
+};
+
+// a CALL to a definition that wasn't compiled when the CALL was linked
+struct lazy_stub {
+	uint32_t pc;
+	struct lazy_def *def;
+};
+
+struct jvst_vm_lazy {
+	// translated, but not simplified, trees of the schema
+	struct jvst_cnode_forest *forest;
+
+	// one def for each tree of the forest, defs[0] is the root
+	size_t ndefs;
+	struct lazy_def *defs;
+	struct hmap *tree_defs;		// tree -> def
+
+	// compiled modules, in the order they're linked
+	size_t nmods;
+	size_t maxmods;
+	struct jvst_vm_module **mods;
+	size_t ncode;			// code of all of the modules
+
+	// stubs in order of pc.  Once a definition is compiled, its stubs
+	// are linked to it, but they're left here.
+	size_t nstubs;
+	size_t maxstubs;
+	struct lazy_stub *stubs;
+
+	// every program linked, each one extending the one before
+	size_t nprogs;
+	size_t maxprogs;
+	struct jvst_vm_program **progs;
+};
+
+// the compiler's state is global, so all lazy programs share one lock
+static pthread_mutex_t lazy_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+lazy_lock(void)
+{
+	if (pthread_mutex_lock(&lazy_mutex) != 0) {
+		fprintf(stderr, "%s:%d (%s) could not lock mutex\n",
+			__FILE__, __LINE__, __func__);
+		abort();
+	}
+}
+
+static void
+lazy_unlock(void)
+{
+	if (pthread_mutex_unlock(&lazy_mutex) != 0) {
+		fprintf(stderr, "%s:%d (%s) could not unlock mutex\n",
+			__FILE__, __LINE__, __func__);
+		abort();
+	}
+}
+
+struct lazy_ids {
+	struct jvst_cnode *tree;
+	struct jvst_cnode_id_table *ref_ids;
+};
+
+static int
+lazy_add_id(void *opaque, struct json_string *k, struct jvst_cnode **ctreep)
+{
+	struct lazy_ids *ids = opaque;
+
+	assert(ctreep != NULL);
+
+	if (*ctreep != ids->tree) {
+		return 1;
+	}
+
+	if (!jvst_cnode_id_table_add(ids->ref_ids, *k, *ctreep)) {
+		fprintf(stderr, "could not add entry to cnode ID table\n");
+		abort();
+	}
+
+	return 1;
+}
+
+// Compiles one tree of the forest as a module, which exports the ids
+// of the tree and imports the ids of any other trees it refers to
+static struct jvst_vm_module *
+lazy_compile_tree(struct jvst_cnode_forest *forest, struct jvst_cnode *tree)
+{
+	struct jvst_cnode_forest *ctrees;
+	struct jvst_ir_forest *ir_forest;
+	struct jvst_ir_stmt *linearized, *flattened;
+	struct jvst_op_program *opasm;
+	struct jvst_vm_module *mod;
+	struct lazy_ids ids;
+
+	ctrees = jvst_cnode_forest_new();
+	jvst_cnode_forest_add_tree(ctrees, tree);
+
+	ids.tree = tree;
+	ids.ref_ids = ctrees->ref_ids;
+	jvst_cnode_id_table_foreach(forest->ref_ids, lazy_add_id, &ids);
+
+	jvst_cnode_simplify_forest(ctrees);
+	jvst_cnode_canonify_forest(ctrees);
+
+	ir_forest = jvst_ir_translate_forest(ctrees);
+	linearized = jvst_ir_linearize_module(ir_forest);
+	flattened = jvst_ir_flatten(linearized);
+
+	opasm = jvst_op_assemble(flattened);
+	mod = jvst_op_encode_module(opasm);
+
+	jvst_ir_forest_free(ir_forest);
+	jvst_cnode_forest_delete(ctrees);
+
+	return mod;
+}
+
+static int
+lazy_stub_cmp(const void *p0, const void *p1)
+{
+	const struct lazy_stub *s0 = p0, *s1 = p1;
+
+	return (s0->pc > s1->pc) - (s0->pc < s1->pc);
+}
+
+static const struct lazy_stub *
+lazy_find_stub(const struct jvst_vm_lazy *lazy, uint32_t pc)
+{
+	struct lazy_stub key;
+
+	key.pc = pc;
+	key.def = NULL;
+
+	return bsearch(&key, lazy->stubs, lazy->nstubs, sizeof lazy->stubs[0], lazy_stub_cmp);
+}
+
+static int
+is_stub(const struct jvst_vm_program *prog, uint32_t pc)
+{
+	return pc < prog->ncode &&
+		jvst_vm_decode_op(prog->code[pc]) == JVST_OP_CALL &&
+		jvst_vm_tobarg(jvst_vm_decode_barg(prog->code[pc])) == 0;
+}
+
+// Records the imports of mod, linked at base, that are stubs
+static void
+lazy_add_stubs(struct jvst_vm_lazy *lazy, const struct jvst_vm_module *mod, size_t base)
+{
+	size_t i, n0;
+
+	n0 = lazy->nstubs;
+	for (i=0; i < mod->nimport; i++) {
+		const struct jvst_vm_symbol *sym = &mod->imports[i];
+		struct jvst_cnode *tree;
+		struct lazy_def *def;
+
+		tree = jvst_cnode_id_table_lookup(lazy->forest->ref_ids, sym->id);
+		if (tree == NULL) {
+			fprintf(stderr, "UNRESOLVED reference \"%s\"\n", sym->id.s);
+			abort();
+		}
+
+		def = hmap_getptr(lazy->tree_defs, tree);
+		assert(def != NULL);
+
+		if (def->mod != NULL) {
+			continue;
+		}
+
+		if (lazy->nstubs >= lazy->maxstubs) {
+			lazy->stubs = xenlargevec(lazy->stubs, &lazy->maxstubs, 1, sizeof lazy->stubs[0]);
+		}
+
+		lazy->stubs[lazy->nstubs].pc = base + sym->off;
+		lazy->stubs[lazy->nstubs].def = def;
+		lazy->nstubs++;
+	}
+
+	// modules are linked in order, so only the new stubs need sorting
+	qsort(&lazy->stubs[n0], lazy->nstubs - n0, sizeof lazy->stubs[0], lazy_stub_cmp);
+}
+
+// Compiles def and links it after the modules compiled so far
+static void
+lazy_add_def(struct jvst_vm_lazy *lazy, struct lazy_def *def)
+{
+	struct jvst_vm_program *prog;
+	size_t base;
+
+	assert(def->mod == NULL);
+
+	def->mod = lazy_compile_tree(lazy->forest, def->tree);
+
+	if (lazy->nmods >= lazy->maxmods) {
+		lazy->mods = xenlargevec(lazy->mods, &lazy->maxmods, 1, sizeof lazy->mods[0]);
+	}
+	lazy->mods[lazy->nmods++] = def->mod;
+
+	base = lazy->ncode;
+	lazy->ncode += def->mod->prog->ncode;
+	lazy_add_stubs(lazy, def->mod, base);
+
+	prog = jvst_vm_link_stubs(lazy->mods, lazy->nmods);
+	prog->lazy = lazy;
+
+	// programs after a verified one are run as if they were verified
+	if (lazy->nprogs > 0 && lazy->progs[0]->verified) {
+		struct jvst_vm_verify_error err;
+
+		if (jvst_vm_verify(prog, &err) != 0) {
+			fprintf(stderr, "%s:%d (%s) lazily linked program failed verification "
+				"at pc %" PRIu32 ": %s\n",
+				__FILE__, __LINE__, __func__, err.pc, err.msg);
+			abort();
+		}
+	}
+
+	if (lazy->nprogs >= lazy->maxprogs) {
+		lazy->progs = xenlargevec(lazy->progs, &lazy->maxprogs, 1, sizeof lazy->progs[0]);
+	}
+	lazy->progs[lazy->nprogs++] = prog;
+}
+
+struct jvst_vm_program *
+jvst_compile_lazy(const struct ast_schema *schema)
+{
+	struct jvst_vm_lazy *lazy;
+	struct jvst_vm_program *prog;
+	size_t i;
+
+	lazy = xcalloc(1, sizeof *lazy);
+
+	lazy_lock();
+
+	lazy->forest = jvst_cnode_translate_ast_with_ids(schema);
+	assert(lazy->forest->len > 0);
+
+	lazy->ndefs = lazy->forest->len;
+	lazy->defs = xcalloc(lazy->ndefs, sizeof lazy->defs[0]);
+	lazy->tree_defs = hmap_create_pointer(DEF_MAP_SIZE, DEF_MAP_MAXLOAD);
+
+	for (i=0; i < lazy->ndefs; i++) {
+		lazy->defs[i].tree = lazy->forest->trees[i];
+
+		if (!hmap_setptr(lazy->tree_defs, lazy->defs[i].tree, &lazy->defs[i])) {
+			fprintf(stderr, "could not add entry to definition table\n");
+			abort();
+		}
+	}
+
+	// trees[0] is always the root
+	lazy_add_def(lazy, &lazy->defs[0]);
+	prog = lazy->progs[0];
+
+	lazy_unlock();
+
+	return prog;
+}
+
+struct jvst_vm_program *
+jvst_vm_lazy_resolve(struct jvst_vm_lazy *lazy, uint32_t pc)
+{
+	struct jvst_vm_program *prog;
+
+	assert(lazy != NULL);
+
+	lazy_lock();
+
+	// another VM may have compiled the definition already
+	prog = lazy->progs[lazy->nprogs-1];
+	if (is_stub(prog, pc)) {
+		const struct lazy_stub *stub;
+
+		stub = lazy_find_stub(lazy, pc);
+		if (stub == NULL) {
+			fprintf(stderr, "%s:%d (%s) CALL at pc %" PRIu32 " is not a stub\n",
+				__FILE__, __LINE__, __func__, pc);
+			abort();
+		}
+
+		lazy_add_def(lazy, stub->def);
+		prog = lazy->progs[lazy->nprogs-1];
+	}
+
+	lazy_unlock();
+
+	return prog;
+}
+
+void
+jvst_vm_lazy_release(struct jvst_vm_program *prog)
+{
+	struct jvst_vm_lazy *lazy;
+	size_t i;
+
+	lazy = prog->lazy;
+	if (lazy == NULL || lazy->progs[0] != prog) {
+		return;
+	}
+
+	for (i=1; i < lazy->nprogs; i++) {
+		lazy->progs[i]->lazy = NULL;
+		jvst_vm_program_free(lazy->progs[i]);
+	}
+	free(lazy->progs);
+
+	for (i=0; i < lazy->nmods; i++) {
+		jvst_vm_module_free(lazy->mods[i]);
+	}
+	free(lazy->mods);
+
+	hmap_free(lazy->tree_defs);
+	free(lazy->defs);
+	free(lazy->stubs);
+	jvst_cnode_forest_delete(lazy->forest);
+	free(lazy);
+
+	prog->lazy = NULL;
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -0,0 +1,47 @@
+#ifndef VALIDATE_LAZY_H
+#define VALIDATE_LAZY_H
+
+#include <stdint.h>
+
+/* Programs that compile definitions on their first CALL.
+ *
+ * A schema that pulls in a large registry of definitions usually only
+ * uses a few of them for any one document.  jvst_compile_lazy() (see
+ * validate.h) compiles the root of the schema as a module (see
+ * validate_link.h), and links it with its CALLs into definitions left
+ * as stubs.  The first VM to reach a stub compiles the definition as a
+ * module of its own, and links it after the modules compiled so far.
+ *
+ * Linking appends code and data, so each program linked this way
+ * extends the one before it: code, pools, DFAs and splits keep their
+ * offsets.  A VM at a stub switches to the newest program and carries
+ * on from the same pc.  Programs don't change once they're linked, so
+ * VMs in other threads keep running the programs they have.  Every
+ * program is kept until the one jvst_compile_lazy() returned is freed.
+ *
+ * If that program was verified, each program after it is verified as
+ * it's linked.  Lazy programs can't be compiled to machine code or C.
+ *
+ * The compiler keeps global state, so compiling at a stub is serialized
+ * with other lazy programs, but can't run at the same time as
+ * jvst_compile_schema() and friends.  The schema has to outlive the
+ * program.
+ */
+
+struct jvst_vm_lazy;
+struct jvst_vm_program;
+
+// Returns a program in which the CALL at pc calls the definition it is
+// a stub for, compiling the definition if no VM has yet
+struct jvst_vm_program *
+jvst_vm_lazy_resolve(struct jvst_vm_lazy *lazy, uint32_t pc);
+
+// Frees the programs linked after prog, and their modules, if prog is
+// the program jvst_compile_lazy() returned.  Called by
+// jvst_vm_program_free().
+void
+jvst_vm_lazy_release(struct jvst_vm_program *prog);
+
+#endif /* VALIDATE_LAZY_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
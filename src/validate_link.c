@@ -0,0 +1,353 @@
+#include "validate_link.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xalloc.h"
+#include "hmap.h"
+#include "validate_vm.h"
+
+enum { EXPORT_MAP_SIZE = 256 };
+#define EXPORT_MAP_MAXLOAD 0.65f
+
+void
+jvst_vm_module_free(struct jvst_vm_module *mod)
+{
+	size_t i;
+
+	if (mod == NULL) {
+		return;
+	}
+
+	if (mod->prog != NULL) {
+		jvst_vm_program_free(mod->prog);
+	}
+
+	for (i=0; i < mod->nexport; i++) {
+		json_str_free(mod->exports[i].id);
+	}
+	free(mod->exports);
+
+	for (i=0; i < mod->nimport; i++) {
+		json_str_free(mod->imports[i].id);
+	}
+	free(mod->imports);
+
+	free(mod);
+}
+
+// where each module's code and data start in the linked program
+struct link_base {
+	size_t code;
+	size_t nfloat;
+	size_t nconst;
+	size_t ndfa;
+	size_t nsplit;
+	size_t nentries;
+};
+
+static size_t
+prog_split_entries(const struct jvst_vm_program *prog)
+{
+	return (prog->nsplit > 0) ? prog->sdata[prog->nsplit] : 0;
+}
+
+static uint32_t
+link_rebase_lit(uint32_t arg, size_t base, const char *what)
+{
+	int ind;
+
+	if (!jvst_vm_arg_islit(arg)) {
+		fprintf(stderr, "cannot link %s index that is not a literal\n", what);
+		abort();
+	}
+
+	ind = jvst_vm_arg_tolit(arg);
+	if (ind < 0 || base > (size_t)(JVST_VM_MAXLIT - ind)) {
+		fprintf(stderr, "%s index %zu is too large for a linked program\n",
+			what, base + (size_t)ind);
+		abort();
+	}
+
+	return jvst_vm_arg_lit(ind + (int)base);
+}
+
+static void
+link_rebase_code(uint32_t *code, size_t ncode, const struct link_base *b)
+{
+	size_t pc;
+
+	for (pc=0; pc < ncode; pc++) {
+		uint32_t a0,a1;
+		enum jvst_vm_op op;
+
+		op = jvst_vm_decode_op(code[pc]);
+		a0 = jvst_vm_decode_arg0(code[pc]);
+		a1 = jvst_vm_decode_arg1(code[pc]);
+
+		switch (op) {
+		case JVST_OP_FLOAD:
+			a1 = link_rebase_lit(a1, b->nfloat, "float pool");
+			break;
+
+		case JVST_OP_ILOAD:
+			a1 = link_rebase_lit(a1, b->nconst, "const pool");
+			break;
+
+		case JVST_OP_MATCH:
+			a0 = link_rebase_lit(a0, b->ndfa, "DFA");
+			break;
+
+		case JVST_OP_SPLIT:
+		case JVST_OP_SPLITV:
+			a0 = link_rebase_lit(a0, b->nsplit, "split");
+			break;
+
+		default:
+			// branches and calls within a module are relative,
+			// and nothing else refers to module data
+			continue;
+		}
+
+		code[pc] = VMOP(op, a0, a1);
+	}
+}
+
+static struct hmap *
+link_exports(struct jvst_vm_module *const *mods, size_t nmods, const struct link_base *bases)
+{
+	struct hmap *exports;
+	size_t m;
+
+	exports = hmap_create_string(EXPORT_MAP_SIZE, EXPORT_MAP_MAXLOAD);
+
+	for (m=0; m < nmods; m++) {
+		size_t i;
+
+		for (i=0; i < mods[m]->nexport; i++) {
+			const struct jvst_vm_symbol *sym = &mods[m]->exports[i];
+
+			// json_strdup() leaves ids nul-terminated
+			if (hmap_get(exports, sym->id.s) != NULL) {
+				fprintf(stderr, "id \"%s\" is exported by more than one module\n",
+					sym->id.s);
+				abort();
+			}
+
+			if (!hmap_setuint(exports, (void *)sym->id.s, bases[m].code + sym->off)) {
+				fprintf(stderr, "could not add entry to export table\n");
+				abort();
+			}
+		}
+	}
+
+	return exports;
+}
+
+// Concatenates the modules' source maps.  Each module's locations and
+// keywords are copied whole, after the empty location at offset zero, and a module
+// without a source map gets a range of unknown location so it doesn't
+// take the location of the module before it.
+static void
+link_srcmap(struct jvst_vm_program *prog, struct jvst_vm_module *const *mods, size_t nmods,
+	const struct link_base *bases)
+{
+	size_t m, nmap, nstr;
+
+	nmap = 0;
+	nstr = 1;
+	for (m=0; m < nmods; m++) {
+		nmap += mods[m]->prog->nsrcmap + 1;
+		nstr += mods[m]->prog->nsrcstr;
+	}
+
+	if (nstr == 1) {
+		return;
+	}
+
+	prog->srcmap = xmalloc(nmap * sizeof prog->srcmap[0]);
+	prog->srcstr = xmalloc(nstr);
+	prog->srcstr[0] = '\0';
+
+	nmap = 0;
+	nstr = 1;
+	for (m=0; m < nmods; m++) {
+		const struct jvst_vm_program *mp = mods[m]->prog;
+		size_t i;
+
+		if (mp->ncode == 0) {
+			continue;
+		}
+
+		if (mp->nsrcmap == 0 || mp->srcmap[0].pc > 0) {
+			prog->srcmap[nmap].pc  = bases[m].code;
+			prog->srcmap[nmap].loc = 0;
+			prog->srcmap[nmap].kw  = 0;
+			nmap++;
+		}
+
+		for (i=0; i < mp->nsrcmap; i++) {
+			prog->srcmap[nmap].pc  = bases[m].code + mp->srcmap[i].pc;
+			prog->srcmap[nmap].loc = (mp->srcmap[i].loc > 0) ? nstr + mp->srcmap[i].loc : 0;
+			prog->srcmap[nmap].kw  = (mp->srcmap[i].kw > 0) ? nstr + mp->srcmap[i].kw : 0;
+			nmap++;
+		}
+
+		if (mp->nsrcstr > 0) {
+			memcpy(&prog->srcstr[nstr], mp->srcstr, mp->nsrcstr);
+			nstr += mp->nsrcstr;
+		}
+	}
+
+	prog->nsrcmap = nmap;
+	prog->nsrcstr = nstr;
+}
+
+static struct jvst_vm_program *
+link_modules(struct jvst_vm_module *const *mods, size_t nmods, int stubs)
+{
+	struct jvst_vm_program *prog;
+	struct link_base *bases, total = { 0 };
+	struct hmap *exports;
+	size_t m;
+
+	assert(nmods > 0);
+
+	bases = xcalloc(nmods, sizeof bases[0]);
+	for (m=0; m < nmods; m++) {
+		const struct jvst_vm_program *mp = mods[m]->prog;
+
+		bases[m] = total;
+
+		total.code     += mp->ncode;
+		total.nfloat   += mp->nfloat;
+		total.nconst   += mp->nconst;
+		total.ndfa     += mp->ndfa;
+		total.nsplit   += mp->nsplit;
+		total.nentries += prog_split_entries(mp);
+	}
+
+	prog = xmalloc(sizeof *prog);
+	memset(prog, 0, sizeof *prog);
+
+	prog->ncode = total.code;
+	prog->code = xmalloc(total.code * sizeof prog->code[0]);
+
+	if (total.nfloat > 0) {
+		prog->nfloat = total.nfloat;
+		prog->fdata = xmalloc(total.nfloat * sizeof prog->fdata[0]);
+	}
+
+	if (total.nconst > 0) {
+		prog->nconst = total.nconst;
+		prog->cdata = xmalloc(total.nconst * sizeof prog->cdata[0]);
+	}
+
+	if (total.ndfa > 0) {
+		prog->ndfa = total.ndfa;
+		prog->dfas = xmalloc(total.ndfa * sizeof prog->dfas[0]);
+	}
+
+	// split data is the offsets of each split's entries, followed
+	// by the entries, which are the code offsets of the procs
+	if (total.nsplit > 0) {
+		prog->nsplit = total.nsplit;
+		prog->sdata = xmalloc((total.nsplit + 1 + total.nentries) * sizeof prog->sdata[0]);
+		prog->sdata[0] = 0;
+	}
+
+	for (m=0; m < nmods; m++) {
+		const struct jvst_vm_program *mp = mods[m]->prog;
+		const struct link_base *b = &bases[m];
+		size_t i;
+
+		memcpy(&prog->code[b->code], mp->code, mp->ncode * sizeof mp->code[0]);
+		link_rebase_code(&prog->code[b->code], mp->ncode, b);
+
+		if (mp->nfloat > 0) {
+			memcpy(&prog->fdata[b->nfloat], mp->fdata, mp->nfloat * sizeof mp->fdata[0]);
+		}
+
+		if (mp->nconst > 0) {
+			memcpy(&prog->cdata[b->nconst], mp->cdata, mp->nconst * sizeof mp->cdata[0]);
+		}
+
+		for (i=0; i < mp->ndfa; i++) {
+			jvst_vm_dfa_copy(&prog->dfas[b->ndfa + i], &mp->dfas[i]);
+		}
+
+		for (i=0; i < mp->nsplit; i++) {
+			prog->sdata[1 + b->nsplit + i] = b->nentries + mp->sdata[1 + i];
+		}
+
+		for (i=0; i < prog_split_entries(mp); i++) {
+			prog->sdata[1 + total.nsplit + b->nentries + i] =
+				b->code + mp->sdata[1 + mp->nsplit + i];
+		}
+	}
+
+	link_srcmap(prog, mods, nmods, bases);
+
+	// patch the imported CALLs
+	exports = link_exports(mods, nmods, bases);
+
+	for (m=0; m < nmods; m++) {
+		size_t i;
+
+		for (i=0; i < mods[m]->nimport; i++) {
+			const struct jvst_vm_symbol *sym = &mods[m]->imports[i];
+			union hmap_value *v;
+			int64_t cp, delta;
+
+			v = hmap_get(exports, sym->id.s);
+			if (v == NULL && stubs) {
+				continue;
+			}
+
+			if (v == NULL) {
+				fprintf(stderr, "UNRESOLVED reference \"%s\"\n", sym->id.s);
+				abort();
+			}
+
+			cp = bases[m].code + sym->off;
+			assert(jvst_vm_decode_op(prog->code[cp]) == JVST_OP_CALL);
+			assert(jvst_vm_decode_op(prog->code[v->u]) == JVST_OP_PROC);
+
+			delta = (int64_t)v->u - cp;
+			if (delta < JVST_VM_BARG_MIN || delta > JVST_VM_BARG_MAX) {
+				fprintf(stderr, "%s:%d (%s) unsupported branch distance %" PRId64 "\n",
+					__FILE__, __LINE__, __func__, delta);
+				abort();
+			}
+
+			prog->code[cp] = VMBR(JVST_OP_CALL, JVST_VM_BR_ALWAYS, (long)delta);
+		}
+	}
+
+	hmap_free(exports);
+	free(bases);
+
+	// the call graph is complete unless there are stubs left, which
+	// leaves the program without a stack bound
+	prog->maxstack = jvst_vm_stack_bound(prog);
+
+	return prog;
+}
+
+struct jvst_vm_program *
+jvst_vm_link(struct jvst_vm_module *const *mods, size_t nmods)
+{
+	return link_modules(mods, nmods, 0);
+}
+
+struct jvst_vm_program *
+jvst_vm_link_stubs(struct jvst_vm_module *const *mods, size_t nmods)
+{
+	return link_modules(mods, nmods, 1);
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
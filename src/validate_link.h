@@ -0,0 +1,61 @@
+#ifndef VALIDATE_LINK_H
+#define VALIDATE_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jdom.h"
+
+/* Separate compilation and linking of schema documents.
+ *
+ * A module is the program compiled from a single schema document, with
+ * its references to other documents left unresolved.  Each unresolved
+ * reference is encoded as a CALL with a zero offset and listed as an
+ * import.  The root of the document and each of its definitions are
+ * listed as exports, along with the offset of their PROC.
+ *
+ * Linking concatenates the code of the modules and appends their float
+ * and constant pools, DFA tables and split lists.  It then rebases the
+ * pool, DFA and split indexes in each module's code, and patches each
+ * imported CALL to call the PROC exported under the same id.  When a
+ * document changes, only its module needs to be compiled again before
+ * relinking.
+ */
+
+struct jvst_vm_program;
+
+struct jvst_vm_symbol {
+	struct json_string id;
+	uint32_t off;		// exports: offset of the PROC.  imports: offset of the CALL
+};
+
+struct jvst_vm_module {
+	struct jvst_vm_program *prog;
+
+	size_t nexport;
+	struct jvst_vm_symbol *exports;
+
+	size_t nimport;
+	struct jvst_vm_symbol *imports;
+};
+
+void
+jvst_vm_module_free(struct jvst_vm_module *mod);
+
+/* Links modules into a single program, which starts with the root of
+ * the first module.  Aborts if an import isn't exported by any of the
+ * modules, or if two modules export the same id.
+ */
+struct jvst_vm_program *
+jvst_vm_link(struct jvst_vm_module *const *mods, size_t nmods);
+
+/* Like jvst_vm_link(), but leaves each import that no module exports
+ * as a stub: a CALL with a zero offset.  Programs with stubs have no
+ * stack bound, and can only be run if they're lazy (see validate_lazy.h).
+ */
+struct jvst_vm_program *
+jvst_vm_link_stubs(struct jvst_vm_module *const *mods, size_t nmods);
+
+#endif /* VALIDATE_LINK_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
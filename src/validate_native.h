@@ -0,0 +1,79 @@
+#ifndef VALIDATE_NATIVE_H
+#define VALIDATE_NATIVE_H
+
+/* Runtime for validators generated by jvst_vm_program_genc().
+ *
+ * The generated code inlines the simple instructions and calls these
+ * functions for the ones that touch the token stream, the call stack,
+ * splits or unique state.  They behave like the instructions of the
+ * same name in the interpreter.  The VM registers are kept in the VM:
+ * %fp and %sp in r_fp and r_sp, and the generated code stores the pc
+ * and flag in r_pc and r_flag before any call that can suspend.
+ *
+ * Calls that can suspend return the result the VM should return, or
+ * JVST_VALID (JVST_INDETERMINATE for RETURN and UNIQUE) if the code
+ * should continue with the next instruction.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "validate.h"
+#include "validate_ir.h"  // for INVALID codes
+#include "validate_vm.h"
+
+// PROC: sets up a frame with nslots slots after the registers, for a
+// proc with the JVST_VM_PROC_xxx flags.  Returns JVST_INVALID if the
+// stack would overflow.
+enum jvst_result
+jvst_vm_native_proc(struct jvst_vm *vm, int nslots, uint32_t flags);
+
+// CALL: pushes the return address and frame pointer.  Returns
+// JVST_INVALID if the stack would overflow.
+enum jvst_result
+jvst_vm_native_call(struct jvst_vm *vm, uint32_t pc);
+
+// RETURN with no error: consumes the current value and pops the frame.
+// Returns JVST_INDETERMINATE and sets *pcp to continue after the CALL,
+// or the result of the VM.
+enum jvst_result
+jvst_vm_native_return(struct jvst_vm *vm, uint32_t *pcp);
+
+// TOKEN: returns non-zero if the VM needs the next token
+int
+jvst_vm_native_token(struct jvst_vm *vm);
+
+// TOKEN with -1: pushes the current token back
+void
+jvst_vm_native_unget(struct jvst_vm *vm);
+
+enum jvst_result
+jvst_vm_native_consume(struct jvst_vm *vm);
+
+enum jvst_result
+jvst_vm_native_match(struct jvst_vm *vm, int64_t dfa);
+
+// SPLIT and SPLITV, with the split index and the slot of the result
+enum jvst_result
+jvst_vm_native_split(struct jvst_vm *vm, int64_t split, int slot, int splitv);
+
+// UNIQUE: returns JVST_INDETERMINATE to continue
+enum jvst_result
+jvst_vm_native_unique(struct jvst_vm *vm, int wh);
+
+// FCMP and FINT where an argument is %TNUM, which needs the lexeme of
+// the current token to compare integers exactly
+int64_t
+jvst_vm_native_fcmp(struct jvst_vm *vm, uint32_t opcode);
+
+int64_t
+jvst_vm_native_fint(struct jvst_vm *vm, uint32_t opcode);
+
+// BCOUNT: range has the first bit in the high 32 bits and the last in
+// the low 32 bits
+uint64_t
+jvst_vm_native_bcount(struct jvst_vm *vm, const union jvst_vm_stackval *bv, uint64_t range);
+
+#endif /* VALIDATE_NATIVE_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
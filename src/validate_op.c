@@ -21,6 +21,10 @@
 #include "jvst_macros.h"
 
 #include "validate_sbuf.h"
+#include "validate_constraints.h"
+#include "idtbl.h"
+#include "hmap.h"
+#include "xxhash.h"
 
 #define DEBUG_DFA 0
 
@@ -330,6 +334,7 @@ op_instr_dump(struct sbuf *buf, struct jvst_op_instr *instr)
 
 	case JVST_OP_BAND:
 	case JVST_OP_BSET:
+	case JVST_OP_BCOUNT:
 		sbuf_snprintf(buf, "%s ", jvst_op_name(instr->op));
 		op_arg_dump(buf, instr->args[0]);
 		sbuf_snprintf(buf, ", ", jvst_op_name(instr->op));
@@ -634,6 +639,7 @@ asm_fixup_addr(struct asm_addr_fixup *fix)
 	case JVST_OP_INCR:
 	case JVST_OP_BSET:
 	case JVST_OP_BAND:
+	case JVST_OP_BCOUNT:
 	case JVST_OP_RETURN:
 	case JVST_OP_MOVE:
 	case JVST_OP_UNIQUE:
@@ -673,6 +679,10 @@ struct op_assembler {
 	int64_t *cdata;
 	size_t maxconst;
 
+	/* pool entries by value, see pool_key() */
+	struct hmap *floats;
+	struct hmap *consts;
+
 	/* split lists
 	 *
 	 * lists are maintained with two structures:
@@ -891,23 +901,82 @@ proc_add_split(struct op_assembler *opasm, struct jvst_op_instr *instr, struct j
 	return (int64_t)ind;
 }
 
+// The float and integer pools are indexed by hmaps whose keys are pool
+// indices plus one (keys can't be NULL), hashed and compared on the
+// value at that index.  A new value is written to the first free entry
+// before it's looked up, so it has an index too.
+static void *
+pool_key(size_t ind)
+{
+	return (void *)(uintptr_t)(ind+1);
+}
+
+static size_t
+pool_ind(const void *k)
+{
+	return (size_t)((uintptr_t)k - 1);
+}
+
+// compares bits rather than values to keep -0.0 and 0.0 apart
+static uint64_t
+float_pool_hash(void *opaque, const void *k)
+{
+	const struct jvst_op_program *prog = opaque;
+	return XXH64(&prog->fdata[pool_ind(k)], sizeof prog->fdata[0], 0);
+}
+
+static int
+float_pool_equals(void *opaque, const void *k1, const void *k2)
+{
+	const struct jvst_op_program *prog = opaque;
+	return memcmp(&prog->fdata[pool_ind(k1)], &prog->fdata[pool_ind(k2)], sizeof prog->fdata[0]) == 0;
+}
+
+static uint64_t
+const_pool_hash(void *opaque, const void *k)
+{
+	const struct jvst_op_program *prog = opaque;
+	return XXH64(&prog->cdata[pool_ind(k)], sizeof prog->cdata[0], 0);
+}
+
+static int
+const_pool_equals(void *opaque, const void *k1, const void *k2)
+{
+	const struct jvst_op_program *prog = opaque;
+	return prog->cdata[pool_ind(k1)] == prog->cdata[pool_ind(k2)];
+}
+
 static int64_t
 proc_add_float(struct op_assembler *opasm, double v)
 {
 	struct jvst_op_program *prog;
+	union hmap_value *hv;
 	size_t ind;
 
 	prog = opasm->prog;
 	assert(prog != NULL);
 
-	ind = prog->nfloat++;
-	if (prog->nfloat > opasm->maxfloat) {
+	ind = prog->nfloat;
+	if (ind >= opasm->maxfloat) {
 		opasm->fdata = xenlargevec(opasm->fdata, &opasm->maxfloat, 1, sizeof opasm->fdata[0]);
 		prog->fdata = opasm->fdata;
 	}
 
 	prog->fdata[ind] = v;
 
+	// reuse an existing pool entry
+	hv = hmap_get(opasm->floats, pool_key(ind));
+	if (hv != NULL) {
+		return hv->i;
+	}
+
+	if (!hmap_setint(opasm->floats, pool_key(ind), (int64_t)ind)) {
+		perror("adding float to pool");
+		abort();
+	}
+
+	prog->nfloat++;
+
 	return (int64_t)ind;
 }
 
@@ -915,27 +984,54 @@ static int64_t
 proc_add_uconst(struct op_assembler *opasm, uint64_t v)
 {
 	struct jvst_op_program *prog;
+	union hmap_value *hv;
 	size_t ind;
 
 	prog = opasm->prog;
 	assert(prog != NULL);
 
-	ind = prog->nconst++;
-	if (prog->nconst > opasm->maxconst) {
+	ind = prog->nconst;
+	if (ind >= opasm->maxconst) {
 		opasm->cdata = xenlargevec(opasm->cdata, &opasm->maxconst, 1, sizeof opasm->cdata[0]);
 		prog->cdata = opasm->cdata;
 	}
 
 	prog->cdata[ind] = (int64_t)v;
 
+	hv = hmap_get(opasm->consts, pool_key(ind));
+	if (hv != NULL) {
+		return hv->i;
+	}
+
+	if (!hmap_setint(opasm->consts, pool_key(ind), (int64_t)ind)) {
+		perror("adding constant to pool");
+		abort();
+	}
+
+	prog->nconst++;
+
 	return (int64_t)ind;
 }
 
+static int
+vm_dfa_same(const struct jvst_vm_dfa *a, const struct jvst_vm_dfa *b)
+{
+	size_t nelts;
+
+	if (a->nstates != b->nstates || a->nedges != b->nedges || a->nends != b->nends) {
+		return 0;
+	}
+
+	// the tables are allocated as one chunk starting at offs
+	nelts = (a->nstates+1) + 2*a->nedges + 2*a->nends;
+	return memcmp(a->offs, b->offs, nelts * sizeof a->offs[0]) == 0;
+}
+
 static int64_t
 proc_add_dfa(struct op_assembler *opasm, struct fsm *fsm)
 {
 	struct jvst_op_program *prog;
-	size_t ind;
+	size_t i, ind;
 
 	prog = opasm->prog;
 	assert(prog != NULL);
@@ -953,6 +1049,15 @@ proc_add_dfa(struct op_assembler *opasm, struct fsm *fsm)
 		jvst_vm_dfa_debug(&prog->dfas[ind]);
 	}
 
+	// identical sub-schemas produce identical DFAs, keep one copy
+	for (i=0; i < ind; i++) {
+		if (vm_dfa_same(&prog->dfas[i], &prog->dfas[ind])) {
+			jvst_vm_dfa_finalize(&prog->dfas[ind]);
+			prog->ndfa--;
+			return (int64_t)i;
+		}
+	}
+
 	return (int64_t)ind;
 }
 
@@ -1014,6 +1119,7 @@ emit_cond(struct op_assembler *opasm, enum jvst_vm_op op,
 	case JVST_OP_INCR:
 	case JVST_OP_BSET:
 	case JVST_OP_BAND:
+	case JVST_OP_BCOUNT:
 	case JVST_OP_RETURN:
 	case JVST_OP_MOVE:
 	case JVST_OP_UNIQUE:
@@ -1048,6 +1154,12 @@ op_assemble_seq(struct op_assembler *opasm, struct jvst_ir_stmt *stmt_list)
 	}
 }
 
+static size_t
+bitvec_nwords(size_t nbits)
+{
+	return (nbits > 64) ? (nbits + 63) / 64 : 1;
+}
+
 static struct jvst_op_proc *
 op_assemble_frame(struct op_assembler *opasm, struct jvst_ir_stmt *top)
 {
@@ -1069,15 +1181,17 @@ op_assemble_frame(struct op_assembler *opasm, struct jvst_ir_stmt *top)
 		stmt->u.counter.frame_off = off++;
 	}
 
-	// allocate slots for bit vectors
+	// allocate slots for bit vectors, one per 64 bits
 	for (stmt = top->u.frame.bitvecs; stmt != NULL; stmt = stmt->next) {
 		assert(stmt->type == JVST_IR_STMT_BITVECTOR);
-		stmt->u.bitvec.frame_off = off++;
+		stmt->u.bitvec.frame_off = off;
+		off += bitvec_nwords(stmt->u.bitvec.nbits);
 	}
 
 	proc = op_proc_new();
 	proc->temp_off = off;
 	proc->nslots = off + top->u.frame.ntemps;
+	proc->loc = top->u.frame.loc;
 	*opasm->procpp = proc;
 	opasm->procpp = &proc->next;
 
@@ -1223,6 +1337,88 @@ emit_float_arg(struct op_assembler *opasm, double x)
 	return freg;
 }
 
+static void
+bitvec_range(struct jvst_ir_expr *expr, size_t *b0p, size_t *b1p)
+{
+	struct jvst_ir_stmt *bv;
+	size_t nb, b0, b1;
+
+	bv = expr->u.btest.bitvec;
+	assert(bv != NULL);
+	assert(bv->type == JVST_IR_STMT_BITVECTOR);
+
+	nb = bv->u.bitvec.nbits;
+
+	b0 = expr->u.btest.b0;
+	b1 = expr->u.btest.b1;
+	if (b1 == (size_t)-1) {
+		b1 = nb-1;
+	}
+
+	if (b0 >= nb || b1 >= nb || b0 > b1) {
+		fprintf(stderr, "%s:%d (%s) invalid bit range (%zu - %zu) for bitvector with %zu bits\n",
+				__FILE__, __LINE__, __func__, b0,b1,nb);
+		abort();
+	}
+
+	*b0p = b0;
+	*b1p = b1;
+}
+
+// loads a constant that may not fit in an instruction's argument
+static struct jvst_op_arg
+emit_uconst_arg(struct op_assembler *opasm, uint64_t v)
+{
+	struct jvst_op_instr *instr;
+	struct jvst_op_arg ireg;
+
+	if (v <= MAX_CONST_VALUE) {
+		return arg_const(v);
+	}
+
+	ireg = arg_new_slot(opasm);
+	instr = op_instr_new(JVST_OP_ILOAD);
+	instr->args[0] = ireg;
+	instr->args[1] = arg_const(proc_add_uconst(opasm, v));
+	emit_instr(opasm, instr);
+
+	return ireg;
+}
+
+// BCOUNT(ireg, bitvec): counts the bits set in a range of a bitvector
+// of any width.  ireg holds the range on entry and the count on exit.
+static struct jvst_op_arg
+emit_bcount(struct op_assembler *opasm, struct jvst_ir_expr *expr)
+{
+	struct jvst_op_instr *instr;
+	struct jvst_op_arg ireg;
+	size_t b0, b1;
+	uint64_t range;
+
+	bitvec_range(expr, &b0, &b1);
+
+	if (b1 > UINT32_MAX) {
+		fprintf(stderr, "%s:%d (%s) bitvector with %zu bits is too large\n",
+				__FILE__, __LINE__, __func__, b1+1);
+		abort();
+	}
+
+	range = ((uint64_t)b0 << 32) | (uint64_t)b1;
+
+	ireg = arg_new_slot(opasm);
+	instr = op_instr_new(JVST_OP_MOVE);
+	instr->args[0] = ireg;
+	instr->args[1] = emit_uconst_arg(opasm, range);
+	emit_instr(opasm, instr);
+
+	instr = op_instr_new(JVST_OP_BCOUNT);
+	instr->args[0] = ireg;
+	instr->args[1] = arg_slot(expr->u.btest.bitvec->u.bitvec.frame_off);
+	emit_instr(opasm, instr);
+
+	return ireg;
+}
+
 static struct jvst_op_arg
 emit_op_arg(struct op_assembler *opasm, struct jvst_ir_expr *arg)
 {
@@ -1313,9 +1509,11 @@ emit_op_arg(struct op_assembler *opasm, struct jvst_ir_expr *arg)
 	case JVST_IR_EXPR_MATCH:
 		return emit_match(opasm, arg);
 
+	case JVST_IR_EXPR_BCOUNT:
+		return emit_bcount(opasm, arg);
+
 	case JVST_IR_EXPR_INT:
 	case JVST_IR_EXPR_BOOL:
-	case JVST_IR_EXPR_BCOUNT:
 		fprintf(stderr, "%s:%d (%s) expression %s not yet implemented\n",
 				__FILE__, __LINE__, __func__,
 				jvst_ir_expr_type_name(arg->type));
@@ -1584,29 +1782,22 @@ op_assemble_cond(struct op_assembler *opasm, struct jvst_ir_expr *cond)
 			assert(bv->type == JVST_IR_STMT_BITVECTOR);
 
 			nb = bv->u.bitvec.nbits;
+			bitvec_range(cond, &b0, &b1);
+			nbm = b1-b0+1;
 
-			// XXX - remove this limitation!
+			// wider bitvectors span several slots, so count the
+			// bits in the range instead of masking one slot
 			if (nb > 64) {
-				fprintf(stderr, "%s:%d (%s) bitvectors with more than 64 bits are currently unsupported\n",
-						__FILE__, __LINE__, __func__);
-				abort();
-			}
-
-			b0 = cond->u.btest.b0;
-			b1 = cond->u.btest.b1;
-			if (b1 == (size_t)-1) {
-				b1 = nb-1;
+				ireg1 = emit_bcount(opasm, cond);
+				if (cond->type == JVST_IR_EXPR_BTESTANY) {
+					emit_cond(opasm, JVST_OP_ICMP, ireg1, arg_const(0));
+					return JVST_VM_BR_NE;
+				}
+
+				emit_cond(opasm, JVST_OP_ICMP, ireg1, emit_uconst_arg(opasm, nbm));
+				return JVST_VM_BR_EQ;
 			}
 
-			if (b0 >= nb || b1 >= nb || b0 > b1) {
-				fprintf(stderr, "%s:%d (%s) invalid bit range (%zu - %zu) for bitvector with %zu bits\n",
-						__FILE__, __LINE__, __func__, b0,b1,nb);
-				abort();
-			}
-
-			nbm = b1-b0+1;
-
-			// XXX - remove 64-bit limitation!
 			if (nbm == 64) {
 				mask = ~(uint64_t)0;
 			} else {
@@ -1667,8 +1858,16 @@ op_assemble_cond(struct op_assembler *opasm, struct jvst_ir_expr *cond)
 			return brc;
 		}
 
-	case JVST_IR_EXPR_BOOL:
 	case JVST_IR_EXPR_BTESTONE:
+		{
+			struct jvst_op_arg ireg;
+
+			ireg = emit_bcount(opasm, cond);
+			emit_cond(opasm, JVST_OP_ICMP, ireg, arg_const(1));
+			return JVST_VM_BR_EQ;
+		}
+
+	case JVST_IR_EXPR_BOOL:
 		fprintf(stderr, "%s:%d (%s) expression %s not yet supported\n",
 				__FILE__, __LINE__, __func__,
 				jvst_ir_expr_type_name(cond->type));
@@ -1898,6 +2097,10 @@ op_assemble(struct op_assembler *opasm, struct jvst_ir_stmt *stmt)
 
 			instr = op_instr_new(JVST_OP_RETURN);
 			instr->args[0] = arg_const(ecode);
+			if (stmt->type == JVST_IR_STMT_INVALID) {
+				instr->loc = stmt->u.invalid.loc;
+				instr->kw  = stmt->u.invalid.kw;
+			}
 			emit_instr(opasm, instr);
 		}
 		return;
@@ -1952,6 +2155,34 @@ op_assemble(struct op_assembler *opasm, struct jvst_ir_stmt *stmt)
 		}
 		return;
 
+	case JVST_IR_STMT_CALL_ID:
+		{
+			struct jvst_op_symbol *sym;
+			struct json_string id;
+			char *lbl;
+
+			// an import: the CALL is patched when the module is
+			// linked.  The id doubles as the label, so procs that
+			// call the same import compare equal.
+			id = stmt->u.call_id.id;
+			lbl = xmalloc(id.len + 1);
+			memcpy(lbl, id.s, id.len);
+			lbl[id.len] = '\0';
+
+			instr = op_instr_new(JVST_OP_CALL);
+			instr->args[0].type = JVST_VM_ARG_LABEL;
+			instr->args[0].u.label = lbl;
+			emit_instr(opasm, instr);
+
+			sym = xmalloc(sizeof *sym);
+			sym->id = json_strdup(id);
+			sym->proc = opasm->currproc;
+			sym->instr = instr;
+			sym->next = opasm->prog->imports;
+			opasm->prog->imports = sym;
+		}
+		return;
+
 	case JVST_IR_STMT_UNIQUE_INIT:
 		{
 			instr = op_instr_new(JVST_OP_UNIQUE);
@@ -1991,7 +2222,6 @@ op_assemble(struct op_assembler *opasm, struct jvst_ir_stmt *stmt)
 	case JVST_IR_STMT_SEQ:
 	case JVST_IR_STMT_IF:
 	case JVST_IR_STMT_FRAME:
-	case JVST_IR_STMT_CALL_ID:
 
 	case JVST_IR_STMT_COUNTER:
 	case JVST_IR_STMT_MATCHER:
@@ -2008,11 +2238,43 @@ op_assemble(struct op_assembler *opasm, struct jvst_ir_stmt *stmt)
 	abort();
 }
 
+struct op_export_builder {
+	struct jvst_op_program *prog;
+	struct jvst_op_proc **procs;	// indexed by frame_ind-1
+	size_t nprocs;
+};
+
+static int
+op_add_export(void *opaque, struct json_string *k, struct jvst_ir_stmt **frp)
+{
+	struct op_export_builder *eb = opaque;
+	struct jvst_op_symbol *sym;
+	size_t ind;
+
+	assert(frp != NULL);
+	assert(*frp != NULL);
+	assert((*frp)->type == JVST_IR_STMT_FRAME);
+
+	ind = (*frp)->u.frame.frame_ind;
+	assert(ind > 0 && ind <= eb->nprocs);
+	assert(eb->procs[ind-1] != NULL);
+
+	sym = xmalloc(sizeof *sym);
+	sym->id = json_strdup(*k);
+	sym->proc = eb->procs[ind-1];
+	sym->instr = NULL;
+	sym->next = eb->prog->exports;
+	eb->prog->exports = sym;
+
+	return 1;
+}
+
 struct jvst_op_program *
 jvst_op_assemble(struct jvst_ir_stmt *ir)
 {
 	struct op_assembler opasm = { 0 };
 	struct asm_addr_fixup_list fixups = { 0 };
+	struct op_export_builder eb = { 0 };
 	struct jvst_ir_stmt *fr;
 	size_t i;
 
@@ -2024,16 +2286,40 @@ jvst_op_assemble(struct jvst_ir_stmt *ir)
 	opasm.procpp = &opasm.prog->procs;
 	opasm.fixups = &fixups;
 
+	opasm.floats = hmap_create(64, 0.7f, opasm.prog, float_pool_hash, float_pool_equals);
+	opasm.consts = hmap_create(64, 0.7f, opasm.prog, const_pool_hash, const_pool_equals);
+	if (opasm.floats == NULL || opasm.consts == NULL) {
+		perror("allocating constant pools");
+		abort();
+	}
+
+	for (i=0, fr=ir->u.program.frames; fr != NULL; i++, fr = fr->next) {
+		eb.nprocs++;
+	}
+	eb.procs = xcalloc(eb.nprocs, sizeof eb.procs[0]);
+
 	for (i=0, fr=ir->u.program.frames; fr != NULL; i++, fr = fr->next) {
 		struct jvst_op_proc *proc;
 
 		proc = op_assemble_frame(&opasm, fr);
 		proc->proc_index = i;
+
+		assert(fr->u.frame.frame_ind > 0 && fr->u.frame.frame_ind <= eb.nprocs);
+		eb.procs[fr->u.frame.frame_ind-1] = proc;
 	}
 
 	asm_fixup_addresses(&fixups);
 	asm_addr_fixup_list_free(&fixups);
 
+	if (ir->u.program.exports != NULL) {
+		eb.prog = opasm.prog;
+		jvst_ir_id_table_foreach(ir->u.program.exports, op_add_export, &eb);
+	}
+
+	free(eb.procs);
+	hmap_free(opasm.floats);
+	hmap_free(opasm.consts);
+
 	return opasm.prog;
 }
 
@@ -2093,8 +2379,56 @@ struct dfa_builder {
 	size_t state_off;
 	size_t edge_off;
 	size_t end_off;
+
+	// literal keys of the match cases, for building a string table
+	struct strtab_key *keys;
+	size_t nkeys;
+	size_t maxkeys;
+	int nonliteral;
 };
 
+struct strtab_key {
+	const char *s;
+	size_t len;
+	int which;
+	uint64_t hash;
+};
+
+// Collects the names of a match case if they are all literals
+static void
+collect_literal_keys(struct dfa_builder *b, const struct jvst_ir_mcase *mc)
+{
+	const struct jvst_cnode_matchset *ms;
+
+	if (b->nonliteral) {
+		return;
+	}
+
+	if (mc->matchset == NULL) {
+		b->nonliteral = 1;
+		return;
+	}
+
+	for (ms = mc->matchset; ms != NULL; ms = ms->next) {
+		struct strtab_key *k;
+
+		if (ms->match.dialect != RE_LITERAL) {
+			b->nonliteral = 1;
+			return;
+		}
+
+		if (b->nkeys >= b->maxkeys) {
+			b->keys = xenlargevec(b->keys, &b->maxkeys, 1, sizeof b->keys[0]);
+		}
+
+		k = &b->keys[b->nkeys++];
+		k->s = ms->match.str.s;
+		k->len = ms->match.str.len;
+		k->which = mc->which;
+		k->hash = 0;
+	}
+}
+
 static int
 collect_and_number_states(const struct fsm *fsm, const struct fsm_state *st, void *opaque)
 {
@@ -2110,6 +2444,8 @@ collect_and_number_states(const struct fsm *fsm, const struct fsm_state *st, voi
 
 		b->dfa->endstates[2*endoff+0] = off;
 		b->dfa->endstates[2*endoff+1] = mc->which;
+
+		collect_literal_keys(b, mc);
 	}
 
 	b->lookup[off].st  = st;
@@ -2153,91 +2489,693 @@ collect_transitions(const struct fsm *fsm,
 	return 1;
 }
 
-void
-jvst_op_build_vm_dfa(struct fsm *fsm, struct jvst_vm_dfa *dfa)
-{
-	struct dfa_builder b = { 0 };
-	size_t i, nstates, nedges, nends, nelts;
-	int *elts;
-	struct dfa_lookup *tbl;
+/* Literal pattern detection
+ *
+ * Many patterns are plain literals, for example ^urn:acme: or -prod$.
+ * The candidate literal is the shortest string the DFA accepts.  The
+ * DFA is then checked against an exact, prefix, suffix and substring
+ * matcher for the candidate by walking the product of the DFA and a KMP
+ * automaton for the literal.  If the two accept exactly the same
+ * strings, MATCH can use the literal instead of walking the DFA.
+ */
 
-	nstates = fsm_countstates(fsm);
-	nedges  = fsm_countedges(fsm);
-	nends   = fsm_count(fsm, fsm_isend);
+enum {
+	DFA_LIT_MAXLEN   = 256,
+	DFA_LIT_MAXPAIRS = 1<<16,
+};
 
-	(void) jvst_vm_dfa_init(dfa, nstates, nedges, nends);
-	tbl = xmalloc(nstates * sizeof *tbl);
+struct lit_automaton {
+	enum jvst_vm_dfa_literal kind;
+	const unsigned char *lit;
+	int m;
+	int fail[DFA_LIT_MAXLEN+1];	// KMP failure function
+};
 
-	for (i=0; i < nstates+1; i++) {
-		dfa->offs[i] = 0;
+// States are the number of literal bytes matched, or -1 if the
+// literal can no longer match
+static int
+lit_step(const struct lit_automaton *la, int q, int c)
+{
+	const unsigned char *lit = la->lit;
+	int m = la->m;
+
+	if (q < 0) {
+		return -1;
 	}
 
-	b.dfa = dfa;
-	b.lookup = tbl;
+	switch (la->kind) {
+	case JVST_VM_DFA_LIT_EXACT:
+		return (q < m && lit[q] == c) ? q+1 : -1;
 
-	fsm_walk_states(fsm, &b, collect_and_number_states);
-	qsort(tbl, nstates, sizeof tbl[0], dfa_cmp);
-	fsm_walk_edges(fsm,  &b, collect_transitions);
-	for (; b.last_state < nstates; b.last_state++) {
-		b.dfa->offs[b.last_state+1] = b.edge_off;
+	case JVST_VM_DFA_LIT_PREFIX:
+		if (q == m) {
+			return m;
+		}
+		return (lit[q] == c) ? q+1 : -1;
+
+	case JVST_VM_DFA_LIT_SUBSTR:
+		if (q == m) {
+			return m;
+		}
+		/* fallthrough */
+
+	case JVST_VM_DFA_LIT_SUFFIX:
+		while (q > 0 && (q == m || lit[q] != c)) {
+			q = la->fail[q];
+		}
+		return (lit[q] == c) ? q+1 : 0;
+
+	case JVST_VM_DFA_LIT_NONE:
+		break;
 	}
 
-	free(tbl);
+	fprintf(stderr, "%s:%d (%s) unknown literal kind %d\n",
+		__FILE__, __LINE__, __func__, la->kind);
+	abort();
 }
 
-void
-jvst_vm_dfa_debug(struct jvst_vm_dfa *dfa)
+// Finds the shortest non-empty string accepted by the DFA
+static int
+dfa_shortest_accepted(const struct jvst_vm_dfa *dfa, unsigned char *buf, size_t max, size_t *np)
 {
-	size_t i,n;
+	size_t nst, qhead, qtail;
+	int *prev, *queue;
+	unsigned char *lbl;
+	int found, st;
 
-	n = dfa->nstates;
-	fprintf(stderr, "%zu states, starting, and count\n", n);
-	for (i=0; i < n; i++) {
-		fprintf(stderr, "%5zu %5d %5d\n", i, dfa->offs[i], dfa->offs[i+1] - dfa->offs[i]);
+	nst = dfa->nstates;
+	prev  = xmalloc(nst * sizeof prev[0]);
+	queue = xmalloc(nst * sizeof queue[0]);
+	lbl   = xmalloc(nst);
+
+	for (st=0; (size_t)st < nst; st++) {
+		prev[st] = -1;
 	}
 
-	fprintf(stderr, "\n%d transitions\n", dfa->offs[n]);
-	assert(dfa->offs[n] == (int)dfa->nedges);
-	for (i=0; i < n; i++) {
-		size_t j, ne, off;
-		off = dfa->offs[i];
+	found = -1;
+	qhead = qtail = 0;
+	queue[qtail++] = JVST_VM_DFA_START;
+	prev[JVST_VM_DFA_START] = JVST_VM_DFA_START;
 
-		ne = dfa->offs[i+1] - off;
-		fprintf(stderr, "state %zu, %zu transitions\n", i, ne);
-		for (j=0; j < ne; j++) {
-			fprintf(stderr, "%5zu %5d %5d\n", i,
-				dfa->transitions[2*(off+j) + 0],
-				dfa->transitions[2*(off+j) + 1]);
+	while (qhead < qtail && found < 0) {
+		int e;
+
+		st = queue[qhead++];
+		for (e = dfa->offs[st]; e < dfa->offs[st+1]; e++) {
+			int dst = dfa->transitions[2*e+1];
+
+			if (prev[dst] >= 0) {
+				continue;
+			}
+
+			prev[dst] = st;
+			lbl[dst] = (unsigned char)dfa->transitions[2*e+0];
+			queue[qtail++] = dst;
+
+			if (jvst_vm_dfa_endstate(dfa, dst, NULL)) {
+				found = dst;
+				break;
+			}
 		}
 	}
 
-	n = dfa->nends;
-	fprintf(stderr, "\n%zu end states\n", n);
-	for (i=0; i < n; i++) {
-		fprintf(stderr, "%5d %5d\n", dfa->endstates[2*i+0], dfa->endstates[2*i+1]);
+	if (found >= 0) {
+		size_t n = 0;
+
+		for (st = found; st != JVST_VM_DFA_START; st = prev[st]) {
+			n++;
+		}
+
+		if (n <= max) {
+			*np = n;
+			for (st = found; st != JVST_VM_DFA_START; st = prev[st]) {
+				buf[--n] = lbl[st];
+			}
+		} else {
+			found = -1;
+		}
 	}
-}
 
-struct op_encoder {
-	size_t len;
-	size_t cap;
-	uint32_t *code;
-};
+	free(prev);
+	free(queue);
+	free(lbl);
 
-static void
-encoder_init(struct op_encoder *enc)
-{
-	enc->len = 0;
-	enc->cap = 8;
-	enc->code = xmalloc(enc->cap * sizeof enc->code[0]);
+	return (found >= 0);
 }
 
-static uint32_t
-encoder_emit(struct op_encoder *enc, uint32_t code)
+// Checks that the DFA and the literal automaton accept the same strings
+static int
+dfa_matches_literal(const struct jvst_vm_dfa *dfa, const struct lit_automaton *la, int *resultp)
 {
-	size_t ind;
-	if (enc->len >= enc->cap) {
-		enc->code = xenlargevec(enc->code, &enc->cap, 1, sizeof enc->code[0]);
+	size_t nst, nq, npairs, qhead, qtail;
+	unsigned char *seen;
+	int *queue;
+	int result, ok;
+
+	// pair indices are offset by one so the dead states (-1) fit
+	nst = dfa->nstates + 1;
+	nq  = (size_t)la->m + 2;
+	npairs = nst * nq;
+	if (npairs > DFA_LIT_MAXPAIRS) {
+		return 0;
+	}
+
+	seen  = xcalloc(npairs, 1);
+	queue = xmalloc(2 * npairs * sizeof queue[0]);
+
+	result = -1;
+	ok = 1;
+
+	qhead = qtail = 0;
+	queue[qtail++] = JVST_VM_DFA_START;
+	queue[qtail++] = 0;
+	seen[(JVST_VM_DFA_START+1)*nq + 1] = 1;
+
+	while (ok && qhead < qtail) {
+		int s, q, c, data, vm_accepts, lit_accepts;
+
+		s = queue[qhead++];
+		q = queue[qhead++];
+
+		vm_accepts  = (s >= 0) && jvst_vm_dfa_endstate(dfa, s, &data);
+		lit_accepts = (q == la->m);
+		if (vm_accepts != lit_accepts) {
+			ok = 0;
+			break;
+		}
+
+		if (vm_accepts) {
+			if (result < 0) {
+				result = data;
+			} else if (data != result) {
+				ok = 0;
+				break;
+			}
+		}
+
+		for (c=0; c < 256; c++) {
+			char ch = (char)c;
+			int s1, q1;
+			size_t ind;
+
+			s1 = (s >= 0) ? jvst_vm_dfa_run(dfa, s, &ch, 1) : -1;
+			q1 = lit_step(la, q, c);
+
+			ind = (size_t)(s1+1)*nq + (size_t)(q1+1);
+			if (!seen[ind]) {
+				seen[ind] = 1;
+				queue[qtail++] = s1;
+				queue[qtail++] = q1;
+			}
+		}
+	}
+
+	free(seen);
+	free(queue);
+
+	if (ok && result > 0) {
+		*resultp = result;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+dfa_find_literal(struct jvst_vm_dfa *dfa)
+{
+	static const enum jvst_vm_dfa_literal kinds[] = {
+		JVST_VM_DFA_LIT_EXACT,
+		JVST_VM_DFA_LIT_PREFIX,
+		JVST_VM_DFA_LIT_SUFFIX,
+		JVST_VM_DFA_LIT_SUBSTR,
+	};
+
+	unsigned char lit[DFA_LIT_MAXLEN];
+	struct lit_automaton la;
+	size_t i, m;
+	int k, result;
+
+	if (dfa->nstates == 0 || jvst_vm_dfa_endstate(dfa, JVST_VM_DFA_START, NULL)) {
+		return;
+	}
+
+	if (!dfa_shortest_accepted(dfa, lit, sizeof lit, &m)) {
+		return;
+	}
+
+	la.lit = lit;
+	la.m = (int)m;
+
+	// KMP failure function: fail[q] is the length of the longest
+	// proper prefix of lit[0..q) that is also a suffix of it
+	la.fail[0] = 0;
+	la.fail[1] = 0;
+	for (k=0, i=1; i < m; i++) {
+		while (k > 0 && lit[i] != lit[k]) {
+			k = la.fail[k];
+		}
+		if (lit[i] == lit[k]) {
+			k++;
+		}
+		la.fail[i+1] = k;
+	}
+
+	for (i=0; i < ARRAYLEN(kinds); i++) {
+		la.kind = kinds[i];
+		if (dfa_matches_literal(dfa, &la, &result)) {
+			dfa->lit_kind   = kinds[i];
+			dfa->lit_result = result;
+			dfa->nlit       = m;
+			dfa->lit        = xmalloc(m);
+			memcpy(dfa->lit, lit, m);
+			return;
+		}
+	}
+}
+
+/* String tables
+ *
+ * When every case of a MATCH comes from a literal name (properties and
+ * required, but not patternProperties), the DFA matches a fixed set of
+ * strings and MATCH can look the string up in a perfect hash table
+ * instead.  The names are taken from the match sets of the cases, and
+ * the DFA is used to check them: each name must reach an end state for
+ * its case, and the DFA must accept no other strings.
+ */
+
+enum {
+	STRTAB_MINKEYS   = 2,
+	STRTAB_MAXKEYS   = 1<<16,
+	STRTAB_MAXDISP   = 1<<12,	// displacements to try per bucket
+	STRTAB_MAXTRIES  = 4,		// times the table is doubled before giving up
+};
+
+static int
+strtab_key_cmp(const void *p0, const void *p1)
+{
+	const struct strtab_key *k0 = p0, *k1 = p1;
+	int diff;
+
+	if (k0->len != k1->len) {
+		return (k0->len < k1->len) ? -1 : 1;
+	}
+
+	diff = memcmp(k0->s, k1->s, k0->len);
+	if (diff != 0) {
+		return diff;
+	}
+
+	return (k0->which > k1->which) - (k0->which < k1->which);
+}
+
+// Counts the strings accepted from state st, stopping at max.  Returns
+// max if the count is at least max or if the language is infinite.
+static size_t
+dfa_count_accepted(const struct jvst_vm_dfa *dfa, int st, const unsigned char *live,
+	unsigned char *color, size_t *counts, size_t max)
+{
+	size_t n;
+	int e;
+
+	if (color[st] == 2) {
+		return counts[st];
+	}
+
+	if (color[st] == 1) {
+		// cycle through a state that can reach an end state
+		return max;
+	}
+
+	color[st] = 1;
+	n = jvst_vm_dfa_endstate(dfa, st, NULL) ? 1 : 0;
+	for (e = dfa->offs[st]; e < dfa->offs[st+1] && n < max; e++) {
+		int dst = dfa->transitions[2*e+1];
+		if (live[dst]) {
+			n += dfa_count_accepted(dfa, dst, live, color, counts, max);
+		}
+	}
+
+	if (n > max) {
+		n = max;
+	}
+
+	color[st] = 2;
+	counts[st] = n;
+	return n;
+}
+
+// Checks that the DFA accepts exactly nkeys strings
+static int
+dfa_accepts_exactly(const struct jvst_vm_dfa *dfa, size_t nkeys)
+{
+	unsigned char *live, *color;
+	size_t *counts, st, nst, n;
+	int changed;
+
+	nst = dfa->nstates;
+	live   = xcalloc(nst, 1);
+	color  = xcalloc(nst, 1);
+	counts = xcalloc(nst, sizeof counts[0]);
+
+	// states that can reach an end state
+	do {
+		changed = 0;
+		for (st=0; st < nst; st++) {
+			int e;
+
+			if (live[st]) {
+				continue;
+			}
+
+			if (jvst_vm_dfa_endstate(dfa, (int)st, NULL)) {
+				live[st] = changed = 1;
+				continue;
+			}
+
+			for (e = dfa->offs[st]; e < dfa->offs[st+1]; e++) {
+				if (live[dfa->transitions[2*e+1]]) {
+					live[st] = changed = 1;
+					break;
+				}
+			}
+		}
+	} while (changed);
+
+	n = 0;
+	if (live[JVST_VM_DFA_START]) {
+		n = dfa_count_accepted(dfa, JVST_VM_DFA_START, live, color, counts, nkeys+1);
+	}
+
+	free(live);
+	free(color);
+	free(counts);
+
+	return n == nkeys;
+}
+
+static int
+strtab_bucket_cmp(const void *p0, const void *p1)
+{
+	const uint32_t *b0 = p0, *b1 = p1;
+
+	// larger buckets first
+	if (b0[1] != b1[1]) {
+		return (b0[1] > b1[1]) ? -1 : 1;
+	}
+
+	return (b0[0] > b1[0]) - (b0[0] < b1[0]);
+}
+
+static uint32_t
+pow2_atleast(size_t n)
+{
+	uint32_t p = 1;
+	while (p < n) {
+		p <<= 1;
+	}
+	return p;
+}
+
+// Chooses the bucket displacements.  Returns 0 if no displacement works
+// for some bucket.
+static int
+strtab_place(struct jvst_vm_strtab *tab, const struct strtab_key *keys, size_t n,
+	uint32_t *slotkey)
+{
+	uint32_t *bstart, *bkeys, *fill, *order, *placed;
+	size_t i, nb;
+	int ok;
+
+	nb = tab->nbuckets;
+	bstart = xcalloc(nb+1, sizeof bstart[0]);
+	fill   = xcalloc(nb, sizeof fill[0]);
+	bkeys  = xmalloc(n * sizeof bkeys[0]);
+	order  = xmalloc(2 * nb * sizeof order[0]);
+	placed = xmalloc(n * sizeof placed[0]);
+
+	for (i=0; i < tab->nslots; i++) {
+		slotkey[i] = UINT32_MAX;
+	}
+
+	// group the keys by bucket
+	for (i=0; i < n; i++) {
+		bstart[jvst_vm_strtab_bucket(tab, keys[i].hash)+1]++;
+	}
+
+	for (i=0; i < nb; i++) {
+		order[2*i+0] = (uint32_t)i;
+		order[2*i+1] = bstart[i+1];
+		bstart[i+1] += bstart[i];
+		tab->disp[i] = 0;
+	}
+
+	// bstart[b] is now the index in bkeys of the first key of bucket b
+	for (i=0; i < n; i++) {
+		uint32_t bucket = jvst_vm_strtab_bucket(tab, keys[i].hash);
+		bkeys[bstart[bucket] + fill[bucket]++] = (uint32_t)i;
+	}
+
+	qsort(order, nb, 2 * sizeof order[0], strtab_bucket_cmp);
+
+	ok = 1;
+	for (i=0; i < nb && ok && order[2*i+1] > 0; i++) {
+		uint32_t bucket = order[2*i+0];
+		uint32_t d, j;
+
+		for (d=0; d < STRTAB_MAXDISP; d++) {
+			size_t np = 0;
+
+			for (j = bstart[bucket]; j < bstart[bucket+1]; j++) {
+				uint32_t sl;
+
+				sl = jvst_vm_strtab_slot(tab, keys[bkeys[j]].hash, d);
+				if (slotkey[sl] != UINT32_MAX) {
+					break;
+				}
+
+				slotkey[sl] = bkeys[j];
+				placed[np++] = sl;
+			}
+
+			if (j == bstart[bucket+1]) {
+				tab->disp[bucket] = d;
+				break;
+			}
+
+			// collision, undo this attempt
+			while (np > 0) {
+				slotkey[placed[--np]] = UINT32_MAX;
+			}
+		}
+
+		if (d == STRTAB_MAXDISP) {
+			ok = 0;
+		}
+	}
+
+	free(bstart);
+	free(bkeys);
+	free(fill);
+	free(order);
+	free(placed);
+
+	return ok;
+}
+
+static void
+dfa_build_strtab(struct jvst_vm_dfa *dfa, struct strtab_key *keys, size_t nkeys)
+{
+	struct jvst_vm_strtab *tab;
+	uint32_t *slotkey;
+	size_t i, n, keylen;
+	int tries;
+
+	if (nkeys == 0) {
+		return;
+	}
+
+	// sort and remove duplicates.  A name that appears in more than
+	// one case means the match sets and the DFA disagree.
+	qsort(keys, nkeys, sizeof keys[0], strtab_key_cmp);
+	for (n=1, i=1; i < nkeys; i++) {
+		const struct strtab_key *prev = &keys[n-1];
+
+		if (keys[i].len == prev->len && memcmp(keys[i].s, prev->s, prev->len) == 0) {
+			if (keys[i].which != prev->which) {
+				return;
+			}
+			continue;
+		}
+
+		keys[n++] = keys[i];
+	}
+
+	if (n < STRTAB_MINKEYS || n > STRTAB_MAXKEYS) {
+		return;
+	}
+
+	keylen = 0;
+	for (i=0; i < n; i++) {
+		int st, which;
+
+		st = jvst_vm_dfa_run(dfa, JVST_VM_DFA_START, keys[i].s, keys[i].len);
+		if (st < 0 || !jvst_vm_dfa_endstate(dfa, st, &which) || which != keys[i].which) {
+			return;
+		}
+
+		keys[i].hash = jvst_vm_strhash(keys[i].s, keys[i].len);
+		keylen += keys[i].len;
+	}
+
+	if (keylen >= UINT32_MAX || !dfa_accepts_exactly(dfa, n)) {
+		return;
+	}
+
+	tab = xmalloc(sizeof *tab);
+	tab->nkeys    = n;
+	tab->nbuckets = pow2_atleast(n/4 > 2 ? n/4 : 2);
+	tab->nslots   = pow2_atleast(n + n/4);
+	tab->disp     = xmalloc(tab->nbuckets * sizeof tab->disp[0]);
+
+	slotkey = NULL;
+	for (tries = 0; tries < STRTAB_MAXTRIES; tries++) {
+		slotkey = xrealloc(slotkey, tab->nslots * sizeof slotkey[0]);
+		if (strtab_place(tab, keys, n, slotkey)) {
+			break;
+		}
+
+		tab->nslots *= 2;
+	}
+
+	if (tries == STRTAB_MAXTRIES) {
+		free(slotkey);
+		free(tab->disp);
+		free(tab);
+		return;
+	}
+
+	tab->keylen = keylen;
+	tab->keys   = xmalloc(keylen + 1);
+	tab->slots  = xmalloc(tab->nslots * sizeof tab->slots[0]);
+
+	keylen = 0;
+	for (i=0; i < tab->nslots; i++) {
+		struct jvst_vm_strtab_slot *slot = &tab->slots[i];
+		const struct strtab_key *k;
+
+		if (slotkey[i] == UINT32_MAX) {
+			slot->off = slot->len = 0;
+			slot->which = 0;
+			continue;
+		}
+
+		k = &keys[slotkey[i]];
+		memcpy(&tab->keys[keylen], k->s, k->len);
+		slot->off   = (uint32_t)keylen;
+		slot->len   = (uint32_t)k->len;
+		slot->which = k->which;
+		keylen += k->len;
+	}
+	tab->keys[keylen] = '\0';
+
+	free(slotkey);
+
+	dfa->strtab = tab;
+}
+
+void
+jvst_op_build_vm_dfa(struct fsm *fsm, struct jvst_vm_dfa *dfa)
+{
+	struct dfa_builder b = { 0 };
+	size_t i, nstates, nedges, nends, nelts;
+	int *elts;
+	struct dfa_lookup *tbl;
+
+	nstates = fsm_countstates(fsm);
+	nedges  = fsm_countedges(fsm);
+	nends   = fsm_count(fsm, fsm_isend);
+
+	(void) jvst_vm_dfa_init(dfa, nstates, nedges, nends);
+	tbl = xmalloc(nstates * sizeof *tbl);
+
+	for (i=0; i < nstates+1; i++) {
+		dfa->offs[i] = 0;
+	}
+
+	b.dfa = dfa;
+	b.lookup = tbl;
+
+	fsm_walk_states(fsm, &b, collect_and_number_states);
+	qsort(tbl, nstates, sizeof tbl[0], dfa_cmp);
+	fsm_walk_edges(fsm,  &b, collect_transitions);
+	for (; b.last_state < nstates; b.last_state++) {
+		b.dfa->offs[b.last_state+1] = b.edge_off;
+	}
+
+	free(tbl);
+
+	dfa_find_literal(dfa);
+	if (dfa->lit_kind == JVST_VM_DFA_LIT_NONE && !b.nonliteral) {
+		dfa_build_strtab(dfa, b.keys, b.nkeys);
+	}
+
+	free(b.keys);
+}
+
+void
+jvst_vm_dfa_debug(struct jvst_vm_dfa *dfa)
+{
+	size_t i,n;
+
+	n = dfa->nstates;
+	fprintf(stderr, "%zu states, starting, and count\n", n);
+	for (i=0; i < n; i++) {
+		fprintf(stderr, "%5zu %5d %5d\n", i, dfa->offs[i], dfa->offs[i+1] - dfa->offs[i]);
+	}
+
+	fprintf(stderr, "\n%d transitions\n", dfa->offs[n]);
+	assert(dfa->offs[n] == (int)dfa->nedges);
+	for (i=0; i < n; i++) {
+		size_t j, ne, off;
+		off = dfa->offs[i];
+
+		ne = dfa->offs[i+1] - off;
+		fprintf(stderr, "state %zu, %zu transitions\n", i, ne);
+		for (j=0; j < ne; j++) {
+			fprintf(stderr, "%5zu %5d %5d\n", i,
+				dfa->transitions[2*(off+j) + 0],
+				dfa->transitions[2*(off+j) + 1]);
+		}
+	}
+
+	n = dfa->nends;
+	fprintf(stderr, "\n%zu end states\n", n);
+	for (i=0; i < n; i++) {
+		fprintf(stderr, "%5d %5d\n", dfa->endstates[2*i+0], dfa->endstates[2*i+1]);
+	}
+}
+
+struct op_encoder {
+	size_t len;
+	size_t cap;
+	uint32_t *code;
+};
+
+static void
+encoder_init(struct op_encoder *enc)
+{
+	enc->len = 0;
+	enc->cap = 8;
+	enc->code = xmalloc(enc->cap * sizeof enc->code[0]);
+}
+
+static uint32_t
+encoder_emit(struct op_encoder *enc, uint32_t code)
+{
+	size_t ind;
+	if (enc->len >= enc->cap) {
+		enc->code = xenlargevec(enc->code, &enc->cap, 1, sizeof enc->code[0]);
 	}
 
 	ind = enc->len++;
@@ -2309,7 +3247,8 @@ encode_pass1(struct op_encoder *enc, struct jvst_op_instr *first)
 
 		case JVST_OP_CALL:
 			{
-				assert(instr->args[0].type == JVST_VM_ARG_CALL);
+				assert(instr->args[0].type == JVST_VM_ARG_CALL ||
+					instr->args[0].type == JVST_VM_ARG_LABEL);
 				assert(instr->args[0].u.dest != NULL);
 
 				cp = encoder_emit(enc, VMBR(instr->op, JVST_VM_BR_ALWAYS, 0));
@@ -2334,6 +3273,7 @@ encode_pass1(struct op_encoder *enc, struct jvst_op_instr *first)
 		case JVST_OP_INCR:
 		case JVST_OP_BSET:
 		case JVST_OP_BAND:
+		case JVST_OP_BCOUNT:
 		case JVST_OP_RETURN:
 		case JVST_OP_UNIQUE:
 			a = encode_arg(instr->args[0]);
@@ -2387,6 +3327,11 @@ encode_pass2(struct op_encoder *enc, struct jvst_op_instr *first)
 			break;
 
 		case JVST_OP_CALL:
+			// imports are patched by the linker
+			if (instr->args[0].type == JVST_VM_ARG_LABEL) {
+				break;
+			}
+
 			assert(instr->args[0].type == JVST_VM_ARG_INSTR ||
 				instr->args[0].type == JVST_VM_ARG_CALL);
 			assert(instr->args[0].u.dest != NULL);
@@ -2415,6 +3360,393 @@ encode_pass2(struct op_encoder *enc, struct jvst_op_instr *first)
 	}
 }
 
+/* Proc deduplication
+ *
+ * Identical sub-schemas, such as a definition that is referenced from
+ * several places, are assembled into separate procs.  Before encoding,
+ * procs with the same frame size and the same instructions are merged
+ * so that only one copy is emitted.  Branch destinations are compared
+ * by their position in the proc, and calls and splits must refer to
+ * the same procs once those have been merged.  Merging callees can make
+ * their callers the same, so this repeats until nothing changes.
+ */
+
+static struct jvst_op_proc *
+proc_rep(struct jvst_op_proc *proc)
+{
+	while (proc->same != NULL) {
+		proc = proc->same;
+	}
+
+	return proc;
+}
+
+static int
+op_splits_same(const struct jvst_op_program *prog, int64_t s0, int64_t s1)
+{
+	size_t b0, e0, b1, e1, i;
+
+	b0 = (s0 > 0) ? prog->splitoff[s0-1] : 0;
+	e0 = prog->splitoff[s0];
+	b1 = (s1 > 0) ? prog->splitoff[s1-1] : 0;
+	e1 = prog->splitoff[s1];
+
+	if (e0-b0 != e1-b1) {
+		return 0;
+	}
+
+	for (i=0; i < e0-b0; i++) {
+		if (proc_rep(prog->splits[b0+i]) != proc_rep(prog->splits[b1+i])) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+op_args_same(struct jvst_op_arg a, struct jvst_op_arg b)
+{
+	if (a.type != b.type) {
+		return 0;
+	}
+
+	switch (a.type) {
+	case JVST_VM_ARG_CALL:
+		return proc_rep(a.u.proc) == proc_rep(b.u.proc);
+
+	case JVST_VM_ARG_INSTR:
+		// code_off holds the instruction's position in its proc
+		return a.u.dest->code_off == b.u.dest->code_off;
+
+	case JVST_VM_ARG_LABEL:
+		return strcmp(a.u.label, b.u.label) == 0;
+
+	default:
+		return a.u.index == b.u.index;
+	}
+}
+
+static int
+op_procs_same(const struct jvst_op_program *prog,
+	const struct jvst_op_proc *p, const struct jvst_op_proc *q)
+{
+	const struct jvst_op_instr *a, *b;
+
+	if (p->nslots != q->nslots) {
+		return 0;
+	}
+
+	for (a = p->ilist, b = q->ilist; a != NULL && b != NULL; a = a->next, b = b->next) {
+		if (a->op != b->op) {
+			return 0;
+		}
+
+		if (a->op == JVST_OP_SPLIT || a->op == JVST_OP_SPLITV) {
+			if (!op_splits_same(prog, a->args[0].u.index, b->args[0].u.index) ||
+				!op_args_same(a->args[1], b->args[1])) {
+				return 0;
+			}
+			continue;
+		}
+
+		if (!op_args_same(a->args[0], b->args[0]) ||
+			!op_args_same(a->args[1], b->args[1])) {
+			return 0;
+		}
+	}
+
+	return a == NULL && b == NULL;
+}
+
+static uint64_t
+op_arg_hash(struct jvst_op_arg a, uint64_t h)
+{
+	uint64_t v;
+
+	switch (a.type) {
+	case JVST_VM_ARG_CALL:
+		v = (uint64_t)(uintptr_t)proc_rep(a.u.proc);
+		break;
+
+	case JVST_VM_ARG_INSTR:
+		v = a.u.dest->code_off;
+		break;
+
+	case JVST_VM_ARG_LABEL:
+		h = XXH64(a.u.label, strlen(a.u.label), h);
+		v = 0;
+		break;
+
+	default:
+		v = (uint64_t)a.u.index;
+		break;
+	}
+
+	h = XXH64(&a.type, sizeof a.type, h);
+	return XXH64(&v, sizeof v, h);
+}
+
+// Hashes what op_procs_same() compares.  Split lists are hashed by
+// their length only.
+static uint64_t
+op_proc_hash(void *opaque, const void *k)
+{
+	const struct jvst_op_program *prog = opaque;
+	const struct jvst_op_proc *p = k;
+	const struct jvst_op_instr *instr;
+	uint64_t h;
+
+	h = XXH64(&p->nslots, sizeof p->nslots, 0);
+	for (instr = p->ilist; instr != NULL; instr = instr->next) {
+		h = XXH64(&instr->op, sizeof instr->op, h);
+		if (instr->op == JVST_OP_SPLIT || instr->op == JVST_OP_SPLITV) {
+			int64_t s = instr->args[0].u.index;
+			uint64_t n = prog->splitoff[s] - ((s > 0) ? prog->splitoff[s-1] : 0);
+
+			h = XXH64(&n, sizeof n, h);
+		} else {
+			h = op_arg_hash(instr->args[0], h);
+		}
+		h = op_arg_hash(instr->args[1], h);
+	}
+
+	return h;
+}
+
+static int
+op_proc_equals(void *opaque, const void *k1, const void *k2)
+{
+	return op_procs_same(opaque, k1, k2);
+}
+
+static size_t
+op_merge_procs(struct jvst_op_program *prog)
+{
+	struct jvst_op_proc *p, *q;
+	struct hmap *reps;
+	size_t nmerged;
+	int changed;
+
+	for (p = prog->procs; p != NULL; p = p->next) {
+		struct jvst_op_instr *instr;
+		uint32_t pos;
+
+		p->same = NULL;
+		for (pos=0, instr = p->ilist; instr != NULL; pos++, instr = instr->next) {
+			instr->code_off = pos;
+		}
+	}
+
+	reps = hmap_create(64, 0.7f, prog, op_proc_hash, op_proc_equals);
+	if (reps == NULL) {
+		perror("merging procs");
+		abort();
+	}
+
+	// Hashes depend on the merges made so far, so the table is
+	// rebuilt for each pass.  Merges made during a pass can leave
+	// stale hashes, which only delays a merge until the next pass.
+	nmerged = 0;
+	do {
+		changed = 0;
+		hmap_clear(reps);
+		for (p = prog->procs; p != NULL; p = p->next) {
+			if (p->same != NULL) {
+				continue;
+			}
+
+			q = hmap_getptr(reps, p);
+			if (q != NULL) {
+				p->same = q;
+				nmerged++;
+				changed = 1;
+				continue;
+			}
+
+			if (!hmap_setptr(reps, p, p)) {
+				perror("merging procs");
+				abort();
+			}
+		}
+	} while (changed);
+
+	hmap_free(reps);
+
+	return nmerged;
+}
+
+// Sets the PROC flags of each proc.  A proc gets JVST_VM_PROC_TLEN if
+// it reads %TLEN, or calls a proc that does: the called frame copies
+// %TLEN from its caller.  Calls to imports are assumed to read it.
+static void
+op_proc_flags(struct jvst_op_program *prog)
+{
+	struct jvst_op_proc *proc;
+	int changed;
+
+	for (proc = prog->procs; proc != NULL; proc = proc->next) {
+		struct jvst_op_instr *instr;
+
+		proc->flags = 0;
+		for (instr = proc->ilist; instr != NULL; instr = instr->next) {
+			if (instr->args[0].type == JVST_VM_ARG_TLEN ||
+					instr->args[1].type == JVST_VM_ARG_TLEN ||
+					(instr->op == JVST_OP_CALL &&
+					 instr->args[0].type == JVST_VM_ARG_LABEL)) {
+				proc->flags |= JVST_VM_PROC_TLEN;
+				break;
+			}
+		}
+	}
+
+	// calls can be recursive, so repeat until nothing changes
+	do {
+		changed = 0;
+		for (proc = prog->procs; proc != NULL; proc = proc->next) {
+			struct jvst_op_instr *instr;
+
+			if (proc->flags & JVST_VM_PROC_TLEN) {
+				continue;
+			}
+
+			for (instr = proc->ilist; instr != NULL; instr = instr->next) {
+				if (instr->op == JVST_OP_CALL &&
+						instr->args[0].type == JVST_VM_ARG_CALL &&
+						(instr->args[0].u.proc->flags & JVST_VM_PROC_TLEN)) {
+					proc->flags |= JVST_VM_PROC_TLEN;
+					changed = 1;
+					break;
+				}
+			}
+		}
+	} while (changed);
+}
+
+// Returns the offset of the string s in the program's srcstr, adding it
+// if it isn't there yet.  Strings are looked up by address: locations
+// point into the schema, and keyword names are literals.
+static uint32_t
+srcmap_str(struct jvst_vm_program *vmprog, struct hmap *strs, size_t *maxstrp,
+	const char *s, size_t len)
+{
+	union hmap_value *v;
+	uint32_t off;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	v = hmap_get(strs, s);
+	if (v != NULL) {
+		return v->u;
+	}
+
+	if (vmprog->nsrcstr + len + 1 > *maxstrp) {
+		vmprog->srcstr = xenlargevec(vmprog->srcstr, maxstrp,
+			vmprog->nsrcstr + len + 1 - *maxstrp, 1);
+	}
+
+	off = vmprog->nsrcstr;
+	memcpy(&vmprog->srcstr[off], s, len);
+	vmprog->srcstr[off+len] = '\0';
+	vmprog->nsrcstr += len+1;
+
+	hmap_setuint(strs, (void *)s, off);
+
+	return off;
+}
+
+// Adds a range to the source map, unless the last range has the same
+// location.  A range at the pc of the last range replaces it.
+static void
+srcmap_add(struct jvst_vm_program *vmprog, size_t *maxmapp, uint32_t pc, uint32_t loc, uint32_t kw)
+{
+	size_t n = vmprog->nsrcmap;
+
+	if (n > 0 && vmprog->srcmap[n-1].pc == pc) {
+		n = --vmprog->nsrcmap;
+	}
+
+	if (n > 0 && vmprog->srcmap[n-1].loc == loc && vmprog->srcmap[n-1].kw == kw) {
+		return;
+	}
+
+	if (n >= *maxmapp) {
+		vmprog->srcmap = xenlargevec(vmprog->srcmap, maxmapp, 1, sizeof vmprog->srcmap[0]);
+	}
+
+	vmprog->srcmap[n].pc  = pc;
+	vmprog->srcmap[n].loc = loc;
+	vmprog->srcmap[n].kw  = kw;
+	vmprog->nsrcmap++;
+}
+
+// Builds the source map of an encoded program: one range for each run
+// of procs with the same schema location, and a one instruction range
+// for each RETURN that fails a keyword.  Procs are encoded in list
+// order, so their code_offs are ascending.  Merged procs aren't
+// encoded, and their code has the locations of the proc they were
+// merged into.
+static void
+op_encode_srcmap(struct jvst_vm_program *vmprog, const struct jvst_op_program *prog)
+{
+	struct jvst_op_proc *proc;
+	struct hmap *strs;
+	size_t maxmap, maxstr;
+
+	maxmap = maxstr = 0;
+	vmprog->srcstr = xenlargevec(NULL, &maxstr, 1, 1);
+	vmprog->srcstr[0] = '\0';
+	vmprog->nsrcstr = 1;
+
+	// the same location is shared by procs translated from the same
+	// schema, eg through a $ref
+	strs = hmap_create_pointer(16, 0.7f);
+
+	for (proc = prog->procs; proc != NULL; proc = proc->next) {
+		struct jvst_op_instr *instr;
+		uint32_t off;
+
+		if (proc->same != NULL) {
+			continue;
+		}
+
+		off = srcmap_str(vmprog, strs, &maxstr, proc->loc.s, proc->loc.len);
+		srcmap_add(vmprog, &maxmap, proc->code_off, off, 0);
+
+		for (instr = proc->ilist; instr != NULL; instr = instr->next) {
+			uint32_t loc, kw;
+
+			if (instr->op != JVST_OP_RETURN || instr->kw == NULL) {
+				continue;
+			}
+
+			loc = (instr->loc.len > 0)
+				? srcmap_str(vmprog, strs, &maxstr, instr->loc.s, instr->loc.len)
+				: off;
+			kw = srcmap_str(vmprog, strs, &maxstr, instr->kw, strlen(instr->kw));
+
+			srcmap_add(vmprog, &maxmap, instr->code_off, loc, kw);
+			if (instr->code_off+1 < vmprog->ncode) {
+				srcmap_add(vmprog, &maxmap, instr->code_off+1, off, 0);
+			}
+		}
+	}
+
+	hmap_free(strs);
+
+	// no locations, so no map
+	if (vmprog->nsrcstr == 1) {
+		free(vmprog->srcmap);
+		free(vmprog->srcstr);
+		vmprog->srcmap  = NULL;
+		vmprog->srcstr  = NULL;
+		vmprog->nsrcmap = 0;
+		vmprog->nsrcstr = 0;
+	}
+}
+
 struct jvst_vm_program *
 jvst_op_encode(struct jvst_op_program *prog)
 {
@@ -2459,20 +3791,38 @@ jvst_op_encode(struct jvst_op_program *prog)
 
 	encoder_init(&enc);
 
+	(void)op_merge_procs(prog);
+	op_proc_flags(prog);
+
 	// first pass, encode data, set branch dests to zero
 	for (proc = prog->procs; proc != NULL; proc = proc->next) {
 		struct jvst_op_instr *instr;
 		uint16_t a,b;
 
+		if (proc->same != NULL) {
+			continue;
+		}
+
 		proc->code_off = encoder_emit(&enc,
-			VMOP(JVST_OP_PROC, VMLIT(proc->nslots), VMLIT(0)));
+			VMOP(JVST_OP_PROC, VMLIT(proc->nslots), VMLIT(proc->flags)));
 
 		assert(proc->ilist != NULL);
 		encode_pass1(&enc, proc->ilist);
 	}
 
+	// merged procs share the code of the proc they were merged into
+	for (proc = prog->procs; proc != NULL; proc = proc->next) {
+		if (proc->same != NULL) {
+			proc->code_off = proc_rep(proc)->code_off;
+		}
+	}
+
 	// second pass, set branch dests and calls to real location
 	for (proc = prog->procs; proc != NULL; proc = proc->next) {
+		if (proc->same != NULL) {
+			continue;
+		}
+
 		assert(proc->ilist != NULL);
 		encode_pass2(&enc, proc->ilist);
 	}
@@ -2505,7 +3855,71 @@ jvst_op_encode(struct jvst_op_program *prog)
 	vmprog->ncode = enc.len;
 	vmprog->code  = enc.code;
 
+	op_encode_srcmap(vmprog, prog);
+
+	vmprog->maxstack = jvst_vm_stack_bound(vmprog);
+
 	return vmprog;
 }
 
+static size_t
+op_count_symbols(const struct jvst_op_symbol *sym, int skip_merged)
+{
+	size_t n;
+
+	for (n=0; sym != NULL; sym = sym->next) {
+		if (!skip_merged || sym->proc->same == NULL) {
+			n++;
+		}
+	}
+
+	return n;
+}
+
+struct jvst_vm_module *
+jvst_op_encode_module(struct jvst_op_program *prog)
+{
+	struct jvst_vm_module *mod;
+	struct jvst_op_symbol *sym;
+	size_t i;
+
+	mod = xmalloc(sizeof *mod);
+	memset(mod, 0, sizeof *mod);
+
+	mod->prog = jvst_op_encode(prog);
+
+	// merged procs share the code_off of the proc they were merged
+	// into, so their exports are still valid
+	mod->nexport = op_count_symbols(prog->exports, 0);
+	if (mod->nexport > 0) {
+		mod->exports = xcalloc(mod->nexport, sizeof mod->exports[0]);
+	}
+
+	for (i=0, sym = prog->exports; sym != NULL; sym = sym->next, i++) {
+		mod->exports[i].id = json_strdup(sym->id);
+		mod->exports[i].off = sym->proc->code_off;
+	}
+
+	// ... but their instructions aren't encoded, and the proc they
+	// were merged into has its own import for the same CALL
+	mod->nimport = op_count_symbols(prog->imports, 1);
+	if (mod->nimport > 0) {
+		mod->imports = xcalloc(mod->nimport, sizeof mod->imports[0]);
+	}
+
+	for (i=0, sym = prog->imports; sym != NULL; sym = sym->next) {
+		if (sym->proc->same != NULL) {
+			continue;
+		}
+
+		assert(jvst_vm_decode_op(mod->prog->code[sym->instr->code_off]) == JVST_OP_CALL);
+
+		mod->imports[i].id = json_strdup(sym->id);
+		mod->imports[i].off = sym->instr->code_off;
+		i++;
+	}
+
+	return mod;
+}
+
 /* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
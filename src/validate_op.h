@@ -6,6 +6,7 @@
 
 #include "validate_ir.h"
 #include "validate_vm.h"
+#include "validate_link.h"
 
 /* What follows is for assembling the opcodes */
 enum jvst_op_arg_type {
@@ -56,6 +57,11 @@ struct jvst_op_instr {
 	uint32_t code_off;
 
 	enum jvst_vm_op op;
+
+	// RETURN with an error: the keyword that failed, and the
+	// location of its schema, see struct jvst_ir_stmt
+	struct json_string loc;
+	const char *kw;
 };
 
 // Instruction data... for assembling the opcodes
@@ -73,9 +79,31 @@ struct jvst_op_proc {
 
 	struct jvst_op_instr *ilist;
 
+	// set by the encoder if the proc is identical to an earlier proc,
+	// which is emitted in its place
+	struct jvst_op_proc *same;
+
+	// JVST_VM_PROC_xxx flags, set by the encoder
+	uint32_t flags;
+
+	// schema location of the frame, see struct jvst_cnode
+	struct json_string loc;
+
 	char label[64];
 };
 
+// An id that a module exports or imports
+struct jvst_op_symbol {
+	struct jvst_op_symbol *next;
+	struct json_string id;
+
+	// exports: the proc for the id.  imports: the proc that calls it
+	struct jvst_op_proc *proc;
+
+	// imports: the CALL instruction
+	struct jvst_op_instr *instr;
+};
+
 struct jvst_op_program {
 	struct jvst_op_proc *procs;
 
@@ -91,6 +119,10 @@ struct jvst_op_program {
 	size_t nsplit;
 	size_t *splitoff;
 	struct jvst_op_proc **splits;
+
+	// only set for modules
+	struct jvst_op_symbol *exports;
+	struct jvst_op_symbol *imports;
 };
 
 struct jvst_ir_stmt;
@@ -113,6 +145,11 @@ jvst_op_print(FILE *f, struct jvst_op_program *prog);
 struct jvst_vm_program *
 jvst_op_encode(struct jvst_op_program *prog);
 
+// Encodes a program assembled from jvst_ir_linearize_module() as a
+// module, which must be linked before it can be run.
+struct jvst_vm_module *
+jvst_op_encode_module(struct jvst_op_program *prog);
+
 struct jvst_vm_program *
 jvst_ir_assemble(struct jvst_ir_stmt *prog);
 
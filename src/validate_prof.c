@@ -0,0 +1,379 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "validate_prof.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xalloc.h"
+
+struct jvst_vm_prof *
+jvst_vm_prof_new(const struct jvst_vm_program *prog, unsigned flags, FILE *report)
+{
+	struct jvst_vm_prof *prof;
+	size_t pc, nproc;
+
+	prof = xcalloc(1, sizeof *prof);
+	prof->prog = prog;
+	prof->flags = flags;
+	prof->report = report;
+	prof->cur_op = -1;
+
+	nproc = 0;
+	for (pc=0; pc < prog->ncode; pc++) {
+		if (jvst_vm_decode_op(prog->code[pc]) == JVST_OP_PROC) {
+			nproc++;
+		}
+	}
+
+	// instructions before the first PROC (there shouldn't be any)
+	// are counted against proc 0
+	prof->nproc = nproc > 0 ? nproc : 1;
+	prof->proc_pc = xcalloc(prof->nproc, sizeof prof->proc_pc[0]);
+	prof->pc_proc = xcalloc(prog->ncode > 0 ? prog->ncode : 1, sizeof prof->pc_proc[0]);
+	prof->procs = xcalloc(prof->nproc, sizeof prof->procs[0]);
+
+	nproc = 0;
+	for (pc=0; pc < prog->ncode; pc++) {
+		if (jvst_vm_decode_op(prog->code[pc]) == JVST_OP_PROC) {
+			prof->proc_pc[nproc++] = pc;
+		}
+
+		prof->pc_proc[pc] = nproc > 0 ? nproc-1 : 0;
+	}
+
+	return prof;
+}
+
+void
+jvst_vm_prof_extend(struct jvst_vm_prof *prof, const struct jvst_vm_program *prog)
+{
+	const struct jvst_vm_program *prog0 = prof->prog;
+	size_t pc, nproc;
+
+	if (prog->ncode <= prog0->ncode) {
+		return;
+	}
+
+	nproc = prof->nproc;
+	for (pc=prog0->ncode; pc < prog->ncode; pc++) {
+		if (jvst_vm_decode_op(prog->code[pc]) == JVST_OP_PROC) {
+			nproc++;
+		}
+	}
+
+	prof->proc_pc = xrealloc(prof->proc_pc, nproc * sizeof prof->proc_pc[0]);
+	prof->pc_proc = xrealloc(prof->pc_proc, prog->ncode * sizeof prof->pc_proc[0]);
+	prof->procs = xrealloc(prof->procs, nproc * sizeof prof->procs[0]);
+	memset(&prof->procs[prof->nproc], 0, (nproc - prof->nproc) * sizeof prof->procs[0]);
+
+	nproc = prof->nproc;
+	for (pc=prog0->ncode; pc < prog->ncode; pc++) {
+		if (jvst_vm_decode_op(prog->code[pc]) == JVST_OP_PROC) {
+			prof->proc_pc[nproc++] = pc;
+		}
+
+		prof->pc_proc[pc] = nproc-1;
+	}
+
+	prof->nproc = nproc;
+	prof->prog = prog;
+}
+
+void
+jvst_vm_prof_free(struct jvst_vm_prof *prof)
+{
+	if (prof == NULL) {
+		return;
+	}
+
+	free(prof->proc_pc);
+	free(prof->pc_proc);
+	free(prof->procs);
+	free(prof);
+}
+
+uint64_t
+jvst_vm_prof_clock(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		perror("clock_gettime");
+		abort();
+	}
+
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+struct prof_row {
+	size_t ind;
+	const struct jvst_vm_prof_count *c;
+};
+
+static int
+cmp_rows_nsec(const void *pa, const void *pb)
+{
+	const struct prof_row *a = pa, *b = pb;
+
+	if (a->c->nsec != b->c->nsec) {
+		return a->c->nsec < b->c->nsec ? 1 : -1;
+	}
+
+	if (a->c->n != b->c->n) {
+		return a->c->n < b->c->n ? 1 : -1;
+	}
+
+	return (a->ind > b->ind) - (a->ind < b->ind);
+}
+
+static int
+cmp_rows_count(const void *pa, const void *pb)
+{
+	const struct prof_row *a = pa, *b = pb;
+
+	if (a->c->n != b->c->n) {
+		return a->c->n < b->c->n ? 1 : -1;
+	}
+
+	return (a->ind > b->ind) - (a->ind < b->ind);
+}
+
+// Fills rows with the non-zero counts, sorted, and returns how many
+// there are
+static size_t
+prof_rows(const struct jvst_vm_prof *prof, const struct jvst_vm_prof_count *counts, size_t n,
+	struct prof_row *rows)
+{
+	size_t i, nrows;
+
+	nrows = 0;
+	for (i=0; i < n; i++) {
+		if (counts[i].n > 0) {
+			rows[nrows].ind = i;
+			rows[nrows].c = &counts[i];
+			nrows++;
+		}
+	}
+
+	qsort(rows, nrows, sizeof rows[0],
+		(prof->flags & JVST_VM_PROF_TIME) ? cmp_rows_nsec : cmp_rows_count);
+
+	return nrows;
+}
+
+static double
+percent(uint64_t part, uint64_t whole)
+{
+	return whole > 0 ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+// rows of locations are indexed by their offset in the program's
+// srcstr
+static const char *
+row_loc(const struct jvst_vm_prof *prof, const struct prof_row *row)
+{
+	return (row->ind > 0) ? &prof->prog->srcstr[row->ind] : "(unknown)";
+}
+
+static void
+print_json_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s != '\0'; s++) {
+		unsigned char ch = *s;
+
+		if (ch == '"' || ch == '\\') {
+			fprintf(f, "\\%c", ch);
+		} else if (ch < 0x20) {
+			fprintf(f, "\\u%04x", ch);
+		} else {
+			fputc(ch, f);
+		}
+	}
+	fputc('"', f);
+}
+
+static void
+report_text(FILE *f, const struct jvst_vm_prof *prof,
+	const struct prof_row *ops, size_t nops, const struct prof_row *procs, size_t nprocs,
+	const struct prof_row *locs, size_t nlocs, uint64_t total, uint64_t nsec)
+{
+	const int timed = (prof->flags & JVST_VM_PROF_TIME) != 0;
+	size_t i;
+
+	fprintf(f, "profile: %" PRIu64 " instructions", total);
+	if (timed) {
+		fprintf(f, " in %.3f ms", (double)nsec / 1e6);
+	}
+	fprintf(f, "\n\n");
+
+	fprintf(f, "  %-10s %14s %7s", "opcode", "count", "%");
+	if (timed) {
+		fprintf(f, " %14s %7s", "nsec", "%");
+	}
+	fprintf(f, "\n");
+
+	for (i=0; i < nops; i++) {
+		const struct jvst_vm_prof_count *c = ops[i].c;
+
+		fprintf(f, "  %-10s %14" PRIu64 " %7.2f", jvst_op_name(ops[i].ind),
+			c->n, percent(c->n, total));
+		if (timed) {
+			fprintf(f, " %14" PRIu64 " %7.2f", c->nsec, percent(c->nsec, nsec));
+		}
+		fprintf(f, "\n");
+	}
+
+	fprintf(f, "\n  %-10s %8s %14s %7s", "proc", "pc", "count", "%");
+	if (timed) {
+		fprintf(f, " %14s %7s", "nsec", "%");
+	}
+	fprintf(f, "\n");
+
+	for (i=0; i < nprocs; i++) {
+		const struct jvst_vm_prof_count *c = procs[i].c;
+
+		fprintf(f, "  %-10zu %8" PRIu32 " %14" PRIu64 " %7.2f", procs[i].ind,
+			prof->proc_pc[procs[i].ind], c->n, percent(c->n, total));
+		if (timed) {
+			fprintf(f, " %14" PRIu64 " %7.2f", c->nsec, percent(c->nsec, nsec));
+		}
+		fprintf(f, "\n");
+	}
+
+	if (nlocs > 0) {
+		fprintf(f, "\n  %14s %7s", "count", "%");
+		if (timed) {
+			fprintf(f, " %14s %7s", "nsec", "%");
+		}
+		fprintf(f, "  %s\n", "schema");
+	}
+
+	for (i=0; i < nlocs; i++) {
+		const struct jvst_vm_prof_count *c = locs[i].c;
+
+		fprintf(f, "  %14" PRIu64 " %7.2f", c->n, percent(c->n, total));
+		if (timed) {
+			fprintf(f, " %14" PRIu64 " %7.2f", c->nsec, percent(c->nsec, nsec));
+		}
+		fprintf(f, "  %s\n", row_loc(prof, &locs[i]));
+	}
+
+	fprintf(f, "\nsplit:   %" PRIu64 " splits, %" PRIu64 " split VMs, at most %" PRIu64 " per split\n",
+		prof->nsplit, prof->split_vms, prof->split_max);
+	fprintf(f, "match:   %" PRIu64 " bytes scanned\n", prof->match_bytes);
+	fprintf(f, "consume: %" PRIu64 " tokens, %" PRIu64 " bytes skipped\n",
+		prof->consume_tokens, prof->consume_bytes);
+}
+
+static void
+report_json(FILE *f, const struct jvst_vm_prof *prof,
+	const struct prof_row *ops, size_t nops, const struct prof_row *procs, size_t nprocs,
+	const struct prof_row *locs, size_t nlocs, uint64_t total, uint64_t nsec)
+{
+	const int timed = (prof->flags & JVST_VM_PROF_TIME) != 0;
+	size_t i;
+
+	fprintf(f, "{\n  \"instructions\": %" PRIu64 ",\n", total);
+	if (timed) {
+		fprintf(f, "  \"nsec\": %" PRIu64 ",\n", nsec);
+	}
+
+	fprintf(f, "  \"ops\": [");
+	for (i=0; i < nops; i++) {
+		fprintf(f, "%s\n    { \"op\": \"%s\", \"count\": %" PRIu64,
+			(i > 0) ? "," : "", jvst_op_name(ops[i].ind), ops[i].c->n);
+		if (timed) {
+			fprintf(f, ", \"nsec\": %" PRIu64, ops[i].c->nsec);
+		}
+		fprintf(f, " }");
+	}
+	fprintf(f, "\n  ],\n");
+
+	fprintf(f, "  \"procs\": [");
+	for (i=0; i < nprocs; i++) {
+		fprintf(f, "%s\n    { \"proc\": %zu, \"pc\": %" PRIu32 ", \"count\": %" PRIu64,
+			(i > 0) ? "," : "", procs[i].ind, prof->proc_pc[procs[i].ind], procs[i].c->n);
+		if (timed) {
+			fprintf(f, ", \"nsec\": %" PRIu64, procs[i].c->nsec);
+		}
+		fprintf(f, " }");
+	}
+	fprintf(f, "\n  ],\n");
+
+	fprintf(f, "  \"schema\": [");
+	for (i=0; i < nlocs; i++) {
+		fprintf(f, "%s\n    { \"location\": ", (i > 0) ? "," : "");
+		print_json_str(f, row_loc(prof, &locs[i]));
+		fprintf(f, ", \"count\": %" PRIu64, locs[i].c->n);
+		if (timed) {
+			fprintf(f, ", \"nsec\": %" PRIu64, locs[i].c->nsec);
+		}
+		fprintf(f, " }");
+	}
+	fprintf(f, "\n  ],\n");
+
+	fprintf(f, "  \"split\": { \"count\": %" PRIu64 ", \"vms\": %" PRIu64 ", \"max\": %" PRIu64 " },\n",
+		prof->nsplit, prof->split_vms, prof->split_max);
+	fprintf(f, "  \"match\": { \"bytes\": %" PRIu64 " },\n", prof->match_bytes);
+	fprintf(f, "  \"consume\": { \"tokens\": %" PRIu64 ", \"bytes\": %" PRIu64 " }\n",
+		prof->consume_tokens, prof->consume_bytes);
+	fprintf(f, "}\n");
+}
+
+void
+jvst_vm_prof_report(FILE *f, const struct jvst_vm_prof *prof)
+{
+	const struct jvst_vm_program *prog = prof->prog;
+	struct prof_row ops[JVST_OP_MAX+1], *procs, *locs;
+	struct jvst_vm_prof_count *loc_counts;
+	size_t i, nops, nprocs, nlocs;
+	uint64_t total, nsec;
+
+	total = nsec = 0;
+	for (i=0; i <= JVST_OP_MAX; i++) {
+		total += prof->ops[i].n;
+		nsec  += prof->ops[i].nsec;
+	}
+
+	procs = xmalloc(prof->nproc * sizeof procs[0]);
+
+	nops = prof_rows(prof, prof->ops, JVST_OP_MAX+1, ops);
+	nprocs = prof_rows(prof, prof->procs, prof->nproc, procs);
+
+	// add up the procs by the offset of their location
+	locs = NULL;
+	loc_counts = NULL;
+	nlocs = 0;
+	if (prog->nsrcmap > 0) {
+		loc_counts = xcalloc(prog->nsrcstr, sizeof loc_counts[0]);
+		locs = xmalloc(prog->nsrcstr * sizeof locs[0]);
+
+		for (i=0; i < prof->nproc; i++) {
+			const char *loc = jvst_vm_program_srcloc(prog, prof->proc_pc[i]);
+			size_t off = (loc != NULL) ? (size_t)(loc - prog->srcstr) : 0;
+
+			loc_counts[off].n    += prof->procs[i].n;
+			loc_counts[off].nsec += prof->procs[i].nsec;
+		}
+
+		nlocs = prof_rows(prof, loc_counts, prog->nsrcstr, locs);
+	}
+
+	if (prof->flags & JVST_VM_PROF_JSON) {
+		report_json(f, prof, ops, nops, procs, nprocs, locs, nlocs, total, nsec);
+	} else {
+		report_text(f, prof, ops, nops, procs, nprocs, locs, nlocs, total, nsec);
+	}
+
+	free(loc_counts);
+	free(locs);
+	free(procs);
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
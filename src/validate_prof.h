@@ -0,0 +1,96 @@
+#ifndef VALIDATE_PROF_H
+#define VALIDATE_PROF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "validate_vm.h"
+
+/* Profiles of VM runs.
+ *
+ * A profiled VM is run by the checked interpreter, which counts each
+ * instruction it executes against its opcode and against the proc that
+ * holds it.  With JVST_VM_PROF_TIME it also times each instruction with
+ * the monotonic clock.  Reading the clock for every instruction is
+ * much slower than the instruction itself, so times are only good for
+ * comparing opcodes and procs with each other.
+ *
+ * Split VMs add to the profile of the VM that started them, and their
+ * time isn't counted against the SPLIT that started them.
+ *
+ * If the program has a source map, the counts of the procs are also
+ * added up by the schema they were compiled from.
+ *
+ * Profiles are started with jvst_vm_set_profile().
+ */
+
+enum jvst_vm_prof_flags {
+	JVST_VM_PROF_TIME = 1 << 0,	// time each instruction
+	JVST_VM_PROF_JSON = 1 << 1,	// report as JSON rather than text
+};
+
+struct jvst_vm_prof_count {
+	uint64_t n;
+	uint64_t nsec;
+};
+
+struct jvst_vm_prof {
+	const struct jvst_vm_program *prog;
+	unsigned flags;
+
+	// where jvst_vm_finalize() reports the profile, or NULL
+	FILE *report;
+
+	struct jvst_vm_prof_count ops[JVST_OP_MAX+1];
+
+	// procs are numbered in the order of their PROCs in the program
+	size_t nproc;
+	uint32_t *proc_pc;	// pc of the PROC of each proc
+	uint32_t *pc_proc;	// proc of each pc
+	struct jvst_vm_prof_count *procs;
+
+	// SPLIT and SPLITV fan-out
+	uint64_t nsplit;	// splits started
+	uint64_t split_vms;	// split VMs started by them
+	uint64_t split_max;	// most split VMs started by one split
+
+	// bytes of string tokens scanned by MATCH
+	uint64_t match_bytes;
+
+	// tokens skipped by CONSUME and RETURN, and the bytes of their
+	// text
+	uint64_t consume_tokens;
+	uint64_t consume_bytes;
+
+	// the instruction being timed, and when its time started.  op is
+	// -1 when no instruction is being timed.
+	int cur_op;
+	uint32_t cur_proc;
+	uint64_t t0;
+};
+
+struct jvst_vm_prof *
+jvst_vm_prof_new(const struct jvst_vm_program *prog, unsigned flags, FILE *report);
+
+// Extends the profile to prog, which extends the program of the
+// profile with more procs.  Lazy programs grow this way as they run
+// (see validate_lazy.h).
+void
+jvst_vm_prof_extend(struct jvst_vm_prof *prof, const struct jvst_vm_program *prog);
+
+void
+jvst_vm_prof_free(struct jvst_vm_prof *prof);
+
+// Monotonic clock, in nanoseconds
+uint64_t
+jvst_vm_prof_clock(void);
+
+// Reports the profile to f: opcodes, procs and schema locations sorted
+// by time if the profile is timed, by count otherwise, then splits,
+// MATCH and CONSUME.
+void
+jvst_vm_prof_report(FILE *f, const struct jvst_vm_prof *prof);
+
+#endif /* VALIDATE_PROF_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
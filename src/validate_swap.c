@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "validate_swap.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xalloc.h"
+#include "validate_vm.h"
+
+/* Each published program is wrapped in a reference counted progref.
+ * The cell holds one reference to the current progref, and each VM
+ * started from the cell holds another.
+ *
+ * Taking a reference happens with the cell locked, and publishing
+ * swaps the current progref with the cell locked before dropping the
+ * cell's reference.  So a progref can't drop to zero references while
+ * a VM is taking one.
+ */
+struct jvst_vm_progref {
+	pthread_mutex_t lock;
+	size_t refs;
+	struct jvst_vm_program *prog;
+};
+
+struct jvst_vm_cell {
+	pthread_mutex_t lock;
+	struct jvst_vm_progref *cur;
+};
+
+static void
+swap_lock(pthread_mutex_t *m)
+{
+	if (pthread_mutex_lock(m) != 0) {
+		fprintf(stderr, "%s:%d (%s) could not lock mutex\n",
+			__FILE__, __LINE__, __func__);
+		abort();
+	}
+}
+
+static void
+swap_unlock(pthread_mutex_t *m)
+{
+	if (pthread_mutex_unlock(m) != 0) {
+		fprintf(stderr, "%s:%d (%s) could not unlock mutex\n",
+			__FILE__, __LINE__, __func__);
+		abort();
+	}
+}
+
+static struct jvst_vm_progref *
+progref_new(struct jvst_vm_program *prog)
+{
+	struct jvst_vm_progref *ref;
+
+	assert(prog != NULL);
+
+	ref = xmalloc(sizeof *ref);
+	if (pthread_mutex_init(&ref->lock, NULL) != 0) {
+		fprintf(stderr, "%s:%d (%s) could not initialize mutex\n",
+			__FILE__, __LINE__, __func__);
+		abort();
+	}
+
+	ref->refs = 1;
+	ref->prog = prog;
+
+	return ref;
+}
+
+void
+jvst_vm_progref_release(struct jvst_vm_progref *ref)
+{
+	size_t refs;
+
+	assert(ref != NULL);
+
+	swap_lock(&ref->lock);
+	assert(ref->refs > 0);
+	refs = --ref->refs;
+	swap_unlock(&ref->lock);
+
+	if (refs > 0) {
+		return;
+	}
+
+	jvst_vm_program_free(ref->prog);
+	pthread_mutex_destroy(&ref->lock);
+	free(ref);
+}
+
+struct jvst_vm_cell *
+jvst_vm_cell_new(struct jvst_vm_program *prog)
+{
+	struct jvst_vm_cell *cell;
+
+	cell = xmalloc(sizeof *cell);
+	if (pthread_mutex_init(&cell->lock, NULL) != 0) {
+		fprintf(stderr, "%s:%d (%s) could not initialize mutex\n",
+			__FILE__, __LINE__, __func__);
+		abort();
+	}
+
+	cell->cur = progref_new(prog);
+
+	return cell;
+}
+
+void
+jvst_vm_cell_publish(struct jvst_vm_cell *cell, struct jvst_vm_program *prog)
+{
+	struct jvst_vm_progref *ref, *old;
+
+	ref = progref_new(prog);
+
+	swap_lock(&cell->lock);
+	old = cell->cur;
+	cell->cur = ref;
+	swap_unlock(&cell->lock);
+
+	jvst_vm_progref_release(old);
+}
+
+void
+jvst_vm_cell_free(struct jvst_vm_cell *cell)
+{
+	if (cell == NULL) {
+		return;
+	}
+
+	jvst_vm_progref_release(cell->cur);
+	pthread_mutex_destroy(&cell->lock);
+	free(cell);
+}
+
+void
+jvst_vm_init_cell(struct jvst_vm *vm, struct jvst_vm_cell *cell)
+{
+	struct jvst_vm_progref *ref;
+
+	swap_lock(&cell->lock);
+	ref = cell->cur;
+
+	swap_lock(&ref->lock);
+	assert(ref->refs > 0);
+	ref->refs++;
+	swap_unlock(&ref->lock);
+
+	swap_unlock(&cell->lock);
+
+	jvst_vm_init_defaults(vm, ref->prog);
+	vm->progref = ref;
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -0,0 +1,48 @@
+#ifndef VALIDATE_SWAP_H
+#define VALIDATE_SWAP_H
+
+/* Swapping the program of long-lived validators.
+ *
+ * A cell holds the current program.  jvst_vm_init_cell() starts a VM
+ * with the program that is current at the time, and the VM keeps a
+ * reference to it until jvst_vm_finalize(), so each document is
+ * validated with a single program.  jvst_vm_cell_publish() replaces
+ * the current program without waiting for VMs that are running: they
+ * keep the old program, which is freed once the last of them is
+ * finalized.
+ *
+ * Cells can be shared between threads.  Each VM must still only be used
+ * by one thread at a time.
+ */
+
+struct jvst_vm;
+struct jvst_vm_program;
+
+struct jvst_vm_cell;
+struct jvst_vm_progref;
+
+// Creates a cell that holds prog.  The cell takes ownership of prog.
+struct jvst_vm_cell *
+jvst_vm_cell_new(struct jvst_vm_program *prog);
+
+// Makes prog the current program and takes ownership of it.  The
+// previous program is freed when no VM refers to it.
+void
+jvst_vm_cell_publish(struct jvst_vm_cell *cell, struct jvst_vm_program *prog);
+
+// Frees the cell.  The current program is freed when no VM refers to it,
+// so VMs started from the cell can outlive it.
+void
+jvst_vm_cell_free(struct jvst_vm_cell *cell);
+
+// Like jvst_vm_init_defaults(), with the cell's current program
+void
+jvst_vm_init_cell(struct jvst_vm *vm, struct jvst_vm_cell *cell);
+
+// Drops a VM's reference to its program.  Called by jvst_vm_finalize().
+void
+jvst_vm_progref_release(struct jvst_vm_progref *ref);
+
+#endif /* VALIDATE_SWAP_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -39,8 +39,12 @@ hash_entry(void *hopaque, const void *key)
 	case SJP_NULL:
 	case SJP_TRUE:
 	case SJP_FALSE:
+		// hash the type alone: the struct has padding and an unset
+		// union, which would give equal entries different hashes
+		return XXH64(&entry->type, sizeof entry->type, 0 /* XXX - SEED */);
+
 	case SJP_NUMBER:
-		return XXH64(entry, sizeof *entry, 0 /* XXX - SEED */);
+		return XXH64(&entry->u.d, sizeof entry->u.d, 0 /* XXX - SEED */);
 
 	case SJP_STRING:
 	case SJP_OBJECT_BEG:
@@ -105,8 +109,11 @@ uniq_stack_init(struct jvst_vm_unique_stack *frame, enum jvst_vm_uniq_state stat
 static void
 finalize_entry(struct jvst_vm_uniq_entry *entry);
 
+static size_t
+entry_bytes(const struct jvst_vm_uniq_entry *entry);
+
 static void
-uniq_stack_final(struct jvst_vm_unique_stack *frame)
+uniq_stack_final(struct jvst_vm_unique *uniq, struct jvst_vm_unique_stack *frame)
 {
 	size_t i,n;
 
@@ -119,6 +126,8 @@ uniq_stack_final(struct jvst_vm_unique_stack *frame)
 
 	n = frame->entries.len;
 	for (i=0; i < n; i++) {
+		assert(uniq->nbytes >= entry_bytes(&frame->entries.items[i]));
+		uniq->nbytes -= entry_bytes(&frame->entries.items[i]);
 		finalize_entry(&frame->entries.items[i]);
 	}
 
@@ -144,6 +153,10 @@ jvst_vm_uniq_initialize(void)
 	uniq->top = 0;
 	uniq_stack_init(&uniq->stack[uniq->top], JVST_VM_UNIQ_BARE);
 
+	uniq->nbytes = 0;
+	uniq->maxbytes = 0;
+	uniq->overflow = 0;
+
 	return uniq;
 }
 
@@ -162,7 +175,9 @@ number_entry(struct jvst_vm_unique *uniq, double d)
 
 	entry = malloc(sizeof *entry);  // XXX - replace with pool allocator?
 	entry->type = SJP_NUMBER;
-	entry->u.d = d;
+	// -0 and 0 are equal, so they need the same bytes for the hash
+	// and for arrays and objects that hold them
+	entry->u.d = (d == 0.0) ? 0.0 : d;
 
 	return entry;
 }
@@ -382,6 +397,21 @@ finalize_entry(struct jvst_vm_uniq_entry *entry)
 	}
 }
 
+// bytes held by an entry, for the limit on uniq->nbytes
+static size_t
+entry_bytes(const struct jvst_vm_uniq_entry *entry)
+{
+	switch (entry->type) {
+	case SJP_STRING:
+	case SJP_OBJECT_BEG:
+	case SJP_ARRAY_BEG:
+		return sizeof *entry + entry->u.b.len;
+
+	default:
+		return sizeof *entry;
+	}
+}
+
 static void
 free_entry(struct jvst_vm_uniq_entry *entry)
 {
@@ -412,6 +442,20 @@ static void uniq_add_entry(struct jvst_vm_unique *uniq, struct jvst_vm_uniq_entr
 	stack->entries.items[stack->entries.len++] = *entry;
 }
 
+// Items nested deeper than the UEM stack fail like items that are too
+// large for the limit on uniq->nbytes
+static enum jvst_result
+uniq_push(struct jvst_vm_unique *uniq, enum jvst_vm_uniq_state state)
+{
+	if (uniq->top+1 >= UNIQ_STACK) {
+		uniq->overflow = 1;
+		return JVST_INVALID;
+	}
+
+	uniq_stack_init(&uniq->stack[++uniq->top], state);
+	return JVST_NEXT;
+}
+
 /* Unique evaluation machine (UEM)
  *
  * The UEM is a pushdown automaton.  There's a stack used for processing
@@ -503,8 +547,7 @@ jvst_vm_uniq_evaluate(struct jvst_vm_unique *uniq, enum SJP_RESULT pret, struct
 		break;
 
 	case SJP_ARRAY_BEG:
-		uniq_stack_init(&uniq->stack[++uniq->top], JVST_VM_UNIQ_ARRAY);
-		return JVST_NEXT;
+		return uniq_push(uniq, JVST_VM_UNIQ_ARRAY);
 
 	case SJP_ARRAY_END:
 		if (uniq->top == 0) {
@@ -514,26 +557,34 @@ jvst_vm_uniq_evaluate(struct jvst_vm_unique *uniq, enum SJP_RESULT pret, struct
 
 		assert(uniq->stack[uniq->top].state == JVST_VM_UNIQ_ARRAY);
 		entry = array_entry(uniq);
-		uniq_stack_final(&uniq->stack[uniq->top--]);
+		uniq_stack_final(uniq, &uniq->stack[uniq->top--]);
 		break;
 
 	case SJP_OBJECT_BEG:
-		uniq_stack_init(&uniq->stack[++uniq->top], JVST_VM_UNIQ_OBJKEY);
-		return JVST_NEXT;
+		return uniq_push(uniq, JVST_VM_UNIQ_OBJKEY);
 
 	case SJP_OBJECT_END:
 		assert(uniq->stack[uniq->top].state == JVST_VM_UNIQ_OBJKEY);
 		entry = object_entry(uniq);
-		uniq_stack_final(&uniq->stack[uniq->top--]);
+		uniq_stack_final(uniq, &uniq->stack[uniq->top--]);
 		break;
 
 	default:
 	case SJP_NONE: SHOULD_NOT_REACH();
 	}
 
+	uniq->nbytes += entry_bytes(entry);
+	if (uniq->maxbytes > 0 && uniq->nbytes > uniq->maxbytes) {
+		uniq->nbytes -= entry_bytes(entry);
+		free_entry(entry);
+		uniq->overflow = 1;
+		return JVST_INVALID;
+	}
+
 	switch (uniq->stack[uniq->top].state) {
 	case JVST_VM_UNIQ_BARE:
 		if (hmap_get(uniq->entries, entry) != NULL) {
+			uniq->nbytes -= entry_bytes(entry);
 			free_entry(entry);
 			// XXX - set state to
 			// unique violation
@@ -70,6 +70,13 @@ struct jvst_vm_unique
 	struct jvst_vm_unique_stack stack[UNIQ_STACK];
 	size_t top;
 	// need stack to store state of objects so we can sort them...
+
+	// bytes held by entries, and the most they may hold (zero for no
+	// limit).  overflow is set when jvst_vm_uniq_evaluate() fails
+	// because of the limit rather than a duplicate.
+	size_t nbytes;
+	size_t maxbytes;
+	int overflow;
 };
 
 struct jvst_vm_unique *
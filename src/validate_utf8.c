@@ -0,0 +1,145 @@
+#include "validate_utf8.h"
+
+#include <string.h>
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+static inline uint64_t
+load64(const unsigned char *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof w);
+	return w;
+}
+
+/* Returns the number of bytes in w that are not continuation bytes
+ * (10xxxxxx).  A byte is a continuation byte if bit 7 is set and bit 6
+ * is clear, so shifting w left by one lines up each byte's bit 6 with
+ * its bit 7.  The bit that crosses into the neighbouring byte lands in
+ * bit 0, which the mask discards, so this works for either byte order.
+ */
+static inline size_t
+count_leads(uint64_t w)
+{
+	uint64_t cont;
+
+	cont = w & ~(w << 1) & HIGHS;
+	return 8 - (size_t)(((cont >> 7) * ONES) >> 56);
+}
+
+void
+jvst_utf8_init(struct jvst_utf8 *u)
+{
+	static const struct jvst_utf8 zero;
+
+	*u = zero;
+	u->lo = 0x80;
+	u->hi = 0xbf;
+}
+
+int
+jvst_utf8_feed(struct jvst_utf8 *u, const char *s, size_t n)
+{
+	const unsigned char *p;
+	size_t i, ncp;
+
+	if (u->invalid) {
+		return 0;
+	}
+
+	p = (const unsigned char *)s;
+	ncp = u->ncp;
+
+	i = 0;
+	while (i < n) {
+		unsigned b;
+
+		if (u->need > 0) {
+			b = p[i++];
+			if (b < u->lo || b > u->hi) {
+				goto invalid;
+			}
+
+			u->need--;
+			u->lo = 0x80;
+			u->hi = 0xbf;
+			continue;
+		}
+
+		// skip runs of ASCII a word at a time
+		while (n - i >= 8 && (load64(p+i) & HIGHS) == 0) {
+			i += 8;
+			ncp += 8;
+		}
+
+		if (i == n) {
+			break;
+		}
+
+		b = p[i++];
+		if (b < 0x80) {
+			ncp++;
+			continue;
+		}
+
+		// The ranges of the first continuation byte exclude
+		// overlong encodings (E0, F0), UTF-16 surrogates (ED) and
+		// code points above U+10FFFF (F4).  Lead bytes C0, C1 and
+		// F5-FF can only start overlong or out of range sequences.
+		if (b < 0xc2) {
+			goto invalid;
+		} else if (b < 0xe0) {
+			u->need = 1;
+		} else if (b < 0xf0) {
+			u->need = 2;
+			u->lo = (b == 0xe0) ? 0xa0 : 0x80;
+			u->hi = (b == 0xed) ? 0x9f : 0xbf;
+		} else if (b < 0xf5) {
+			u->need = 3;
+			u->lo = (b == 0xf0) ? 0x90 : 0x80;
+			u->hi = (b == 0xf4) ? 0x8f : 0xbf;
+		} else {
+			goto invalid;
+		}
+
+		ncp++;
+	}
+
+	u->ncp = ncp;
+	return 1;
+
+invalid:
+	u->ncp = ncp;
+	u->invalid = 1;
+	return 0;
+}
+
+int
+jvst_utf8_complete(const struct jvst_utf8 *u)
+{
+	return !u->invalid && u->need == 0;
+}
+
+size_t
+jvst_utf8_count(const char *s, size_t n)
+{
+	const unsigned char *p;
+	size_t i, ncp;
+
+	p = (const unsigned char *)s;
+	ncp = 0;
+
+	for (i=0; n - i >= 8; i += 8) {
+		ncp += count_leads(load64(p+i));
+	}
+
+	for (; i < n; i++) {
+		ncp += ((p[i] & 0xc0) != 0x80);
+	}
+
+	return ncp;
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
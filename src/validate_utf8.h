@@ -0,0 +1,51 @@
+#ifndef VALIDATE_UTF8_H
+#define VALIDATE_UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* UTF-8 validation and code point counting.
+ *
+ * String lengths in JSON Schema are counted in code points, so both the
+ * VM (for %TLEN) and the binary decoders need to count the code points
+ * in string data, and the binary decoders also need to reject malformed
+ * UTF-8.
+ *
+ * The routines process eight bytes at a time and only fall back to a
+ * byte-at-a-time loop for multibyte sequences.  Validation is
+ * incremental: a string can be fed in pieces that split multibyte
+ * sequences anywhere.
+ */
+
+struct jvst_utf8 {
+	size_t ncp;		// code points seen so far
+	uint8_t need;		// continuation bytes still expected
+	uint8_t lo, hi;		// allowed range of the next continuation byte
+	uint8_t invalid;	// sticky error flag
+};
+
+void
+jvst_utf8_init(struct jvst_utf8 *u);
+
+/* Validates and counts the next n bytes of a string.  Returns 0 if the
+ * data seen so far is not valid UTF-8.
+ */
+int
+jvst_utf8_feed(struct jvst_utf8 *u, const char *s, size_t n);
+
+/* Returns 1 if all data fed so far is valid UTF-8 and does not end in
+ * the middle of a multibyte sequence.
+ */
+int
+jvst_utf8_complete(const struct jvst_utf8 *u);
+
+/* Counts the code points in s, which must be valid UTF-8.  Counts are
+ * additive, so a string split anywhere (even inside a multibyte
+ * sequence) can be counted a piece at a time.
+ */
+size_t
+jvst_utf8_count(const char *s, size_t n);
+
+#endif /* VALIDATE_UTF8_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
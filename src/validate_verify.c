@@ -0,0 +1,496 @@
+#include "validate_verify.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "validate_vm.h"
+
+struct verifier {
+	struct jvst_vm_program *prog;
+	struct jvst_vm_verify_error *err;
+
+	// current proc: code[proc0] is the PROC, code[proc1] is the
+	// next PROC or the end of the code
+	uint32_t proc0;
+	uint32_t proc1;
+
+	// registers and slots in the frame of the current proc
+	uint32_t nframe;
+};
+
+static int
+verify_fail(struct verifier *v, uint32_t pc, const char *msg)
+{
+	if (v->err != NULL) {
+		v->err->pc  = pc;
+		v->err->msg = msg;
+	}
+
+	return -1;
+}
+
+#define FAIL(v, pc, msg) return verify_fail((v), (pc), (msg))
+
+static int
+is_proc(const struct jvst_vm_program *prog, long pc)
+{
+	return pc >= 0 && (size_t)pc < prog->ncode &&
+		jvst_vm_decode_op(prog->code[pc]) == JVST_OP_PROC;
+}
+
+// arg must be a slot with n slots from it in the frame
+static int
+verify_slots(struct verifier *v, uint32_t pc, uint32_t arg, uint32_t n)
+{
+	uint32_t slot;
+
+	if (!jvst_vm_arg_isslot(arg)) {
+		FAIL(v, pc, "expected a slot argument");
+	}
+
+	slot = jvst_vm_arg_toslot(arg);
+	if (slot >= v->nframe || n > v->nframe - slot) {
+		FAIL(v, pc, "slot outside of the frame");
+	}
+
+	return 0;
+}
+
+// arg is either a literal or a slot in the frame
+static int
+verify_value(struct verifier *v, uint32_t pc, uint32_t arg)
+{
+	if (jvst_vm_arg_islit(arg)) {
+		return 0;
+	}
+
+	return verify_slots(v, pc, arg, 1);
+}
+
+static int
+verify_lit(struct verifier *v, uint32_t pc, uint32_t arg, int lo, int hi)
+{
+	int lit;
+
+	if (!jvst_vm_arg_islit(arg)) {
+		FAIL(v, pc, "expected a literal argument");
+	}
+
+	lit = jvst_vm_arg_tolit(arg);
+	if (lit < lo || lit > hi) {
+		FAIL(v, pc, "literal argument out of range");
+	}
+
+	return 0;
+}
+
+static uint32_t
+split_nproc(const struct jvst_vm_program *prog, int split)
+{
+	return prog->sdata[split+1] - prog->sdata[split];
+}
+
+static int
+ends_proc(uint32_t opcode)
+{
+	switch (jvst_vm_decode_op(opcode)) {
+	case JVST_OP_RETURN:
+		return 1;
+
+	case JVST_OP_JMP:
+		return jvst_vm_decode_bcond(opcode) == JVST_VM_BR_ALWAYS;
+
+	case JVST_OP_UNIQUE:
+		return jvst_vm_decode_arg0(opcode) == jvst_vm_arg_lit(JVST_VM_UNIQUE_EVAL);
+
+	default:
+		return 0;
+	}
+}
+
+static int
+verify_op(struct verifier *v, uint32_t pc)
+{
+	const struct jvst_vm_program *prog = v->prog;
+	uint32_t opcode, a0, a1;
+	enum jvst_vm_op op;
+
+	opcode = prog->code[pc];
+	op = jvst_vm_decode_op(opcode);
+	a0 = jvst_vm_decode_arg0(opcode);
+	a1 = jvst_vm_decode_arg1(opcode);
+
+	switch (op) {
+	case JVST_OP_NOP:
+	case JVST_OP_CONSUME:
+		return 0;
+
+	case JVST_OP_PROC:
+		FAIL(v, pc, "PROC inside of a proc");
+
+	case JVST_OP_ICMP:
+		if (verify_value(v, pc, a0) < 0) {
+			return -1;
+		}
+		return verify_value(v, pc, a1);
+
+	case JVST_OP_FCMP:
+		if (verify_slots(v, pc, a0, 1) < 0) {
+			return -1;
+		}
+		return verify_slots(v, pc, a1, 1);
+
+	case JVST_OP_FINT:
+		if (verify_slots(v, pc, a0, 1) < 0) {
+			return -1;
+		}
+		return verify_value(v, pc, a1);
+
+	case JVST_OP_JMP:
+		{
+			long br = jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+
+			if ((long)pc + br <= (long)v->proc0 || (long)pc + br >= (long)v->proc1) {
+				FAIL(v, pc, "branch target outside of its proc");
+			}
+		}
+		return 0;
+
+	case JVST_OP_CALL:
+		{
+			long br = jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+
+			// a stub, compiled on the first CALL
+			if (br == 0 && prog->lazy != NULL) {
+				return 0;
+			}
+
+			if (!is_proc(prog, (long)pc + br)) {
+				FAIL(v, pc, "CALL target is not a PROC");
+			}
+		}
+		return 0;
+
+	case JVST_OP_SPLIT:
+	case JVST_OP_SPLITV:
+		{
+			uint32_t nslots;
+			int split;
+
+			if (verify_lit(v, pc, a0, 0, JVST_VM_MAXLIT) < 0) {
+				return -1;
+			}
+
+			split = jvst_vm_arg_tolit(a0);
+			if ((size_t)split >= prog->nsplit) {
+				FAIL(v, pc, "invalid split index");
+			}
+
+			// SPLITV sets a bit for each proc of the split
+			nslots = 1;
+			if (op == JVST_OP_SPLITV) {
+				uint32_t nproc = split_nproc(prog, split);
+				nslots = nproc / 64 + ((nproc % 64) > 0);
+				if (nslots == 0) {
+					nslots = 1;
+				}
+			}
+
+			return verify_slots(v, pc, a1, nslots);
+		}
+
+	case JVST_OP_TOKEN:
+		return verify_lit(v, pc, a1, -1, 0);
+
+	case JVST_OP_MATCH:
+		if (verify_lit(v, pc, a0, 0, JVST_VM_MAXLIT) < 0) {
+			return -1;
+		}
+
+		if ((size_t)jvst_vm_arg_tolit(a0) >= prog->ndfa) {
+			FAIL(v, pc, "invalid DFA index");
+		}
+		return 0;
+
+	case JVST_OP_FLOAD:
+	case JVST_OP_ILOAD:
+		{
+			size_t n = (op == JVST_OP_FLOAD) ? prog->nfloat : prog->nconst;
+
+			if (verify_slots(v, pc, a0, 1) < 0) {
+				return -1;
+			}
+
+			if (verify_lit(v, pc, a1, 0, JVST_VM_MAXLIT) < 0) {
+				return -1;
+			}
+
+			if ((size_t)jvst_vm_arg_tolit(a1) >= n) {
+				FAIL(v, pc, "invalid pool index");
+			}
+		}
+		return 0;
+
+	case JVST_OP_MOVE:
+	case JVST_OP_INCR:
+	case JVST_OP_BAND:
+		if (verify_slots(v, pc, a0, 1) < 0) {
+			return -1;
+		}
+		return verify_value(v, pc, a1);
+
+	case JVST_OP_BSET:
+		if (verify_slots(v, pc, a0, 1) < 0) {
+			return -1;
+		}
+
+		// a literal bit must be in the frame, a bit held in a slot
+		// is checked when the BSET runs
+		if (jvst_vm_arg_islit(a1)) {
+			int bit = jvst_vm_arg_tolit(a1);
+
+			if (bit < 0) {
+				FAIL(v, pc, "BSET with a negative bit");
+			}
+
+			return verify_slots(v, pc, a0, bit/64 + 1);
+		}
+		return verify_slots(v, pc, a1, 1);
+
+	case JVST_OP_BCOUNT:
+		if (verify_slots(v, pc, a0, 1) < 0) {
+			return -1;
+		}
+		return verify_slots(v, pc, a1, 1);
+
+	case JVST_OP_RETURN:
+		return verify_lit(v, pc, a0, 0, JVST_VM_MAXLIT);
+
+	case JVST_OP_UNIQUE:
+		return verify_lit(v, pc, a0, JVST_VM_UNIQUE_INIT, JVST_VM_UNIQUE_FINAL);
+	}
+
+	FAIL(v, pc, "unknown op");
+}
+
+static int
+verify_splits(struct verifier *v)
+{
+	const struct jvst_vm_program *prog = v->prog;
+	size_t i, n, off;
+
+	if (prog->nsplit == 0) {
+		return 0;
+	}
+
+	if (prog->sdata == NULL || prog->sdata[0] != 0) {
+		FAIL(v, JVST_VM_VERIFY_NOPC, "split table does not start at zero");
+	}
+
+	for (i=0; i < prog->nsplit; i++) {
+		if (prog->sdata[i+1] < prog->sdata[i]) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "split table is not sorted");
+		}
+	}
+
+	// the procs of each split follow the offsets
+	n = prog->sdata[prog->nsplit];
+	off = prog->nsplit + 1;
+	for (i=0; i < n; i++) {
+		if (!is_proc(prog, prog->sdata[off+i])) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "split entry is not a PROC");
+		}
+	}
+
+	return 0;
+}
+
+static int
+is_pow2(uint32_t n)
+{
+	return n > 0 && (n & (n-1)) == 0;
+}
+
+// The lookup masks the bucket and the slot index, so displacements
+// can't index past the slots once both sizes are powers of two.  What
+// remains is that the keys of the slots are inside the key buffer.
+static int
+verify_strtab(struct verifier *v, const struct jvst_vm_strtab *tab)
+{
+	size_t i;
+
+	if (!is_pow2(tab->nbuckets) || !is_pow2(tab->nslots)) {
+		FAIL(v, JVST_VM_VERIFY_NOPC, "string table size is not a power of two");
+	}
+
+	if (tab->disp == NULL || tab->slots == NULL || tab->keys == NULL) {
+		FAIL(v, JVST_VM_VERIFY_NOPC, "string table is missing");
+	}
+
+	if (tab->nkeys > tab->nslots) {
+		FAIL(v, JVST_VM_VERIFY_NOPC, "string table has more keys than slots");
+	}
+
+	for (i=0; i < tab->nslots; i++) {
+		const struct jvst_vm_strtab_slot *slot = &tab->slots[i];
+
+		if (slot->which == 0) {
+			continue;
+		}
+
+		if (slot->which < 0) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "string table slot has an invalid case");
+		}
+
+		if (slot->off > tab->keylen || slot->len > tab->keylen - slot->off) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "string table key out of range");
+		}
+	}
+
+	return 0;
+}
+
+static int
+verify_dfa(struct verifier *v, const struct jvst_vm_dfa *dfa)
+{
+	size_t i;
+
+	if (dfa->nstates == 0 || dfa->offs == NULL) {
+		FAIL(v, JVST_VM_VERIFY_NOPC, "DFA without states");
+	}
+
+	if (dfa->offs[0] != 0) {
+		FAIL(v, JVST_VM_VERIFY_NOPC, "DFA edges do not start at zero");
+	}
+
+	for (i=0; i < dfa->nstates; i++) {
+		if (dfa->offs[i+1] < dfa->offs[i]) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "DFA edge offsets are not sorted");
+		}
+	}
+
+	if ((size_t)dfa->offs[dfa->nstates] > dfa->nedges) {
+		FAIL(v, JVST_VM_VERIFY_NOPC, "DFA edge offset out of range");
+	}
+
+	for (i=0; i < dfa->nedges; i++) {
+		int st = dfa->transitions[2*i+1];
+
+		if (st < 0 || (size_t)st >= dfa->nstates) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "DFA edge to an invalid state");
+		}
+	}
+
+	for (i=0; i < dfa->nends; i++) {
+		int st = dfa->endstates[2*i];
+
+		if (st < 0 || (size_t)st >= dfa->nstates) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "DFA end state is not a state");
+		}
+	}
+
+	switch (dfa->lit_kind) {
+	case JVST_VM_DFA_LIT_NONE:
+		break;
+
+	case JVST_VM_DFA_LIT_EXACT:
+	case JVST_VM_DFA_LIT_PREFIX:
+	case JVST_VM_DFA_LIT_SUFFIX:
+	case JVST_VM_DFA_LIT_SUBSTR:
+		if (dfa->nlit > 0 && dfa->lit == NULL) {
+			FAIL(v, JVST_VM_VERIFY_NOPC, "DFA literal is missing");
+		}
+		break;
+
+	default:
+		FAIL(v, JVST_VM_VERIFY_NOPC, "DFA literal has an invalid kind");
+	}
+
+	if (dfa->strtab != NULL) {
+		return verify_strtab(v, dfa->strtab);
+	}
+
+	return 0;
+}
+
+int
+jvst_vm_verify(struct jvst_vm_program *prog, struct jvst_vm_verify_error *err)
+{
+	struct verifier v = { 0 };
+	size_t i;
+	uint32_t pc;
+
+	v.prog = prog;
+	v.err  = err;
+
+	if (prog->ncode == 0) {
+		FAIL(&v, JVST_VM_VERIFY_NOPC, "program without code");
+	}
+
+	if (verify_splits(&v) < 0) {
+		return -1;
+	}
+
+	for (i=0; i < prog->ndfa; i++) {
+		if (verify_dfa(&v, &prog->dfas[i]) < 0) {
+			return -1;
+		}
+	}
+
+	for (pc=0; pc < prog->ncode; pc = v.proc1) {
+		uint32_t opcode, last;
+		int nslots;
+
+		opcode = prog->code[pc];
+		if (jvst_vm_decode_op(opcode) != JVST_OP_PROC) {
+			FAIL(&v, pc, "code outside of a proc");
+		}
+
+		if (verify_lit(&v, pc, jvst_vm_decode_arg0(opcode), 0, JVST_VM_MAXLIT) < 0) {
+			return -1;
+		}
+
+		if (verify_lit(&v, pc, jvst_vm_decode_arg1(opcode), 0, JVST_VM_MAXLIT) < 0) {
+			return -1;
+		}
+
+		if (jvst_vm_arg_tolit(jvst_vm_decode_arg1(opcode)) & ~JVST_VM_PROC_FLAGS) {
+			FAIL(&v, pc, "unknown PROC flags");
+		}
+
+		nslots = jvst_vm_arg_tolit(jvst_vm_decode_arg0(opcode));
+
+		v.proc0  = pc;
+		v.nframe = JVST_VM_NUMREG + nslots;
+		for (v.proc1 = pc+1; v.proc1 < prog->ncode; v.proc1++) {
+			if (jvst_vm_decode_op(prog->code[v.proc1]) == JVST_OP_PROC) {
+				break;
+			}
+		}
+
+		// control can't run off the end of a proc.  UNIQUE EVAL
+		// repeats until the set is finished, and ends the procs
+		// that the uniqueItems splits run.
+		last = prog->code[v.proc1-1];
+		if (v.proc1 == pc+1 || !ends_proc(last)) {
+			FAIL(&v, v.proc1-1, "proc does not end with RETURN or JMP");
+		}
+
+		for (pc = v.proc0+1; pc < v.proc1; pc++) {
+			if (verify_op(&v, pc) < 0) {
+				return -1;
+			}
+		}
+	}
+
+	// VMs trust the stack bound of verified programs
+	if (prog->maxstack != JVST_VM_STACK_UNBOUNDED &&
+			prog->maxstack < jvst_vm_stack_bound(prog)) {
+		FAIL(&v, JVST_VM_VERIFY_NOPC, "stack bound is too small");
+	}
+
+	prog->verified = 1;
+	return 0;
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
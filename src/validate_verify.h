@@ -0,0 +1,46 @@
+#ifndef VALIDATE_VERIFY_H
+#define VALIDATE_VERIFY_H
+
+#include <stdint.h>
+
+/* One-time verification of VM programs.
+ *
+ * The interpreter checks every pc, slot index and pool index as it
+ * runs, so a corrupt program stops with an error instead of reading
+ * outside its tables.  jvst_vm_verify() makes the same checks once,
+ * over the whole program:
+ *
+ *   - every instruction is a known op with arguments of the right kind
+ *   - the program is a sequence of procs, each starting with PROC and
+ *     ending with RETURN, an unconditional JMP or UNIQUE EVAL
+ *   - JMP targets stay within their proc, CALL targets and split
+ *     entries are PROCs, other than the stubs of lazy programs (see
+ *     validate_lazy.h), which are verified as they're linked
+ *   - slots are within the frame of their proc
+ *   - float and constant pool, DFA and split indexes are in range, and
+ *     the DFA and split tables themselves are consistent
+ *   - the stack bound of the program, if it has one, is large enough
+ *
+ * Verified programs are run by an interpreter loop without these
+ * checks.  Values that are only known at run time (the bit of a BSET
+ * held in a slot, the range of a BCOUNT) are still checked.
+ */
+
+struct jvst_vm_program;
+
+struct jvst_vm_verify_error {
+	uint32_t pc;		// instruction at fault, or JVST_VM_VERIFY_NOPC
+	const char *msg;
+};
+
+#define JVST_VM_VERIFY_NOPC UINT32_MAX
+
+/* Verifies prog.  Returns 0 and marks prog as verified, or -1 and fills
+ * in *err (if err isn't NULL) with the first problem found.
+ */
+int
+jvst_vm_verify(struct jvst_vm_program *prog, struct jvst_vm_verify_error *err);
+
+#endif /* VALIDATE_VERIFY_H */
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
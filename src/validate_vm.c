@@ -15,7 +15,15 @@
 #include "hmap.h"
 #include "validate_ir.h"  // XXX - this is for INVALID codes, which should be moved!
 #include "validate_uniq.h"
+#include "validate_bin.h"
+#include "validate_utf8.h"
+#include "validate_swap.h"
+#include "validate_native.h"
+#include "validate_jit.h"
+#include "validate_prof.h"
+#include "validate_lazy.h"
 #include "debug.h"
+#include "xxhash.h"
 
 #define DEBUG_OPCODES (debug & DEBUG_VMOP)	// displays opcodes and the current frame's stack
 #define DEBUG_STEP    0				// instruction-by-instruction execution of the VM
@@ -57,6 +65,7 @@ jvst_op_name(enum jvst_vm_op op)
 	case JVST_OP_INCR:      return "INCR";
 	case JVST_OP_BSET:      return "BSET";
 	case JVST_OP_BAND:      return "BAND";
+	case JVST_OP_BCOUNT:    return "BCOUNT";
 	case JVST_OP_RETURN:    return "RETURN";
 	case JVST_OP_UNIQUE:	return "UNIQUE";
 	}
@@ -235,8 +244,25 @@ vm_dump(struct sbuf *buf, const struct jvst_vm_program *prog, int indent)
 
 	if (prog->ndfa > 0) {
 		for (i=0; i < prog->ndfa; i++) {
+			const struct jvst_vm_dfa *dfa;
+
+			// programs built by hand may only give the number
+			// of DFAs
+			dfa = (prog->dfas != NULL) ? &prog->dfas[i] : NULL;
+
 			sbuf_indent(buf, indent+2);
-			sbuf_snprintf(buf, "DFA(%zu)\n", i);
+			if (dfa == NULL) {
+				sbuf_snprintf(buf, "DFA(%zu)\n", i);
+			} else if (dfa->strtab != NULL) {
+				sbuf_snprintf(buf, "DFA(%zu) STRTAB %zu keys, %" PRIu32 " slots\n",
+					i, dfa->strtab->nkeys, dfa->strtab->nslots);
+			} else if (dfa->lit_kind == JVST_VM_DFA_LIT_NONE) {
+				sbuf_snprintf(buf, "DFA(%zu)\n", i);
+			} else {
+				sbuf_snprintf(buf, "DFA(%zu) %s \"%.*s\" -> %d\n", i,
+					jvst_vm_dfa_literal_name(dfa->lit_kind),
+					(int)dfa->nlit, dfa->lit, dfa->lit_result);
+			}
 		}
 
 		sbuf_snprintf(buf, "\n");
@@ -304,9 +330,72 @@ jvst_vm_dfa_init(struct jvst_vm_dfa *dfa, size_t nstates, size_t nedges, size_t
 	dfa->transitions = dfa->offs + (nstates+1);
 	dfa->endstates = dfa->transitions  + 2*nedges;
 
+	dfa->lit_kind   = JVST_VM_DFA_LIT_NONE;
+	dfa->lit_result = 0;
+	dfa->nlit       = 0;
+	dfa->lit        = NULL;
+	dfa->strtab     = NULL;
+	dfa->run        = NULL;
+
 	return nelts;
 }
 
+uint64_t
+jvst_vm_strhash(const char *s, size_t n)
+{
+	return (uint64_t)XXH64(s, n, 0);
+}
+
+int
+jvst_vm_strtab_lookup(const struct jvst_vm_strtab *tab, const char *s, size_t n)
+{
+	const struct jvst_vm_strtab_slot *slot;
+	uint64_t h;
+	uint32_t b;
+
+	h = jvst_vm_strhash(s, n);
+	b = jvst_vm_strtab_bucket(tab, h);
+	slot = &tab->slots[jvst_vm_strtab_slot(tab, h, tab->disp[b])];
+
+	if (slot->which == 0 || slot->len != n) {
+		return 0;
+	}
+
+	if (memcmp(&tab->keys[slot->off], s, n) != 0) {
+		return 0;
+	}
+
+	return slot->which;
+}
+
+void
+jvst_vm_strtab_free(struct jvst_vm_strtab *tab)
+{
+	free(tab->disp);
+	free(tab->slots);
+	free(tab->keys);
+	free(tab);
+}
+
+static struct jvst_vm_strtab *
+strtab_copy(const struct jvst_vm_strtab *src)
+{
+	struct jvst_vm_strtab *dst;
+
+	dst = xmalloc(sizeof *dst);
+	*dst = *src;
+
+	dst->disp  = xmalloc(src->nbuckets * sizeof dst->disp[0]);
+	dst->slots = xmalloc(src->nslots * sizeof dst->slots[0]);
+	dst->keys  = xmalloc(src->keylen + 1);
+
+	memcpy(dst->disp, src->disp, src->nbuckets * sizeof dst->disp[0]);
+	memcpy(dst->slots, src->slots, src->nslots * sizeof dst->slots[0]);
+	memcpy(dst->keys, src->keys, src->keylen + 1);
+
+	return dst;
+}
+
 void
 jvst_vm_dfa_copy(struct jvst_vm_dfa *dst, const struct jvst_vm_dfa *src)
 {
@@ -315,6 +404,23 @@ jvst_vm_dfa_copy(struct jvst_vm_dfa *dst, const struct jvst_vm_dfa *src)
 	memcpy(dst->offs, src->offs, (src->nstates+1)*sizeof src->offs[0]);
 	memcpy(dst->transitions, src->transitions, 2*src->nedges * sizeof src->transitions[0]);
 	memcpy(dst->endstates, src->endstates, 2*src->nends * sizeof src->endstates[0]);
+
+	dst->lit_kind   = src->lit_kind;
+	dst->lit_result = src->lit_result;
+	dst->nlit       = 0;
+	dst->lit        = NULL;
+	if (src->lit_kind != JVST_VM_DFA_LIT_NONE) {
+		dst->nlit = src->nlit;
+		dst->lit  = xmalloc(src->nlit);
+		memcpy(dst->lit, src->lit, src->nlit);
+	}
+
+	dst->strtab = NULL;
+	if (src->strtab != NULL) {
+		dst->strtab = strtab_copy(src->strtab);
+	}
+
+	dst->run = src->run;
 }
 
 void
@@ -324,9 +430,94 @@ jvst_vm_dfa_finalize(struct jvst_vm_dfa *dfa)
 	// arrays within the dfa were allocated as a single chunk, so
 	// this frees them
 	free(dfa->offs);
+	free(dfa->lit);
+	if (dfa->strtab != NULL) {
+		jvst_vm_strtab_free(dfa->strtab);
+	}
 	*dfa = zero;
 }
 
+const char *
+jvst_vm_dfa_literal_name(enum jvst_vm_dfa_literal kind)
+{
+	switch (kind) {
+	case JVST_VM_DFA_LIT_NONE:   return "NONE";
+	case JVST_VM_DFA_LIT_EXACT:  return "EXACT";
+	case JVST_VM_DFA_LIT_PREFIX: return "PREFIX";
+	case JVST_VM_DFA_LIT_SUFFIX: return "SUFFIX";
+	case JVST_VM_DFA_LIT_SUBSTR: return "SUBSTR";
+	}
+
+	fprintf(stderr, "%s:%d (%s) unknown literal kind %d\n",
+		__FILE__, __LINE__, __func__, kind);
+	abort();
+}
+
+// Searches for lit in buf.  memchr is usually vectorized by the C
+// library, so this skips quickly over text that cannot start a match.
+static int
+find_literal(const char *buf, size_t n, const char *lit, size_t m)
+{
+	const char *p, *end;
+
+	if (m == 0) {
+		return 1;
+	}
+
+	if (m > n) {
+		return 0;
+	}
+
+	// last position where a match can start
+	end = buf + (n - m);
+	for (p = buf; p <= end; p++) {
+		p = memchr(p, lit[0], (size_t)(end - p) + 1);
+		if (p == NULL) {
+			return 0;
+		}
+
+		if (memcmp(p+1, lit+1, m-1) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+jvst_vm_dfa_run_literal(const struct jvst_vm_dfa *dfa, const char *buf, size_t n)
+{
+	const char *lit = dfa->lit;
+	size_t m = dfa->nlit;
+	int matched;
+
+	switch (dfa->lit_kind) {
+	case JVST_VM_DFA_LIT_EXACT:
+		matched = (n == m) && memcmp(buf, lit, m) == 0;
+		break;
+
+	case JVST_VM_DFA_LIT_PREFIX:
+		matched = (n >= m) && memcmp(buf, lit, m) == 0;
+		break;
+
+	case JVST_VM_DFA_LIT_SUFFIX:
+		matched = (n >= m) && memcmp(buf + (n-m), lit, m) == 0;
+		break;
+
+	case JVST_VM_DFA_LIT_SUBSTR:
+		matched = find_literal(buf, n, lit, m);
+		break;
+
+	case JVST_VM_DFA_LIT_NONE:
+	default:
+		fprintf(stderr, "%s:%d (%s) DFA does not match a literal\n",
+			__FILE__, __LINE__, __func__);
+		abort();
+	}
+
+	return matched ? dfa->lit_result : 0;
+}
+
 static int
 twoint_binary_search(const int *restrict list, int i0, int i1, int key)
 {
@@ -390,6 +581,10 @@ jvst_vm_dfa_run(const struct jvst_vm_dfa *dfa, int st0, const char *buf, size_t
 		return JVST_VM_DFA_BADSTATE;
 	}
 
+	if (dfa->run != NULL) {
+		return dfa->run(st0, buf, n);
+	}
+
 	st = st0;
 	for (i=0; i < n; i++) {
 		int i0,i1,edge;
@@ -432,6 +627,8 @@ jvst_vm_program_free(struct jvst_vm_program *prog)
 {
 	size_t i;
 	assert(prog != NULL);
+	jvst_vm_lazy_release(prog);
+
 	free(prog->fdata);
 	free(prog->cdata);
 	free(prog->sdata);
@@ -442,15 +639,222 @@ jvst_vm_program_free(struct jvst_vm_program *prog)
 	free(prog->dfas);
 
 	free(prog->code);
+	free(prog->srcmap);
+	free(prog->srcstr);
+	jvst_vm_jit_free(prog->jit);
 	free(prog);
 }
 
+// Returns the source map range of pc, or NULL
+static const struct jvst_vm_srcloc *
+program_srcmap_find(const struct jvst_vm_program *prog, uint32_t pc)
+{
+	size_t lo, hi;
+
+	if (prog->nsrcmap == 0 || pc >= prog->ncode || pc < prog->srcmap[0].pc) {
+		return NULL;
+	}
+
+	// last range that starts at or before pc
+	lo = 0;
+	hi = prog->nsrcmap;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo)/2;
+
+		if (prog->srcmap[mid].pc <= pc) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return &prog->srcmap[lo];
+}
+
+const char *
+jvst_vm_program_srcloc(const struct jvst_vm_program *prog, uint32_t pc)
+{
+	const struct jvst_vm_srcloc *sl;
+
+	sl = program_srcmap_find(prog, pc);
+	if (sl == NULL || sl->loc == 0) {
+		return NULL;
+	}
+
+	assert(sl->loc < prog->nsrcstr);
+	return &prog->srcstr[sl->loc];
+}
+
+const char *
+jvst_vm_program_keyword(const struct jvst_vm_program *prog, uint32_t pc)
+{
+	const struct jvst_vm_srcloc *sl;
+
+	sl = program_srcmap_find(prog, pc);
+	if (sl == NULL || sl->kw == 0) {
+		return NULL;
+	}
+
+	assert(sl->kw < prog->nsrcstr);
+	return &prog->srcstr[sl->kw];
+}
+
+enum {
+	BOUND_NEW = 0,
+	BOUND_VISITING,
+	BOUND_DONE,
+};
+
+// Computes the stack used from the PROC at pc0 into depth[pc0].
+// Returns -1 if the proc recurses or has an unresolved CALL.
+static int
+stack_bound_proc(const struct jvst_vm_program *prog, uint32_t pc0, size_t *depth, unsigned char *state)
+{
+	size_t calls;
+	uint32_t pc;
+
+	switch (state[pc0]) {
+	case BOUND_DONE:
+		return 0;
+
+	case BOUND_VISITING:
+		return -1;
+	}
+
+	state[pc0] = BOUND_VISITING;
+
+	calls = 0;
+	for (pc = pc0+1; pc < prog->ncode; pc++) {
+		uint32_t opcode;
+		long target;
+
+		opcode = prog->code[pc];
+		if (jvst_vm_decode_op(opcode) == JVST_OP_PROC) {
+			break;
+		}
+
+		if (jvst_vm_decode_op(opcode) != JVST_OP_CALL) {
+			continue;
+		}
+
+		target = (long)pc + jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+		if (target < 0 || (size_t)target >= prog->ncode ||
+			jvst_vm_decode_op(prog->code[target]) != JVST_OP_PROC) {
+			return -1;
+		}
+
+		if (stack_bound_proc(prog, target, depth, state) < 0) {
+			return -1;
+		}
+
+		// the CALL pushes the return address and frame pointer
+		if (depth[target] + 2 > calls) {
+			calls = depth[target] + 2;
+		}
+	}
+
+	depth[pc0] = JVST_VM_NUMREG +
+		jvst_vm_arg_tolit(jvst_vm_decode_arg0(prog->code[pc0])) + calls;
+	state[pc0] = BOUND_DONE;
+
+	return 0;
+}
+
+size_t
+jvst_vm_stack_bound(const struct jvst_vm_program *prog)
+{
+	unsigned char *state;
+	size_t *depth;
+	size_t pc, bound;
+
+	if (prog->ncode == 0) {
+		return JVST_VM_STACK_UNBOUNDED;
+	}
+
+	depth = xcalloc(prog->ncode, sizeof depth[0]);
+	state = xcalloc(prog->ncode, sizeof state[0]);
+
+	// split VMs start at their own procs, so take the deepest of
+	// all of the procs rather than just the root
+	bound = 0;
+	for (pc=0; pc < prog->ncode; pc++) {
+		if (jvst_vm_decode_op(prog->code[pc]) != JVST_OP_PROC) {
+			continue;
+		}
+
+		if (stack_bound_proc(prog, pc, depth, state) < 0) {
+			bound = JVST_VM_STACK_UNBOUNDED;
+			break;
+		}
+
+		if (depth[pc] > bound) {
+			bound = depth[pc];
+		}
+	}
+
+	free(depth);
+	free(state);
+
+	return bound;
+}
+
 enum { VM_DEFAULT_STACK = 1024  };   // 8 bytes per stack element, so default to 16K stack
 enum { VM_STACK_BUFFER = 64     };   // in resize, minimum amount of extra space
 enum { VM_DEFAULT_MAXSPLIT = 16 };
 
-void
-jvst_vm_init_defaults(struct jvst_vm *vm, struct jvst_vm_program *prog)
+struct jvst_vm_budget {
+	struct jvst_vm_limits limits;
+
+	// used so far by the VM and its splits
+	uint64_t ninstr;
+	size_t depth;
+	size_t nsplit;
+	size_t memory;
+};
+
+// Counts nbytes against the memory limit.  Returns -1, without
+// counting them, if they don't fit.
+static int
+vm_charge(struct jvst_vm *vm, size_t nbytes)
+{
+	struct jvst_vm_budget *b = vm->budget;
+
+	if (b == NULL) {
+		return 0;
+	}
+
+	if (b->limits.memory > 0 &&
+		(b->memory > b->limits.memory || nbytes > b->limits.memory - b->memory)) {
+		return -1;
+	}
+
+	b->memory += nbytes;
+	return 0;
+}
+
+static void
+vm_release(struct jvst_vm *vm, size_t nbytes)
+{
+	if (vm->budget != NULL) {
+		assert(vm->budget->memory >= nbytes);
+		vm->budget->memory -= nbytes;
+	}
+}
+
+// initial stack slots of a VM running prog.  Programs with a stack
+// bound get all of their stack up front.
+static size_t
+vm_stack_size(const struct jvst_vm_program *prog)
+{
+	if (prog->maxstack == JVST_VM_STACK_UNBOUNDED) {
+		return VM_DEFAULT_STACK;
+	}
+
+	return prog->maxstack;
+}
+
+static void
+vm_init(struct jvst_vm *vm, struct jvst_vm_program *prog)
 {
 	static struct jvst_vm zero = { 0 };
 
@@ -458,8 +862,9 @@ jvst_vm_init_defaults(struct jvst_vm *vm, struct jvst_vm_program *prog)
 
 	vm->prog = prog;
 
-	vm->maxstack = VM_DEFAULT_STACK;
+	vm->maxstack = vm_stack_size(prog);
 	vm->stack = xmalloc(vm->maxstack * sizeof vm->stack[0]);
+	vm->stack_limit = JVST_VM_DEFAULT_STACK_LIMIT;
 
 	vm->nsplit = 0;
 	vm->maxsplit = VM_DEFAULT_MAXSPLIT;
@@ -474,6 +879,109 @@ jvst_vm_init_defaults(struct jvst_vm *vm, struct jvst_vm_program *prog)
 			      ARRAYLEN(vm->pbuf));
 }
 
+void
+jvst_vm_init_defaults(struct jvst_vm *vm, struct jvst_vm_program *prog)
+{
+	vm_init(vm, prog);
+
+	if (prog->nschema > 0) {
+		vm->matches = xcalloc((prog->nschema + 63) / 64, sizeof vm->matches[0]);
+	}
+}
+
+void
+jvst_vm_set_stack_limit(struct jvst_vm *vm, size_t nslots)
+{
+	vm->stack_limit = nslots;
+}
+
+void
+jvst_vm_set_limits(struct jvst_vm *vm, const struct jvst_vm_limits *limits)
+{
+	if (vm->budget == NULL) {
+		vm->budget = xcalloc(1, sizeof *vm->budget);
+	}
+
+	vm->budget->limits = *limits;
+
+	// the stack the VM already has counts against the memory limit
+	vm->budget->memory = vm->maxstack * sizeof vm->stack[0];
+}
+
+const uint64_t *
+jvst_vm_matches(const struct jvst_vm *vm)
+{
+	assert(vm->matches != NULL);
+	return vm->matches;
+}
+
+void
+jvst_vm_set_input(struct jvst_vm *vm, enum jvst_vm_input input)
+{
+	enum jvst_bin_format fmt;
+
+	if (vm->bin != NULL) {
+		jvst_bin_decoder_finalize(vm->bin);
+		free(vm->bin);
+		vm->bin = NULL;
+	}
+
+	switch (input) {
+	case JVST_VM_INPUT_JSON:
+		return;
+
+	case JVST_VM_INPUT_CBOR:
+		fmt = JVST_BIN_CBOR;
+		break;
+
+	case JVST_VM_INPUT_MSGPACK:
+		fmt = JVST_BIN_MSGPACK;
+		break;
+
+	default:
+		fprintf(stderr, "%s:%d (%s) unknown input encoding %d\n",
+			__FILE__, __LINE__, __func__, input);
+		abort();
+	}
+
+	vm->bin = xmalloc(sizeof *vm->bin);
+	jvst_bin_decoder_init(vm->bin, fmt);
+}
+
+void
+jvst_vm_set_early_exit(struct jvst_vm *vm, enum jvst_vm_early_exit early_exit)
+{
+	vm->early_exit = early_exit;
+}
+
+int
+jvst_vm_decided(const struct jvst_vm *vm)
+{
+	return vm->decided;
+}
+
+void
+jvst_vm_set_profile(struct jvst_vm *vm, unsigned flags, FILE *report)
+{
+	jvst_vm_prof_free(vm->prof);
+	vm->prof = jvst_vm_prof_new(vm->prog, flags, report);
+}
+
+// Clears what a split VM shares with the VM that started it: the
+// budget, the profile and (for uniqueItems evaluation) the unique set.
+// Finalizing the split VM then frees only its own state.
+static void
+vm_split_detach(const struct jvst_vm *vm, struct jvst_vm *svm)
+{
+	// XXX - kludge
+	if (svm->uniq == vm->uniq) {
+		svm->uniq = NULL;
+	}
+
+	svm->budget = NULL;
+	svm->prof = NULL;
+}
+
 void
 jvst_vm_finalize(struct jvst_vm *vm)
 {
@@ -485,12 +993,33 @@ jvst_vm_finalize(struct jvst_vm *vm)
 		jvst_vm_uniq_finalize(vm->uniq);
 	}
 
+	if (vm->bin) {
+		jvst_bin_decoder_finalize(vm->bin);
+		free(vm->bin);
+	}
+
 	free(vm->stack);
 
 	for (i=0; i < vm->nsplit; i++) {
+		vm_split_detach(vm, &vm->splits[i]);
 		jvst_vm_finalize(&vm->splits[i]);
 	}
 	free(vm->splits);
+	hmap_free(vm->split_states);
+	free(vm->mcache);
+	free(vm->matches);
+	free(vm->budget);
+
+	if (vm->prof != NULL) {
+		if (vm->prof->report != NULL) {
+			jvst_vm_prof_report(vm->prof->report, vm->prof);
+		}
+		jvst_vm_prof_free(vm->prof);
+	}
+
+	if (vm->progref != NULL) {
+		jvst_vm_progref_release(vm->progref);
+	}
 
 	*vm = zero;
 }
@@ -510,7 +1039,7 @@ vm_dumpstack(FILE *f, const struct jvst_vm *vm)
 	fp = vm->r_fp;
 	sp = vm->r_sp;
 	if (fp > 0) {
-		fprintf(f, "[%5d] %" PRId64 "\t(PPC)\n", fp-2, vm->stack[fp-2].i);
+		fprintf(f, "[%5d] %" PRIu32 "\t(PPC)\n", fp-2, (uint32_t)vm->stack[fp-2].u);
 		fprintf(f, "[%5d] %" PRId64 "\t(PFP)\n", fp-1, vm->stack[fp-1].i);
 		fprintf(f, "---\n");
 	}
@@ -546,13 +1075,19 @@ jvst_vm_dumpstate(struct jvst_vm *vm)
 	vm_dumpstack(stderr,vm);
 }
 
-static void
+// Makes room for newlen stack slots.  Returns 0, or the error if that's
+// more than the stack or memory limit of the VM.
+static int
 resize_stack(struct jvst_vm *vm, size_t newlen)
 {
 	size_t newmax;
 
-	if (newlen < vm->maxstack) {
-		return;
+	if (newlen <= vm->maxstack) {
+		return 0;
+	}
+
+	if (newlen > vm->stack_limit) {
+		return JVST_INVALID_VM_STACK_OVERFLOW;
 	}
 
 	newmax = vm->maxstack;
@@ -568,18 +1103,30 @@ resize_stack(struct jvst_vm *vm, size_t newlen)
 		newmax = newlen + VM_STACK_BUFFER;
 	}
 
+	if (newmax > vm->stack_limit) {
+		newmax = vm->stack_limit;
+	}
+
+	if (vm_charge(vm, (newmax - vm->maxstack) * sizeof vm->stack[0]) != 0) {
+		return JVST_INVALID_VM_MEMORY_LIMIT;
+	}
+
 	vm->stack = xrealloc(vm->stack, newmax * sizeof vm->stack[0]);
 	vm->maxstack = newmax;
+
+	return 0;
 }
 
+// checked is zero for verified programs (see validate_verify.h), which
+// skips the range check
 static inline union jvst_vm_stackval *
-vm_slotptr(struct jvst_vm *vm, uint32_t fp, uint32_t arg)
+vm_slotptr(struct jvst_vm *vm, uint32_t fp, uint32_t arg, const int checked)
 {
 	int slot;
 
 	assert(jvst_vm_arg_isslot(arg));
 	slot = jvst_vm_arg_toslot(arg);
-	if (fp+slot > vm->r_sp) {
+	if (checked && fp+slot > vm->r_sp) {
 		// XXX - better error code!
 		PANIC(vm, -1, "slot exceeded stack");
 	}
@@ -588,7 +1135,7 @@ vm_slotptr(struct jvst_vm *vm, uint32_t fp, uint32_t arg)
 }
 
 static inline uint64_t
-vm_uval(struct jvst_vm *vm, uint32_t fp, uint32_t arg)
+vm_uval(struct jvst_vm *vm, uint32_t fp, uint32_t arg, const int checked)
 {
 	int slot;
 
@@ -596,11 +1143,11 @@ vm_uval(struct jvst_vm *vm, uint32_t fp, uint32_t arg)
 		return jvst_vm_arg_tolit(arg);
 	}
 
-	return vm_slotptr(vm,fp,arg)->u;
+	return vm_slotptr(vm,fp,arg,checked)->u;
 }
 
 static inline int64_t
-vm_ival(struct jvst_vm *vm, uint32_t fp, uint32_t arg)
+vm_ival(struct jvst_vm *vm, uint32_t fp, uint32_t arg, const int checked)
 {
 	int slot;
 
@@ -608,52 +1155,209 @@ vm_ival(struct jvst_vm *vm, uint32_t fp, uint32_t arg)
 		return jvst_vm_arg_tolit(arg);
 	}
 
-	return vm_slotptr(vm,fp,arg)->i;
+	return vm_slotptr(vm,fp,arg,checked)->i;
 }
 
 static inline double *
-vm_fvalptr(struct jvst_vm *vm, uint32_t fp, uint32_t arg)
+vm_fvalptr(struct jvst_vm *vm, uint32_t fp, uint32_t arg, const int checked)
 {
 	int slot;
 
-	if (jvst_vm_arg_islit(arg)) {
+	if (checked && jvst_vm_arg_islit(arg)) {
 		// XXX - better error code!
 		PANIC(vm, -1, "literal arg to float compare");
 	}
 
-	return &vm_slotptr(vm,fp,arg)->f;
+	return &vm_slotptr(vm,fp,arg,checked)->f;
 }
 
-static inline int
-iopcmp(struct jvst_vm *vm, uint32_t fp, uint32_t opcode)
-{
-	uint32_t a,b;
-	int64_t va,vb;
-
-	a = jvst_vm_decode_arg0(opcode);
-	b = jvst_vm_decode_arg1(opcode);
+enum {
+	VM_TNUM_UNKNOWN = 0,	// not decoded yet
+	VM_TNUM_INT,		// integer value in tnum_int
+	VM_TNUM_FLOAT,		// only the double value is usable
+};
 
-	va = vm_ival(vm, fp, a);
-	vb = vm_ival(vm, fp, b);
+// every integer with a magnitude up to 2^53 is exact as a double
+#define VM_MAX_EXACT_INT 9007199254740992.0
 
-	return (va > vb) - (va < vb);
-}
+/* Parses an integer lexeme (an optional minus sign followed by
+ * digits).  Returns 0 if the lexeme is not an integer, or if it does
+ * not fit in an int64_t.
+ */
+static int
+lexeme_to_int(const char *s, size_t n, int64_t *vp)
+{
+	uint64_t u, lim;
+	size_t i;
+	int neg;
+
+	neg = (n > 0 && s[0] == '-');
+	i = neg;
+	if (i == n) {
+		return 0;
+	}
+
+	lim = neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+	for (u=0; i < n; i++) {
+		unsigned dig = (unsigned char)s[i] - '0';
+		if (dig > 9 || u > (lim - dig) / 10) {
+			return 0;
+		}
+
+		u = 10*u + dig;
+	}
+
+	*vp = (neg && u > 0) ? -(int64_t)(u-1) - 1 : (int64_t)u;
+	return 1;
+}
+
+/* Returns 1 and sets *ip if arg is the %TNUM register, the register
+ * holds the current number token, that token is an integer and its
+ * double value d is at least 2^53, where it may have been rounded.
+ * Smaller integers are exact as doubles, and are left to the double
+ * path.
+ *
+ * TOKEN records the frame it loads a number into.  That frame and the
+ * frames called from it, which copy its registers, hold the token, so
+ * a register that still holds an earlier token is never mistaken for
+ * the current one.
+ *
+ * Integer lexemes are decoded exactly, so values beyond 2^53 compare
+ * and divide correctly.  Binary tokens arrive with their integer value,
+ * see vm_token_int().
+ */
+static int
+vm_tnum_int(struct jvst_vm *vm, uint32_t fp, uint32_t arg, double d, int64_t *ip)
+{
+	// integers that round to 2^53 may be 2^53+1
+	if (fabs(d) < VM_MAX_EXACT_INT) {
+		return 0;
+	}
+
+	if (arg != VMREG(JVST_VM_TNUM) || !vm->tnum_loaded || fp < vm->tnum_fp || vm->pret != SJP_OK) {
+		return 0;
+	}
+
+	if (vm->tnum_state == VM_TNUM_UNKNOWN) {
+		vm->tnum_state = VM_TNUM_FLOAT;
+		if (vm->evt.text != NULL && lexeme_to_int(vm->evt.text, vm->evt.n, &vm->tnum_int)) {
+			vm->tnum_state = VM_TNUM_INT;
+		}
+	}
+
+	if (vm->tnum_state != VM_TNUM_INT) {
+		return 0;
+	}
+
+	*ip = vm->tnum_int;
+	return 1;
+}
+
+// compares an integer and a double without rounding the integer
+static int
+cmp_int_float(int64_t i, double d)
+{
+	double t;
+	int64_t ti;
+
+	if (isnan(d)) {
+		return 0;
+	}
+
+	if (d >= 9223372036854775808.0) {
+		return -1;
+	}
+
+	if (d < -9223372036854775808.0) {
+		return 1;
+	}
+
+	t = trunc(d);
+	ti = (int64_t)t;
+	if (i != ti) {
+		return (i > ti) - (i < ti);
+	}
+
+	// i == trunc(d), so the fractional part decides
+	return (t > d) - (t < d);
+}
+
+static inline int
+iopcmp(struct jvst_vm *vm, uint32_t fp, uint32_t opcode, const int checked)
+{
+	uint32_t a,b;
+	int64_t va,vb;
+
+	a = jvst_vm_decode_arg0(opcode);
+	b = jvst_vm_decode_arg1(opcode);
+
+	va = vm_ival(vm, fp, a, checked);
+	vb = vm_ival(vm, fp, b, checked);
+
+	return (va > vb) - (va < vb);
+}
 
 static inline int
-fopcmp(struct jvst_vm *vm, uint32_t fp, uint32_t opcode)
+fopcmp(struct jvst_vm *vm, uint32_t fp, uint32_t opcode, const int checked)
 {
 	uint32_t a,b;
 	double va,vb;
 
+	int64_t iv;
+
 	a = jvst_vm_decode_arg0(opcode);
 	b = jvst_vm_decode_arg1(opcode);
 
-	va = vm_fvalptr(vm, fp, a)[0];
-	vb = vm_fvalptr(vm, fp, b)[0];
+	va = vm_fvalptr(vm, fp, a, checked)[0];
+	vb = vm_fvalptr(vm, fp, b, checked)[0];
+
+	if (vm_tnum_int(vm, fp, a, va, &iv)) {
+		return cmp_int_float(iv, vb);
+	}
+
+	if (vm_tnum_int(vm, fp, b, vb, &iv)) {
+		return -cmp_int_float(iv, va);
+	}
 
 	return (va > vb) - (va < vb);
 }
 
+/* FINT on an integer token beyond 2^53, whose double may have been
+ * rounded.  Returns 1 and sets *flagp if v is such a token and the
+ * divisor (if any) is an integer.
+ */
+static int
+vm_fint_int(struct jvst_vm *vm, uint32_t fp, uint32_t arg0, uint32_t arg1, double v, int64_t *flagp, const int checked)
+{
+	int64_t iv, div;
+
+	if (!vm_tnum_int(vm, fp, arg0, v, &iv)) {
+		return 0;
+	}
+
+	div = 0;
+	if (arg1 != 0) {
+		if (jvst_vm_arg_isslot(arg1)) {
+			double fdiv = vm_fvalptr(vm, fp, arg1, checked)[0];
+			if (fdiv != ceil(fdiv) || fabs(fdiv) > VM_MAX_EXACT_INT) {
+				return 0;
+			}
+			div = (int64_t)fdiv;
+		} else {
+			div = jvst_vm_arg_tolit(arg1);
+		}
+
+		if (div == 0) {
+			return 0;
+		}
+	}
+
+	// divisors of +/-1 are excluded from the remainder because
+	// INT64_MIN % -1 overflows
+	*flagp = (div == 0 || div == 1 || div == -1) || (iv % div == 0);
+	return 1;
+}
+
 static inline int
 has_partial_token(struct jvst_vm *vm)
 {
@@ -673,6 +1377,16 @@ setup_next_token(struct jvst_vm *vm, uint32_t fp)
 	}
 }
 
+static uint32_t
+vm_frame_flags(const struct jvst_vm *vm, uint32_t fp)
+{
+	if (fp == 0) {
+		return vm->root_flags;
+	}
+
+	return (uint32_t)(vm->stack[fp-2].u >> 32);
+}
+
 static void
 load_slots_from_token(struct jvst_vm *vm, uint32_t fp)
 {
@@ -681,7 +1395,14 @@ load_slots_from_token(struct jvst_vm *vm, uint32_t fp)
 	vm->stack[fp+JVST_VM_TLEN].i = 0;
 
 	vm->stack[fp+JVST_VM_TT].i = vm->evt.type;
-	if (vm->evt.type == SJP_STRING) {
+	if (vm->evt.type == SJP_STRING && has_partial_token(vm)) {
+		// only the first piece of the string is here, the rest is
+		// counted in vm_run_next as it arrives.  Procs that don't
+		// read %TLEN skip the decoding.
+		if (vm_frame_flags(vm, fp) & JVST_VM_PROC_TLEN) {
+			vm->stack[fp+JVST_VM_TLEN].i += jvst_utf8_count(vm->evt.text, vm->evt.n);
+		}
+	} else if (vm->evt.type == SJP_STRING) {
 		vm->stack[fp+JVST_VM_TLEN].i += vm->evt.extra.ncp;
 	} else {
 		vm->stack[fp+JVST_VM_TLEN].i += vm->evt.n;
@@ -689,6 +1410,9 @@ load_slots_from_token(struct jvst_vm *vm, uint32_t fp)
 	if (vm->evt.type == SJP_NUMBER) {
 		vm->stack[fp+JVST_VM_TNUM].f = vm->evt.extra.d;
 	}
+
+	vm->tnum_loaded = (vm->evt.type == SJP_NUMBER);
+	vm->tnum_fp = fp;
 }
 
 static void
@@ -892,6 +1616,81 @@ debug_op(struct jvst_vm *vm, uint32_t pc, uint32_t opcode)
 	debug_state(vm);
 }
 
+// the match cache of the root VM, which split VMs share
+static struct jvst_vm_mcache *
+vm_mcache(struct jvst_vm *vm)
+{
+	while (vm->parent != NULL) {
+		vm = vm->parent;
+	}
+
+	if (vm->mcache == NULL) {
+		vm->mcache = xcalloc(1, sizeof *vm->mcache);
+	}
+
+	return vm->mcache;
+}
+
+// Matches a short, complete string token, using the match cache
+static int
+vm_match_cached(struct jvst_vm *vm, const struct jvst_vm_dfa *dfa)
+{
+	struct jvst_vm_mcache *mc;
+	struct jvst_vm_mcache_entry *ent;
+	const char *key;
+	uint32_t dfa_id;
+	size_t n;
+	int st, result;
+
+	mc = vm_mcache(vm);
+	key = vm->evt.text;
+	n = vm->evt.n;
+
+	dfa_id = (uint32_t)(dfa - vm->prog->dfas) + 1;
+	ent = &mc->entries[XXH64(key, n, dfa_id) & (JVST_VM_MCACHE_SIZE-1)];
+
+	if (ent->dfa == dfa_id && ent->len == n && (n == 0 || memcmp(ent->key, key, n) == 0)) {
+		mc->hits++;
+		return ent->result;
+	}
+
+	mc->misses++;
+
+	result = 0;
+	st = jvst_vm_dfa_run(dfa, JVST_VM_DFA_START, key, n);
+	if (st < 0 || !jvst_vm_dfa_endstate(dfa, st, &result)) {
+		result = 0;
+	}
+
+	ent->dfa = dfa_id;
+	ent->len = (uint32_t)n;
+	ent->result = result;
+	if (n > 0) {
+		memcpy(ent->key, key, n);
+	}
+
+	return result;
+}
+
+void
+jvst_vm_mcache_stats(const struct jvst_vm *vm, size_t *hitsp, size_t *missesp)
+{
+	size_t hits = 0, misses = 0;
+
+	if (vm->mcache != NULL) {
+		hits = vm->mcache->hits;
+		misses = vm->mcache->misses;
+	}
+
+	if (hitsp != NULL) {
+		*hitsp = hits;
+	}
+
+	if (missesp != NULL) {
+		*missesp = misses;
+	}
+}
+
 /* MATCH semantics:
  *
  * Works with the current string token, which may be a partial token.
@@ -916,9 +1715,39 @@ vm_match(struct jvst_vm *vm, const struct jvst_vm_dfa *dfa)
 		PANIC(vm, -1, "MATCH op on a non-string token");
 	}
 
+	// Literal patterns are compared directly.  Partial tokens walk the
+	// DFA.  The last piece of a partial token can still be compared
+	// directly if the DFA is in its start state, since then no earlier
+	// piece began a match.
+	if (dfa->lit_kind != JVST_VM_DFA_LIT_NONE && vm->dfa_st == JVST_VM_DFA_START &&
+			!has_partial_token(vm)) {
+		result = jvst_vm_dfa_run_literal(dfa, vm->evt.text, vm->evt.n);
+		vm->tokstate = JVST_VM_TOKEN_CONSUMED;
+		vm->stack[vm->r_fp + JVST_VM_M].i = result;
+		return SJP_OK;
+	}
+
+	// Likewise for DFAs that match a fixed set of strings
+	if (dfa->strtab != NULL && vm->dfa_st == JVST_VM_DFA_START && !has_partial_token(vm)) {
+		result = jvst_vm_strtab_lookup(dfa->strtab, vm->evt.text, vm->evt.n);
+		vm->tokstate = JVST_VM_TOKEN_CONSUMED;
+		vm->stack[vm->r_fp + JVST_VM_M].i = result;
+		return SJP_OK;
+	}
+
+	if (vm->dfa_st == JVST_VM_DFA_START && !has_partial_token(vm) &&
+			vm->evt.n <= JVST_VM_MCACHE_MAXKEY) {
+		result = vm_match_cached(vm, dfa);
+		vm->tokstate = JVST_VM_TOKEN_CONSUMED;
+		vm->stack[vm->r_fp + JVST_VM_M].i = result;
+		return SJP_OK;
+	}
+
 	ret = SJP_OK;
 	st = jvst_vm_dfa_run(dfa, vm->dfa_st, vm->evt.text, vm->evt.n);
 	if (has_partial_token(vm)) {
+		// resume from here with the next piece of the string
+		vm->dfa_st = st;
 		return JVST_MORE;
 	}
 
@@ -944,6 +1773,244 @@ vm_match(struct jvst_vm *vm, const struct jvst_vm_dfa *dfa)
 static enum jvst_result
 vm_run_next(struct jvst_vm *vm, enum SJP_RESULT pret, struct sjp_event *evt);
 
+// Returns non-zero if two split VMs will behave identically on the rest
+// of the input.  VMs with nested splits or unique state are never
+// considered the same.
+static int
+vm_split_same_state(const struct jvst_vm *a, const struct jvst_vm *b)
+{
+	if (a->r_pc != b->r_pc || a->r_sp != b->r_sp || a->r_fp != b->r_fp ||
+		a->r_flag != b->r_flag) {
+		return 0;
+	}
+
+	if (a->nsplit != 0 || b->nsplit != 0 || a->uniq != NULL || b->uniq != NULL) {
+		return 0;
+	}
+
+	if (a->nobj != b->nobj || a->narr != b->narr || a->dfa_st != b->dfa_st ||
+		a->tokstate != b->tokstate || a->needtok != b->needtok) {
+		return 0;
+	}
+
+	if (a->tnum_loaded != b->tnum_loaded || (a->tnum_loaded && a->tnum_fp != b->tnum_fp)) {
+		return 0;
+	}
+
+	return memcmp(a->stack, b->stack, a->r_sp * sizeof a->stack[0]) == 0;
+}
+
+// Hashes the pc, the frame pointer and the slots of the current frame,
+// which tell most split VMs apart.  vm_split_same_state compares the
+// rest.
+static uint64_t
+vm_split_hash(void *opaque, const void *k)
+{
+	const struct jvst_vm *svm = k;
+	uint64_t h;
+
+	(void)opaque;
+
+	assert(svm->r_sp >= svm->r_fp);
+
+	h = XXH64(&svm->r_pc, sizeof svm->r_pc, svm->r_fp);
+	return XXH64(&svm->stack[svm->r_fp],
+		(svm->r_sp - svm->r_fp) * sizeof svm->stack[0], h);
+}
+
+static int
+vm_split_equals(void *opaque, const void *k1, const void *k2)
+{
+	(void)opaque;
+	return vm_split_same_state(k1, k2);
+}
+
+// memory counted against the budget for a split VM
+static size_t
+vm_split_bytes(const struct jvst_vm *svm, const struct jvst_vm *vm)
+{
+	size_t nb;
+
+	nb = sizeof *svm + svm->maxstack * sizeof svm->stack[0];
+
+	// a split VM with its own uniqueItems set
+	if (svm->uniq != NULL && svm->uniq != vm->uniq) {
+		nb += svm->uniq->nbytes;
+	}
+
+	return nb;
+}
+
+// Merges split VMs that are in the same state, so that the work per
+// token is bounded by the number of distinct states rather than by the
+// number of splits.  This is the usual state merging of an NFA
+// simulation.  Merged VMs are released and record the VM whose result
+// they share.
+static void
+vm_split_merge(struct jvst_vm *vm, uint32_t nproc)
+{
+	uint32_t i;
+
+	if (nproc < 2) {
+		return;
+	}
+
+	if (vm->split_states == NULL) {
+		vm->split_states = hmap_create(2*nproc, 0.5, NULL, vm_split_hash, vm_split_equals);
+		if (vm->split_states == NULL) {
+			perror("allocating split states");
+			abort();
+		}
+	} else {
+		hmap_clear(vm->split_states);
+	}
+
+	for (i=0; i < nproc; i++) {
+		struct jvst_vm *first;
+
+		if (vm->splits[i].prog == NULL) {
+			continue;
+		}
+
+		first = hmap_getptr(vm->split_states, &vm->splits[i]);
+		if (first == NULL) {
+			if (!hmap_setptr(vm->split_states, &vm->splits[i], &vm->splits[i])) {
+				perror("adding split state");
+				abort();
+			}
+			continue;
+		}
+
+		vm_release(vm, vm_split_bytes(&vm->splits[i], vm));
+		vm_split_detach(vm, &vm->splits[i]);
+		jvst_vm_finalize(&vm->splits[i]);
+		vm->splits[i].same = first;
+	}
+}
+
+static inline unsigned
+vm_popcount(uint64_t w)
+{
+#if defined(__GNUC__)
+	return (unsigned)__builtin_popcountll(w);
+#else
+	w = w - ((w >> 1) & 0x5555555555555555);
+	w = (w & 0x3333333333333333) + ((w >> 2) & 0x3333333333333333);
+	w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0f;
+	return (unsigned)((w * 0x0101010101010101) >> 56);
+#endif /* __GNUC__ */
+}
+
+// Counts the bits set in bits b0..b1 of a bitvector that spans
+// consecutive slots.  Only the first and last words need masking, so
+// the words in between are a plain popcount loop, which the compiler
+// can vectorize.
+static uint64_t
+vm_bcount(const union jvst_vm_stackval *bv, size_t b0, size_t b1)
+{
+	size_t w0, w1, w;
+	uint64_t m0, m1, n;
+
+	w0 = b0 / 64;
+	w1 = b1 / 64;
+
+	m0 = ~(uint64_t)0 << (b0 % 64);
+	m1 = ~(uint64_t)0 >> (63 - b1 % 64);
+
+	if (w0 == w1) {
+		return vm_popcount(bv[w0].u & m0 & m1);
+	}
+
+	n = vm_popcount(bv[w0].u & m0);
+	for (w = w0+1; w < w1; w++) {
+		n += vm_popcount(bv[w].u);
+	}
+	n += vm_popcount(bv[w1].u & m1);
+
+	return n;
+}
+
+static int
+vm_split_error(const struct jvst_vm *svm)
+{
+	while (svm->same != NULL) {
+		svm = svm->same;
+	}
+
+	return svm->error;
+}
+
+// errors from running out of a resource rather than from the document
+// failing a constraint.  A split VM with one of these fails the VM that
+// started the split as well.
+static int
+vm_limit_error(int error)
+{
+	switch (error) {
+	case JVST_INVALID_VM_STACK_OVERFLOW:
+	case JVST_INVALID_VM_INSTR_LIMIT:
+	case JVST_INVALID_VM_DEPTH_LIMIT:
+	case JVST_INVALID_VM_SPLIT_LIMIT:
+	case JVST_INVALID_VM_UNIQUE_LIMIT:
+	case JVST_INVALID_VM_MEMORY_LIMIT:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+// Counts the split VMs that vm is about to start against the budget.
+// Returns 0, or the error if they don't fit.
+static int
+vm_split_charge(struct jvst_vm *vm, uint32_t nproc)
+{
+	struct jvst_vm_budget *b = vm->budget;
+	size_t nb;
+
+	if (b == NULL) {
+		return 0;
+	}
+
+	if (b->limits.nsplit > 0 && nproc > b->limits.nsplit - b->nsplit) {
+		return JVST_INVALID_VM_SPLIT_LIMIT;
+	}
+
+	nb = sizeof vm->splits[0] + vm_stack_size(vm->prog) * sizeof vm->stack[0];
+	if (vm_charge(vm, nproc * nb) != 0) {
+		return JVST_INVALID_VM_MEMORY_LIMIT;
+	}
+
+	b->nsplit += nproc;
+	return 0;
+}
+
+// cleans up split resources and resets vm->nsplit
+static void
+vm_split_free(struct jvst_vm *vm)
+{
+	size_t i;
+
+	for (i=0; i < vm->nsplit; i++) {
+		// merged VMs were released by vm_split_merge
+		if (vm->splits[i].same != NULL) {
+			vm->splits[i].same = NULL;
+			continue;
+		}
+
+		vm_release(vm, vm_split_bytes(&vm->splits[i], vm));
+		vm_split_detach(vm, &vm->splits[i]);
+		jvst_vm_finalize(&vm->splits[i]);
+	}
+
+	if (vm->budget != NULL) {
+		assert(vm->budget->nsplit >= vm->nsplit);
+		vm->budget->nsplit -= vm->nsplit;
+	}
+
+	vm->nsplit = 0;
+}
+
 static int
 vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv)
 {
@@ -956,17 +2023,27 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 
 	if (vm->nsplit == 0) {
 		uint32_t i, off, fp0;
+		int err;
+
+		if (err = vm_split_charge(vm, nproc), err != 0) {
+			vm->error = err;
+			return JVST_INVALID;
+		}
 
 		if (nproc > vm->maxsplit) {
-			size_t incr = vm->maxsplit - nproc;
+			size_t incr = nproc - vm->maxsplit;
 			vm->splits = xenlargevec(vm->splits, &vm->maxsplit, incr, sizeof vm->splits[0]);
 		}
 
 		fp0 = vm->r_fp;
 		off = vm->prog->nsplit + 1 + proc0;
 		for (i=0; i < nproc; i++) {
-			jvst_vm_init_defaults(&vm->splits[i], vm->prog);
+			vm_init(&vm->splits[i], vm->prog);
+			vm->splits[i].stack_limit = vm->stack_limit;
+			vm->splits[i].budget = vm->budget;
+			vm->splits[i].prof = vm->prof;
 			vm->splits[i].r_pc = vm->prog->sdata[off + i];
+			vm->splits[i].parent = vm;
 
 			// XXX - kludge to support unique constraints.
 			// This needs to be fixed!
@@ -987,6 +2064,14 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 		// SPLIT should leave the current token, if any, consumed
 		vm->tokstate = JVST_VM_TOKEN_CONSUMED;
 		vm->nsplit = nproc;
+
+		if (vm->prof != NULL) {
+			vm->prof->nsplit++;
+			vm->prof->split_vms += nproc;
+			if (nproc > vm->prof->split_max) {
+				vm->prof->split_max = nproc;
+			}
+		}
 	}
 
 	if (vm->nsplit != nproc) {
@@ -994,6 +2079,8 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 		PANIC(vm, -1, "SPLIT count and current split do not agree");
 	}
 
+	vm_split_merge(vm, nproc);
+
 	endstate = JVST_INDETERMINATE;
 	ndone = 0;
 	for (i=0; i < nproc; i++) {
@@ -1004,7 +2091,9 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 			continue;
 		}
 
-		// run vm code
+		// run vm code, split VMs see the same token
+		vm->splits[i].tnum_state = vm->tnum_state;
+		vm->splits[i].tnum_int = vm->tnum_int;
 		ret = vm_run_next(&vm->splits[i], vm->pret, &vm->evt);
 
 		switch (ret) {
@@ -1041,6 +2130,12 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 			 */
 			assert(vm->splits[i].error != 0);
 			vm->splits[i].prog = NULL;
+
+			if (vm_limit_error(vm->splits[i].error)) {
+				vm->error = vm->splits[i].error;
+				vm_split_free(vm);
+				return JVST_INVALID;
+			}
 			break;
 		}
 
@@ -1074,7 +2169,7 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 		for (i=0; i < nproc; i++) {
 			assert(vm->splits[i].prog == NULL);
 
-			if (vm->splits[i].error == 0) {
+			if (vm_split_error(&vm->splits[i]) == 0) {
 				slot->i++;
 			}
 		}
@@ -1106,7 +2201,7 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 			}
 #endif /* DEBUG_SPLITV */
 
-			if (vm->splits[i].error == 0) {
+			if (vm_split_error(&vm->splits[i]) == 0) {
 				slot[sl].u |= mask;
 			}
 			mask = mask << 1;
@@ -1114,27 +2209,184 @@ vm_split(struct jvst_vm *vm, int split, union jvst_vm_stackval *slot, int splitv
 		}
 	}
 
-	// clean up split resources and reset vm->nsplit
-	for (i=0; i < nproc; i++) {
-		assert(vm->splits[i].prog == NULL);
+	vm_split_free(vm);
+	return JVST_VALID;
+}
 
-		// XXX - kludge
-		if (vm->splits[i].uniq == vm->uniq) {
-			vm->splits[i].uniq = NULL;
-		}
+// Sets up a frame of n slots at fp for a proc with the given PROC
+// flags.  fp0 is the frame of the caller, or the same as fp for the
+// first frame.
+static void
+vm_push_frame(struct jvst_vm *vm, uint32_t fp0, uint32_t fp, int n, uint32_t flags)
+{
+	int i;
 
-		jvst_vm_finalize(&vm->splits[i]);
+	// the caller has made room for the frame
+	for (i=0; i < n; i++) {
+		vm->stack[fp+i].u = 0;
+	}
+
+	// the return pc only needs the low 32 bits, the flags of a called
+	// frame go in the high bits
+	if (fp == 0) {
+		vm->root_flags = flags;
+	} else {
+		vm->stack[fp-2].u |= (uint64_t)flags << 32;
+	}
+
+	if (fp0 != fp) {
+		// a caller below the frame that loaded the current number
+		// passes on an earlier token
+		if (fp0 < vm->tnum_fp) {
+			vm->tnum_loaded = 0;
+		}
+
+		// copy registers
+		vm->stack[fp+JVST_VM_TT  ].i = vm->stack[fp0+JVST_VM_TT  ].i;
+		vm->stack[fp+JVST_VM_TNUM].f = vm->stack[fp0+JVST_VM_TNUM].f;
+		vm->stack[fp+JVST_VM_TLEN].i = vm->stack[fp0+JVST_VM_TLEN].i;
+		vm->stack[fp+JVST_VM_M   ].i = vm->stack[fp0+JVST_VM_M   ].i;
+	} else {
+		// load TT / TNUM / TLEN from current token
+		load_slots_from_token(vm,fp);
+	}
+}
+
+// The root frame of a program compiled from several schemas splits
+// once, over the roots of the schemas.  Called after a SPLITV in the
+// root frame.
+static void
+vm_record_matches(struct jvst_vm *vm, const union jvst_vm_stackval *slot)
+{
+	size_t i, nw;
+
+	if (vm->matches == NULL) {
+		return;
+	}
+
+	nw = (vm->prog->nschema + 63) / 64;
+	for (i=0; i < nw; i++) {
+		vm->matches[i] = slot[i].u;
+	}
+}
+
+static void
+vm_uniq_init(struct jvst_vm *vm)
+{
+	vm->uniq = jvst_vm_uniq_initialize();
+	if (vm->budget != NULL) {
+		vm->uniq->maxbytes = vm->budget->limits.uniq_bytes;
+	}
+}
+
+// Adds the current token to the uniqueItems set.  The bytes the set
+// holds also count against the memory limit.
+static int
+vm_uniq_eval(struct jvst_vm *vm)
+{
+	size_t nb0;
+	int ret;
+
+	nb0 = vm->uniq->nbytes;
+	ret = jvst_vm_uniq_evaluate(vm->uniq, vm->pret, &vm->evt);
+
+	if (vm->uniq->nbytes < nb0) {
+		vm_release(vm, nb0 - vm->uniq->nbytes);
+	} else if (vm_charge(vm, vm->uniq->nbytes - nb0) != 0) {
+		// count the bytes anyway, they're released with the set
+		vm->budget->memory += vm->uniq->nbytes - nb0;
+		vm->error = JVST_INVALID_VM_MEMORY_LIMIT;
+		return JVST_INVALID;
+	}
+
+	if (ret == JVST_INVALID) {
+		vm->error = vm->uniq->overflow ? JVST_INVALID_VM_UNIQUE_LIMIT : JVST_INVALID_NOT_UNIQUE;
+	}
+
+	return ret;
+}
+
+static void
+vm_uniq_final(struct jvst_vm *vm)
+{
+	vm_release(vm, vm->uniq->nbytes);
+	jvst_vm_uniq_finalize(vm->uniq);
+	vm->uniq = NULL;
+}
+
+// Charges the time since the last switch to the instruction being
+// timed, then starts timing op in proc.  op is -1 to stop timing.
+static void
+vm_prof_switch(struct jvst_vm_prof *prof, int op, uint32_t proc)
+{
+	uint64_t t;
+
+	t = jvst_vm_prof_clock();
+	if (prof->cur_op >= 0) {
+		prof->ops[prof->cur_op].nsec += t - prof->t0;
+		prof->procs[prof->cur_proc].nsec += t - prof->t0;
+	}
+
+	prof->t0 = t;
+	prof->cur_op = op;
+	prof->cur_proc = proc;
+}
+
+static inline void
+vm_prof_op(struct jvst_vm_prof *prof, uint32_t pc, enum jvst_vm_op op)
+{
+	uint32_t proc = prof->pc_proc[pc];
+
+	prof->ops[op].n++;
+	prof->procs[proc].n++;
+
+	if (prof->flags & JVST_VM_PROF_TIME) {
+		vm_prof_switch(prof, op, proc);
+	}
+}
+
+// Counts the token that consume_current_value() is about to skip, if
+// there is one
+static void
+vm_prof_consume(struct jvst_vm *vm)
+{
+	if (vm->nobj > 0 || vm->narr > 0 ||
+			vm->tokstate == JVST_VM_TOKEN_READY ||
+			vm->tokstate == JVST_VM_TOKEN_BUFFERED) {
+		vm->prof->consume_tokens++;
+		vm->prof->consume_bytes += vm->evt.n;
 	}
-	vm->nsplit = 0;
-	return JVST_VALID;
 }
 
 #define DEBUG_OP(vm,pc,opcode) do{ if (DEBUG_OPCODES) { debug_op((vm),(pc),(opcode)); } } while(0)
 
+// Switches vm to a program that has compiled the definition the stub
+// CALL at pc is for (see validate_lazy.h).  The new program extends
+// the old one, so the VM carries on from the same pc.
+static void
+vm_lazy_switch(struct jvst_vm *vm, uint32_t pc)
+{
+	struct jvst_vm_program *prog;
+
+	prog = jvst_vm_lazy_resolve(vm->prog->lazy, pc);
+	if (vm->prof != NULL) {
+		jvst_vm_prof_extend(vm->prof, prog);
+	}
+
+	vm->prog = prog;
+}
+
 #define NEXT do{ vm->r_pc = ++pc; goto loop; } while(0)
 #define BRANCH(newpc) do { pc += (newpc); vm->r_pc = pc; goto loop; } while(0)
-static enum jvst_result
-vm_run_next(struct jvst_vm *vm, enum SJP_RESULT pret, struct sjp_event *evt)
+
+/* The interpreter loop.  checked, counted and profiled are constants
+ * in each caller: for verified programs checked is zero, and the checks
+ * of pcs, slots and indexes that jvst_vm_verify() has already made drop
+ * out of the loop.  counted is only set for VMs with an instruction
+ * limit, and profiled for VMs with a profile.
+ */
+static inline enum jvst_result
+vm_exec(struct jvst_vm *vm, const int checked, const int counted, const int profiled)
 {
 	uint32_t opcode, pc, fp, sp;
 	int64_t flag;
@@ -1142,10 +2394,7 @@ vm_run_next(struct jvst_vm *vm, enum SJP_RESULT pret, struct sjp_event *evt)
 	size_t ncode;
 
 	enum jvst_vm_op op;
-	int ret;
-
-	vm->evt = *evt;
-	vm->pret = pret;
+	int ret, err;
 
 	code  = vm->prog->code;
 	ncode = vm->prog->ncode;
@@ -1161,15 +2410,25 @@ loop:
 	assert(pc >= 0);  // safety in case type is changed
 
 	// bounds check pc
-	if (pc > ncode) {
+	if (checked && pc >= ncode) {
 		vm->error = JVST_INVALID_VM_BAD_PC;
 		ret = JVST_INVALID;
 		goto finish;
 	}
 
+	if (counted && ++vm->budget->ninstr > vm->budget->limits.ninstr) {
+		vm->error = JVST_INVALID_VM_INSTR_LIMIT;
+		ret = JVST_INVALID;
+		goto finish;
+	}
+
 	opcode = code[pc];
 	op = jvst_vm_decode_op(opcode);
 	DEBUG_OP(vm, pc, opcode);
+
+	if (profiled && op <= JVST_OP_MAX) {
+		vm_prof_op(vm->prof, pc, op);
+	}
 #if DEBUG_STEP
 	{
 		static char buf[256];
@@ -1183,13 +2442,15 @@ loop:
 
 	case JVST_OP_PROC:
 		{
-			uint32_t a, fp0;
-			int i,n,nsl;
+			uint32_t a, b, fp0, flags;
+			int n,nsl;
 			a = jvst_vm_decode_arg0(opcode);
+			b = jvst_vm_decode_arg1(opcode);
 			assert(jvst_vm_arg_islit(a));
 
 			nsl = jvst_vm_arg_tolit(a);
-			if (nsl < 0) {
+			flags = jvst_vm_arg_islit(b) ? (uint32_t)jvst_vm_arg_tolit(b) : 0;
+			if (checked && nsl < 0) {
 				// XXX - better error messages
 				vm->error = JVST_INVALID_VM_INVALID_ARG;
 				ret = JVST_INVALID;
@@ -1199,26 +2460,21 @@ loop:
 			// allocate extra slots for "registers"
 			n = nsl + JVST_VM_NUMREG;
 
+			// Programs with a stack bound have all of their
+			// stack from vm_init(), so verified ones don't need to
+			// check for room
+			if ((checked || vm->prog->maxstack == JVST_VM_STACK_UNBOUNDED) &&
+					(err = resize_stack(vm, sp+n)) != 0) {
+				vm->error = err;
+				ret = JVST_INVALID;
+				goto finish;
+			}
+
 			// setup frame
 			fp0 = fp;
 			fp = sp;
-
-			// allocate stack slots
-			resize_stack(vm, sp+n);
-			for (i=0; i < n; i++) {
-				vm->stack[sp++].u = 0;
-			}
-
-			if (fp0 != fp) {
-				// copy registers
-				vm->stack[fp+JVST_VM_TT  ].i = vm->stack[fp0+JVST_VM_TT  ].i;
-				vm->stack[fp+JVST_VM_TNUM].f = vm->stack[fp0+JVST_VM_TNUM].f;
-				vm->stack[fp+JVST_VM_TLEN].i = vm->stack[fp0+JVST_VM_TLEN].i;
-				vm->stack[fp+JVST_VM_M   ].i = vm->stack[fp0+JVST_VM_M   ].i;
-			} else {
-				// load TT / TNUM / TLEN from current token
-				load_slots_from_token(vm,fp);
-			}
+			vm_push_frame(vm, fp0, fp, n, flags);
+			sp += n;
 
 			vm->r_fp = fp;
 			vm->r_sp = sp;
@@ -1227,12 +2483,12 @@ loop:
 
 	/* integer comparisons */
 	case JVST_OP_ICMP:
-		vm->r_flag = flag = iopcmp(vm, fp, opcode);
+		vm->r_flag = flag = iopcmp(vm, fp, opcode, checked);
 		NEXT;
 
 	/* floating point comparisons */
 	case JVST_OP_FCMP:
-		vm->r_flag = flag = fopcmp(vm, fp, opcode);
+		vm->r_flag = flag = fopcmp(vm, fp, opcode, checked);
 		NEXT;
 
 	case JVST_OP_FINT:
@@ -1245,12 +2501,17 @@ loop:
 			arg1 = jvst_vm_decode_arg1(opcode);
 			assert(jvst_vm_arg_isslot(arg0));
 
-			v = vm_fvalptr(vm, fp, arg0)[0];
+			v = vm_fvalptr(vm, fp, arg0, checked)[0];
+			if (vm_fint_int(vm, fp, arg0, arg1, v, &flag, checked)) {
+				vm->r_flag = flag;
+				NEXT;
+			}
+
 			if (arg1 != 0) {
 				double div;
 
 				if (jvst_vm_arg_isslot(arg1)) {
-					div = vm_fvalptr(vm, fp, arg1)[0];
+					div = vm_fvalptr(vm, fp, arg1, checked)[0];
 				} else {
 					div = jvst_vm_arg_tolit(arg1);
 				}
@@ -1309,6 +2570,10 @@ loop:
 		{
 			int ret;
 
+			if (profiled) {
+				vm_prof_consume(vm);
+			}
+
 			ret = consume_current_value(vm);
 			if (ret != JVST_VALID) {
 				return ret;
@@ -1324,7 +2589,7 @@ loop:
 			assert(jvst_vm_arg_islit(arg0));
 
 			if (arg0 != 0) {
-				vm->error = vm_ival(vm, fp, arg0);
+				vm->error = vm_ival(vm, fp, arg0, checked);
 				assert(vm->error != 0);
 				ret = JVST_INVALID;
 				goto finish;
@@ -1334,6 +2599,10 @@ loop:
 
 			// consume token, then return to previous frame or, if top of
 			// stack, return JVST_VALID
+			if (profiled) {
+				vm_prof_consume(vm);
+			}
+
 			ret = consume_current_value(vm);
 			if (ret != JVST_VALID && ret != JVST_NEXT) {
 				return ret;
@@ -1348,7 +2617,7 @@ loop:
 			}
 
 			vm->r_sp = sp = fp-2;
-			vm->r_pc = pc = vm->stack[fp-2].u;
+			vm->r_pc = pc = (uint32_t)vm->stack[fp-2].u;
 			vm->r_fp = fp = vm->stack[fp-1].u;
 			NEXT; // pc points to CALL, continue with next instruction
 		}
@@ -1365,11 +2634,11 @@ loop:
 
 			if (jvst_vm_arg_islit(a1)) {
 				int lit = jvst_vm_arg_tolit(a1);
-				vm_slotptr(vm,fp,a0)->i = lit;
+				vm_slotptr(vm,fp,a0,checked)->i = lit;
 			} else {
 				union jvst_vm_stackval *s0, *s1;
-				s0 = vm_slotptr(vm,fp,a0);
-				s1 = vm_slotptr(vm,fp,a1);
+				s0 = vm_slotptr(vm,fp,a0,checked);
+				s1 = vm_slotptr(vm,fp,a1,checked);
 				memcpy(s0,s1,sizeof(*s0));
 			}
 		}
@@ -1387,17 +2656,17 @@ loop:
 
 			assert(jvst_vm_arg_isslot(a0));
 			assert(jvst_vm_arg_islit(a1));
-			slot = vm_slotptr(vm, fp, a0);
+			slot = vm_slotptr(vm, fp, a0, checked);
 			ind = jvst_vm_arg_tolit(a1);
 
 			if (op == JVST_OP_FLOAD) {
-				if (ind < 0 || (size_t)ind > vm->prog->nfloat) {
+				if (checked && (ind < 0 || (size_t)ind >= vm->prog->nfloat)) {
 					PANIC(vm, -1, "invalid float pool index");
 				}
 
 				slot->f = vm->prog->fdata[ind];
 			} else {
-				if (ind < 0 || (size_t)ind > vm->prog->nconst) {
+				if (checked && (ind < 0 || (size_t)ind >= vm->prog->nconst)) {
 					PANIC(vm, -1, "invalid const pool index");
 				}
 
@@ -1417,8 +2686,8 @@ loop:
 
 			assert(jvst_vm_arg_isslot(a0));
 
-			slot = vm_slotptr(vm, fp, a0);
-			delta = vm_ival(vm, fp, a1);
+			slot = vm_slotptr(vm, fp, a0, checked);
+			delta = vm_ival(vm, fp, a1, checked);
 			slot->i += delta;
 		}
 		NEXT;
@@ -1430,15 +2699,19 @@ loop:
 			const struct jvst_vm_dfa *dfa;
 
 			a0 = jvst_vm_decode_arg0(opcode);
-			dfa_ind = vm_ival(vm, fp, a0);
+			dfa_ind = vm_ival(vm, fp, a0, checked);
 
-			if (dfa_ind < 0 || (size_t)dfa_ind >= vm->prog->ndfa) {
+			if (checked && (dfa_ind < 0 || (size_t)dfa_ind >= vm->prog->ndfa)) {
 				PANIC(vm, -1, "MATCH op with invalid DFA");
 			}
 
 			dfa = &vm->prog->dfas[dfa_ind];
 			assert(dfa != NULL);
 
+			if (profiled) {
+				vm->prof->match_bytes += vm->evt.n;
+			}
+
 			ret = vm_match(vm, dfa);
 			if (ret != JVST_VALID) {
 				goto finish;
@@ -1453,10 +2726,26 @@ loop:
 			barg = jvst_vm_decode_barg(opcode);
 			br = jvst_vm_tobarg(barg);
 
+			if (br == 0 && vm->prog->lazy != NULL) {
+				vm_lazy_switch(vm, pc);
+
+				code  = vm->prog->code;
+				ncode = vm->prog->ncode;
+
+				opcode = code[pc];
+				br = jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+			}
+
 			assert(pc+br >= 0 && (size_t)(pc+br) < vm->prog->ncode);
 			assert(jvst_vm_decode_op(vm->prog->code[pc+br]) == JVST_OP_PROC);
 
-			resize_stack(vm, sp+2);
+			if ((checked || vm->prog->maxstack == JVST_VM_STACK_UNBOUNDED) &&
+					(err = resize_stack(vm, sp+2)) != 0) {
+				vm->error = err;
+				ret = JVST_INVALID;
+				goto finish;
+			}
+
 			vm->stack[sp+0].u = pc;
 			vm->stack[sp+1].u = fp;
 
@@ -1478,14 +2767,17 @@ loop:
 
 			assert(jvst_vm_arg_isslot(a0));
 
-			slot = vm_slotptr(vm, fp, a0);
-			bit = vm_ival(vm, fp, a1);
+			slot = vm_slotptr(vm, fp, a0, checked);
+			bit = vm_ival(vm, fp, a1, checked);
 
-			if (bit < 0 || bit >= 64) {
+			// the bit may come from a slot, so it's checked even
+			// in verified programs
+			if (bit < 0 || slot + bit/64 >= &vm->stack[sp]) {
 				PANIC(vm, -1, "BSET op with invalid bit");
 			}
 
-			slot->u |= (1<<bit);
+			// bits past the first 64 are in the following slots
+			slot[bit / 64].u |= (uint64_t)1 << (bit % 64);
 		}
 		NEXT;
 
@@ -1500,13 +2792,38 @@ loop:
 
 			assert(jvst_vm_arg_isslot(a0));
 
-			slot = vm_slotptr(vm, fp, a0);
-			mask = vm_uval(vm, fp, a1);
+			slot = vm_slotptr(vm, fp, a0, checked);
+			mask = vm_uval(vm, fp, a1, checked);
 
 			slot->u &= mask;
 		}
 		NEXT;
 
+	case JVST_OP_BCOUNT:
+		{
+			uint32_t a0,a1;
+			union jvst_vm_stackval *reg, *bv;
+			uint64_t range;
+
+			a0 = jvst_vm_decode_arg0(opcode);
+			a1 = jvst_vm_decode_arg1(opcode);
+
+			assert(jvst_vm_arg_isslot(a0));
+			assert(jvst_vm_arg_isslot(a1));
+
+			reg = vm_slotptr(vm, fp, a0, checked);
+			bv = vm_slotptr(vm, fp, a1, checked);
+			range = reg->u;
+
+			if ((range >> 32) > (range & 0xffffffff) ||
+					bv + (range & 0xffffffff)/64 >= &vm->stack[sp]) {
+				PANIC(vm, -1, "BCOUNT op with invalid range");
+			}
+
+			reg->u = vm_bcount(bv, range >> 32, range & 0xffffffff);
+		}
+		NEXT;
+
 	case JVST_OP_SPLITV:
 	case JVST_OP_SPLIT:
 		{
@@ -1517,13 +2834,13 @@ loop:
 			a0 = jvst_vm_decode_arg0(opcode);
 			a1 = jvst_vm_decode_arg1(opcode);
 
-			if (!jvst_vm_arg_isslot(a1)) {
+			if (checked && !jvst_vm_arg_isslot(a1)) {
 				PANIC(vm, -1, "SPLIT op with non-slot second argument");
 			}
 
-			split = vm_ival(vm, fp, a0);
-			slot = vm_slotptr(vm, fp, a1);
-			if (split < 0 || (size_t)split >= vm->prog->nsplit) {
+			split = vm_ival(vm, fp, a0, checked);
+			slot = vm_slotptr(vm, fp, a1, checked);
+			if (checked && (split < 0 || (size_t)split >= vm->prog->nsplit)) {
 				PANIC(vm, -1, "SPLIT op with bad split index");
 			}
 
@@ -1531,6 +2848,10 @@ loop:
 			if (ret != JVST_VALID) {
 				goto finish;
 			}
+
+			if (op == JVST_OP_SPLITV && fp == 0) {
+				vm_record_matches(vm, slot);
+			}
 		}
 		NEXT;
 
@@ -1544,32 +2865,27 @@ loop:
 
 			switch (wh) {
 			case JVST_VM_UNIQUE_INIT:
-				vm->uniq = jvst_vm_uniq_initialize();
+				vm_uniq_init(vm);
 				break;
 
 			case JVST_VM_UNIQUE_EVAL:
-				{
-					int ret = jvst_vm_uniq_evaluate(vm->uniq, vm->pret, &vm->evt);
-					switch (ret) {
-					case JVST_VALID:
-					case JVST_NEXT:
-					case JVST_MORE:
-						return ret;
-
-					case JVST_INVALID:
-						vm->error = JVST_INVALID_NOT_UNIQUE;
-						ret = JVST_INVALID;
-						goto finish;
-
-					default:
-						PANIC(vm, -1, "unexpected return from jvst_vm_uniq_evaluate");
-					}
+				ret = vm_uniq_eval(vm);
+				switch (ret) {
+				case JVST_VALID:
+				case JVST_NEXT:
+				case JVST_MORE:
+					return ret;
+
+				case JVST_INVALID:
+					goto finish;
+
+				default:
+					PANIC(vm, -1, "unexpected return from jvst_vm_uniq_evaluate");
 				}
 				break;
 
 			case JVST_VM_UNIQUE_FINAL:
-				jvst_vm_uniq_finalize(vm->uniq);
-				vm->uniq = NULL;
+				vm_uniq_final(vm);
 				break;
 
 			default:
@@ -1594,6 +2910,416 @@ finish:
 #undef BRANCH
 #undef DEBUG_OP
 
+static enum jvst_result
+vm_run_checked(struct jvst_vm *vm)
+{
+	return vm_exec(vm, 1, 0, 0);
+}
+
+static enum jvst_result
+vm_run_verified(struct jvst_vm *vm)
+{
+	return vm_exec(vm, 0, 0, 0);
+}
+
+static enum jvst_result
+vm_run_counted(struct jvst_vm *vm)
+{
+	return vm_exec(vm, 1, 1, 0);
+}
+
+static enum jvst_result
+vm_run_profiled(struct jvst_vm *vm)
+{
+	struct jvst_vm_prof *prof = vm->prof;
+	const int timed = (prof->flags & JVST_VM_PROF_TIME) != 0;
+	const int counted = vm->budget != NULL && vm->budget->limits.ninstr > 0;
+	enum jvst_result ret;
+	uint32_t proc;
+	int op;
+
+	// A split VM runs inside the SPLIT of its parent.  Time the split
+	// VM on its own, then go back to timing the SPLIT.
+	op = prof->cur_op;
+	proc = prof->cur_proc;
+	if (timed) {
+		vm_prof_switch(prof, -1, 0);
+	}
+
+	ret = counted ? vm_exec(vm, 1, 1, 1) : vm_exec(vm, 1, 0, 1);
+
+	if (timed) {
+		vm_prof_switch(prof, op, proc);
+	}
+
+	return ret;
+}
+
+static enum jvst_result
+vm_run_next(struct jvst_vm *vm, enum SJP_RESULT pret, struct sjp_event *evt)
+{
+	// The rest of a partial string token arrives a piece at a time
+	// while CONSUME or MATCH finish the token.  Count each piece into
+	// %TLEN so length checks see the whole string.
+	if (vm->pret != SJP_OK && vm->tokstate == JVST_VM_TOKEN_READY &&
+			vm->evt.type == SJP_STRING && evt->type == SJP_STRING &&
+			(vm_frame_flags(vm, vm->r_fp) & JVST_VM_PROC_TLEN)) {
+		vm->stack[vm->r_fp + JVST_VM_TLEN].i += jvst_utf8_count(evt->text, evt->n);
+	}
+
+	vm->evt = *evt;
+	vm->pret = pret;
+	vm->tnum_loaded = 0;
+
+	// only the interpreter profiles and counts instructions
+	if (vm->prof != NULL) {
+		return vm_run_profiled(vm);
+	}
+
+	if (vm->budget != NULL && vm->budget->limits.ninstr > 0) {
+		return vm_run_counted(vm);
+	}
+
+	if (vm->prog->native != NULL) {
+		return vm->prog->native(vm);
+	}
+
+	if (vm->prog->verified) {
+		return vm_run_verified(vm);
+	}
+
+	return vm_run_checked(vm);
+}
+
+/* Runtime for generated validators, see validate_native.h */
+
+enum jvst_result
+jvst_vm_native_proc(struct jvst_vm *vm, int nslots, uint32_t flags)
+{
+	uint32_t fp0, n;
+	int err;
+
+	n = nslots + JVST_VM_NUMREG;
+	if (err = resize_stack(vm, vm->r_sp+n), err != 0) {
+		vm->error = err;
+		return JVST_INVALID;
+	}
+
+	fp0 = vm->r_fp;
+	vm->r_fp = vm->r_sp;
+	vm_push_frame(vm, fp0, vm->r_fp, n, flags);
+	vm->r_sp += n;
+
+	return JVST_VALID;
+}
+
+enum jvst_result
+jvst_vm_native_call(struct jvst_vm *vm, uint32_t pc)
+{
+	int err;
+
+	if (err = resize_stack(vm, vm->r_sp+2), err != 0) {
+		vm->error = err;
+		return JVST_INVALID;
+	}
+
+	vm->stack[vm->r_sp+0].u = pc;
+	vm->stack[vm->r_sp+1].u = vm->r_fp;
+	vm->r_sp += 2;
+
+	return JVST_VALID;
+}
+
+enum jvst_result
+jvst_vm_native_return(struct jvst_vm *vm, uint32_t *pcp)
+{
+	uint32_t fp;
+	int ret;
+
+	ret = consume_current_value(vm);
+	if (ret != JVST_VALID && ret != JVST_NEXT) {
+		return ret;
+	}
+
+	fp = vm->r_fp;
+	if (fp == 0) {
+		vm->r_pc = 0;
+		return JVST_VALID;
+	}
+
+	// continue with the instruction after the CALL
+	*pcp = (uint32_t)vm->stack[fp-2].u + 1;
+	vm->r_sp = fp-2;
+	vm->r_fp = vm->stack[fp-1].u;
+	vm->r_pc = *pcp;
+
+	return JVST_INDETERMINATE;
+}
+
+int
+jvst_vm_native_token(struct jvst_vm *vm)
+{
+	return next_token(vm, vm->r_fp);
+}
+
+void
+jvst_vm_native_unget(struct jvst_vm *vm)
+{
+	unget_token(vm);
+}
+
+enum jvst_result
+jvst_vm_native_consume(struct jvst_vm *vm)
+{
+	return consume_current_value(vm);
+}
+
+enum jvst_result
+jvst_vm_native_match(struct jvst_vm *vm, int64_t dfa)
+{
+	if (dfa < 0 || (size_t)dfa >= vm->prog->ndfa) {
+		PANIC(vm, -1, "MATCH op with invalid DFA");
+	}
+
+	return vm_match(vm, &vm->prog->dfas[dfa]);
+}
+
+enum jvst_result
+jvst_vm_native_split(struct jvst_vm *vm, int64_t split, int slot, int splitv)
+{
+	union jvst_vm_stackval *sv;
+	int ret;
+
+	if (split < 0 || (size_t)split >= vm->prog->nsplit) {
+		PANIC(vm, -1, "SPLIT op with bad split index");
+	}
+
+	sv = &vm->stack[vm->r_fp + slot];
+	ret = vm_split(vm, split, sv, splitv);
+	if (ret == JVST_VALID && splitv && vm->r_fp == 0) {
+		vm_record_matches(vm, sv);
+	}
+
+	return ret;
+}
+
+enum jvst_result
+jvst_vm_native_unique(struct jvst_vm *vm, int wh)
+{
+	int ret;
+
+	switch (wh) {
+	case JVST_VM_UNIQUE_INIT:
+		vm_uniq_init(vm);
+		return JVST_INDETERMINATE;
+
+	case JVST_VM_UNIQUE_EVAL:
+		ret = vm_uniq_eval(vm);
+		switch (ret) {
+		case JVST_VALID:
+		case JVST_NEXT:
+		case JVST_MORE:
+		case JVST_INVALID:
+			return ret;
+
+		default:
+			PANIC(vm, -1, "unexpected return from jvst_vm_uniq_evaluate");
+		}
+
+	case JVST_VM_UNIQUE_FINAL:
+		vm_uniq_final(vm);
+		return JVST_INDETERMINATE;
+
+	default:
+		PANIC(vm, -1, "invalid arg0 for UNIQUE op");
+	}
+}
+
+int64_t
+jvst_vm_native_fcmp(struct jvst_vm *vm, uint32_t opcode)
+{
+	return fopcmp(vm, vm->r_fp, opcode, 1);
+}
+
+int64_t
+jvst_vm_native_fint(struct jvst_vm *vm, uint32_t opcode)
+{
+	uint32_t arg0, arg1;
+	int64_t flag;
+	double v, div;
+
+	arg0 = jvst_vm_decode_arg0(opcode);
+	arg1 = jvst_vm_decode_arg1(opcode);
+
+	v = vm_fvalptr(vm, vm->r_fp, arg0, 1)[0];
+	if (vm_fint_int(vm, vm->r_fp, arg0, arg1, v, &flag, 1)) {
+		return flag;
+	}
+
+	if (arg1 != 0) {
+		if (jvst_vm_arg_isslot(arg1)) {
+			div = vm_fvalptr(vm, vm->r_fp, arg1, 1)[0];
+		} else {
+			div = jvst_vm_arg_tolit(arg1);
+		}
+
+		v /= div;
+	}
+
+	return isfinite(v) && (v == ceil(v));
+}
+
+uint64_t
+jvst_vm_native_bcount(struct jvst_vm *vm, const union jvst_vm_stackval *bv, uint64_t range)
+{
+	if ((range >> 32) > (range & 0xffffffff)) {
+		PANIC(vm, -1, "BCOUNT op with invalid range");
+	}
+
+	return vm_bcount(bv, range >> 32, range & 0xffffffff);
+}
+
+static void
+vm_input_more(struct jvst_vm *vm, char *data, size_t n)
+{
+	if (vm->bin != NULL) {
+		jvst_bin_decoder_more(vm->bin, data, n);
+	} else {
+		sjp_parser_more(&vm->parser, data, n);
+	}
+}
+
+static enum SJP_RESULT
+vm_input_next(struct jvst_vm *vm, struct sjp_event *evt)
+{
+	if (vm->bin != NULL) {
+		return (enum SJP_RESULT)jvst_bin_decoder_next(vm->bin, evt);
+	}
+
+	return sjp_parser_next(&vm->parser, evt);
+}
+
+// Tracks how deeply the document nests.  Returns -1 if it's deeper than
+// the depth limit.
+static int
+vm_count_depth(struct jvst_vm *vm, const struct sjp_event *evt)
+{
+	struct jvst_vm_budget *b = vm->budget;
+
+	switch (evt->type) {
+	case SJP_ARRAY_BEG:
+	case SJP_OBJECT_BEG:
+		if (b->limits.depth > 0 && b->depth >= b->limits.depth) {
+			vm->error = JVST_INVALID_VM_DEPTH_LIMIT;
+			return -1;
+		}
+		b->depth++;
+		return 0;
+
+	case SJP_ARRAY_END:
+	case SJP_OBJECT_END:
+		if (b->depth > 0) {
+			b->depth--;
+		}
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+// Returns non-zero if the root schema accepts the document whatever the
+// rest of it holds: the root frame is consuming the current value, and
+// then returns VALID.
+static int
+vm_rest_is_valid(const struct jvst_vm *vm)
+{
+	const struct jvst_vm_program *prog = vm->prog;
+	uint32_t pc, opcode;
+	size_t nhops;
+
+	if (vm->r_fp != 0) {
+		return 0;
+	}
+
+	pc = vm->r_pc;
+	if (pc >= prog->ncode || jvst_vm_decode_op(prog->code[pc]) != JVST_OP_CONSUME) {
+		return 0;
+	}
+
+	// follow unconditional jumps to the RETURN, the code generator
+	// doesn't chain many of them
+	for (pc++, nhops=0; pc < prog->ncode && nhops < 8; nhops++) {
+		opcode = prog->code[pc];
+
+		switch (jvst_vm_decode_op(opcode)) {
+		case JVST_OP_NOP:
+			pc++;
+			break;
+
+		case JVST_OP_JMP:
+			if (jvst_vm_decode_bcond(opcode) != JVST_VM_BR_ALWAYS) {
+				return 0;
+			}
+			pc += jvst_vm_tobarg(jvst_vm_decode_barg(opcode));
+			break;
+
+		case JVST_OP_RETURN:
+			return jvst_vm_decode_arg0(opcode) == jvst_vm_arg_lit(0);
+
+		default:
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+// Records whether ret, a result of the root VM, decides the document
+static enum jvst_result
+vm_decide(struct jvst_vm *vm, enum jvst_result ret)
+{
+	switch (vm->early_exit) {
+	case JVST_VM_EXIT_AT_END:
+		break;
+
+	case JVST_VM_EXIT_DECIDED:
+		if (ret == JVST_INVALID) {
+			vm->decided = 1;
+		}
+		break;
+
+	case JVST_VM_EXIT_DECIDED_NOCHECK:
+		if (ret == JVST_INVALID || ret == JVST_VALID) {
+			vm->decided = 1;
+		} else if (ret == JVST_NEXT && vm_rest_is_valid(vm)) {
+			vm->decided = 1;
+			ret = JVST_VALID;
+		}
+		break;
+	}
+
+	return ret;
+}
+
+// Sets up the integer value of a new token.  Binary input decodes
+// integers exactly, so its tokens arrive with the value.  JSON number
+// lexemes are decoded the first time FINT or FCMP needs them, see
+// vm_tnum_int().
+static void
+vm_token_int(struct jvst_vm *vm, const struct sjp_event *evt)
+{
+	vm->tnum_state = VM_TNUM_UNKNOWN;
+	if (vm->bin == NULL || evt->type != SJP_NUMBER) {
+		return;
+	}
+
+	vm->tnum_state = VM_TNUM_FLOAT;
+	if (jvst_bin_decoder_int(vm->bin, &vm->tnum_int)) {
+		vm->tnum_state = VM_TNUM_INT;
+	}
+}
+
 enum jvst_result
 jvst_vm_more(struct jvst_vm *vm, char *data, size_t n)
 {
@@ -1606,7 +3332,11 @@ jvst_vm_more(struct jvst_vm *vm, char *data, size_t n)
 		return JVST_INVALID;
 	}
 
-	sjp_parser_more(&vm->parser, data, n);
+	if (vm->decided) {
+		return JVST_VALID;
+	}
+
+	vm_input_more(vm, data, n);
 
 	pret = SJP_OK;
 	evt.type = SJP_NONE;
@@ -1614,7 +3344,8 @@ jvst_vm_more(struct jvst_vm *vm, char *data, size_t n)
 	if (!vm->needtok) {
 		enum jvst_result ret;
 
-		ret = vm_run_next(vm, pret, &evt);
+		vm_token_int(vm, &evt);
+		ret = vm_decide(vm, vm_run_next(vm, pret, &evt));
 		if (ret != JVST_NEXT) {
 			return ret;
 		}
@@ -1624,7 +3355,7 @@ jvst_vm_more(struct jvst_vm *vm, char *data, size_t n)
 	for (;;) {
 		enum jvst_result ret;
 
-		pret = sjp_parser_next(&vm->parser, &evt);
+		pret = vm_input_next(vm, &evt);
 		if (DEBUG_TOKENS) {
 			char txt[256];
 			size_t n = evt.n;
@@ -1643,7 +3374,12 @@ jvst_vm_more(struct jvst_vm *vm, char *data, size_t n)
 
 		if (SJP_ERROR(pret)) {
 			vm->error = pret;
-			if (DEBUG_OPCODES) {
+			vm_decide(vm, JVST_INVALID);
+			if (DEBUG_OPCODES && vm->bin != NULL) {
+				fprintf(stderr, "Error decoding binary input: %s\n",
+					jvst_bin_errname(pret));
+				debug_state(vm);
+			} else if (DEBUG_OPCODES) {
 				const char *lbeg, *lend, *err, *end;
 				size_t i,n,width = 60, padding = 12;
 				char buf[128] = { 0 }, *bstart = &buf[0];
@@ -1723,8 +3459,21 @@ jvst_vm_more(struct jvst_vm *vm, char *data, size_t n)
 			return JVST_INVALID;
 		}
 
+		// each event reaches the VM here once, split VMs see it
+		// again through vm_split()
+		if (vm->budget != NULL && vm_count_depth(vm, &evt) != 0) {
+			return vm_decide(vm, JVST_INVALID);
+		}
+
 		vm->needtok = 0;
-		ret = vm_run_next(vm, pret, &evt);
+		vm_token_int(vm, &evt);
+		ret = vm_decide(vm, vm_run_next(vm, pret, &evt));
+		if (ret == JVST_MORE && pret != SJP_OK) {
+			// the VM wants the rest of a partial token
+			vm->needtok = 1;
+			continue;
+		}
+
 		if (ret != JVST_NEXT) {
 			return ret;
 		}
@@ -1737,6 +3486,27 @@ jvst_vm_close(struct jvst_vm *vm)
 {
 	int st,ret;
 
+	// the rest of the document doesn't matter
+	if (vm->decided) {
+		return (vm->error == 0) ? JVST_VALID : JVST_INVALID;
+	}
+
+	if (vm->bin != NULL) {
+		// binary items are self-delimiting, so the decoder has
+		// already handed over every complete value
+		if (vm->error == 0 && SJP_ERROR(jvst_bin_decoder_close(vm->bin))) {
+			vm->error = JVST_INVALID_JSON;
+		}
+
+		// the root proc returns once it has the whole document, a
+		// truncated one leaves it waiting for more tokens
+		if (vm->error == 0 && (vm->r_pc != 0 || vm->r_fp != 0)) {
+			vm->error = JVST_INVALID_JSON;
+		}
+
+		return (vm->error == 0) ? JVST_VALID : JVST_INVALID;
+	}
+
 	if (vm->r_pc != 0) {
 		char buf[2] = " ";
 		// FIXME: this is a dumb hack to deal with numbers The problem is
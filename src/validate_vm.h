@@ -22,9 +22,19 @@ enum jvst_vm_register {
 };
 #define JVST_VM_NUMREG (JVST_VM_M+1)
 
+// PROC flags
+enum {
+	// the proc, or a proc it calls, reads %TLEN.  The VM only counts
+	// the code points of a partial string in frames with this flag.
+	JVST_VM_PROC_TLEN = 0x01,
+
+	JVST_VM_PROC_FLAGS = JVST_VM_PROC_TLEN,
+};
+
 enum jvst_vm_op {
 	JVST_OP_NOP	= 0,
-	JVST_OP_PROC,		// FRAME N sets up a call frame and reserves N 64-bit slots on the call stack
+	JVST_OP_PROC,		// PROC N F sets up a call frame and reserves N 64-bit slots on the call stack.
+				// F holds the JVST_VM_PROC_xxx flags of the proc.
 
 	// Integer and float comparisons.  xCMP(slot, slot_or_const)
 	// These set the FLAGS register to:
@@ -38,6 +48,9 @@ enum jvst_vm_op {
 	JVST_OP_FINT,		// Checks if a float value in a slot is an integer.
 				// args: slot.  result: isnormal(reg) && (reg == ceil(reg)).
 				// FLAGS should have a non-zero value on success, a zero value on failure.
+				// Integer number tokens beyond 2^53, which may not be exact as
+				// doubles, are checked with int64 arithmetic when the divisor
+				// is also an integer.
 
 	JVST_OP_JMP,		// Branch, the branch interprets the FLAGS register based on the condition arg:
 				// 
@@ -77,12 +90,18 @@ enum jvst_vm_op {
 
 	JVST_OP_BAND,		// Bitwise-AND: BAND(regA,reg_slotB)  regA = regA & reg_slotB
 
+	JVST_OP_BCOUNT,		// Counts bits set in a bitvector: BCOUNT(regA,slotB)
+				// The bitvector starts at slotB and spans as many slots as it
+				// needs.  regA holds the range of bits on entry, with the first
+				// bit in the high 32 bits and the last bit in the low 32 bits,
+				// and the number of bits set in the range on exit.
+
 	JVST_OP_RETURN,		// Returns VALID or raises an INVALID result.  INVALID results have an error code.
 
 	JVST_OP_UNIQUE,		// Initializes UNIQUE data, finalizes UNIQUE data, or evaluates for UNIQUE
 };
 
-#define JVST_OP_MAX JVST_OP_RETURN
+#define JVST_OP_MAX JVST_OP_UNIQUE
 
 enum jvst_vm_br_cond {
 	JVST_VM_BR_NEVER  = 0,           // bits: 000
@@ -286,6 +305,71 @@ jvst_vm_encode2(enum jvst_vm_op op, uint16_t a, uint16_t b)
 	return (uint32_t)op | ((uint32_t)a << 5) | ((uint32_t)b << 18);
 }
 
+// DFAs that only match a literal string are matched without walking
+// the DFA.  The DFA is still used for partial tokens.
+enum jvst_vm_dfa_literal {
+	JVST_VM_DFA_LIT_NONE = 0,
+	JVST_VM_DFA_LIT_EXACT,		// ^lit$
+	JVST_VM_DFA_LIT_PREFIX,		// ^lit
+	JVST_VM_DFA_LIT_SUFFIX,		// lit$
+	JVST_VM_DFA_LIT_SUBSTR,		// lit
+};
+
+/* Perfect hash table for DFAs that match a fixed set of strings, such
+ * as the property names of an object without patternProperties.
+ *
+ * Keys are hashed once.  The hash picks a bucket, and the bucket's
+ * displacement picks the slot:
+ *
+ *   slot = (h1 + disp[bucket]*h2) mod nslots
+ *
+ * The displacements are chosen when the table is built so that no two
+ * keys share a slot.  A lookup compares the length and bytes of the key
+ * in the slot to confirm the match.
+ */
+struct jvst_vm_strtab_slot {
+	uint32_t off;		// offset of the key in the key buffer
+	uint32_t len;
+	int which;		// match case, zero if the slot is empty
+};
+
+struct jvst_vm_strtab {
+	size_t nkeys;
+	uint32_t nbuckets;	// power of two
+	uint32_t nslots;	// power of two
+
+	uint32_t *disp;
+	struct jvst_vm_strtab_slot *slots;
+	char *keys;
+	size_t keylen;
+};
+
+uint64_t
+jvst_vm_strhash(const char *s, size_t n);
+
+// Returns the bucket of a key's hash
+static inline uint32_t
+jvst_vm_strtab_bucket(const struct jvst_vm_strtab *tab, uint64_t h)
+{
+	return (uint32_t)((h * 0x9E3779B97F4A7C15ULL) >> 32) & (tab->nbuckets-1);
+}
+
+static inline uint32_t
+jvst_vm_strtab_slot(const struct jvst_vm_strtab *tab, uint64_t h, uint32_t disp)
+{
+	uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+	return (h1 + disp*h2) & (tab->nslots-1);
+}
+
+/* Looks up a string.  Returns its match case, or 0 if the string is not
+ * in the table.
+ */
+int
+jvst_vm_strtab_lookup(const struct jvst_vm_strtab *tab, const char *s, size_t n);
+
+void
+jvst_vm_strtab_free(struct jvst_vm_strtab *tab);
+
 struct jvst_vm_dfa {
 	size_t nstates;
 	size_t nedges;
@@ -294,6 +378,20 @@ struct jvst_vm_dfa {
 	int *offs;
 	int *transitions;
 	int *endstates;
+
+	// literal fast path
+	enum jvst_vm_dfa_literal lit_kind;
+	int lit_result;		// end state value when the literal matches
+	size_t nlit;
+	char *lit;
+
+	// string table, NULL unless the DFA matches a fixed set of strings
+	struct jvst_vm_strtab *strtab;
+
+	// compiled state machine (see validate_gen_c.c), NULL unless the
+	// DFA is part of a generated C validator.  Used by
+	// jvst_vm_dfa_run() in place of the transition table.
+	int (*run)(int st0, const char *buf, size_t n);
 };
 
 size_t
@@ -328,9 +426,41 @@ jvst_vm_dfa_run(const struct jvst_vm_dfa *dfa, int st0, const char *buf, size_t
 bool
 jvst_vm_dfa_endstate(const struct jvst_vm_dfa *dfa, int st1, int *datap);
 
+/* Runs a literal DFA (lit_kind is not JVST_VM_DFA_LIT_NONE) on a
+ * complete string.  Returns the end state value if the string matches,
+ * and 0 otherwise.
+ */
+int
+jvst_vm_dfa_run_literal(const struct jvst_vm_dfa *dfa, const char *buf, size_t n);
+
+const char *
+jvst_vm_dfa_literal_name(enum jvst_vm_dfa_literal kind);
+
 void
 jvst_vm_dfa_finalize(struct jvst_vm_dfa *dfa);
 
+struct jvst_vm;
+struct jvst_vm_jit;
+struct jvst_vm_lazy;
+
+// A range of a program's source map.  The code from pc up to the pc of
+// the next range was compiled from the schema at srcstr+loc, a URI
+// fragment like "#/properties/foo".  Offset zero of srcstr is the empty
+// string, for code whose schema isn't known.
+//
+// Most ranges cover a proc, and only know the schema.  A RETURN that
+// fails the document has a range of its own, with the keyword that
+// failed at srcstr+kw, eg "pattern", and the location of its schema,
+// which can be a subschema that was compiled into the proc.  Checks
+// that aren't a single keyword, like a type switch that several
+// keywords contribute to, give the first of them.  A proc merged with
+// an identical proc reports the locations of the one that was kept.
+struct jvst_vm_srcloc {
+	uint32_t pc;
+	uint32_t loc;
+	uint32_t kw;
+};
+
 struct jvst_vm_program {
 	size_t ncode;
 
@@ -345,8 +475,62 @@ struct jvst_vm_program {
 	struct jvst_vm_dfa *dfas;
 
 	uint32_t *code;
+
+	// number of schemas in a program compiled from several schemas by
+	// jvst_compile_schemas(), otherwise zero
+	size_t nschema;
+
+	// the program compiled to C (see validate_gen_c.c) or to machine
+	// code (see validate_jit.h), NULL for programs that are interpreted
+	enum jvst_result (*native)(struct jvst_vm *vm);
+
+	// machine code from jvst_vm_jit(), freed with the program
+	struct jvst_vm_jit *jit;
+
+	// set by jvst_vm_verify(), see validate_verify.h
+	int verified;
+
+	// compiles definitions on their first CALL (see validate_lazy.h),
+	// NULL unless the program came from jvst_compile_lazy()
+	struct jvst_vm_lazy *lazy;
+
+	// stack slots used by any VM running the program, from
+	// jvst_vm_stack_bound(), or JVST_VM_STACK_UNBOUNDED
+	size_t maxstack;
+
+	// maps pcs back to the schemas they were compiled from, in order
+	// of pc, with one range per proc or run of procs and one per
+	// failing RETURN.  Empty if the schemas don't have locations.
+	// See jvst_vm_program_srcloc() and jvst_vm_program_keyword().
+	size_t nsrcmap;
+	struct jvst_vm_srcloc *srcmap;
+
+	// NUL-terminated locations and keywords of the source map
+	size_t nsrcstr;
+	char *srcstr;
 };
 
+// maxstack of programs with recursive calls, or that haven't been
+// analyzed
+#define JVST_VM_STACK_UNBOUNDED 0
+
+// Returns the most stack slots a VM running prog can use: the deepest
+// chain of CALLs from any proc, with the frame of each proc and the
+// two slots each CALL pushes.  Returns JVST_VM_STACK_UNBOUNDED if a
+// proc can call itself, directly or not, or if a CALL is unresolved.
+size_t
+jvst_vm_stack_bound(const struct jvst_vm_program *prog);
+
+// Returns the location of the schema the code at pc was compiled from,
+// or NULL if the program doesn't know
+const char *
+jvst_vm_program_srcloc(const struct jvst_vm_program *prog, uint32_t pc);
+
+// Returns the keyword that the RETURN at pc fails, or NULL if pc isn't
+// a RETURN for a keyword or the program doesn't know
+const char *
+jvst_vm_program_keyword(const struct jvst_vm_program *prog, uint32_t pc);
+
 struct jvst_vm_program *
 jvst_vm_readfile(FILE *f);
 
@@ -359,6 +543,11 @@ jvst_vm_writefile(FILE *f, const struct jvst_vm_program *prog);
 int
 jvst_vm_program_writebuf(struct sbuf *buf, const struct jvst_vm_program *prog);
 
+// Writes prog as C source for a validator that runs without the
+// interpreter.  See validate_gen_c.c.
+int
+jvst_vm_program_genc(FILE *f, const struct jvst_vm_program *prog);
+
 void
 jvst_vm_program_print(FILE *f, const struct jvst_vm_program *prog);
 
@@ -377,6 +566,32 @@ enum {
 	JVST_VM_PARSER_BUFSIZE = 4096,
 };
 
+// Input encodings accepted by the VM.  Binary inputs are decoded into
+// the same token stream as JSON text.
+enum jvst_vm_input {
+	JVST_VM_INPUT_JSON = 0,
+	JVST_VM_INPUT_CBOR,
+	JVST_VM_INPUT_MSGPACK,
+};
+
+// When a VM may stop reading its input, see jvst_vm_set_early_exit()
+enum jvst_vm_early_exit {
+	// the result is only known once jvst_vm_close() has seen the
+	// whole document
+	JVST_VM_EXIT_AT_END = 0,
+
+	// stop once the result is decided.  Invalid documents are decided
+	// at the first violation.  Valid documents still have to be read
+	// to the end to check that they're well formed JSON.
+	JVST_VM_EXIT_DECIDED,
+
+	// as JVST_VM_EXIT_DECIDED, but without checking the rest of a
+	// valid document.  Valid documents are decided once the root
+	// schema can't fail, for example while it consumes the rest of a
+	// value it accepts whatever its contents.
+	JVST_VM_EXIT_DECIDED_NOCHECK,
+};
+
 enum jvst_vm_tokstate {
 	JVST_VM_TOKEN_CONSUMED,
 	JVST_VM_TOKEN_FETCH,
@@ -391,6 +606,35 @@ union jvst_vm_stackval {
 };
 
 struct jvst_vm_unique;
+struct jvst_vm_progref;
+struct jvst_bin_decoder;
+struct jvst_vm_budget;
+struct jvst_vm_prof;
+
+/* Memo of recent MATCH results.  In arrays of similar objects the same
+ * property names are matched over and over, so MATCH remembers the
+ * match case of short strings, keyed by the DFA and the string.  The
+ * cache is direct mapped and fixed in size.  Partial tokens and strings
+ * longer than JVST_VM_MCACHE_MAXKEY bytes bypass it.
+ */
+enum {
+	JVST_VM_MCACHE_SIZE   = 256,	// entries, must be a power of two
+	JVST_VM_MCACHE_MAXKEY = 32,
+};
+
+struct jvst_vm_mcache_entry {
+	uint32_t dfa;		// DFA index plus one, zero if the entry is empty
+	uint32_t len;
+	int result;
+	char key[JVST_VM_MCACHE_MAXKEY];
+};
+
+struct jvst_vm_mcache {
+	size_t hits;
+	size_t misses;
+
+	struct jvst_vm_mcache_entry entries[JVST_VM_MCACHE_SIZE];
+};
 
 struct jvst_vm {
 	struct jvst_vm_program *prog;
@@ -398,10 +642,35 @@ struct jvst_vm {
 	size_t maxstack;
 	union jvst_vm_stackval *stack;
 
+	// for programs without a stack bound, the most stack slots the
+	// VM may use before it fails with JVST_INVALID_VM_STACK_OVERFLOW
+	size_t stack_limit;
+
+	// resource limits and what's been used against them, NULL if the
+	// VM has no limits.  Split VMs share the budget of the VM that
+	// started the split.
+	struct jvst_vm_budget *budget;
+
+	// profile of the run, NULL if it isn't profiled.  Split VMs add to
+	// the profile of the VM that started the split.
+	struct jvst_vm_prof *prof;
+
 	size_t nsplit;
 	size_t maxsplit;
 	struct jvst_vm *splits;
 
+	// the VM that started this split VM, NULL for the root VM
+	struct jvst_vm *parent;
+
+	// set when a split VM reached the same state as another split VM
+	// and was merged into it.  The merged VM has finished and takes
+	// its result from the VM it was merged into.
+	struct jvst_vm *same;
+
+	// split VMs by state, for finding the split VMs to merge.  Keeps
+	// its buckets between splits.
+	struct hmap *split_states;
+
 	// for consuming nested structures
 	size_t nobj;
 	size_t narr;
@@ -419,18 +688,123 @@ struct jvst_vm {
 	enum SJP_RESULT pret;
 	int error;
 	int dfa_st;
+
+	// integer value of the current number token.  This is decoded
+	// from the token's lexeme the first time FINT or FCMP needs it,
+	// which is only for tokens beyond 2^53.
+	int tnum_state;
+	int64_t tnum_int;
+
+	// set while %TNUM of frame tnum_fp, and of the frames above it,
+	// holds the current token.  The integer value is only used for
+	// those registers.
+	int tnum_loaded;
+	uint32_t tnum_fp;
+
+	// PROC flags of the root frame.  The flags of the other frames
+	// are kept above the return pc, see vm_frame_flags()
+	uint32_t root_flags;
 	enum jvst_vm_tokstate tokstate;
 	int needtok;  // flag if the next call to vm_run_next should have a token
 
+	enum jvst_vm_early_exit early_exit;
+	int decided;  // set once the result can't change, see jvst_vm_decided()
+
 	char pstack[JVST_VM_PARSER_STKSIZE];
 	char pbuf[JVST_VM_PARSER_BUFSIZE];
 
+	// decoder for binary input, NULL if the input is JSON text
+	struct jvst_bin_decoder *bin;
+
+	// MATCH results, allocated on first use.  Split VMs use the cache
+	// of the root VM, and leave this NULL.
+	struct jvst_vm_mcache *mcache;
+
 	struct jvst_vm_unique *uniq;
+
+	// for programs compiled from several schemas, which of them the
+	// document matched, one bit per schema.  NULL for split VMs.
+	uint64_t *matches;
+
+	// reference to prog when the VM was started from a cell (see
+	// validate_swap.h), released by jvst_vm_finalize()
+	struct jvst_vm_progref *progref;
 };
 
 void
 jvst_vm_init_defaults(struct jvst_vm *vm, struct jvst_vm_program *prog);
 
+// For programs compiled from several schemas, returns the schemas that
+// the document matched: bit i of word i/64 is set if it matched schema
+// i.  Only meaningful after jvst_vm_close() returns JVST_VALID.
+const uint64_t *
+jvst_vm_matches(const struct jvst_vm *vm);
+
+// Sets the stack limit of a VM running a program with recursive calls
+// (see jvst_vm_stack_bound).  The default is JVST_VM_DEFAULT_STACK_LIMIT
+// slots.  Must be called before the first call to jvst_vm_more().
+void
+jvst_vm_set_stack_limit(struct jvst_vm *vm, size_t nslots);
+
+#define JVST_VM_DEFAULT_STACK_LIMIT (1u << 20)
+
+/* Limits on the work and memory a VM may spend on one document, for
+ * validating untrusted input.  A zero field is no limit.  A VM that
+ * runs into a limit fails with the matching JVST_INVALID_VM_* error,
+ * whether or not the document is valid.
+ *
+ * The limits cover the VM and all of its split VMs together.
+ */
+struct jvst_vm_limits {
+	// instructions executed, JVST_INVALID_VM_INSTR_LIMIT.  VMs with
+	// an instruction limit run in the interpreter, which counts
+	// them, even if the program has native code.
+	uint64_t ninstr;
+
+	// arrays and objects open at once, JVST_INVALID_VM_DEPTH_LIMIT
+	size_t depth;
+
+	// split VMs running at once, JVST_INVALID_VM_SPLIT_LIMIT
+	size_t nsplit;
+
+	// bytes held by uniqueItems sets, JVST_INVALID_VM_UNIQUE_LIMIT
+	size_t uniq_bytes;
+
+	// bytes of VM stacks, split VMs and uniqueItems sets,
+	// JVST_INVALID_VM_MEMORY_LIMIT
+	size_t memory;
+};
+
+// Sets the resource limits of a VM.  Must be called before the first
+// call to jvst_vm_more().
+void
+jvst_vm_set_limits(struct jvst_vm *vm, const struct jvst_vm_limits *limits);
+
+// Selects the input encoding.  Must be called before the first call to
+// jvst_vm_more().  The default is JSON text.
+void
+jvst_vm_set_input(struct jvst_vm *vm, enum jvst_vm_input input);
+
+// Lets the VM decide its result before the end of the document.  Must
+// be called before the first call to jvst_vm_more().  The default is
+// JVST_VM_EXIT_AT_END.
+void
+jvst_vm_set_early_exit(struct jvst_vm *vm, enum jvst_vm_early_exit early_exit);
+
+// Returns non-zero once the result is decided.  Callers can stop
+// feeding the VM input: jvst_vm_more() and jvst_vm_close() return the
+// decided result without reading any more of it.  Always zero for
+// JVST_VM_EXIT_AT_END.
+int
+jvst_vm_decided(const struct jvst_vm *vm);
+
+// Profiles the run, see validate_prof.h.  flags are from enum
+// jvst_vm_prof_flags.  If report isn't NULL, jvst_vm_finalize() writes
+// the profile to it.  Must be called before the first call to
+// jvst_vm_more().  Profiled VMs are always interpreted.
+void
+jvst_vm_set_profile(struct jvst_vm *vm, unsigned flags, FILE *report);
+
 enum jvst_result
 jvst_vm_more(struct jvst_vm *vm, char *data, size_t n);
 
@@ -443,6 +817,10 @@ jvst_vm_finalize(struct jvst_vm *vm);
 void
 jvst_vm_dumpstate(struct jvst_vm *vm);
 
+// Reports how often MATCH found its result in the match cache
+void
+jvst_vm_mcache_stats(const struct jvst_vm *vm, size_t *hitsp, size_t *missesp);
+
 #endif /* VALIDATE_VM_H */
 
 /* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
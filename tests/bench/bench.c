@@ -0,0 +1,703 @@
+/*
+ * Benchmarks of schema compilation and validation.
+ *
+ * Each run compiles one schema and validates one document with it,
+ * over and over, then writes its results as one line of JSON to
+ * stdout.  make bench collects the lines of all the cases in a file,
+ * and compare.sh compares two such files, say from two commits.
+ *
+ * Documents are either generated (-g <case>, see cases[] for the
+ * list), each case with a schema of its own, or read from a schema
+ * and a document file, for the curated corpus in tests/bench/corpus.
+ *
+ * Built with JVST_BENCH_GENC defined, the benchmark runs a validator
+ * generated by jvst -l c, which is linked in with it, rather than
+ * compiling the schema.  The Makefile generates the validator from the
+ * schema that -S prints.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+#include "sjp_testing.h"
+
+#include "parser.h"
+#include "ast.h"
+#include "xalloc.h"
+#include "validate.h"
+#include "validate_vm.h"
+#include "validate_jit.h"
+#include "validate_prof.h"
+
+unsigned debug;
+
+enum {
+	DEFAULT_SIZE = 4 * 1024 * 1024,
+	CHUNK_SIZE   = 65536,
+	MIN_ITER     = 3,
+};
+
+#define DEFAULT_SECONDS 1.0
+#define BASE_URI "http://example.com/bench.json"
+
+struct text {
+	char *s;
+	size_t len;
+	size_t max;
+};
+
+static void
+text_printf(struct text *t, const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	for (;;) {
+		size_t avail = t->max - t->len;
+
+		va_start(args, fmt);
+		n = vsnprintf(t->s != NULL ? &t->s[t->len] : NULL, avail, fmt, args);
+		va_end(args);
+
+		assert(n >= 0);
+		if ((size_t)n < avail) {
+			t->len += n;
+			return;
+		}
+
+		t->s = xenlargevec(t->s, &t->max, n + 1, 1);
+	}
+}
+
+// Generated cases.  Each writes a schema, and a document that the
+// schema accepts of about size bytes.
+
+static void
+gen_numbers(struct text *schema, struct text *doc, size_t size)
+{
+	size_t i;
+
+	text_printf(schema, "{ \"type\" : \"array\", "
+		"\"items\" : { \"type\" : \"number\", \"minimum\" : 0, \"maximum\" : 1e9 } }");
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		if (i % 4 == 3) {
+			text_printf(doc, "%s%zu.%zu", (i > 0) ? "," : "", (i * 7919) % 1000000, i % 100);
+		} else {
+			text_printf(doc, "%s%zu", (i > 0) ? "," : "", (i * 7919) % 1000000);
+		}
+	}
+	text_printf(doc, "]");
+}
+
+enum { WIDE_KEYS = 300 };
+
+static void
+gen_wide_object(struct text *schema, struct text *doc, size_t size)
+{
+	size_t i, k;
+
+	text_printf(schema, "{ \"type\" : \"array\", \"items\" : { \"type\" : \"object\", \"properties\" : {");
+	for (k=0; k < WIDE_KEYS; k++) {
+		text_printf(schema, "%s \"key%zu\" : { \"type\" : \"%s\" }",
+			(k > 0) ? "," : "", k, (k % 2 == 0) ? "integer" : "string");
+	}
+	text_printf(schema, " }, \"required\" : [ \"key0\", \"key%d\" ], "
+		"\"additionalProperties\" : false } }", WIDE_KEYS-1);
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		text_printf(doc, "%s{", (i > 0) ? "," : "");
+
+		// keys in a different order in each object
+		for (k=0; k < WIDE_KEYS; k++) {
+			size_t key = (k * 7 + i) % WIDE_KEYS;
+
+			if (key % 2 == 0) {
+				text_printf(doc, "%s\"key%zu\":%zu", (k > 0) ? "," : "", key, i + k);
+			} else {
+				text_printf(doc, "%s\"key%zu\":\"v%zu\"", (k > 0) ? "," : "", key, i + k);
+			}
+		}
+		text_printf(doc, "}");
+	}
+	text_printf(doc, "]");
+}
+
+enum { DEEP_DEPTH = 100 };
+
+static void
+gen_deep(struct text *schema, struct text *doc, size_t size)
+{
+	size_t i, d;
+
+	text_printf(schema, "{ \"type\" : \"array\", "
+		"\"items\" : { \"$ref\" : \"#/definitions/node\" }, "
+		"\"definitions\" : { \"node\" : { \"type\" : \"object\", "
+		"\"properties\" : { "
+		"\"v\" : { \"type\" : \"integer\" }, "
+		"\"next\" : { \"$ref\" : \"#/definitions/node\" } }, "
+		"\"required\" : [ \"v\" ] } } }");
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		text_printf(doc, "%s", (i > 0) ? "," : "");
+		for (d=0; d < DEEP_DEPTH; d++) {
+			text_printf(doc, "{\"v\":%zu%s", d, (d+1 < DEEP_DEPTH) ? ",\"next\":" : "");
+		}
+		for (d=0; d < DEEP_DEPTH; d++) {
+			text_printf(doc, "}");
+		}
+	}
+	text_printf(doc, "]");
+}
+
+static void
+gen_pattern(struct text *schema, struct text *doc, size_t size)
+{
+	static const char *const words[] = {
+		"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf",
+	};
+	size_t i;
+
+	text_printf(schema, "{ \"type\" : \"array\", "
+		"\"items\" : { \"type\" : \"string\", \"pattern\" : \"^[a-z]+-[0-9]+(\\\\.[a-z]+)?$\" } }");
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		text_printf(doc, "%s\"%s-%zu%s\"", (i > 0) ? "," : "",
+			words[i % 7], i, (i % 3 == 0) ? ".x" : "");
+	}
+	text_printf(doc, "]");
+}
+
+static void
+gen_unique_scalars(struct text *schema, struct text *doc, size_t size)
+{
+	size_t i;
+
+	text_printf(schema, "{ \"type\" : \"array\", \"uniqueItems\" : true }");
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		if (i % 2 == 0) {
+			text_printf(doc, "%s%zu", (i > 0) ? "," : "", i);
+		} else {
+			text_printf(doc, "%s\"s%zu\"", (i > 0) ? "," : "", i);
+		}
+	}
+	text_printf(doc, "]");
+}
+
+static void
+gen_unique_objects(struct text *schema, struct text *doc, size_t size)
+{
+	size_t i;
+
+	text_printf(schema, "{ \"type\" : \"array\", \"uniqueItems\" : true, "
+		"\"items\" : { \"type\" : \"object\" } }");
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		text_printf(doc, "%s{\"id\":%zu,\"name\":\"n%zu\",\"tags\":[\"a\",\"b\",%zu]}",
+			(i > 0) ? "," : "", i, i % 97, i % 5);
+	}
+	text_printf(doc, "]");
+}
+
+static void
+gen_oneof(struct text *schema, struct text *doc, size_t size)
+{
+	size_t i;
+
+	text_printf(schema, "{ \"type\" : \"array\", \"items\" : { \"oneOf\" : [ "
+		"{ \"type\" : \"object\", \"properties\" : { "
+			"\"kind\" : { \"const\" : \"circle\" }, \"r\" : { \"type\" : \"number\" } }, "
+			"\"required\" : [ \"kind\", \"r\" ] }, "
+		"{ \"type\" : \"object\", \"properties\" : { "
+			"\"kind\" : { \"const\" : \"square\" }, \"side\" : { \"type\" : \"number\" } }, "
+			"\"required\" : [ \"kind\", \"side\" ] }, "
+		"{ \"type\" : \"object\", \"properties\" : { "
+			"\"kind\" : { \"const\" : \"rect\" }, "
+			"\"w\" : { \"type\" : \"number\" }, \"h\" : { \"type\" : \"number\" } }, "
+			"\"required\" : [ \"kind\", \"w\", \"h\" ] }, "
+		"{ \"type\" : \"object\", \"properties\" : { "
+			"\"kind\" : { \"const\" : \"point\" } }, "
+			"\"required\" : [ \"kind\" ], \"maxProperties\" : 1 } "
+		"] } }");
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		const char *sep = (i > 0) ? "," : "";
+
+		switch (i % 4) {
+		case 0: text_printf(doc, "%s{\"kind\":\"circle\",\"r\":%zu}", sep, i);                 break;
+		case 1: text_printf(doc, "%s{\"side\":%zu,\"kind\":\"square\"}", sep, i);              break;
+		case 2: text_printf(doc, "%s{\"kind\":\"rect\",\"w\":%zu,\"h\":%zu.5}", sep, i, i);    break;
+		case 3: text_printf(doc, "%s{\"kind\":\"point\"}", sep);                              break;
+		}
+	}
+	text_printf(doc, "]");
+}
+
+enum { BLOB_SIZE = 65536 };
+
+static void
+gen_blob(struct text *schema, struct text *doc, size_t size)
+{
+	static const char b64[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	static char blob[BLOB_SIZE];
+	size_t i, j;
+
+	text_printf(schema, "{ \"type\" : \"array\", \"items\" : { \"type\" : \"object\", "
+		"\"properties\" : { \"id\" : { \"type\" : \"integer\" } }, "
+		"\"required\" : [ \"id\" ] } }");
+
+	text_printf(doc, "[");
+	for (i=0; doc->len < size; i++) {
+		for (j=0; j < BLOB_SIZE; j++) {
+			blob[j] = b64[(i + j*31) % 64];
+		}
+
+		text_printf(doc, "%s{\"id\":%zu,\"data\":\"%.*s\"}",
+			(i > 0) ? "," : "", i, BLOB_SIZE, blob);
+	}
+	text_printf(doc, "]");
+}
+
+// A coordinate of a GeoJSON position, in millionths of a degree
+static void
+gen_coord(struct text *doc, size_t seed, long range)
+{
+	long v = (long)(seed % (size_t)(2 * range * 1000000L)) - range * 1000000L;
+
+	text_printf(doc, "%s%ld.%06ld", (v < 0) ? "-" : "", labs(v) / 1000000L, labs(v) % 1000000L);
+}
+
+static void
+gen_position(struct text *doc, size_t seed)
+{
+	text_printf(doc, "[");
+	gen_coord(doc, seed * 7919, 180);
+	text_printf(doc, ",");
+	gen_coord(doc, seed * 104729, 90);
+	if (seed % 5 == 0) {
+		text_printf(doc, ",%zu", seed % 4000);
+	}
+	text_printf(doc, "]");
+}
+
+static void
+gen_geojson(struct text *schema, struct text *doc, size_t size)
+{
+	size_t i, k;
+
+	text_printf(schema, "{ \"type\" : \"object\", \"required\" : [ \"type\", \"features\" ], "
+		"\"properties\" : { "
+			"\"type\" : { \"const\" : \"FeatureCollection\" }, "
+			"\"features\" : { \"type\" : \"array\", "
+				"\"items\" : { \"$ref\" : \"#/definitions/feature\" } } }, "
+		"\"definitions\" : { "
+		"\"position\" : { \"type\" : \"array\", \"minItems\" : 2, \"maxItems\" : 3, "
+			"\"items\" : { \"type\" : \"number\" } }, "
+		"\"feature\" : { \"type\" : \"object\", "
+			"\"required\" : [ \"type\", \"geometry\", \"properties\" ], "
+			"\"properties\" : { "
+			"\"type\" : { \"const\" : \"Feature\" }, "
+			"\"id\" : { \"type\" : [ \"string\", \"integer\" ] }, "
+			"\"properties\" : { \"type\" : [ \"object\", \"null\" ] }, "
+			"\"geometry\" : { \"oneOf\" : [ "
+			"{ \"type\" : \"object\", \"required\" : [ \"type\", \"coordinates\" ], "
+				"\"properties\" : { \"type\" : { \"const\" : \"Point\" }, "
+				"\"coordinates\" : { \"$ref\" : \"#/definitions/position\" } } }, "
+			"{ \"type\" : \"object\", \"required\" : [ \"type\", \"coordinates\" ], "
+				"\"properties\" : { \"type\" : { \"const\" : \"LineString\" }, "
+				"\"coordinates\" : { \"type\" : \"array\", \"minItems\" : 2, "
+					"\"items\" : { \"$ref\" : \"#/definitions/position\" } } } }, "
+			"{ \"type\" : \"object\", \"required\" : [ \"type\", \"coordinates\" ], "
+				"\"properties\" : { \"type\" : { \"const\" : \"Polygon\" }, "
+				"\"coordinates\" : { \"type\" : \"array\", \"items\" : { "
+					"\"type\" : \"array\", \"minItems\" : 4, "
+					"\"items\" : { \"$ref\" : \"#/definitions/position\" } } } } } "
+			"] } } } } }");
+
+	text_printf(doc, "{\"type\":\"FeatureCollection\",\"features\":[");
+	for (i=0; doc->len < size; i++) {
+		text_printf(doc, "%s{\"type\":\"Feature\",", (i > 0) ? "," : "");
+
+		if (i % 2 == 0) {
+			text_printf(doc, "\"id\":\"f%zu\",", i);
+		} else {
+			text_printf(doc, "\"id\":%zu,", i);
+		}
+
+		switch (i % 3) {
+		case 0:
+			text_printf(doc, "\"geometry\":{\"type\":\"Point\",\"coordinates\":");
+			gen_position(doc, i);
+			text_printf(doc, "}");
+			break;
+
+		case 1:
+			text_printf(doc, "\"geometry\":{\"type\":\"LineString\",\"coordinates\":[");
+			for (k=0; k < 2 + i % 5; k++) {
+				text_printf(doc, "%s", (k > 0) ? "," : "");
+				gen_position(doc, i * 16 + k);
+			}
+			text_printf(doc, "]}");
+			break;
+
+		case 2:
+			// a closed ring
+			text_printf(doc, "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[");
+			for (k=0; k < 4 + i % 5; k++) {
+				text_printf(doc, "%s", (k > 0) ? "," : "");
+				gen_position(doc, i * 16 + k);
+			}
+			text_printf(doc, ",");
+			gen_position(doc, i * 16);
+			text_printf(doc, "]]}");
+			break;
+		}
+
+		if (i % 4 == 0) {
+			text_printf(doc, ",\"properties\":null}");
+		} else {
+			text_printf(doc, ",\"properties\":{\"name\":\"feature %zu\",\"rank\":%zu,\"tags\":[\"t%zu\"]}}",
+				i, i % 10, i % 7);
+		}
+	}
+	text_printf(doc, "]}");
+}
+
+static const struct {
+	const char *name;
+	void (*gen)(struct text *schema, struct text *doc, size_t size);
+} cases[] = {
+	{ "numbers",        gen_numbers        },
+	{ "wide_object",    gen_wide_object    },
+	{ "deep",           gen_deep           },
+	{ "pattern",        gen_pattern        },
+	{ "unique_scalars", gen_unique_scalars },
+	{ "unique_objects", gen_unique_objects },
+	{ "oneof",          gen_oneof          },
+	{ "blob",           gen_blob           },
+	{ "geojson",        gen_geojson        },
+};
+
+static void
+readfile(const char *fname, struct text *t)
+{
+	FILE *f;
+	size_t r;
+
+	f = fopen(fname, "r");
+	if (f == NULL) {
+		fprintf(stderr, "error opening '%s': %s\n", fname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	for (;;) {
+		if (t->len + BUFSIZ >= t->max) {
+			t->s = xenlargevec(t->s, &t->max, BUFSIZ, 1);
+		}
+
+		r = fread(&t->s[t->len], 1, t->max - t->len - 1, f);
+		if (r == 0) {
+			break;
+		}
+		t->len += r;
+	}
+
+	if (ferror(f)) {
+		fprintf(stderr, "error reading '%s': %s\n", fname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(f);
+	t->s[t->len] = '\0';
+}
+
+#ifdef JVST_BENCH_GENC
+
+// generated by jvst -l c, the program is static
+struct jvst_vm_program *
+jvst_validator(void);
+
+#else
+
+static struct jvst_vm_program *
+compile(struct text *schema)
+{
+	static const struct ast_schema ast_default;
+	struct sjp_lexer l;
+	struct ast_schema *ast;
+	struct json_string uri;
+	int r;
+
+	uri.s = BASE_URI;
+	uri.len = strlen(BASE_URI);
+
+	ast = xmalloc(sizeof *ast);
+	*ast = ast_default;
+
+	sjp_lexer_init(&l);
+	sjp_lexer_more(&l, schema->s, schema->len);
+	parse(&l, ast, uri);
+
+	r = sjp_lexer_close(&l);
+	if (SJP_ERROR(r)) {
+		fprintf(stderr, "error parsing schema: %s\n", ret2name(r));
+		exit(EXIT_FAILURE);
+	}
+
+	// resolves $ref, which jvst_compile_schema() doesn't
+	return jvst_compile_schemas((const struct ast_schema *const *)&ast, 1);
+}
+
+#endif /* JVST_BENCH_GENC */
+
+static uint64_t
+count_tokens(struct text *doc)
+{
+	static char pstack[JVST_VM_PARSER_STKSIZE];
+	static char pbuf[JVST_VM_PARSER_BUFSIZE];
+	struct sjp_parser p;
+	struct sjp_event evt;
+	enum SJP_RESULT ret;
+	uint64_t n;
+
+	(void)sjp_parser_init(&p, pstack, sizeof pstack, pbuf, sizeof pbuf);
+	sjp_parser_more(&p, doc->s, doc->len);
+
+	// pieces of partial strings count as one token
+	n = 0;
+	do {
+		ret = sjp_parser_next(&p, &evt);
+		if (ret == SJP_OK && evt.type != SJP_NONE) {
+			n++;
+		}
+	} while (!SJP_ERROR(ret) && evt.type != SJP_NONE);
+
+	return n;
+}
+
+// Validates the document and returns the result.  If ninstr isn't
+// NULL, the run is profiled and ninstr set to the instructions run.
+static enum jvst_result
+run(struct jvst_vm_program *prog, struct text *doc, uint64_t *ninstr)
+{
+	struct jvst_vm vm;
+	enum jvst_result ret;
+	size_t off, n;
+
+	jvst_vm_init_defaults(&vm, prog);
+	if (ninstr != NULL) {
+		jvst_vm_set_profile(&vm, 0, NULL);
+	}
+
+	ret = JVST_VALID;
+	for (off = 0; off < doc->len && !JVST_IS_INVALID(ret); off += n) {
+		n = doc->len - off;
+		if (n > CHUNK_SIZE) {
+			n = CHUNK_SIZE;
+		}
+
+		ret = jvst_vm_more(&vm, &doc->s[off], n);
+	}
+
+	ret = jvst_vm_close(&vm);
+
+	if (ninstr != NULL) {
+		size_t i;
+
+		*ninstr = 0;
+		for (i=0; i <= JVST_OP_MAX; i++) {
+			*ninstr += vm.prof->ops[i].n;
+		}
+	}
+
+	jvst_vm_finalize(&vm);
+
+	return ret;
+}
+
+static void
+usage(void)
+{
+	size_t i;
+
+	fprintf(stderr, "usage: jvst_bench [-j] [-c <commit>] [-s <size>] [-t <seconds>] -g <case>\n"
+			"       jvst_bench [-j] [-c <commit>] [-t <seconds>] -n <name> <schema> <json>\n"
+			"       jvst_bench -S -g <case>\n"
+			"\n"
+			"  -g <case>     generates a document of about <size> bytes (default %d)\n"
+			"  -n <name>     names the case of a schema and document read from files\n"
+			"  -t <seconds>  validates for at least this long (default %.1f)\n"
+			"  -c <commit>   labels the results\n"
+			"  -j            compiles the VM code to machine code\n"
+			"  -S            prints the schema of the case, and exits\n"
+			"\n"
+			"cases:\n", DEFAULT_SIZE, DEFAULT_SECONDS);
+
+	for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+		fprintf(stderr, "  %s\n", cases[i].name);
+	}
+
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static struct text schema, doc;
+	const char *gen = NULL, *name = NULL, *commit = "";
+	size_t size = DEFAULT_SIZE;
+	double seconds = DEFAULT_SECONDS;
+	int jit = 0, jitted = 0, print_schema = 0;
+	const char *lang = "jvst";
+
+	struct jvst_vm_program *prog;
+	enum jvst_result ret;
+	uint64_t t0, compile_ns, best_ns, total_ns, ninstr, ntok;
+	size_t iter;
+	struct rusage ru;
+
+	{
+		int c;
+
+		while (c = getopt(argc, argv, "c:g:jn:s:t:S"), c != -1) {
+			switch (c) {
+			case 'c': commit  = optarg;                   break;
+			case 'g': gen     = optarg;                   break;
+			case 'j': jit     = 1;                        break;
+			case 'n': name    = optarg;                   break;
+			case 's': size    = strtoul(optarg, NULL, 0); break;
+			case 't': seconds = strtod(optarg, NULL);     break;
+			case 'S': print_schema = 1;                   break;
+
+			default:
+				usage();
+			}
+		}
+
+		argc -= optind;
+		argv += optind;
+	}
+
+	if (gen != NULL) {
+		size_t i;
+
+		for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+			if (strcmp(cases[i].name, gen) == 0) {
+				break;
+			}
+		}
+
+		if (i == sizeof cases / sizeof cases[0] || argc != 0) {
+			usage();
+		}
+
+		cases[i].gen(&schema, &doc, size);
+		name = gen;
+	} else {
+		if (name == NULL || argc != 2) {
+			usage();
+		}
+
+		readfile(argv[0], &schema);
+		readfile(argv[1], &doc);
+	}
+
+	if (print_schema) {
+		fwrite(schema.s, 1, schema.len, stdout);
+		return (ferror(stdout) || fflush(stdout) != 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+#ifdef JVST_BENCH_GENC
+	// the static program can't be compiled to machine code
+	if (jit) {
+		usage();
+	}
+
+	prog = jvst_validator();
+	compile_ns = 0;
+	lang = "c";
+#else
+	t0 = jvst_vm_prof_clock();
+	prog = compile(&schema);
+	compile_ns = jvst_vm_prof_clock() - t0;
+
+	if (jit) {
+		jitted = (jvst_vm_jit(prog) == 0);
+	}
+#endif /* JVST_BENCH_GENC */
+
+	ntok = count_tokens(&doc);
+
+	// the interpreter counts instructions, even for machine code
+	(void)run(prog, &doc, &ninstr);
+
+	ret = JVST_VALID;
+	best_ns = UINT64_MAX;
+	total_ns = 0;
+	for (iter = 0; iter < MIN_ITER || (double)total_ns < seconds * 1e9; iter++) {
+		uint64_t ns;
+
+		t0 = jvst_vm_prof_clock();
+		ret = run(prog, &doc, NULL);
+		ns = jvst_vm_prof_clock() - t0;
+
+		total_ns += ns;
+		if (ns < best_ns) {
+			best_ns = ns;
+		}
+	}
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0) {
+		perror("getrusage");
+		exit(EXIT_FAILURE);
+	}
+
+	// best_ns is at least one clock tick
+	if (best_ns == 0) {
+		best_ns = 1;
+	}
+
+	printf("{ \"case\": \"%s\", \"commit\": \"%s\", \"lang\": \"%s\", \"jit\": %s, \"valid\": %s, "
+		"\"bytes\": %zu, \"tokens\": %" PRIu64 ", "
+		"\"compile_ms\": %.3f, \"iterations\": %zu, \"best_ms\": %.3f, "
+		"\"mb_per_s\": %.2f, \"tokens_per_s\": %.0f, "
+		"\"instructions\": %" PRIu64 ", \"instructions_per_token\": %.2f, "
+		"\"peak_rss_kb\": %ld }\n",
+		name, commit, lang, jitted ? "true" : "false", (ret == JVST_VALID) ? "true" : "false",
+		doc.len, ntok,
+		(double)compile_ns / 1e6, iter, (double)best_ns / 1e6,
+		((double)doc.len / (1024.0 * 1024.0)) / ((double)best_ns / 1e9),
+		(double)ntok / ((double)best_ns / 1e9),
+		ninstr, (ntok > 0) ? (double)ninstr / (double)ntok : 0.0,
+		(long)ru.ru_maxrss);
+
+#ifndef JVST_BENCH_GENC
+	jvst_vm_program_free(prog);
+#endif
+
+	return (ret == JVST_VALID) ? 0 : 1;
+}
+
+/* vim: set tabstop=8 shiftwidth=8 noexpandtab: */
@@ -0,0 +1,38 @@
+#! /bin/bash
+
+# Compares the results of two commits in a results file written by
+# `make bench`.  Where a case was run more than once for a commit, its
+# fastest run is used.
+#
+#   compare.sh <results.jsonl> <old commit> <new commit>
+
+JQ=${JQ:-jq}
+
+if [ $# -ne 3 ]; then
+  echo "usage: $0 <results.jsonl> <old commit> <new commit>" >&2
+  exit 1
+fi
+
+in=$1
+old=$2
+new=$3
+
+printf "%-16s %-4s %-5s %10s %10s %8s %10s %10s\n" \
+  case lang jit "old MB/s" "new MB/s" change "old i/tok" "new i/tok"
+
+${JQ} -r -s --arg old "$old" --arg new "$new" '
+  # results from before generated C was benchmarked have no lang
+  def best(c): map(select(.commit == c) | .lang //= "jvst")
+    | group_by([.case, .lang, .jit])
+    | map(max_by(.mb_per_s) | { key: "\(.case) \(.lang) \(.jit)", value: . })
+    | from_entries;
+
+  best($old) as $o | best($new) as $n
+  | $n | keys[] | select($o[.] != null)
+  | [ $o[.], $n[.] ]
+  | "\(.[1].case) \(.[1].lang) \(.[1].jit) \(.[0].mb_per_s) \(.[1].mb_per_s) \(.[0].instructions_per_token) \(.[1].instructions_per_token)"
+' "$in" |
+while read name lang jit o n oi ni; do
+  printf "%-16s %-4s %-5s %10.2f %10.2f %+7.1f%% %10.2f %10.2f\n" \
+    "$name" "$lang" "$jit" "$o" "$n" "$(awk "BEGIN { print ($n - $o) * 100 / $o }")" "$oi" "$ni"
+done
@@ -5,6 +5,24 @@ if [ -z "${JVST}" ]; then
   exit 1
 fi
 
+# JVST_LANG=c generates a C validator for each schema, builds it with
+# ${CC} ${GENC_CFLAGS} against ${GENC_LIBS} (the jvst runtime), and
+# runs it on each case instead of running the VM
+JVST_LANG=${JVST_LANG:-jvst}
+CC=${CC:-cc}
+
+case ${JVST_LANG} in
+  jvst) ;;
+  c)
+    gendir=`mktemp -d "${TMPDIR:-/tmp}/jvst-genc.XXXXXX"` || exit 1
+    trap 'rm -rf "${gendir}"' EXIT
+    ;;
+  *)
+    echo "unknown JVST_LANG: ${JVST_LANG}"
+    exit 1
+    ;;
+esac
+
 declare -a failures
 succ=0
 skip=0
@@ -30,6 +48,15 @@ while [ $# -gt 0 ]; do
 
   printf " ---------[ %s: %s ]----------\n" "$testdir" "$desc"
 
+  if [ "${JVST_LANG}" = "c" ]; then
+    rm -f ${gendir}/validator ${gendir}/validator.c
+    if ! ${JVST} -l c -c ${schema} > ${gendir}/validator.c ||
+       ! ${CC} ${GENC_CFLAGS} -DJVST_GEN_MAIN -o ${gendir}/validator \
+           ${gendir}/validator.c ${GENC_LIBS}; then
+      echo "${testdir}: could not build the generated validator"
+    fi
+  fi
+
   for testfile in ${testdir}/test_*.json ; do
     ncase=$(( $ncase + 1 ))
     ntotcase=$(( $ntotcase + 1 ))
@@ -42,9 +69,19 @@ while [ $# -gt 0 ]; do
 
     casedesc=`awk -v CN=$casenum -- '$1 == CN { print }' < ${desc_file} | sed -e 's/^[0-9]\{1,\}[ 	]\{1,\}//'`
 
-    ${JVST} -l jvst -c -r ${schema} ${testfile} > /dev/null 2>&1
-    valid=$?
-    if [ $valid != 0 ]; then
+    if [ "${JVST_LANG}" = "c" ]; then
+      if [ -x ${gendir}/validator ]; then
+        ${gendir}/validator < ${testfile} > /dev/null 2>&1
+        valid=$?
+      else
+        # fails every case, whatever it expects
+        valid=error
+      fi
+    else
+      ${JVST} -l jvst -c -r ${schema} ${testfile} > /dev/null 2>&1
+      valid=$?
+    fi
+    if [ $valid != 0 ] && [ $valid != error ]; then
       # standardize valid to be 0 (success) or 1 (failure)
       valid=1
     fi
@@ -61,7 +98,9 @@ while [ $# -gt 0 ]; do
       expect_str="<skip>"
     fi
 
-    if [ $valid = 0 ]; then
+    if [ $valid = error ]; then
+      actual_str="ERROR"
+    elif [ $valid = 0 ]; then
       actual_str="VALID"
     else
       actual_str="INVALID"
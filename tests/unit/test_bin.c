@@ -0,0 +1,534 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jvst_macros.h"
+
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+#include "sjp_testing.h"
+
+#include "parser.h"
+#include "validate.h"
+#include "validate_bin.h"
+#include "validate_vm.h"
+
+#include "validate_testing.h"
+
+// expands to the bytes and length of a string literal, which may
+// contain NUL bytes
+#define BYTES(s) (s), (sizeof (s) - 1)
+
+struct bin_event {
+  enum SJP_EVENT type;
+  const char *text;
+  double d;
+};
+
+struct bin_test {
+  const char *input;
+  size_t len;
+
+  // 0 if the document is valid, otherwise the expected error
+  int err;
+
+  struct bin_event events[16];
+};
+
+static int
+check_event(const char *fname, size_t i, const struct bin_event *exp, const struct sjp_event *evt)
+{
+  if (evt->type != exp->type) {
+    fprintf(stderr, "%s ERROR: event %zu: expected %s, found %s\n",
+        fname, i, evt2name(exp->type), evt2name(evt->type));
+    return 0;
+  }
+
+  switch (exp->type) {
+  case SJP_NUMBER:
+    if (evt->extra.d != exp->d) {
+      fprintf(stderr, "%s ERROR: event %zu: expected %g, found %g\n",
+          fname, i, exp->d, evt->extra.d);
+      return 0;
+    }
+    break;
+
+  case SJP_STRING:
+    if (evt->n != strlen(exp->text) || memcmp(evt->text, exp->text, evt->n) != 0) {
+      fprintf(stderr, "%s ERROR: event %zu: expected '%s', found '%.*s'\n",
+          fname, i, exp->text, (int)evt->n, evt->text);
+      return 0;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return 1;
+}
+
+// Decodes the input in chunks of chunksz bytes, so items are split
+// across chunk boundaries
+static int
+run_test(const char *fname, enum jvst_bin_format fmt, const struct bin_test *t, size_t chunksz)
+{
+  struct jvst_bin_decoder d;
+  size_t off, nevt;
+  int ret, err;
+
+  jvst_bin_decoder_init(&d, fmt);
+
+  off = 0;
+  nevt = 0;
+  err = 0;
+
+  jvst_bin_decoder_more(&d, t->input, 0);
+  for (;;) {
+    struct sjp_event evt = { 0 };
+
+    ret = jvst_bin_decoder_next(&d, &evt);
+    if (SJP_ERROR(ret)) {
+      err = ret;
+      break;
+    }
+
+    if (ret == SJP_MORE) {
+      size_t n;
+
+      if (off == t->len) {
+        err = jvst_bin_decoder_close(&d);
+        break;
+      }
+
+      n = t->len - off;
+      if (n > chunksz) {
+        n = chunksz;
+      }
+
+      jvst_bin_decoder_more(&d, t->input + off, n);
+      off += n;
+      continue;
+    }
+
+    assert(ret == SJP_OK);
+    if (t->events[nevt].type == SJP_NONE) {
+      fprintf(stderr, "%s ERROR: unexpected event %s\n", fname, evt2name(evt.type));
+      goto failed;
+    }
+
+    if (!check_event(fname, nevt, &t->events[nevt], &evt)) {
+      goto failed;
+    }
+
+    nevt++;
+  }
+
+  if (err != t->err) {
+    fprintf(stderr, "%s ERROR: expected result %s, found %s\n",
+        fname,
+        t->err ? jvst_bin_errname(t->err) : "OK",
+        err ? jvst_bin_errname(err) : "OK");
+    goto failed;
+  }
+
+  if (err == 0 && t->events[nevt].type != SJP_NONE) {
+    fprintf(stderr, "%s ERROR: missing event %s\n", fname, evt2name(t->events[nevt].type));
+    goto failed;
+  }
+
+  jvst_bin_decoder_finalize(&d);
+  return 1;
+
+failed:
+  jvst_bin_decoder_finalize(&d);
+  return 0;
+}
+
+#define RUNTESTS(fmt, testlist) runtests(__func__, (fmt), (testlist))
+static void runtests(const char *testname, enum jvst_bin_format fmt, const struct bin_test tests[])
+{
+  static const size_t chunks[] = { 4096, 1, 3 };
+  int i;
+  size_t j;
+
+  for (i=0; tests[i].input != NULL; i++) {
+    for (j=0; j < ARRAYLEN(chunks); j++) {
+      ntest++;
+
+      if (!run_test(testname, fmt, &tests[i], chunks[j])) {
+        printf("%s[%d] (chunk size %zu): failed\n", testname, i+1, chunks[j]);
+        nfail++;
+      }
+    }
+  }
+}
+
+static void test_cbor_scalars(void)
+{
+  const struct bin_test tests[] = {
+    { BYTES("\x00"), 0, { { SJP_NUMBER, NULL, 0.0 } } },
+    { BYTES("\x17"), 0, { { SJP_NUMBER, NULL, 23.0 } } },
+    { BYTES("\x18\x64"), 0, { { SJP_NUMBER, NULL, 100.0 } } },
+    { BYTES("\x19\x03\xe8"), 0, { { SJP_NUMBER, NULL, 1000.0 } } },
+    { BYTES("\x1a\x00\x0f\x42\x40"), 0, { { SJP_NUMBER, NULL, 1000000.0 } } },
+    { BYTES("\x1b\x00\x00\x00\xe8\xd4\xa5\x10\x00"), 0, { { SJP_NUMBER, NULL, 1000000000000.0 } } },
+    { BYTES("\x20"), 0, { { SJP_NUMBER, NULL, -1.0 } } },
+    { BYTES("\x38\x63"), 0, { { SJP_NUMBER, NULL, -100.0 } } },
+
+    // half, single and double precision floats
+    { BYTES("\xf9\x3c\x00"), 0, { { SJP_NUMBER, NULL, 1.0 } } },
+    { BYTES("\xf9\xc4\x00"), 0, { { SJP_NUMBER, NULL, -4.0 } } },
+    { BYTES("\xf9\x00\x01"), 0, { { SJP_NUMBER, NULL, 5.960464477539063e-8 } } },
+    { BYTES("\xfa\x47\xc3\x50\x00"), 0, { { SJP_NUMBER, NULL, 100000.0 } } },
+    { BYTES("\xfb\x3f\xf1\x99\x99\x99\x99\x99\x9a"), 0, { { SJP_NUMBER, NULL, 1.1 } } },
+
+    { BYTES("\xf4"), 0, { { SJP_FALSE } } },
+    { BYTES("\xf5"), 0, { { SJP_TRUE } } },
+    { BYTES("\xf6"), 0, { { SJP_NULL } } },
+
+    { BYTES("\x60"), 0, { { SJP_STRING, "" } } },
+    { BYTES("\x64\x49\x45\x54\x46"), 0, { { SJP_STRING, "IETF" } } },
+    { BYTES("\x62\xc3\xbc"), 0, { { SJP_STRING, "\xc3\xbc" } } },
+
+    // tags are ignored
+    { BYTES("\xc1\x1a\x51\x4b\x67\xb0"), 0, { { SJP_NUMBER, NULL, 1363896240.0 } } },
+
+    // indefinite length string
+    { BYTES("\x7f\x65\x73\x74\x72\x65\x61\x64\x6d\x69\x6e\x67\xff"), 0, { { SJP_STRING, "streaming" } } },
+
+    // text must be valid UTF-8, and each chunk of an indefinite
+    // length string must be complete
+    { BYTES("\x62\xc3\x28"), JVST_BIN_ERR_UTF8 },
+    { BYTES("\x63\xed\xa0\x80"), JVST_BIN_ERR_UTF8 },
+    { BYTES("\x7f\x61\xc3\x61\xbc\xff"), JVST_BIN_ERR_UTF8 },
+    { BYTES("\x7f\x62\xc3\xbc\x61\x61\xff"), 0, { { SJP_STRING, "\xc3\xbc""a" } } },
+
+    // items without a JSON equivalent
+    { BYTES("\xf7"), JVST_BIN_ERR_TYPE },
+    { BYTES("\xf0"), JVST_BIN_ERR_TYPE },
+    { BYTES("\x44\x01\x02\x03\x04"), JVST_BIN_ERR_TYPE },
+    { BYTES("\xf9\x7c\x00"), JVST_BIN_ERR_TYPE },
+    { BYTES("\xf9\x7e\x00"), JVST_BIN_ERR_TYPE },
+
+    // reserved and malformed encodings
+    { BYTES("\x1c"), JVST_BIN_ERR_SYNTAX },
+    { BYTES("\xff"), JVST_BIN_ERR_SYNTAX },
+    { BYTES("\x7f\x01\xff"), JVST_BIN_ERR_SYNTAX },
+
+    // truncated and trailing data
+    { BYTES("\x19\x03"), JVST_BIN_ERR_UNFINISHED },
+    { BYTES("\x64\x49\x45"), JVST_BIN_ERR_UNFINISHED },
+    { BYTES("\x01\x02"), JVST_BIN_ERR_TRAILING, { { SJP_NUMBER, NULL, 1.0 } } },
+
+    { NULL },
+  };
+
+  RUNTESTS(JVST_BIN_CBOR, tests);
+}
+
+static void test_cbor_containers(void)
+{
+  const struct bin_test tests[] = {
+    { BYTES("\x80"), 0, { { SJP_ARRAY_BEG }, { SJP_ARRAY_END } } },
+    { BYTES("\xa0"), 0, { { SJP_OBJECT_BEG }, { SJP_OBJECT_END } } },
+
+    {
+      BYTES("\x83\x01\x82\x02\x03\x82\x04\x05"), 0,
+      {
+        { SJP_ARRAY_BEG },
+          { SJP_NUMBER, NULL, 1.0 },
+          { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 2.0 }, { SJP_NUMBER, NULL, 3.0 }, { SJP_ARRAY_END },
+          { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 4.0 }, { SJP_NUMBER, NULL, 5.0 }, { SJP_ARRAY_END },
+        { SJP_ARRAY_END },
+      },
+    },
+
+    {
+      BYTES("\xa2\x61\x61\x01\x61\x62\x82\x02\x03"), 0,
+      {
+        { SJP_OBJECT_BEG },
+          { SJP_STRING, "a" }, { SJP_NUMBER, NULL, 1.0 },
+          { SJP_STRING, "b" },
+            { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 2.0 }, { SJP_NUMBER, NULL, 3.0 }, { SJP_ARRAY_END },
+        { SJP_OBJECT_END },
+      },
+    },
+
+    // indefinite length containers
+    {
+      BYTES("\x9f\x01\x9f\x02\x03\xff\x82\x04\x05\xff"), 0,
+      {
+        { SJP_ARRAY_BEG },
+          { SJP_NUMBER, NULL, 1.0 },
+          { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 2.0 }, { SJP_NUMBER, NULL, 3.0 }, { SJP_ARRAY_END },
+          { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 4.0 }, { SJP_NUMBER, NULL, 5.0 }, { SJP_ARRAY_END },
+        { SJP_ARRAY_END },
+      },
+    },
+
+    {
+      BYTES("\xbf\x63\x46\x75\x6e\xf5\x63\x41\x6d\x74\x21\xff"), 0,
+      {
+        { SJP_OBJECT_BEG },
+          { SJP_STRING, "Fun" }, { SJP_TRUE },
+          { SJP_STRING, "Amt" }, { SJP_NUMBER, NULL, -2.0 },
+        { SJP_OBJECT_END },
+      },
+    },
+
+    // non-string keys
+    { BYTES("\xa1\x01\x02"), JVST_BIN_ERR_KEY, { { SJP_OBJECT_BEG } } },
+    { BYTES("\xa1\x80\x02"), JVST_BIN_ERR_KEY, { { SJP_OBJECT_BEG } } },
+
+    // key without a value
+    { BYTES("\xbf\x61\x61\xff"), JVST_BIN_ERR_SYNTAX, { { SJP_OBJECT_BEG }, { SJP_STRING, "a" } } },
+
+    // break in a definite length container
+    { BYTES("\x82\x01\xff"), JVST_BIN_ERR_SYNTAX, { { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 1.0 } } },
+
+    // truncated containers
+    { BYTES("\x82\x01"), JVST_BIN_ERR_UNFINISHED, { { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 1.0 } } },
+    { BYTES("\x9f\x01"), JVST_BIN_ERR_UNFINISHED, { { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 1.0 } } },
+
+    { NULL },
+  };
+
+  RUNTESTS(JVST_BIN_CBOR, tests);
+}
+
+static void test_msgpack_scalars(void)
+{
+  const struct bin_test tests[] = {
+    { BYTES("\x00"), 0, { { SJP_NUMBER, NULL, 0.0 } } },
+    { BYTES("\x7f"), 0, { { SJP_NUMBER, NULL, 127.0 } } },
+    { BYTES("\xff"), 0, { { SJP_NUMBER, NULL, -1.0 } } },
+    { BYTES("\xe0"), 0, { { SJP_NUMBER, NULL, -32.0 } } },
+    { BYTES("\xcc\xff"), 0, { { SJP_NUMBER, NULL, 255.0 } } },
+    { BYTES("\xcd\x01\x00"), 0, { { SJP_NUMBER, NULL, 256.0 } } },
+    { BYTES("\xce\x00\x01\x00\x00"), 0, { { SJP_NUMBER, NULL, 65536.0 } } },
+    { BYTES("\xcf\x00\x00\x00\x01\x00\x00\x00\x00"), 0, { { SJP_NUMBER, NULL, 4294967296.0 } } },
+    { BYTES("\xd0\x80"), 0, { { SJP_NUMBER, NULL, -128.0 } } },
+    { BYTES("\xd1\xff\x7f"), 0, { { SJP_NUMBER, NULL, -129.0 } } },
+    { BYTES("\xd2\x80\x00\x00\x00"), 0, { { SJP_NUMBER, NULL, -2147483648.0 } } },
+    { BYTES("\xd3\xff\xff\xff\xff\xff\xff\xff\xfe"), 0, { { SJP_NUMBER, NULL, -2.0 } } },
+    { BYTES("\xd3\x00\x00\x00\x00\x00\x00\x00\x05"), 0, { { SJP_NUMBER, NULL, 5.0 } } },
+    { BYTES("\xd0\x7f"), 0, { { SJP_NUMBER, NULL, 127.0 } } },
+    { BYTES("\xd0\xff"), 0, { { SJP_NUMBER, NULL, -1.0 } } },
+    { BYTES("\xd1\x7f\xff"), 0, { { SJP_NUMBER, NULL, 32767.0 } } },
+    { BYTES("\xd1\x80\x00"), 0, { { SJP_NUMBER, NULL, -32768.0 } } },
+    { BYTES("\xd2\x7f\xff\xff\xff"), 0, { { SJP_NUMBER, NULL, 2147483647.0 } } },
+    { BYTES("\xd2\xff\xff\xff\xff"), 0, { { SJP_NUMBER, NULL, -1.0 } } },
+    { BYTES("\xd3\x7f\xff\xff\xff\xff\xff\xff\xff"), 0, { { SJP_NUMBER, NULL, 9223372036854775807.0 } } },
+    { BYTES("\xd3\x80\x00\x00\x00\x00\x00\x00\x00"), 0, { { SJP_NUMBER, NULL, -9223372036854775808.0 } } },
+    { BYTES("\xd3\xff\xff\xff\xff\xff\xff\xff\xff"), 0, { { SJP_NUMBER, NULL, -1.0 } } },
+
+    { BYTES("\xca\x3f\xc0\x00\x00"), 0, { { SJP_NUMBER, NULL, 1.5 } } },
+    { BYTES("\xcb\x3f\xf1\x99\x99\x99\x99\x99\x9a"), 0, { { SJP_NUMBER, NULL, 1.1 } } },
+
+    { BYTES("\xc0"), 0, { { SJP_NULL } } },
+    { BYTES("\xc2"), 0, { { SJP_FALSE } } },
+    { BYTES("\xc3"), 0, { { SJP_TRUE } } },
+
+    { BYTES("\xa0"), 0, { { SJP_STRING, "" } } },
+    { BYTES("\xa3\x66\x6f\x6f"), 0, { { SJP_STRING, "foo" } } },
+    { BYTES("\xd9\x03\x62\x61\x72"), 0, { { SJP_STRING, "bar" } } },
+    { BYTES("\xda\x00\x03\x62\x61\x7a"), 0, { { SJP_STRING, "baz" } } },
+    { BYTES("\xdb\x00\x00\x00\x01\x71"), 0, { { SJP_STRING, "q" } } },
+
+    { BYTES("\xa2\xc0\xaf"), JVST_BIN_ERR_UTF8 },
+
+    // bin and ext types
+    { BYTES("\xc4\x01\x00"), JVST_BIN_ERR_TYPE },
+    { BYTES("\xd4\x01\x00"), JVST_BIN_ERR_TYPE },
+    { BYTES("\xcb\x7f\xf0\x00\x00\x00\x00\x00\x00"), JVST_BIN_ERR_TYPE },
+
+    // never used
+    { BYTES("\xc1"), JVST_BIN_ERR_SYNTAX },
+
+    { BYTES("\xa3\x66\x6f"), JVST_BIN_ERR_UNFINISHED },
+    { BYTES("\xc0\xc0"), JVST_BIN_ERR_TRAILING, { { SJP_NULL } } },
+
+    { NULL },
+  };
+
+  RUNTESTS(JVST_BIN_MSGPACK, tests);
+}
+
+static void test_msgpack_containers(void)
+{
+  const struct bin_test tests[] = {
+    { BYTES("\x90"), 0, { { SJP_ARRAY_BEG }, { SJP_ARRAY_END } } },
+    { BYTES("\x80"), 0, { { SJP_OBJECT_BEG }, { SJP_OBJECT_END } } },
+
+    {
+      BYTES("\x82\xa1\x61\x01\xa1\x62\x92\xc3\xc0"), 0,
+      {
+        { SJP_OBJECT_BEG },
+          { SJP_STRING, "a" }, { SJP_NUMBER, NULL, 1.0 },
+          { SJP_STRING, "b" },
+            { SJP_ARRAY_BEG }, { SJP_TRUE }, { SJP_NULL }, { SJP_ARRAY_END },
+        { SJP_OBJECT_END },
+      },
+    },
+
+    {
+      BYTES("\xdc\x00\x02\x01\xdd\x00\x00\x00\x01\xde\x00\x00"), 0,
+      {
+        { SJP_ARRAY_BEG },
+          { SJP_NUMBER, NULL, 1.0 },
+          { SJP_ARRAY_BEG }, { SJP_OBJECT_BEG }, { SJP_OBJECT_END }, { SJP_ARRAY_END },
+        { SJP_ARRAY_END },
+      },
+    },
+
+    { BYTES("\x81\x01\x02"), JVST_BIN_ERR_KEY, { { SJP_OBJECT_BEG } } },
+    { BYTES("\x92\x01"), JVST_BIN_ERR_UNFINISHED, { { SJP_ARRAY_BEG }, { SJP_NUMBER, NULL, 1.0 } } },
+
+    { NULL },
+  };
+
+  RUNTESTS(JVST_BIN_MSGPACK, tests);
+}
+
+struct bin_doc_test {
+  enum jvst_vm_input input;
+  const char *doc;
+  size_t len;
+  enum jvst_result result;
+};
+
+static struct jvst_vm_program *
+compile_schema(const char *schema)
+{
+  struct sjp_lexer l = { 0 };
+  struct ast_schema ast = { 0 };
+  struct json_string uribase = { "http://example.com/bin.json", 27 };
+  struct jvst_vm_program *prog;
+  char *buf;
+  size_t len;
+
+  len = strlen(schema);
+  buf = malloc(len);
+  assert(buf != NULL);
+  memcpy(buf, schema, len);
+
+  sjp_lexer_init(&l);
+  sjp_lexer_more(&l, buf, len);
+  parse(&l, &ast, uribase);
+
+  prog = jvst_compile_schema(&ast);
+  free(buf);
+
+  return prog;
+}
+
+// Validates the document with the VM, feeding it chunksz bytes at a time
+static enum jvst_result
+run_doc(struct jvst_vm_program *prog, const struct bin_doc_test *t, size_t chunksz)
+{
+  struct jvst_vm vm;
+  char buf[64];
+  size_t off, n;
+  enum jvst_result ret;
+
+  assert(t->len <= sizeof buf);
+  memcpy(buf, t->doc, t->len);
+
+  jvst_vm_init_defaults(&vm, prog);
+  jvst_vm_set_input(&vm, t->input);
+
+  ret = JVST_MORE;
+  for (off=0; off < t->len && !JVST_IS_INVALID(ret); off += n) {
+    n = t->len - off;
+    if (n > chunksz) {
+      n = chunksz;
+    }
+
+    ret = jvst_vm_more(&vm, buf + off, n);
+  }
+
+  if (!JVST_IS_INVALID(ret)) {
+    ret = jvst_vm_close(&vm);
+  }
+
+  jvst_vm_finalize(&vm);
+  return ret;
+}
+
+#define RUNDOCS(schema, testlist) rundocs(__func__, (schema), (testlist))
+static void rundocs(const char *testname, const char *schema, const struct bin_doc_test tests[])
+{
+  static const size_t chunks[] = { 64, 1 };
+  struct jvst_vm_program *prog;
+  enum jvst_result ret;
+  int i;
+  size_t j;
+
+  prog = compile_schema(schema);
+
+  for (i=0; tests[i].doc != NULL; i++) {
+    for (j=0; j < ARRAYLEN(chunks); j++) {
+      ntest++;
+
+      ret = run_doc(prog, &tests[i], chunks[j]);
+      if (ret != tests[i].result) {
+        printf("%s[%d] (chunk size %zu): expected %d, found %d\n",
+            testname, i+1, chunks[j], tests[i].result, ret);
+        nfail++;
+      }
+    }
+  }
+
+  jvst_vm_program_free(prog);
+}
+
+static void test_vm_truncated(void)
+{
+  const struct bin_doc_test tests[] = {
+    { JVST_VM_INPUT_CBOR,    BYTES("\x82\x01\x02"), JVST_VALID },
+    { JVST_VM_INPUT_CBOR,    BYTES("\x82\x01"), JVST_INVALID },
+    { JVST_VM_INPUT_CBOR,    BYTES("\x9f\x01\x02"), JVST_INVALID },
+    { JVST_VM_INPUT_CBOR,    BYTES("\x82"), JVST_INVALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\x92\x01\x02"), JVST_VALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\x92\x01"), JVST_INVALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\xdc\x00\x02\x01"), JVST_INVALID },
+    { 0, NULL },
+  };
+
+  RUNDOCS("{ \"type\": \"array\", \"items\": { \"type\": \"integer\" } }", tests);
+}
+
+static void test_vm_large_integers(void)
+{
+  // 2^53+1 rounds to the even 2^53 as a double
+  const struct bin_doc_test tests[] = {
+    { JVST_VM_INPUT_CBOR,    BYTES("\x1b\x00\x20\x00\x00\x00\x00\x00\x01"), JVST_INVALID },
+    { JVST_VM_INPUT_CBOR,    BYTES("\x1b\x00\x20\x00\x00\x00\x00\x00\x02"), JVST_VALID },
+    { JVST_VM_INPUT_CBOR,    BYTES("\x3b\x00\x20\x00\x00\x00\x00\x00\x00"), JVST_INVALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\xcf\x00\x20\x00\x00\x00\x00\x00\x01"), JVST_INVALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\xd3\xff\xdf\xff\xff\xff\xff\xff\xff"), JVST_INVALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\xd3\xff\xdf\xff\xff\xff\xff\xff\xfe"), JVST_VALID },
+    // INT64_MIN and the integers next to it
+    { JVST_VM_INPUT_MSGPACK, BYTES("\xd3\x80\x00\x00\x00\x00\x00\x00\x00"), JVST_VALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\xd3\x80\x00\x00\x00\x00\x00\x00\x01"), JVST_INVALID },
+    { JVST_VM_INPUT_MSGPACK, BYTES("\xd3\x7f\xff\xff\xff\xff\xff\xff\xff"), JVST_INVALID },
+    { 0, NULL },
+  };
+
+  RUNDOCS("{ \"multipleOf\": 2 }", tests);
+}
+
+int main(void)
+{
+  test_cbor_scalars();
+  test_cbor_containers();
+  test_msgpack_scalars();
+  test_msgpack_containers();
+
+  test_vm_truncated();
+  test_vm_large_integers();
+
+  return report_tests();
+}
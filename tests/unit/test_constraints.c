@@ -2826,6 +2826,28 @@ void test_simplify_xored_counts(void)
         SJP_NONE),
     },
 
+    {
+      SIMPLIFY,
+      NULL,
+
+      // more than two children: exactly one range must match
+      newcnode_switch(&A, 0,
+        SJP_ARRAY_BEG, newcnode_bool(&A, JVST_CNODE_XOR,
+                         newcnode_counts(&A, JVST_CNODE_ITEM_RANGE, 0, 4, true),
+                         newcnode_counts(&A, JVST_CNODE_ITEM_RANGE, 3, 8, true),
+                         newcnode_counts(&A, JVST_CNODE_ITEM_RANGE, 6, 10, true),
+                         NULL),
+        SJP_NONE),
+
+      newcnode_switch(&A, 0,
+        SJP_ARRAY_BEG, newcnode_bool(&A, JVST_CNODE_OR,
+                         newcnode_counts(&A, JVST_CNODE_ITEM_RANGE, 0, 2, true),
+                         newcnode_counts(&A, JVST_CNODE_ITEM_RANGE, 5, 5, true),
+                         newcnode_counts(&A, JVST_CNODE_ITEM_RANGE, 9, 10, true),
+                         NULL),
+        SJP_NONE),
+    },
+
     { STOP },
   };
 
@@ -3295,6 +3317,62 @@ static void test_simplify_oneof_2(void)
   RUNTESTS(tests);
 }
 
+static void test_simplify_oneof_disjoint(void)
+{
+  struct arena_info A = {0};
+
+  const struct cnode_test tests[] = {
+    {
+      SIMPLIFY,
+      NULL,
+
+      // branches that require a "kind" property with different
+      // constant values can't both be valid, so the XOR becomes an OR
+      newcnode_switch(&A, 0,
+        SJP_OBJECT_BEG, newcnode_bool(&A, JVST_CNODE_XOR,
+          newcnode_bool(&A, JVST_CNODE_AND,
+            newcnode_required(&A, stringset(&A, "kind", NULL)),
+            newcnode_propset(&A,
+              newcnode_prop_match(&A, RE_LITERAL, "kind",
+                newcnode_switch(&A, 0, SJP_STRING, newcnode_strmatch(&A, RE_LITERAL, "circle"), SJP_NONE)),
+              NULL),
+            NULL),
+          newcnode_bool(&A, JVST_CNODE_AND,
+            newcnode_required(&A, stringset(&A, "kind", NULL)),
+            newcnode_propset(&A,
+              newcnode_prop_match(&A, RE_LITERAL, "kind",
+                newcnode_switch(&A, 0, SJP_STRING, newcnode_strmatch(&A, RE_LITERAL, "square"), SJP_NONE)),
+              NULL),
+            NULL),
+          NULL),
+        SJP_NONE),
+
+      newcnode_switch(&A, 0,
+        SJP_OBJECT_BEG, newcnode_bool(&A, JVST_CNODE_OR,
+          newcnode_bool(&A, JVST_CNODE_AND,
+            newcnode_required(&A, stringset(&A, "kind", NULL)),
+            newcnode_propset(&A,
+              newcnode_prop_match(&A, RE_LITERAL, "kind",
+                newcnode_switch(&A, 0, SJP_STRING, newcnode_strmatch(&A, RE_LITERAL, "circle"), SJP_NONE)),
+              NULL),
+            NULL),
+          newcnode_bool(&A, JVST_CNODE_AND,
+            newcnode_required(&A, stringset(&A, "kind", NULL)),
+            newcnode_propset(&A,
+              newcnode_prop_match(&A, RE_LITERAL, "kind",
+                newcnode_switch(&A, 0, SJP_STRING, newcnode_strmatch(&A, RE_LITERAL, "square"), SJP_NONE)),
+              NULL),
+            NULL),
+          NULL),
+        SJP_NONE),
+    },
+
+    { STOP },
+  };
+
+  RUNTESTS(tests);
+}
+
 static void test_simplify_uniqueItems(void)
 {
   struct arena_info A = {0};
@@ -4744,6 +4822,7 @@ int main(void)
   test_simplify_patterns();
   test_simplify_allof_2();
   test_simplify_oneof_2();
+  test_simplify_oneof_disjoint();
 
   test_simplify_anded_counts();
   test_simplify_ored_counts();
@@ -23,6 +23,7 @@ int ir_trees_equal(const char *fname, struct jvst_ir_stmt *n1, struct jvst_ir_st
 enum id_test_type {
   IDS,
   ROOTS,
+  PRUNED_ROOTS,
   IR_TRANSLATE,
   IR_LINEARIZE,
   STOP,
@@ -88,6 +89,10 @@ run_test(const char *fname, const struct id_test *t)
     }
     break;
 
+  case PRUNED_ROOTS:
+    jvst_cnode_prune_forest(forest);
+    /* fallthrough */
+
   case ROOTS:
     {
       struct id_pair *pair;
@@ -551,6 +556,61 @@ static void test_rerooted_refs(void)
   RUNTESTS(tests);
 }
 
+static void test_pruned_refs(void)
+{
+  struct arena_info A = {0};
+
+  const struct id_test tests[] = {
+    {
+      // bar is referenced, but only from foo, which isn't
+      PRUNED_ROOTS,
+      "{ \"definitions\" : { "
+          "\"foo\" : { \"$ref\" : \"#/definitions/bar\" }, "
+          "\"bar\" : { \"type\" : \"integer\" } }, "
+        "\"type\" : \"string\" }",
+      new_idpairs(
+          new_idpair(&A, "",
+            newcnode_switch(&A, 0,
+              SJP_STRING, newcnode_valid(),
+              SJP_NONE)),
+
+          NULL),
+    },
+
+    {
+      // baz is only referenced from foo, which nothing refers to
+      PRUNED_ROOTS,
+      "{ \"definitions\" : { "
+          "\"foo\" : { \"$ref\" : \"#/definitions/baz\" }, "
+          "\"bar\" : { \"type\" : \"integer\" }, "
+          "\"baz\" : { \"type\" : \"string\" } }, "
+        "\"properties\" : { \"x\" : { \"$ref\" : \"#/definitions/bar\" } } }",
+      new_idpairs(
+          new_idpair(&A, "",
+            newcnode_switch(&A, 1,
+              SJP_OBJECT_BEG, newcnode_bool(&A, JVST_CNODE_AND,
+                                newcnode_propset(&A,
+                                  newcnode_prop_match(&A, RE_LITERAL, "x",
+                                    newcnode_ref(&A, URI_BASE "#/definitions/bar")),
+                                  NULL),
+                                newcnode_valid(),
+                                NULL),
+              SJP_NONE)),
+
+          new_idpair(&A, "",
+            newcnode_switch(&A, 0,
+              SJP_NUMBER, newcnode(&A,JVST_CNODE_NUM_INTEGER),
+              SJP_NONE)),
+
+          NULL),
+    },
+
+    { STOP },
+  };
+
+  RUNTESTS(tests);
+}
+
 static void test_ir_translation(void)
 {
   struct arena_info A = {0};
@@ -997,6 +1057,7 @@ int main(void)
   test_uri_ids();
 
   test_rerooted_refs();
+  test_pruned_refs();
 
   test_ir_translation();
   test_ir_linearize();
@@ -543,11 +543,10 @@ void test_ir_minimum(void)
           ),
 
           newir_block(&A, 2, "true",
-            newir_move(&A, newir_ftemp(&A, 1), newir_expr(&A, JVST_IR_EXPR_TOK_NUM)),
             newir_move(&A, newir_ftemp(&A, 0), newir_num(&A, 1.1)),
             newir_cbranch(&A,
               newir_op(&A, JVST_IR_EXPR_GE, 
-                newir_ftemp(&A, 1),
+                newir_expr(&A, JVST_IR_EXPR_TOK_NUM),
                 newir_ftemp(&A, 0)
               ),
               4, "true",
@@ -7072,11 +7071,10 @@ void test_ir_anyof_allof_oneof_1(void)
             ),
 
             newir_block(&A, 2, "true",
-              newir_move(&A, newir_ftemp(&A, 1), newir_expr(&A, JVST_IR_EXPR_TOK_NUM)),
               newir_move(&A, newir_ftemp(&A, 0), newir_num(&A, 2.0)),
               newir_cbranch(&A,
                 newir_op(&A, JVST_IR_EXPR_GE, 
-                  newir_ftemp(&A, 1),
+                  newir_expr(&A, JVST_IR_EXPR_TOK_NUM),
                   newir_ftemp(&A, 0)
                 ),
                 4, "true",
@@ -7216,11 +7214,10 @@ void test_ir_anyof_allof_oneof_1(void)
             ),
 
             newir_block(&A, 8, "and_true",
-              newir_move(&A, newir_ftemp(&A, 1), newir_expr(&A, JVST_IR_EXPR_TOK_NUM)),
               newir_move(&A, newir_ftemp(&A, 0), newir_num(&A, 2.0)),
               newir_cbranch(&A,
                 newir_op(&A, JVST_IR_EXPR_GE, 
-                  newir_ftemp(&A, 1),
+                  newir_expr(&A, JVST_IR_EXPR_TOK_NUM),
                   newir_ftemp(&A, 0)
                 ),
                 4, "true",
@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jvst_macros.h"
+
+#include "sjp_lexer.h"
+#include "sjp_testing.h"
+
+#include "parser.h"
+#include "validate.h"
+#include "validate_vm.h"
+#include "validate_prof.h"
+#include "validate_verify.h"
+
+#include "validate_testing.h"
+
+enum {
+  NTHREADS  = 4,
+  NRUNS     = 200,
+  NDEFS     = 8,
+};
+
+// p<k> must be an integer of at least k, and tree is recursive
+static const char schema[] =
+  "{"
+  "  \"properties\" : {"
+  "    \"p0\" : { \"$ref\" : \"#/definitions/d0\" },"
+  "    \"p1\" : { \"$ref\" : \"#/definitions/d1\" },"
+  "    \"p2\" : { \"$ref\" : \"#/definitions/d2\" },"
+  "    \"p3\" : { \"$ref\" : \"#/definitions/d3\" },"
+  "    \"p4\" : { \"$ref\" : \"#/definitions/d4\" },"
+  "    \"p5\" : { \"$ref\" : \"#/definitions/d5\" },"
+  "    \"p6\" : { \"$ref\" : \"#/definitions/d6\" },"
+  "    \"p7\" : { \"$ref\" : \"#/definitions/d7\" },"
+  "    \"tree\" : { \"$ref\" : \"#/definitions/tree\" }"
+  "  },"
+  "  \"definitions\" : {"
+  "    \"d0\" : { \"type\" : \"integer\", \"minimum\" : 0 },"
+  "    \"d1\" : { \"type\" : \"integer\", \"minimum\" : 1 },"
+  "    \"d2\" : { \"type\" : \"integer\", \"minimum\" : 2 },"
+  "    \"d3\" : { \"type\" : \"integer\", \"minimum\" : 3 },"
+  "    \"d4\" : { \"type\" : \"integer\", \"minimum\" : 4 },"
+  "    \"d5\" : { \"type\" : \"integer\", \"minimum\" : 5 },"
+  "    \"d6\" : { \"type\" : \"integer\", \"minimum\" : 6 },"
+  "    \"d7\" : { \"type\" : \"integer\", \"minimum\" : 7 },"
+  "    \"tree\" : {"
+  "      \"type\" : \"object\","
+  "      \"properties\" : {"
+  "        \"v\" : { \"$ref\" : \"#/definitions/d1\" },"
+  "        \"kids\" : { \"type\" : \"array\", \"items\" : { \"$ref\" : \"#/definitions/tree\" } }"
+  "      }"
+  "    }"
+  "  }"
+  "}";
+
+// the schema has to outlive a lazy program
+static struct jvst_vm_program *
+compile_lazy(void)
+{
+  struct sjp_lexer l = { 0 };
+  struct ast_schema *ast;
+  struct json_string uribase = { "http://example.com/lazy.json", 28 };
+  char *buf;
+  size_t len;
+
+  ast = calloc(1, sizeof *ast);
+  assert(ast != NULL);
+
+  len = strlen(schema);
+  buf = malloc(len);
+  assert(buf != NULL);
+  memcpy(buf, schema, len);
+
+  sjp_lexer_init(&l);
+  sjp_lexer_more(&l, buf, len);
+  parse(&l, ast, uribase);
+  free(buf);
+
+  return jvst_compile_lazy(ast);
+}
+
+// Runs the document, and returns the program the VM ended up with in
+// *progp if progp isn't NULL
+static int
+run_doc(struct jvst_vm_program *prog, const char *doc, unsigned pflags,
+    struct jvst_vm_program **progp)
+{
+  struct jvst_vm vm;
+  char buf[4096];
+  size_t n;
+  int valid;
+
+  n = strlen(doc);
+  assert(n < sizeof buf);
+  memcpy(buf, doc, n);
+
+  jvst_vm_init_defaults(&vm, prog);
+  if (pflags != 0) {
+    jvst_vm_set_profile(&vm, pflags, NULL);
+  }
+
+  valid = !JVST_IS_INVALID(jvst_vm_more(&vm, buf, n)) &&
+    !JVST_IS_INVALID(jvst_vm_close(&vm));
+
+  if (progp != NULL) {
+    *progp = vm.prog;
+  }
+
+  jvst_vm_finalize(&vm);
+
+  return valid;
+}
+
+static size_t
+count_procs(const struct jvst_vm_program *prog)
+{
+  size_t pc, n;
+
+  for (n=0, pc=0; pc < prog->ncode; pc++) {
+    n += (jvst_vm_decode_op(prog->code[pc]) == JVST_OP_PROC);
+  }
+
+  return n;
+}
+
+static void test_lazy_results(void)
+{
+  static const struct {
+    bool valid;
+    const char *doc;
+  } docs[] = {
+    { true,  "{}" },
+    { true,  "{ \"p3\" : 3 }" },
+    { false, "{ \"p3\" : 2 }" },
+    { false, "{ \"p5\" : \"five\" }" },
+    { true,  "{ \"p0\" : 0, \"p7\" : 7 }" },
+    { false, "{ \"p0\" : 0, \"p7\" : 6 }" },
+    { true,  "{ \"tree\" : { \"v\" : 1, \"kids\" : [ { \"v\" : 2 }, { \"kids\" : [ { \"v\" : 3 } ] } ] } }" },
+    { false, "{ \"tree\" : { \"v\" : 1, \"kids\" : [ { \"v\" : 2 }, { \"kids\" : [ { \"v\" : 0 } ] } ] } }" },
+    { false, "{ \"tree\" : { \"kids\" : [ 1 ] } }" },
+  };
+
+  int verify;
+
+  // both the checked interpreter and, once the program is verified,
+  // the interpreter without checks
+  for (verify=0; verify < 2; verify++) {
+    struct jvst_vm_program *prog;
+    size_t i;
+
+    prog = compile_lazy();
+
+    if (verify) {
+      ntest++;
+      if (jvst_vm_verify(prog, NULL) != 0) {
+        printf("%s: lazy program failed verification\n", __func__);
+        nfail++;
+      }
+    }
+
+    for (i=0; i < ARRAYLEN(docs); i++) {
+      ntest++;
+      if (run_doc(prog, docs[i].doc, 0, NULL) != docs[i].valid) {
+        printf("%s: expected %s to be %s%s\n", __func__, docs[i].doc,
+            docs[i].valid ? "valid" : "invalid", verify ? " (verified)" : "");
+        nfail++;
+      }
+    }
+
+    jvst_vm_program_free(prog);
+  }
+}
+
+static void test_lazy_on_demand(void)
+{
+  struct jvst_vm_program *prog, *prog_p3, *prog_again, *prog_tree;
+  size_t nprocs;
+
+  prog = compile_lazy();
+  nprocs = count_procs(prog);
+
+  // a document that doesn't get to a definition compiles nothing
+  ntest++;
+  run_doc(prog, "{ \"other\" : 1 }", 0, &prog_p3);
+  if (prog_p3 != prog) {
+    printf("%s: compiled a definition the document doesn't use\n", __func__);
+    nfail++;
+  }
+
+  // the first CALL into a definition compiles it...
+  ntest++;
+  run_doc(prog, "{ \"p3\" : 3 }", 0, &prog_p3);
+  if (prog_p3 == prog || count_procs(prog_p3) <= nprocs) {
+    printf("%s: CALL into a definition did not compile it\n", __func__);
+    nfail++;
+  }
+
+  // ... and later VMs use it without compiling it again
+  ntest++;
+  run_doc(prog, "{ \"p3\" : 4 }", 0, &prog_again);
+  if (prog_again != prog_p3) {
+    printf("%s: definition was compiled twice\n", __func__);
+    nfail++;
+  }
+
+  // a definition that calls others compiles them as they're called,
+  // and a profile grows along with the program
+  ntest++;
+  run_doc(prog, "{ \"tree\" : { \"kids\" : [ { \"v\" : 2 } ] } }",
+      JVST_VM_PROF_TIME, &prog_tree);
+  if (prog_tree == prog_p3 || count_procs(prog_tree) <= count_procs(prog_p3)) {
+    printf("%s: recursive definition was not compiled\n", __func__);
+    nfail++;
+  }
+
+  jvst_vm_program_free(prog);
+}
+
+struct runner {
+  pthread_t thread;
+  struct jvst_vm_program *prog;
+  size_t id;
+  size_t nrun;
+  size_t nwrong;
+};
+
+static void *
+runner_run(void *arg)
+{
+  struct runner *r = arg;
+
+  for (r->nrun=0; r->nrun < NRUNS; r->nrun++) {
+    char doc[64];
+    size_t k;
+    bool valid;
+
+    // each thread gets to the definitions in a different order, so
+    // they race to compile them
+    k = (r->id * 3 + r->nrun) % NDEFS;
+    valid = (r->nrun % 2 == 0);
+    snprintf(doc, sizeof doc, "{ \"p%zu\" : %d }", k, (int)k - !valid);
+
+    if (run_doc(r->prog, doc, 0, NULL) != valid) {
+      r->nwrong++;
+    }
+  }
+
+  return NULL;
+}
+
+static void test_lazy_concurrent(void)
+{
+  struct runner runners[NTHREADS];
+  struct jvst_vm_program *prog;
+  size_t i;
+
+  prog = compile_lazy();
+
+  for (i=0; i < NTHREADS; i++) {
+    runners[i].prog = prog;
+    runners[i].id = i;
+    runners[i].nrun = 0;
+    runners[i].nwrong = 0;
+
+    if (pthread_create(&runners[i].thread, NULL, runner_run, &runners[i]) != 0) {
+      fprintf(stderr, "%s: could not start runner\n", __func__);
+      abort();
+    }
+  }
+
+  for (i=0; i < NTHREADS; i++) {
+    pthread_join(runners[i].thread, NULL);
+
+    ntest++;
+    if (runners[i].nwrong > 0) {
+      printf("%s: runner %zu had %zu wrong results out of %zu\n",
+          __func__, i, runners[i].nwrong, runners[i].nrun);
+      nfail++;
+    }
+  }
+
+  jvst_vm_program_free(prog);
+}
+
+int main(void)
+{
+  test_lazy_results();
+  test_lazy_on_demand();
+  test_lazy_concurrent();
+
+  return report_tests();
+}
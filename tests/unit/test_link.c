@@ -0,0 +1,322 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jvst_macros.h"
+
+#include "sjp_lexer.h"
+#include "sjp_testing.h"
+
+#include "parser.h"
+#include "validate.h"
+#include "validate_vm.h"
+#include "validate_link.h"
+
+#include "validate_testing.h"
+
+enum { MAXMODULES = 4 };
+
+struct link_doc {
+  bool succeeds;
+  const char *json;
+};
+
+// documents are linked in order, so the first is the entry point
+struct link_test {
+  const char *uris[MAXMODULES];
+  const char *schemas[MAXMODULES];
+  struct link_doc docs[16];
+};
+
+static struct jvst_vm_module *
+compile_module(const char *uri, const char *schema)
+{
+  struct sjp_lexer l = { 0 };
+  struct ast_schema ast = { 0 };
+  struct json_string uribase;
+  size_t len;
+  static char buf[65536];
+
+  uribase.s = uri;
+  uribase.len = strlen(uri);
+
+  len = strlen(schema);
+  assert(len < sizeof buf);
+  memcpy(buf, schema, len);
+
+  sjp_lexer_init(&l);
+  sjp_lexer_more(&l, buf, len);
+  parse(&l, &ast, uribase);
+
+  return jvst_compile_module(&ast);
+}
+
+static int
+run_doc(const char *fname, struct jvst_vm_program *prog, const struct link_doc *d)
+{
+  struct jvst_vm vm;
+  char buf[4096];
+  size_t n;
+  int ret, failed;
+
+  n = strlen(d->json);
+  assert(n < sizeof buf);
+  memcpy(buf, d->json, n);
+
+  jvst_vm_init_defaults(&vm, prog);
+  ret = jvst_vm_more(&vm, buf, n);
+  failed = JVST_IS_INVALID(ret);
+  if (!failed) {
+    failed = JVST_IS_INVALID(jvst_vm_close(&vm));
+  }
+  jvst_vm_finalize(&vm);
+
+  if (failed == d->succeeds) {
+    fprintf(stderr, "%s: expected %s to be %s\n",
+        fname, d->json, d->succeeds ? "valid" : "invalid");
+    return 0;
+  }
+
+  return 1;
+}
+
+static int
+run_test(const char *fname, const struct link_test *t)
+{
+  struct jvst_vm_module *mods[MAXMODULES];
+  struct jvst_vm_program *prog;
+  size_t i, n;
+  int ret;
+
+  for (n=0; n < MAXMODULES && t->schemas[n] != NULL; n++) {
+    mods[n] = compile_module(t->uris[n], t->schemas[n]);
+  }
+
+  prog = jvst_vm_link(mods, n);
+
+  ret = 1;
+  for (i=0; t->docs[i].json != NULL; i++) {
+    if (!run_doc(fname, prog, &t->docs[i])) {
+      ret = 0;
+    }
+  }
+
+  jvst_vm_program_free(prog);
+  for (i=0; i < n; i++) {
+    jvst_vm_module_free(mods[i]);
+  }
+
+  return ret;
+}
+
+#define RUNTESTS(testlist) runtests(__func__, (testlist))
+static void runtests(const char *testname, const struct link_test tests[])
+{
+  int i;
+
+  for (i=0; tests[i].schemas[0] != NULL; i++) {
+    ntest++;
+
+    if (!run_test(testname, &tests[i])) {
+      printf("%s[%d]: failed\n", testname, i+1);
+      nfail++;
+    }
+  }
+}
+
+static void test_link_definitions(void)
+{
+  const struct link_test tests[] = {
+    {
+      { "http://example.com/main.json", "http://example.com/common.json" },
+      {
+        "{ \"properties\" : { "
+            "\"id\" : { \"$ref\" : \"http://example.com/common.json#/definitions/id\" }, "
+            "\"n\" : { \"$ref\" : \"http://example.com/common.json#/definitions/small\" } } }",
+
+        "{ \"definitions\" : { "
+            "\"id\" : { \"type\" : \"string\", \"minLength\" : 3 }, "
+            "\"small\" : { \"type\" : \"number\", \"maximum\" : 10 } } }",
+      },
+      {
+        { true,  "{}" },
+        { true,  "{ \"id\" : \"abc\", \"n\" : 5 }" },
+        { false, "{ \"id\" : \"ab\" }" },
+        { false, "{ \"id\" : 7 }" },
+        { false, "{ \"n\" : 11.5 }" },
+        { NULL },
+      },
+    },
+
+    { { NULL } },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_link_pools(void)
+{
+  // both modules have floats, DFAs and splits, so the second
+  // module's indexes have to be rebased
+  const struct link_test tests[] = {
+    {
+      { "http://example.com/a.json", "http://example.com/b.json" },
+      {
+        "{ \"type\" : \"object\", "
+          "\"properties\" : { "
+            "\"x\" : { \"multipleOf\" : 0.5 }, "
+            "\"y\" : { \"$ref\" : \"http://example.com/b.json#\" } }, "
+          "\"anyOf\" : [ { \"required\" : [ \"x\" ] }, { \"required\" : [ \"y\" ] } ] }",
+
+        "{ \"type\" : \"object\", "
+          "\"properties\" : { "
+            "\"p\" : { \"multipleOf\" : 0.25 }, "
+            "\"q\" : { \"type\" : \"string\" } }, "
+          "\"oneOf\" : [ { \"required\" : [ \"p\" ] }, { \"required\" : [ \"q\" ] } ] }",
+      },
+      {
+        { true,  "{ \"x\" : 1.5 }" },
+        { false, "{ \"x\" : 1.2 }" },
+        { false, "{ \"z\" : 1 }" },
+        { true,  "{ \"y\" : { \"p\" : 0.75 } }" },
+        { false, "{ \"y\" : { \"p\" : 0.3 } }" },
+        { true,  "{ \"y\" : { \"q\" : \"s\" } }" },
+        { false, "{ \"y\" : { \"q\" : 1 } }" },
+        { false, "{ \"y\" : { \"p\" : 0.5, \"q\" : \"s\" } }" },
+        { false, "{ \"y\" : {} }" },
+        { NULL },
+      },
+    },
+
+    { { NULL } },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_link_cycle(void)
+{
+  const struct link_test tests[] = {
+    {
+      { "http://example.com/tree.json", "http://example.com/node.json" },
+      {
+        "{ \"type\" : \"array\", "
+          "\"items\" : { \"$ref\" : \"http://example.com/node.json#\" } }",
+
+        "{ \"type\" : \"object\", "
+          "\"properties\" : { "
+            "\"v\" : { \"type\" : \"integer\" }, "
+            "\"kids\" : { \"$ref\" : \"http://example.com/tree.json#\" } } }",
+      },
+      {
+        { true,  "[]" },
+        { true,  "[ { \"v\" : 1, \"kids\" : [ { \"v\" : 2 } ] } ]" },
+        { false, "[ { \"v\" : 1, \"kids\" : [ { \"v\" : 2.5 } ] } ]" },
+        { false, "[ { \"kids\" : {} } ]" },
+        { NULL },
+      },
+    },
+
+    { { NULL } },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_link_srcmap(void)
+{
+  struct jvst_vm_module *mods[2];
+  struct jvst_vm_program *prog;
+  const char *loc;
+  size_t i, base;
+  int found;
+
+  mods[0] = compile_module("http://example.com/tree.json",
+      "{ \"type\" : \"array\", "
+        "\"items\" : { \"$ref\" : \"http://example.com/node.json#\" } }");
+
+  mods[1] = compile_module("http://example.com/node.json",
+      "{ \"type\" : \"object\", "
+        "\"properties\" : { "
+          "\"v\" : { \"type\" : \"integer\" }, "
+          "\"kids\" : { \"$ref\" : \"http://example.com/tree.json#\" } } }");
+
+  prog = jvst_vm_link(mods, 2);
+  base = mods[0]->prog->ncode;
+
+  ntest++;
+
+  for (i=1; i < prog->nsrcmap; i++) {
+    if (prog->srcmap[i].pc < prog->srcmap[i-1].pc) {
+      printf("%s: source map isn't in order of pc at range %zu\n", __func__, i);
+      nfail++;
+      goto done;
+    }
+  }
+
+  // each module starts with its root schema
+  loc = jvst_vm_program_srcloc(prog, 0);
+  if (loc == NULL || strcmp(loc, "#") != 0) {
+    printf("%s: expected pc 0 to be at \"#\", found %s\n", __func__, loc ? loc : "(null)");
+    nfail++;
+    goto done;
+  }
+
+  loc = jvst_vm_program_srcloc(prog, base);
+  if (loc == NULL || strcmp(loc, "#") != 0) {
+    printf("%s: expected pc %zu to be at \"#\", found %s\n", __func__, base, loc ? loc : "(null)");
+    nfail++;
+    goto done;
+  }
+
+  found = 0;
+  for (i=base; i < prog->ncode; i++) {
+    loc = jvst_vm_program_srcloc(prog, i);
+    if (loc != NULL && strcmp(loc, "#/properties/v") == 0) {
+      found = 1;
+      break;
+    }
+  }
+
+  if (!found) {
+    printf("%s: no code at \"#/properties/v\"\n", __func__);
+    nfail++;
+    goto done;
+  }
+
+  // the keywords of the second module are moved with its locations
+  found = 0;
+  for (i=base; i < prog->ncode; i++) {
+    const char *kw;
+
+    loc = jvst_vm_program_srcloc(prog, i);
+    kw = jvst_vm_program_keyword(prog, i);
+    if (loc != NULL && strcmp(loc, "#/properties/v") == 0 &&
+        kw != NULL && strcmp(kw, "type") == 0) {
+      found = 1;
+      break;
+    }
+  }
+
+  if (!found) {
+    printf("%s: no \"type\" keyword at \"#/properties/v\"\n", __func__);
+    nfail++;
+  }
+
+done:
+  jvst_vm_program_free(prog);
+  jvst_vm_module_free(mods[0]);
+  jvst_vm_module_free(mods[1]);
+}
+
+int main(void)
+{
+  test_link_definitions();
+  test_link_pools();
+  test_link_cycle();
+  test_link_srcmap();
+
+  return report_tests();
+}
@@ -0,0 +1,332 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jvst_macros.h"
+
+#include "sjp_lexer.h"
+#include "sjp_testing.h"
+
+#include "parser.h"
+#include "validate.h"
+#include "validate_vm.h"
+
+#include "validate_testing.h"
+
+enum { MAXSCHEMAS = 8 };
+
+struct multi_doc {
+  uint64_t matches;
+  const char *json;
+};
+
+struct multi_test {
+  const char *schemas[MAXSCHEMAS];
+  struct multi_doc docs[16];
+};
+
+static void
+parse_schema(struct ast_schema *ast, size_t i, const char *schema)
+{
+  struct sjp_lexer l = { 0 };
+  struct json_string uribase;
+  char *buf, *uri;
+  size_t len;
+
+  // each schema needs its own ids
+  uri = malloc(64);
+  assert(uri != NULL);
+  snprintf(uri, 64, "http://example.com/schema%zu.json", i);
+  uribase.s = uri;
+  uribase.len = strlen(uri);
+
+  // the AST refers to the buffers, so they aren't freed
+  len = strlen(schema);
+  buf = malloc(len);
+  assert(buf != NULL);
+  memcpy(buf, schema, len);
+
+  sjp_lexer_init(&l);
+  sjp_lexer_more(&l, buf, len);
+  parse(&l, ast, uribase);
+}
+
+static int
+run_doc(const char *fname, struct jvst_vm_program *prog, const struct multi_doc *d)
+{
+  struct jvst_vm vm;
+  char buf[4096];
+  size_t n;
+  int ret;
+  uint64_t got;
+
+  n = strlen(d->json);
+  assert(n < sizeof buf);
+  memcpy(buf, d->json, n);
+
+  jvst_vm_init_defaults(&vm, prog);
+  ret = jvst_vm_more(&vm, buf, n);
+  if (!JVST_IS_INVALID(ret)) {
+    ret = jvst_vm_close(&vm);
+  }
+
+  got = jvst_vm_matches(&vm)[0];
+  jvst_vm_finalize(&vm);
+
+  if (ret != JVST_VALID) {
+    fprintf(stderr, "%s: expected %s to be well-formed\n", fname, d->json);
+    return 0;
+  }
+
+  if (got != d->matches) {
+    fprintf(stderr, "%s: %s matched 0x%" PRIx64 ", expected 0x%" PRIx64 "\n",
+        fname, d->json, got, d->matches);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int
+run_test(const char *fname, const struct multi_test *t)
+{
+  struct ast_schema asts[MAXSCHEMAS] = { { 0 } };
+  const struct ast_schema *schemas[MAXSCHEMAS];
+  struct jvst_vm_program *prog;
+  size_t i, n;
+  int ret;
+
+  for (n=0; n < MAXSCHEMAS && t->schemas[n] != NULL; n++) {
+    parse_schema(&asts[n], n, t->schemas[n]);
+    schemas[n] = &asts[n];
+  }
+
+  prog = jvst_compile_schemas(schemas, n);
+
+  ret = 1;
+  for (i=0; t->docs[i].json != NULL; i++) {
+    if (!run_doc(fname, prog, &t->docs[i])) {
+      ret = 0;
+    }
+  }
+
+  jvst_vm_program_free(prog);
+
+  return ret;
+}
+
+#define RUNTESTS(testlist) runtests(__func__, (testlist))
+static void runtests(const char *testname, const struct multi_test tests[])
+{
+  int i;
+
+  for (i=0; tests[i].schemas[0] != NULL; i++) {
+    ntest++;
+
+    if (!run_test(testname, &tests[i])) {
+      printf("%s[%d]: failed\n", testname, i+1);
+      nfail++;
+    }
+  }
+}
+
+static void test_multi_types(void)
+{
+  const struct multi_test tests[] = {
+    {
+      {
+        "{ \"type\" : \"object\" }",
+        "{ \"type\" : \"array\" }",
+        "{ \"type\" : \"number\", \"minimum\" : 10 }",
+        "{ \"type\" : \"integer\" }",
+      },
+      {
+        { 0x1, "{ \"a\" : [ 1, 2 ] }" },
+        { 0x2, "[ { \"a\" : 1 } ]" },
+        { 0xc, "12" },
+        { 0x4, "10.5" },
+        { 0x8, "3" },
+        { 0x0, "\"str\"" },
+        { NULL },
+      },
+    },
+
+    { { NULL } },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_multi_objects(void)
+{
+  // routing messages: each schema picks out one kind of message, and
+  // the schemas share the definition of the header
+  const struct multi_test tests[] = {
+    {
+      {
+        "{ \"definitions\" : { \"hdr\" : { \"type\" : \"object\", \"required\" : [ \"id\" ], "
+            "\"properties\" : { \"id\" : { \"type\" : \"integer\" } } } }, "
+          "\"type\" : \"object\", \"required\" : [ \"hdr\", \"login\" ], "
+          "\"properties\" : { \"hdr\" : { \"$ref\" : \"#/definitions/hdr\" }, "
+            "\"login\" : { \"type\" : \"string\" } } }",
+
+        "{ \"definitions\" : { \"hdr\" : { \"type\" : \"object\", \"required\" : [ \"id\" ], "
+            "\"properties\" : { \"id\" : { \"type\" : \"integer\" } } } }, "
+          "\"type\" : \"object\", \"required\" : [ \"hdr\", \"logout\" ], "
+          "\"properties\" : { \"hdr\" : { \"$ref\" : \"#/definitions/hdr\" }, "
+            "\"logout\" : { \"type\" : \"boolean\" } } }",
+
+        "{ \"type\" : \"object\", "
+          "\"anyOf\" : [ { \"required\" : [ \"login\" ] }, { \"required\" : [ \"logout\" ] } ] }",
+      },
+      {
+        { 0x5, "{ \"hdr\" : { \"id\" : 1 }, \"login\" : \"me\" }" },
+        { 0x6, "{ \"hdr\" : { \"id\" : 2 }, \"logout\" : true }" },
+        { 0x7, "{ \"hdr\" : { \"id\" : 3 }, \"login\" : \"me\", \"logout\" : false }" },
+        { 0x4, "{ \"hdr\" : { \"id\" : 1.5 }, \"login\" : \"me\" }" },
+        { 0x4, "{ \"login\" : \"me\" }" },
+        { 0x0, "{ \"hdr\" : { \"id\" : 1 } }" },
+        { NULL },
+      },
+    },
+
+    { { NULL } },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_multi_wide(void)
+{
+  // more schemas than fit in one word of matches: schema i matches
+  // integers of at least i
+  enum { NSCHEMAS = 100, NWORDS = (NSCHEMAS + 63) / 64 };
+  static const struct {
+    const char *json;
+    int nmatch;
+  } docs[] = {
+    { "70", 71 },
+    { "99", 100 },
+    { "0", 1 },
+    { "-1", 0 },
+    { "64.5", 0 },
+    { NULL, 0 },
+  };
+
+  static struct ast_schema asts[NSCHEMAS];
+  const struct ast_schema *sp[NSCHEMAS];
+  struct jvst_vm_program *prog;
+  size_t i, d;
+
+  for (i=0; i < NSCHEMAS; i++) {
+    char schema[64];
+
+    snprintf(schema, sizeof schema,
+        "{ \"type\" : \"integer\", \"minimum\" : %zu }", i);
+    parse_schema(&asts[i], i, schema);
+    sp[i] = &asts[i];
+  }
+
+  prog = jvst_compile_schemas(sp, NSCHEMAS);
+
+  for (d=0; docs[d].json != NULL; d++) {
+    struct jvst_vm vm;
+    const uint64_t *got;
+    char buf[16];
+    size_t n, w;
+    int ret;
+
+    ntest++;
+
+    n = strlen(docs[d].json);
+    memcpy(buf, docs[d].json, n);
+
+    jvst_vm_init_defaults(&vm, prog);
+    ret = jvst_vm_more(&vm, buf, n);
+    if (!JVST_IS_INVALID(ret)) {
+      ret = jvst_vm_close(&vm);
+    }
+
+    got = jvst_vm_matches(&vm);
+    for (w=0; ret == JVST_VALID && w < NWORDS; w++) {
+      uint64_t want;
+      int nbits;
+
+      nbits = docs[d].nmatch - 64*(int)w;
+      if (nbits <= 0) {
+        want = 0;
+      } else if (nbits >= 64) {
+        want = ~(uint64_t)0;
+      } else {
+        want = ((uint64_t)1 << nbits) - 1;
+      }
+
+      if (got[w] != want) {
+        printf("%s: %s matched 0x%" PRIx64 " in word %zu, expected 0x%" PRIx64 "\n",
+            __func__, docs[d].json, got[w], w, want);
+        nfail++;
+        break;
+      }
+    }
+
+    if (ret != JVST_VALID) {
+      printf("%s: expected %s to be well-formed\n", __func__, docs[d].json);
+      nfail++;
+    }
+
+    jvst_vm_finalize(&vm);
+  }
+
+  jvst_vm_program_free(prog);
+}
+
+static void test_multi_malformed(void)
+{
+  const char *schemas[] = {
+    "{ \"type\" : \"object\" }",
+    "{ \"type\" : \"array\" }",
+  };
+  struct ast_schema asts[2] = { { 0 } };
+  const struct ast_schema *sp[2];
+  struct jvst_vm_program *prog;
+  struct jvst_vm vm;
+  char buf[] = "[ 1, 2 }";
+  int ret;
+
+  parse_schema(&asts[0], 0, schemas[0]);
+  parse_schema(&asts[1], 1, schemas[1]);
+  sp[0] = &asts[0];
+  sp[1] = &asts[1];
+
+  prog = jvst_compile_schemas(sp, 2);
+
+  ntest++;
+
+  jvst_vm_init_defaults(&vm, prog);
+  ret = jvst_vm_more(&vm, buf, sizeof buf - 1);
+  if (!JVST_IS_INVALID(ret)) {
+    ret = jvst_vm_close(&vm);
+  }
+  jvst_vm_finalize(&vm);
+
+  if (!JVST_IS_INVALID(ret)) {
+    printf("%s: malformed document should be invalid\n", __func__);
+    nfail++;
+  }
+
+  jvst_vm_program_free(prog);
+}
+
+int main(void)
+{
+  test_multi_types();
+  test_multi_objects();
+  test_multi_wide();
+  test_multi_malformed();
+
+  return report_tests();
+}
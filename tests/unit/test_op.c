@@ -198,7 +198,18 @@ op_encodings_equal(const char *fname, struct jvst_vm_program *p1, struct jvst_vm
   // text dumps and compare
   // 
   // XXX - replace with an actual comparison
-  if (jvst_vm_program_dump(p1, buf1, sizeof buf1) != 0) {
+  //
+  // The expected programs only give the number of DFAs, so the dump of
+  // the actual program leaves out how each DFA matches.
+  if (p2->dfas == NULL && p1->ndfa == p2->ndfa) {
+    struct jvst_vm_program p1_nodfa = *p1;
+
+    p1_nodfa.dfas = NULL;
+    if (jvst_vm_program_dump(&p1_nodfa, buf1, sizeof buf1) != 0) {
+      fprintf(stderr, "buffer for program 1 not large enough (currently %zu bytes)\n",
+          sizeof buf1);
+    }
+  } else if (jvst_vm_program_dump(p1, buf1, sizeof buf1) != 0) {
     fprintf(stderr, "buffer for program 1 not large enough (currently %zu bytes)\n",
         sizeof buf1);
   }
@@ -678,7 +689,7 @@ static void test_op_minimum(void)
           opfloat, 1.1,
 
           newop_proc(&A,
-            opslots, 2,
+            opslots, 1,
 
             oplabel, "entry_0",
             newop_instr(&A, JVST_OP_TOKEN),
@@ -689,9 +700,8 @@ static void test_op_minimum(void)
             newop_return(&A, 1),
 
             oplabel, "true_2",
-            newop_load(&A, JVST_OP_MOVE, oparg_slot(1), oparg_tnum()),
             newop_load(&A, JVST_OP_FLOAD, oparg_slot(0), oparg_lit(0)),
-            newop_cmp(&A, JVST_OP_FCMP, oparg_slot(1), oparg_slot(0)),
+            newop_cmp(&A, JVST_OP_FCMP, oparg_tnum(), oparg_slot(0)),
             newop_br(&A, JVST_VM_BR_GE, "true_4"),
 
             oplabel, "invalid_3_7",
@@ -773,7 +783,7 @@ static void test_op_minimum(void)
           opfloat, 1.1,
 
           newop_proc(&A,
-            opslots, 2,
+            opslots, 1,
 
             oplabel, "entry_0",
             newop_instr(&A, JVST_OP_TOKEN),
@@ -784,9 +794,8 @@ static void test_op_minimum(void)
             newop_return(&A, 1),
 
             oplabel, "true_2",
-            newop_load(&A, JVST_OP_MOVE, oparg_slot(1), oparg_tnum()),
             newop_load(&A, JVST_OP_FLOAD, oparg_slot(0), oparg_lit(0)),
-            newop_cmp(&A, JVST_OP_FCMP, oparg_slot(1), oparg_slot(0)),
+            newop_cmp(&A, JVST_OP_FCMP, oparg_tnum(), oparg_slot(0)),
             newop_br(&A, JVST_VM_BR_GE, "true_4"),
 
             oplabel, "invalid_3_7",
@@ -807,16 +816,15 @@ static void test_op_minimum(void)
       newvm_program(&A,
           VM_FLOATS, 1, 1.1,
 
-          JVST_OP_PROC, VMLIT(2), VMLIT(0),
+          JVST_OP_PROC, VMLIT(1), VMLIT(0),
           JVST_OP_TOKEN, 0, 0,
           JVST_OP_ICMP, VMREG(JVST_VM_TT), VMLIT(SJP_NUMBER),
           JVST_OP_JMP, JVST_VM_BR_EQ, "true_2",
           JVST_OP_RETURN, VMLIT(1), 0,
 
           VM_LABEL, "true_2",
-          JVST_OP_MOVE, VMSLOT(1), VMREG(JVST_VM_TNUM),
           JVST_OP_FLOAD, VMSLOT(0), VMLIT(0),
-          JVST_OP_FCMP, VMSLOT(1), VMSLOT(0),
+          JVST_OP_FCMP, VMREG(JVST_VM_TNUM), VMSLOT(0),
           JVST_OP_JMP, JVST_VM_BR_GE, "true_4",
 
           JVST_OP_RETURN, VMLIT(3), 0,
@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jvst_macros.h"
+
+#include "sjp_lexer.h"
+#include "sjp_testing.h"
+
+#include "parser.h"
+#include "validate.h"
+#include "validate_vm.h"
+#include "validate_swap.h"
+
+#include "validate_testing.h"
+
+enum {
+  NREADERS  = 4,
+  NRUNS     = 2000,
+  NPUBLISH  = 200,
+};
+
+// the two schemas differ in whether the document is valid, so a
+// reader can tell which program validated it
+static const char schema_any[] = "{ \"type\" : \"array\" }";
+static const char schema_short[] = "{ \"type\" : \"array\", \"maxItems\" : 2 }";
+static const char doc[] = "[ 1, 2, 3, 4, 5 ]";
+
+static size_t ncode_any;
+static size_t ncode_short;
+
+static struct jvst_vm_program *
+compile_schema(const char *schema)
+{
+  struct sjp_lexer l = { 0 };
+  struct ast_schema ast = { 0 };
+  struct json_string uribase = { "http://example.com/swap.json", 28 };
+  struct jvst_vm_program *prog;
+  char *buf;
+  size_t len;
+
+  len = strlen(schema);
+  buf = malloc(len);
+  assert(buf != NULL);
+  memcpy(buf, schema, len);
+
+  sjp_lexer_init(&l);
+  sjp_lexer_more(&l, buf, len);
+  parse(&l, &ast, uribase);
+
+  prog = jvst_compile_schema(&ast);
+  free(buf);
+
+  return prog;
+}
+
+// feeds the document a few bytes at a time, so the VM is in flight for
+// a while
+static int
+feed(struct jvst_vm *vm, size_t chunk)
+{
+  char buf[sizeof doc];
+  size_t off, n;
+  int ret;
+
+  memcpy(buf, doc, sizeof doc - 1);
+  for (off=0; off < sizeof doc - 1; off += n) {
+    n = sizeof doc - 1 - off;
+    if (n > chunk) {
+      n = chunk;
+    }
+
+    ret = jvst_vm_more(vm, &buf[off], n);
+    if (JVST_IS_INVALID(ret)) {
+      return 0;
+    }
+  }
+
+  return !JVST_IS_INVALID(jvst_vm_close(vm));
+}
+
+static int
+expected(const struct jvst_vm *vm)
+{
+  if (vm->prog->ncode == ncode_any) {
+    return 1;
+  }
+
+  if (vm->prog->ncode == ncode_short) {
+    return 0;
+  }
+
+  return -1;
+}
+
+static void test_swap_inflight(void)
+{
+  struct jvst_vm_cell *cell;
+  struct jvst_vm old, new;
+  struct jvst_vm_program *prog_any, *prog_short;
+
+  prog_any = compile_schema(schema_any);
+  prog_short = compile_schema(schema_short);
+
+  ntest++;
+
+  cell = jvst_vm_cell_new(prog_any);
+  jvst_vm_init_cell(&old, cell);
+
+  // publishing doesn't change the program of a VM in flight...
+  jvst_vm_cell_publish(cell, prog_short);
+  jvst_vm_init_cell(&new, cell);
+
+  if (old.prog != prog_any || new.prog != prog_short) {
+    printf("%s: VMs started with the wrong program\n", __func__);
+    nfail++;
+  }
+
+  // ... and the old program stays alive until the VM is finalized
+  if (!feed(&old, 3)) {
+    printf("%s: document should be valid with the old program\n", __func__);
+    nfail++;
+  }
+  jvst_vm_finalize(&old);
+
+  if (feed(&new, 3)) {
+    printf("%s: document should be invalid with the new program\n", __func__);
+    nfail++;
+  }
+
+  // VMs can outlive the cell
+  jvst_vm_cell_free(cell);
+  jvst_vm_finalize(&new);
+}
+
+struct reader {
+  pthread_t thread;
+  struct jvst_vm_cell *cell;
+  size_t nrun;
+  size_t nwrong;
+};
+
+static void *
+reader_run(void *arg)
+{
+  struct reader *r = arg;
+
+  for (r->nrun=0; r->nrun < NRUNS; r->nrun++) {
+    struct jvst_vm vm;
+    int exp, got;
+
+    jvst_vm_init_cell(&vm, r->cell);
+    exp = expected(&vm);
+    got = feed(&vm, 1 + r->nrun % 4);
+    jvst_vm_finalize(&vm);
+
+    if (exp != got) {
+      r->nwrong++;
+    }
+  }
+
+  return NULL;
+}
+
+static void test_swap_concurrent(void)
+{
+  struct reader readers[NREADERS];
+  struct jvst_vm_cell *cell;
+  size_t i;
+
+  cell = jvst_vm_cell_new(compile_schema(schema_any));
+
+  for (i=0; i < NREADERS; i++) {
+    readers[i].cell = cell;
+    readers[i].nrun = 0;
+    readers[i].nwrong = 0;
+
+    if (pthread_create(&readers[i].thread, NULL, reader_run, &readers[i]) != 0) {
+      fprintf(stderr, "%s: could not start reader\n", __func__);
+      abort();
+    }
+  }
+
+  for (i=0; i < NPUBLISH; i++) {
+    jvst_vm_cell_publish(cell, compile_schema((i%2 == 0) ? schema_short : schema_any));
+  }
+
+  for (i=0; i < NREADERS; i++) {
+    pthread_join(readers[i].thread, NULL);
+
+    ntest++;
+    if (readers[i].nwrong > 0) {
+      printf("%s: reader %zu had %zu wrong results out of %zu\n",
+          __func__, i, readers[i].nwrong, readers[i].nrun);
+      nfail++;
+    }
+  }
+
+  jvst_vm_cell_free(cell);
+}
+
+int main(void)
+{
+  struct jvst_vm_program *prog;
+
+  prog = compile_schema(schema_any);
+  ncode_any = prog->ncode;
+  jvst_vm_program_free(prog);
+
+  prog = compile_schema(schema_short);
+  ncode_short = prog->ncode;
+  jvst_vm_program_free(prog);
+
+  assert(ncode_any != ncode_short);
+
+  test_swap_inflight();
+  test_swap_concurrent();
+
+  return report_tests();
+}
@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jvst_macros.h"
+
+#include "validate_utf8.h"
+
+#include "validate_testing.h"
+
+struct utf8_test {
+  const char *input;
+  int valid;
+  size_t ncp;
+};
+
+static int
+check(const char *fname, const struct utf8_test *t, const char *what, int valid, size_t ncp)
+{
+  if (valid != t->valid) {
+    fprintf(stderr, "%s ERROR: %s: expected valid=%d, found %d\n",
+        fname, what, t->valid, valid);
+    return 0;
+  }
+
+  if (valid && ncp != t->ncp) {
+    fprintf(stderr, "%s ERROR: %s: expected %zu code points, found %zu\n",
+        fname, what, t->ncp, ncp);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int
+run_test(const char *fname, const struct utf8_test *t)
+{
+  struct jvst_utf8 u;
+  size_t len, i, j;
+  int ok;
+
+  len = strlen(t->input);
+
+  // all at once
+  jvst_utf8_init(&u);
+  ok = jvst_utf8_feed(&u, t->input, len) && jvst_utf8_complete(&u);
+  if (!check(fname, t, "whole", ok, u.ncp)) {
+    return 0;
+  }
+
+  if (t->valid && jvst_utf8_count(t->input, len) != t->ncp) {
+    fprintf(stderr, "%s ERROR: count: expected %zu code points, found %zu\n",
+        fname, t->ncp, jvst_utf8_count(t->input, len));
+    return 0;
+  }
+
+  // split in two and three pieces at every position, including
+  // inside multibyte sequences
+  for (i=0; i <= len; i++) {
+    for (j=i; j <= len; j++) {
+      jvst_utf8_init(&u);
+      ok = jvst_utf8_feed(&u, t->input, i);
+      ok = jvst_utf8_feed(&u, t->input + i, j-i) && ok;
+      ok = jvst_utf8_feed(&u, t->input + j, len-j) && ok;
+      ok = ok && jvst_utf8_complete(&u);
+
+      if (!check(fname, t, "pieces", ok, u.ncp)) {
+        fprintf(stderr, "  split at %zu and %zu\n", i, j);
+        return 0;
+      }
+
+      if (t->valid) {
+        size_t n = jvst_utf8_count(t->input, i) +
+          jvst_utf8_count(t->input + i, j-i) +
+          jvst_utf8_count(t->input + j, len-j);
+        if (n != t->ncp) {
+          fprintf(stderr, "%s ERROR: count split at %zu and %zu: expected %zu, found %zu\n",
+              fname, i, j, t->ncp, n);
+          return 0;
+        }
+      }
+    }
+  }
+
+  return 1;
+}
+
+#define RUNTESTS(testlist) runtests(__func__, (testlist))
+static void runtests(const char *testname, const struct utf8_test tests[])
+{
+  int i;
+
+  for (i=0; tests[i].input != NULL; i++) {
+    ntest++;
+
+    if (!run_test(testname, &tests[i])) {
+      printf("%s[%d]: failed\n", testname, i+1);
+      nfail++;
+    }
+  }
+}
+
+static void test_valid(void)
+{
+  const struct utf8_test tests[] = {
+    { "", 1, 0 },
+    { "a", 1, 1 },
+    { "abcdefgh", 1, 8 },
+    { "abcdefghijklmnopqrstuvwxyz0123456789", 1, 36 },
+
+    { "\xc3\xbc", 1, 1 },                       // U+00FC
+    { "\xe2\x82\xac", 1, 1 },                   // U+20AC
+    { "\xf0\x9f\x98\x80", 1, 1 },               // U+1F600
+    { "\xef\xbf\xbf", 1, 1 },                   // U+FFFF
+    { "\xf4\x8f\xbf\xbf", 1, 1 },               // U+10FFFF
+    { "\xe0\xa0\x80", 1, 1 },                   // U+0800
+    { "\xed\x9f\xbf", 1, 1 },                   // U+D7FF
+
+    // mixed ASCII and multibyte runs longer than a word
+    { "caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9""e", 1, 17 },
+    { "\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82, \xd0\xbc\xd0\xb8\xd1\x80!", 1, 12 },
+    { "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87\xe5\xad\x97\xe5\x88\x97", 1, 7 },
+    { "aaaaaaa\xf0\x9f\x98\x80""bbbbbbbbbbbbbbb", 1, 23 },
+
+    { NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_invalid(void)
+{
+  const struct utf8_test tests[] = {
+    { "\x80", 0 },                              // lone continuation byte
+    { "abc\xbf", 0 },
+    { "\xc3", 0 },                              // truncated sequences
+    { "\xe2\x82", 0 },
+    { "\xf0\x9f\x98", 0 },
+    { "\xc3\x28", 0 },                          // bad continuation byte
+    { "\xc0\xaf", 0 },                          // overlong encodings
+    { "\xc1\xbf", 0 },
+    { "\xe0\x9f\xbf", 0 },
+    { "\xf0\x8f\xbf\xbf", 0 },
+    { "\xed\xa0\x80", 0 },                      // surrogates
+    { "\xed\xbf\xbf", 0 },
+    { "\xf4\x90\x80\x80", 0 },                  // above U+10FFFF
+    { "\xf5\x80\x80\x80", 0 },
+    { "\xff", 0 },
+    { "abcdefgh\xc3\xbc\xbc", 0 },
+
+    { NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+int main(void)
+{
+  test_valid();
+  test_invalid();
+
+  return report_tests();
+}
@@ -9,7 +9,12 @@
 #include "ast.h"
 #include "validate.h"
 #include "validate_testing.h"
+#include "validate_ir.h"
 #include "validate_vm.h"
+#include "validate_jit.h"
+#include "validate_verify.h"
+#include "validate_prof.h"
+#include "validate_explain.h"
 
 #define PROTOTYPE 0
 
@@ -75,50 +80,117 @@ static int run_prototype_test(const struct validation_test *t)
   return !failed;
 }
 
-static int run_vm_test(const struct validation_test *t)
+// runs the VM over json, returns non-zero if the document is invalid
+// and sets *errp to the error code.  The document is passed to the VM
+// chunk bytes at a time, or all at once if chunk is 0.
+static int run_vm(struct jvst_vm_program *prog, const char *json, size_t chunk,
+    bool succeeds, int *errp)
 {
-  static const struct ast_string_set zero;
-  struct jvst_vm_program *prog;
   struct jvst_vm vm;
   char buf[4096];
-  size_t n;
+  size_t n, off;
   int ret, failed;
-  struct ast_string_set sset;
-
-  if (t->schema->all_ids == NULL) {
-    sset = zero;
-
-    sset.str.s = BASE_URI;
-    sset.str.len = strlen(sset.str.s);
-    t->schema->all_ids = &sset;
-  }
-
-  prog = jvst_compile_schema(t->schema);
 
   jvst_vm_init_defaults(&vm, prog);
-  n = strlen(t->json);
+  n = strlen(json);
   if (n >= sizeof buf) {
     fprintf(stderr, "json exceeds buffer size (%s:%d)\n", __FILE__, __LINE__);
     abort();
   }
 
+  if (chunk == 0) {
+    chunk = n;
+  }
+
   // already checked buffer size
-  strcpy(buf, t->json);
-  ret = jvst_vm_more(&vm, buf, n);
+  strcpy(buf, json);
+  ret = JVST_MORE;
+  for (off = 0; off < n && !JVST_IS_INVALID(ret); off += chunk) {
+    ret = jvst_vm_more(&vm, &buf[off], (n - off < chunk) ? n - off : chunk);
+  }
   failed = JVST_IS_INVALID(ret);
 
-  if (failed && t->succeeds) {
+  if (failed && succeeds) {
     jvst_vm_dumpstate(&vm);
   }
 
   ret = jvst_vm_close(&vm);
-  if (!failed && JVST_IS_INVALID(ret) && t->succeeds) {
+  if (!failed && JVST_IS_INVALID(ret) && succeeds) {
     jvst_vm_dumpstate(&vm);
   }
 
   failed = failed || JVST_IS_INVALID(ret);
+  *errp = vm.error;
 
   jvst_vm_finalize(&vm);
+
+  return failed;
+}
+
+static int run_vm_test(const struct validation_test *t)
+{
+  static const struct ast_string_set zero;
+  struct jvst_vm_program *prog;
+  struct jvst_vm_verify_error verr;
+  int failed, err, mismatch;
+  struct ast_string_set sset;
+
+  if (t->schema->all_ids == NULL) {
+    sset = zero;
+
+    sset.str.s = BASE_URI;
+    sset.str.len = strlen(sset.str.s);
+    t->schema->all_ids = &sset;
+  }
+
+  prog = jvst_compile_schema(t->schema);
+  failed = run_vm(prog, t->json, 0, t->succeeds, &err);
+  mismatch = 0;
+
+  // compiled programs must pass verification, and the interpreter
+  // without checks must agree with the checked one
+  if (jvst_vm_verify(prog, &verr) != 0) {
+    fprintf(stderr, "program for %s failed verification at pc %u: %s\n",
+        t->json, (unsigned)verr.pc, verr.msg);
+    mismatch = 1;
+  } else {
+    int vfailed, verror;
+
+    vfailed = run_vm(prog, t->json, 0, t->succeeds, &verror);
+    if (vfailed != failed || verror != err) {
+      fprintf(stderr, "verified program disagrees with the interpreter on %s\n",
+          t->json);
+      mismatch = 1;
+    }
+  }
+
+  // the JIT must agree with the interpreter, including the error,
+  // both on the whole document and when it has to suspend and resume
+  // at every byte
+  if (jvst_vm_jit(prog) == 0) {
+    static const size_t chunks[] = { 0, 1 };
+    size_t i;
+
+    for (i=0; i < ARRAYLEN(chunks); i++) {
+      int jfailed, jerr;
+
+      jfailed = run_vm(prog, t->json, chunks[i], t->succeeds, &jerr);
+      if (jfailed != failed || jerr != err) {
+        fprintf(stderr, "JIT disagrees with the interpreter on %s (chunk %zu): "
+            "interpreter %s (error %d), JIT %s (error %d)\n",
+            t->json, chunks[i],
+            failed ? "invalid" : "valid", err,
+            jfailed ? "invalid" : "valid", jerr);
+        mismatch = 1;
+      }
+    }
+  }
+
+  // report a mismatch as the opposite of the expected result
+  if (mismatch) {
+    failed = t->succeeds;
+  }
+
   jvst_vm_program_free(prog);
 
   if (t->schema->all_ids == &sset) {
@@ -128,6 +200,38 @@ static int run_vm_test(const struct validation_test *t)
   return !failed;
 }
 
+// returns non-zero if the lowered IR of the schema splits the validator
+static int schema_has_split(struct ast_schema *schema)
+{
+  static const struct ast_string_set zero;
+  struct ast_string_set sset;
+  struct jvst_ir_stmt *prog, *fr;
+  int split;
+
+  if (schema->all_ids == NULL) {
+    sset = zero;
+
+    sset.str.s = BASE_URI;
+    sset.str.len = strlen(sset.str.s);
+    schema->all_ids = &sset;
+  }
+
+  prog = jvst_ir_from_cnode(jvst_cnode_from_ast(schema));
+
+  split = 0;
+  for (fr = prog->u.program.frames; fr != NULL; fr = fr->next) {
+    if (fr->u.frame.splits != NULL || fr->u.frame.nsplits > 0) {
+      split = 1;
+    }
+  }
+
+  if (schema->all_ids == &sset) {
+    schema->all_ids = NULL;
+  }
+
+  return split;
+}
+
 #define RUNTESTS(testlist) runtests(__func__, (testlist))
 static void runtests(const char *testname, const struct validation_test tests[])
 {
@@ -621,25 +725,147 @@ void test_required(void)
   RUNTESTS(tests);
 }
 
-void test_minimum(void)
+enum { NWIDE = 70 };
+
+// writes an object with the properties p0 .. p<NWIDE-1>, except pskip
+static char *wide_object(char buf[static NWIDE*12], size_t skip)
+{
+  size_t i, n;
+
+  n = 0;
+  buf[n++] = '{';
+  for (i=0; i < NWIDE; i++) {
+    if (i == skip) {
+      continue;
+    }
+
+    n += sprintf(&buf[n], "%s\"p%zu\":%zu", (n > 1) ? "," : "", i, i);
+  }
+  buf[n++] = '}';
+  buf[n] = '\0';
+
+  return buf;
+}
+
+void test_required_wide(void)
+{
+  // more required names than fit in one 64-bit slot
+  static struct ast_string_set req[NWIDE];
+  static char names[NWIDE][8];
+  static char all[NWIDE*12], missing_first[NWIDE*12], missing_last[NWIDE*12];
+  struct arena_info A = {0};
+  struct ast_schema *schema;
+  size_t i;
+
+  for (i=0; i < NWIDE; i++) {
+    snprintf(names[i], sizeof names[i], "p%zu", i);
+    req[i].str.s = names[i];
+    req[i].str.len = strlen(names[i]);
+    req[i].next = (i+1 < NWIDE) ? &req[i+1] : NULL;
+  }
+
+  schema = newschema_p(&A, 0, "required", &req[0], NULL);
+
+  {
+    const struct validation_test tests[] = {
+      { true, wide_object(all, NWIDE), schema },
+      { false, wide_object(missing_first, 0), schema },
+      { false, wide_object(missing_last, NWIDE-1), schema },
+      { false, "{}", schema },
+      { true, "[]", schema },
+
+      { false, NULL, NULL },
+    };
+
+    RUNTESTS(tests);
+  }
+}
+
+void test_some_of_wide(void)
+{
+  // more branches than fit in one 64-bit slot.  Branch i matches only
+  // the number i.
+  static struct ast_schema_set branches[NWIDE];
+  struct arena_info A = {0};
+  struct ast_schema *any, *one;
+  size_t i;
+
+  for (i=0; i < NWIDE; i++) {
+    branches[i].schema = newschema_p(&A, 0,
+        "minimum", (double)i,
+        "maximum", (double)i,
+        NULL);
+    branches[i].next = (i+1 < NWIDE) ? &branches[i+1] : NULL;
+  }
+
+  any = newschema_p(&A, 0, "anyOf", &branches[0], NULL);
+  one = newschema_p(&A, 0, "oneOf", &branches[0], NULL);
+
+  {
+    const struct validation_test tests[] = {
+      { true, "0", any },
+      { true, "66", any },
+      { true, "69", any },
+      { false, "70", any },
+      { false, "3.5", any },
+
+      { true, "1", one },
+      { true, "68", one },
+      { false, "65.5", one },
+      { false, "-1", one },
+
+      { false, NULL, NULL },
+    };
+
+    RUNTESTS(tests);
+  }
+}
+
+void test_properties_many_names(void)
 {
   struct arena_info A = {0};
+
+  // all names are literals, so the property names are matched with a
+  // string table.  Several names are prefixes of others.
   struct ast_schema *schema = newschema_p(&A, 0,
-      "minimum", 1.1,
+      "properties", newprops(&A,
+        "id", newschema(&A, JSON_VALUE_NUMBER),
+        "ids", newschema(&A, JSON_VALUE_ARRAY),
+        "idx", newschema(&A, JSON_VALUE_NUMBER),
+        "name", newschema(&A, JSON_VALUE_STRING),
+        "names", newschema(&A, JSON_VALUE_ARRAY),
+        "created", newschema(&A, JSON_VALUE_STRING),
+        "updated", newschema(&A, JSON_VALUE_STRING),
+        "owner", newschema(&A, JSON_VALUE_OBJECT),
+        "tags", newschema(&A, JSON_VALUE_ARRAY),
+        "enabled", newschema(&A, JSON_VALUE_BOOL),
+        "", newschema(&A, JSON_VALUE_STRING),
+        NULL),
+      "required", stringset(&A, "id", "name", NULL),
       NULL);
 
   const struct validation_test tests[] = {
-    // "description": "above the minimum is valid",
-    { true, "2.6", schema },
-
-    // "description": "boundary point is valid",
-    { true, "1.1", schema },
+    { true, "{\"id\": 1, \"name\": \"x\"}", schema },
+    { true, "{\"id\": 1, \"ids\": [], \"idx\": 2, \"name\": \"x\", \"names\": []}", schema },
+    { true, "{\"name\": \"x\", \"tags\": [], \"enabled\": true, \"id\": 3, \"owner\": {}}", schema },
+    { true, "{\"id\": 1, \"name\": \"x\", \"\": \"empty\"}", schema },
+
+    // unknown names, including prefixes and extensions of known
+    // names, are not constrained
+    { true, "{\"id\": 1, \"name\": \"x\", \"i\": {}, \"idxs\": {}, \"nam\": {}}", schema },
+
+    { false, "{\"id\": 1, \"name\": \"x\", \"ids\": 4}", schema },
+    { false, "{\"id\": 1, \"name\": \"x\", \"idx\": []}", schema },
+    { false, "{\"id\": 1, \"name\": \"x\", \"names\": \"y\"}", schema },
+    { false, "{\"id\": 1, \"name\": \"x\", \"enabled\": 1}", schema },
+    { false, "{\"id\": 1, \"name\": \"x\", \"\": 7}", schema },
+    { false, "{\"id\": \"1\", \"name\": \"x\"}", schema },
+
+    // required names
+    { false, "{\"ids\": [], \"name\": \"x\"}", schema },
+    { false, "{\"id\": 1, \"names\": []}", schema },
 
-    // "description": "below the minimum is invalid",
-    { false, "0.6", schema },
-
-    // "description": "ignores non-numbers",
-    { true, "\"x\"", schema },
+    { true, "[]", schema },
 
     { false, NULL, NULL },
   };
@@ -647,139 +873,1143 @@ void test_minimum(void)
   RUNTESTS(tests);
 }
 
-void test_anyof_1(void)
+void test_match_cache(void)
 {
   struct arena_info A = {0};
+
+  struct ast_string_set ids = {
+    .str = { .s = BASE_URI, .len = strlen(BASE_URI) }
+  };
+
   struct ast_schema *schema = newschema_p(&A, 0,
-      "anyOf", schema_set(&A, 
-        newschema_p(&A, JSON_VALUE_INTEGER, NULL),
-        newschema_p(&A, 0, "minimum", 2.0, NULL),
+      "items_single", newschema_p(&A, 0,
+        "properties", newpatternprops(&A,
+          "x-.*", newschema(&A, JSON_VALUE_NUMBER),
+          "id[0-9]+", newschema(&A, JSON_VALUE_STRING),
+          NULL),
         NULL),
       NULL);
 
   const struct validation_test tests[] = {
-    // "description": "first anyOf valid",
-    { true, "1", schema, },
-    // "description": "second anyOf valid",
-    { true, "2.5", schema, },
-    // "description": "both anyOf valid",
-    { true, "3", schema, },
-    // "description": "neither anyOf valid",
-    { false, "1.5", schema, },
+    { true, "[{\"x-a\": 1, \"id1\": \"a\"}, {\"x-a\": 2, \"id1\": \"b\"}, {\"id1\": \"c\", \"x-a\": 3}]", schema },
+    { false, "[{\"x-a\": 1, \"id1\": \"a\"}, {\"x-a\": 2, \"id1\": \"b\"}, {\"x-a\": \"3\"}]", schema },
+    { false, "[{\"x-a\": 1, \"id1\": \"a\"}, {\"x-a\": 2, \"id1\": 2}]", schema },
+    { true, "[{\"x-a\": 1}, {\"x-b\": 2}, {\"x-a\": 3, \"id\": 4}, {\"id\": 5}]", schema },
 
     { false, NULL, NULL },
   };
 
   RUNTESTS(tests);
+
+  // repeated names should hit the match cache
+  {
+    struct jvst_vm_program *prog;
+    struct jvst_vm vm;
+    char buf[] = "[{\"x-a\": 1}, {\"x-a\": 2}, {\"x-a\": 3}, {\"x-a\": 4}]";
+    enum jvst_result ret;
+    size_t hits, misses;
+
+    schema->all_ids = &ids;
+    prog = jvst_compile_schema(schema);
+
+    jvst_vm_init_defaults(&vm, prog);
+    ret = jvst_vm_more(&vm, buf, strlen(buf));
+    if (!JVST_IS_INVALID(ret)) {
+      ret = jvst_vm_close(&vm);
+    }
+
+    jvst_vm_mcache_stats(&vm, &hits, &misses);
+
+    ntest++;
+    if (JVST_IS_INVALID(ret) || hits != 3 || misses != 1) {
+      printf("%s: expected a valid result with 3 hits and 1 miss, found %s with %zu hits and %zu misses\n",
+          __func__, JVST_IS_INVALID(ret) ? "invalid" : "valid", hits, misses);
+      nfail++;
+    }
+
+    jvst_vm_finalize(&vm);
+    jvst_vm_program_free(prog);
+    schema->all_ids = NULL;
+  }
+
+  // split VMs share the cache of the root VM, and splits that don't
+  // MATCH don't allocate it
+  {
+    struct ast_schema *anyof_match = newschema_p(&A, 0,
+        "items_single", newschema_p(&A, 0,
+          "anyOf", schema_set(&A,
+            newschema_p(&A, JSON_VALUE_OBJECT,
+              "properties", newpatternprops(&A,
+                "x-.*", newschema(&A, JSON_VALUE_NUMBER),
+                "id[0-9]+", newschema(&A, JSON_VALUE_NUMBER),
+                NULL),
+              NULL),
+            newschema_p(&A, JSON_VALUE_OBJECT,
+              "properties", newpatternprops(&A,
+                "x-.*", newschema(&A, JSON_VALUE_STRING),
+                "id[0-9]+", newschema(&A, JSON_VALUE_STRING),
+                NULL),
+              NULL),
+            NULL),
+          NULL),
+        NULL);
+
+    // property names that are looked up in a string table
+    struct ast_schema *anyof_nomatch = newschema_p(&A, 0,
+        "items_single", newschema_p(&A, 0,
+          "anyOf", schema_set(&A,
+            newschema_p(&A, 0, "required", stringset(&A, "a", NULL), NULL),
+            newschema_p(&A, 0, "required", stringset(&A, "b", NULL), NULL),
+            NULL),
+          NULL),
+        NULL);
+
+    const struct {
+      struct ast_schema *schema;
+      const char *json;
+      size_t hits;
+      size_t misses;
+    } tests[] = {
+      { anyof_match, "[{\"x-a\": 1}, {\"x-a\": \"a\"}, {\"x-a\": 3}]", 5, 1 },
+      { anyof_nomatch, "[{\"a\": 1}, {\"b\": 2}, {\"a\": 3, \"b\": 4}]", 0, 0 },
+      { NULL },
+    };
+
+    int i;
+
+    for (i=0; tests[i].schema != NULL; i++) {
+      struct jvst_vm_program *prog;
+      struct jvst_vm vm;
+      char buf[256];
+      enum jvst_result ret;
+      size_t hits, misses;
+
+      tests[i].schema->all_ids = &ids;
+      prog = jvst_compile_schema(tests[i].schema);
+
+      jvst_vm_init_defaults(&vm, prog);
+      strcpy(buf, tests[i].json);
+      ret = jvst_vm_more(&vm, buf, strlen(buf));
+      if (!JVST_IS_INVALID(ret)) {
+        ret = jvst_vm_close(&vm);
+      }
+
+      jvst_vm_mcache_stats(&vm, &hits, &misses);
+
+      ntest++;
+      if (JVST_IS_INVALID(ret) || hits != tests[i].hits || misses != tests[i].misses) {
+        printf("%s[%d]: expected a valid result with %zu hits and %zu misses, found %s with %zu hits and %zu misses\n",
+            __func__, i+1, tests[i].hits, tests[i].misses,
+            JVST_IS_INVALID(ret) ? "invalid" : "valid", hits, misses);
+        nfail++;
+      } else if (tests[i].hits + tests[i].misses == 0 && vm.mcache != NULL) {
+        printf("%s[%d]: match cache allocated without a MATCH\n", __func__, i+1);
+        nfail++;
+      }
+
+      jvst_vm_finalize(&vm);
+      jvst_vm_program_free(prog);
+      tests[i].schema->all_ids = NULL;
+    }
+  }
 }
 
-void test_anyof_2(void)
+struct limit_test {
+  int error;    // expected error, zero if the document is valid
+  const char *json;
+  struct ast_schema *schema;
+  struct jvst_vm_limits limits;
+};
+
+void test_resource_limits(void)
 {
   struct arena_info A = {0};
-  struct ast_schema *schema = newschema_p(&A, 0,
-      "anyOf", schema_set(&A, 
+  int i;
+
+  struct ast_string_set ids = {
+    .str = { .s = BASE_URI, .len = strlen(BASE_URI) }
+  };
+
+  struct ast_schema *empty = newschema(&A, 0);
+
+  struct ast_schema *items = newschema_p(&A, 0,
+      "items_single", newschema(&A, JSON_VALUE_INTEGER),
+      NULL);
+
+  struct ast_schema *anyof = newschema_p(&A, 0,
+      "anyOf", schema_set(&A,
         newschema_p(&A, JSON_VALUE_OBJECT,
           "properties", newprops(&A,
             "foo", newschema_p(&A, JSON_VALUE_NUMBER, NULL),
-            "bar", newschema_p(&A, JSON_VALUE_STRING, NULL),
             NULL),
           NULL),
         newschema_p(&A, JSON_VALUE_OBJECT,
           "properties", newprops(&A,
             "foo", newschema_p(&A, JSON_VALUE_STRING, NULL),
-            "bar", newschema_p(&A, JSON_VALUE_NUMBER, NULL),
             NULL),
           NULL),
         NULL),
       NULL);
 
-  const struct validation_test tests[] = {
-    // "description": "empty object should be valid"
-    { true, "{}", schema, },
-
-    // "description": "both schemas require an object"
-    { false, "1", schema, },
+  struct ast_schema *unique = newschema_p(&A, 0,
+      "uniqueItems", 1,
+      NULL);
 
-    // "description": "foo is a number"
-    { true, "{ \"foo\" : 5 }", schema, },
+  // the uniqueItems set is held by a split VM
+  struct ast_schema *anyof_unique = newschema_p(&A, 0,
+      "anyOf", schema_set(&A,
+        newschema_p(&A, 0,
+          "uniqueItems", 1,
+          NULL),
+        newschema_p(&A, 0,
+          "items_single", newschema(&A, JSON_VALUE_STRING),
+          "minItems", 5,
+          NULL),
+        NULL),
+      NULL);
 
-    // "description": "bar is a string"
-    { true, "{ \"bar\" : \"baz\" }", schema, },
+  const struct limit_test tests[] = {
+    { 0, "[[[1]]]", empty, { .depth = 3 } },
+    { JVST_INVALID_VM_DEPTH_LIMIT, "[[[[1]]]]", empty, { .depth = 3 } },
 
-    // "description": "foo is a string"
-    { true, "{ \"foo\" : \"quux\" }", schema, },
+    { 0, "[1, 2, 3, 4]", items, { .ninstr = 10000 } },
+    { JVST_INVALID_VM_INSTR_LIMIT, "[1, 2, 3, 4]", items, { .ninstr = 10 } },
 
-    // "description": "bar is a number"
-    { true, "{ \"bar\" : 7 }", schema, },
+    { 0, "{ \"foo\" : 5 }", anyof, { .nsplit = 2 } },
+    { JVST_INVALID_VM_SPLIT_LIMIT, "{ \"foo\" : 5 }", anyof, { .nsplit = 1 } },
 
-    // "description": "foo is a number and bar is a string"
-    { true, "{ \"bar\" : \"this\", \"foo\" : 0.3 }", schema, },
+    // the split VMs don't fit
+    { JVST_INVALID_VM_MEMORY_LIMIT, "{ \"foo\" : 5 }", anyof, { .memory = 1 } },
 
-    // "description": "foo is a string and bar is a number"
-    { true, "{ \"foo\" : \"that\", \"bar\" : 0.6 }", schema, },
+    // limits hit by a split VM fail the whole VM
+    { JVST_INVALID_VM_INSTR_LIMIT, "{ \"foo\" : 5 }", anyof, { .ninstr = 20 } },
+    { 0, "[\"aaaa\", \"bbbb\", \"cccc\"]", anyof_unique, { .uniq_bytes = 4096 } },
+    { JVST_INVALID_VM_UNIQUE_LIMIT, "[\"aaaa\", \"bbbb\", \"cccc\"]", anyof_unique, { .uniq_bytes = 40 } },
 
-    // "description": "invalid: foo is a string and bar is a string"
-    { false, "{ \"foo\" : \"abc\", \"bar\" : \"def\" }", schema, },
+    { 0, "[\"aaaa\", \"bbbb\", \"cccc\"]", unique, { .uniq_bytes = 4096 } },
+    { JVST_INVALID_VM_UNIQUE_LIMIT, "[\"aaaa\", \"bbbb\", \"cccc\"]", unique, { .uniq_bytes = 40 } },
 
-    // "description": "invalid: foo is a number and bar is a number"
-    { false, "{ \"foo\" : 4, \"bar\" : 0.25 }", schema, },
+    // limits don't make invalid documents valid
+    { JVST_INVALID_NOT_UNIQUE, "[\"aaaa\", \"aaaa\"]", unique, { .uniq_bytes = 4096 } },
 
-    { false, NULL, NULL },
+    { 0, NULL, NULL },
   };
 
-  RUNTESTS(tests);
+  for (i=0; tests[i].json != NULL; i++) {
+    struct jvst_vm_program *prog;
+    struct jvst_vm vm;
+    char buf[256];
+    enum jvst_result ret;
+
+    ntest++;
+
+    tests[i].schema->all_ids = &ids;
+    prog = jvst_compile_schema(tests[i].schema);
+
+    jvst_vm_init_defaults(&vm, prog);
+    jvst_vm_set_limits(&vm, &tests[i].limits);
+
+    strcpy(buf, tests[i].json);
+    ret = jvst_vm_more(&vm, buf, strlen(buf));
+    if (!JVST_IS_INVALID(ret)) {
+      ret = jvst_vm_close(&vm);
+    }
+
+    if (vm.error != tests[i].error) {
+      printf("%s[%d]: expected error %d (%s), found %d on %s\n",
+          __func__, i+1,
+          tests[i].error, tests[i].error ? jvst_invalid_msg(tests[i].error) : "valid",
+          vm.error, tests[i].json);
+      nfail++;
+    }
+
+    jvst_vm_finalize(&vm);
+    jvst_vm_program_free(prog);
+    tests[i].schema->all_ids = NULL;
+  }
 }
 
-void test_dependencies_1(void)
+struct early_exit_test {
+  enum jvst_vm_early_exit early_exit;
+  const char *json;           // the start of a document, never closed
+  struct ast_schema *schema;
+
+  int decided;                // decided after json
+  enum jvst_result result;    // jvst_vm_close() result
+};
+
+void test_early_exit(void)
 {
   struct arena_info A = {0};
-  // schema: { "dependencies": {"quux": ["foo", "bar"], "this": ["that"]} }
-  struct ast_schema *schema = newschema_p(&A, 0,
-          "dep_strings", newpropnames(&A,
-                           "quux", stringset(&A, "foo", "bar", NULL),
-                           "this", stringset(&A, "that", NULL),
-                           NULL),
-          NULL);
+  int i;
 
-  const struct validation_test tests[] = {
-    // "description": "empty object should be valid"
-    { true, "{}", schema, },
+  struct ast_string_set ids = {
+    .str = { .s = BASE_URI, .len = strlen(BASE_URI) }
+  };
 
-    // "description": "non-objects are valid"
-    { true, "1", schema, },
-    { true, "1.1", schema, },
-    { true, "[]", schema, },
-    { true, "true", schema, },
-    { true, "false", schema, },
-    { true, "null", schema, },
+  struct ast_schema *empty = newschema(&A, 0);
 
-    // "description": "foo by itself is valid"
-    { true, "{ \"foo\" : 5 }", schema, },
+  struct ast_schema *items = newschema_p(&A, 0,
+      "items_single", newschema(&A, JSON_VALUE_INTEGER),
+      NULL);
 
-    // "description": "bar by itself is valid"
-    { true, "{ \"bar\" : \"baz\" }", schema, },
+  const struct early_exit_test tests[] = {
+    // the default waits for the whole document
+    { JVST_VM_EXIT_AT_END, "[1, \"x\", ", items, 0, JVST_INVALID },
+    { JVST_VM_EXIT_AT_END, "[1, 2, ", empty, 0, JVST_INVALID },
 
-    // "description": "foo and bar by themselves are valid"
-    { true, "{ \"foo\" : \"quux\" }", schema, },
+    // invalid documents are decided at the first violation
+    { JVST_VM_EXIT_DECIDED, "[1, \"x\", ", items, 1, JVST_INVALID },
+    { JVST_VM_EXIT_DECIDED_NOCHECK, "[1, \"x\", ", items, 1, JVST_INVALID },
 
-    // "description": "quux and foo/bar without bar/foo is invalid"
-    { false, "{ \"quux\" : 3, \"foo\" : \"quux\" }", schema, },
-    { false, "{ \"quux\" : 3, \"bar\" : true }", schema, },
+    // valid ones need the rest of the document to be well formed...
+    { JVST_VM_EXIT_DECIDED, "[1, 2, ", empty, 0, JVST_INVALID },
+    { JVST_VM_EXIT_DECIDED, "[1, 2]", empty, 0, JVST_VALID },
 
-    // "description": "quux and both foo and bar is valid"
-    { true, "{ \"quux\" : 3, \"foo\" : \"this\", \"bar\" : false }", schema, },
+    // ... unless that isn't checked
+    { JVST_VM_EXIT_DECIDED_NOCHECK, "[1, 2, ", empty, 1, JVST_VALID },
+    { JVST_VM_EXIT_DECIDED_NOCHECK, "[1, 2, ", items, 0, JVST_INVALID },
 
-    // "description": "that by itself is valid"
-    { true, "{ \"that\" : 7 }", schema, },
+    { 0, NULL, NULL },
+  };
 
-    // "description": "this with that is valid"
-    { true, "{ \"this\" : 5, \"that\" : 0.3 }", schema, },
+  for (i=0; tests[i].json != NULL; i++) {
+    struct jvst_vm_program *prog;
+    struct jvst_vm vm;
+    char buf[256];
+    enum jvst_result ret;
+    int decided;
 
-    // "description": "this without that is invalid"
-    { false, "{ \"this\" : 5, \"foo\" : 0.3 }", schema, },
+    ntest++;
 
-    // "description": "this, that, and quux without both foo and bar is invalid"
-    { false, "{ \"this\" : 5, \"that\" : 0.6, \"quux\" : false }", schema, },
+    tests[i].schema->all_ids = &ids;
+    prog = jvst_compile_schema(tests[i].schema);
+
+    jvst_vm_init_defaults(&vm, prog);
+    jvst_vm_set_early_exit(&vm, tests[i].early_exit);
+
+    strcpy(buf, tests[i].json);
+    (void)jvst_vm_more(&vm, buf, strlen(buf));
+    decided = jvst_vm_decided(&vm);
+    ret = jvst_vm_close(&vm);
+
+    if ((decided != 0) != (tests[i].decided != 0) || ret != tests[i].result) {
+      printf("%s[%d]: expected %s and %s, found %s and %s on %s\n",
+          __func__, i+1,
+          tests[i].decided ? "decided" : "not decided",
+          tests[i].result == JVST_VALID ? "valid" : "invalid",
+          decided ? "decided" : "not decided",
+          ret == JVST_VALID ? "valid" : "invalid",
+          tests[i].json);
+      nfail++;
+    }
+
+    jvst_vm_finalize(&vm);
+    jvst_vm_program_free(prog);
+    tests[i].schema->all_ids = NULL;
+  }
+}
+
+void test_profile(void)
+{
+  struct arena_info A = {0};
+  unsigned flags;
+
+  struct ast_string_set ids = {
+    .str = { .s = BASE_URI, .len = strlen(BASE_URI) }
+  };
+
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "anyOf", schema_set(&A,
+        newschema_p(&A, JSON_VALUE_OBJECT,
+          "properties", newprops(&A,
+            "foo", newschema_p(&A, JSON_VALUE_NUMBER, NULL),
+            NULL),
+          NULL),
+        newschema_p(&A, JSON_VALUE_OBJECT,
+          "properties", newprops(&A,
+            "foo", newschema_p(&A, JSON_VALUE_STRING, NULL),
+            NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  schema->all_ids = &ids;
+
+  for (flags = 0; flags <= JVST_VM_PROF_TIME; flags += JVST_VM_PROF_TIME) {
+    struct jvst_vm_program *prog;
+    struct jvst_vm vm;
+    const struct jvst_vm_prof *prof;
+    char buf[] = "{ \"foo\" : 5, \"bar\" : [1, 2] }";
+    uint64_t nops, nprocs, ops_nsec, procs_nsec;
+    enum jvst_result ret;
+    size_t i;
+
+    ntest++;
+
+    prog = jvst_compile_schema(schema);
+
+    jvst_vm_init_defaults(&vm, prog);
+    jvst_vm_set_profile(&vm, flags, NULL);
+
+    (void)jvst_vm_more(&vm, buf, strlen(buf));
+    ret = jvst_vm_close(&vm);
+    prof = vm.prof;
+
+    nops = nprocs = ops_nsec = procs_nsec = 0;
+    for (i=0; i <= JVST_OP_MAX; i++) {
+      nops += prof->ops[i].n;
+      ops_nsec += prof->ops[i].nsec;
+    }
+
+    for (i=0; i < prof->nproc; i++) {
+      nprocs += prof->procs[i].n;
+      procs_nsec += prof->procs[i].nsec;
+    }
+
+    if (ret != JVST_VALID) {
+      printf("%s: profiled run is invalid\n", __func__);
+      nfail++;
+    } else if (nops == 0 || nops != nprocs) {
+      printf("%s: %llu instructions by opcode, %llu by proc\n",
+          __func__, (unsigned long long)nops, (unsigned long long)nprocs);
+      nfail++;
+    } else if (ops_nsec != procs_nsec || ((flags & JVST_VM_PROF_TIME) == 0 && ops_nsec != 0)) {
+      printf("%s: %llu nsec by opcode, %llu by proc\n",
+          __func__, (unsigned long long)ops_nsec, (unsigned long long)procs_nsec);
+      nfail++;
+    } else if (prof->nsplit != 1 || prof->split_vms != 2 || prof->split_max != 2 ||
+        prof->ops[JVST_OP_SPLIT].n + prof->ops[JVST_OP_SPLITV].n == 0) {
+      printf("%s: expected one split of 2 VMs, found %llu splits of %llu VMs\n",
+          __func__, (unsigned long long)prof->nsplit, (unsigned long long)prof->split_vms);
+      nfail++;
+    } else if (prof->match_bytes < 3 || prof->consume_tokens < 4 || prof->consume_bytes < 2) {
+      printf("%s: expected MATCH and CONSUME to be counted, found %llu match bytes, %llu consume tokens\n",
+          __func__, (unsigned long long)prof->match_bytes,
+          (unsigned long long)prof->consume_tokens);
+      nfail++;
+    }
+
+    jvst_vm_finalize(&vm);
+    jvst_vm_program_free(prog);
+  }
+
+  schema->all_ids = NULL;
+}
+
+enum { MERGE_NITEMS = 200, MERGE_MEMORY_LIMIT = 1 << 15 };
+
+// Split VMs that reach the same state are merged.  Merged VMs share the
+// budget and the profile of the VM that started the split, and must
+// give back the memory they were charged.
+void test_split_merge_limits(void)
+{
+  struct arena_info A = {0};
+  int i;
+
+  struct ast_string_set ids = {
+    .str = { .s = BASE_URI, .len = strlen(BASE_URI) }
+  };
+
+  // schema: { "items": { "anyOf": [ { "required": ["a"] }, { "required": ["a"] } ] } }
+  //
+  // the two split VMs of each item stay in the same state and are merged
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "items_single", newschema_p(&A, 0,
+        "anyOf", schema_set(&A,
+          newschema_p(&A, 0, "required", stringset(&A, "a", NULL), NULL),
+          newschema_p(&A, 0, "required", stringset(&A, "a", NULL), NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  // enough memory for the splits of one item at a time, so memory
+  // that merged VMs don't give back runs out over the document
+  const struct jvst_vm_limits limits = {
+    .nsplit = 16,
+    .memory = MERGE_MEMORY_LIMIT,
+  };
+
+  const struct {
+    const char *item;
+    enum jvst_result result;
+  } tests[] = {
+    { "{ \"a\" : 1 }", JVST_VALID },
+    { "{ \"b\" : 1, \"a\" : 2 }", JVST_VALID },
+    { "{ \"b\" : 1 }", JVST_INVALID },
+    { NULL },
+  };
+
+  schema->all_ids = &ids;
+
+  for (i=0; tests[i].item != NULL; i++) {
+    struct jvst_vm_program *prog;
+    struct jvst_vm vm;
+    char buf[8192];
+    enum jvst_result ret;
+    size_t n, len;
+
+    ntest++;
+
+    // the item is last, so invalid items don't stop the run early
+    len = 0;
+    buf[len++] = '[';
+    for (n=0; n < MERGE_NITEMS; n++) {
+      len += sprintf(&buf[len], "{ \"a\" : %zu }, ", n);
+    }
+    len += sprintf(&buf[len], "%s ]", tests[i].item);
+    assert(len < sizeof buf);
+
+    prog = jvst_compile_schema(schema);
+
+    jvst_vm_init_defaults(&vm, prog);
+    jvst_vm_set_limits(&vm, &limits);
+    jvst_vm_set_profile(&vm, 0, NULL);
+
+    ret = jvst_vm_more(&vm, buf, len);
+    if (!JVST_IS_INVALID(ret)) {
+      ret = jvst_vm_close(&vm);
+    }
+
+    if (ret != tests[i].result ||
+        vm.error == JVST_INVALID_VM_MEMORY_LIMIT || vm.error == JVST_INVALID_VM_SPLIT_LIMIT) {
+      printf("%s[%d]: expected %s, found %s (error %d) on %s\n",
+          __func__, i+1,
+          tests[i].result == JVST_VALID ? "valid" : "invalid",
+          ret == JVST_VALID ? "valid" : "invalid",
+          vm.error, tests[i].item);
+      nfail++;
+    } else if (vm.prof->split_vms == 0) {
+      printf("%s[%d]: expected split VMs in the profile\n", __func__, i+1);
+      nfail++;
+    }
+
+    jvst_vm_finalize(&vm);
+    jvst_vm_program_free(prog);
+  }
+
+  schema->all_ids = NULL;
+}
+
+// Strings that arrive in pieces are only counted for procs that read
+// %TLEN, see JVST_VM_PROC_TLEN
+void test_string_pieces(void)
+{
+  struct arena_info A = {0};
+  int i;
+
+  struct ast_string_set ids = {
+    .str = { .s = BASE_URI, .len = strlen(BASE_URI) }
+  };
+
+  const struct {
+    struct ast_schema *schema;
+    unsigned flags;
+    const char *json;
+    enum jvst_result result;
+  } tests[] = {
+    { newschema_p(&A, JSON_VALUE_STRING, "minLength", 10, NULL),
+      JVST_VM_PROC_TLEN, "\"h\xc3\xa9llo w\xc3\xb6rld\"", JVST_VALID },
+    { newschema_p(&A, JSON_VALUE_STRING, "minLength", 10, NULL),
+      JVST_VM_PROC_TLEN, "\"h\xc3\xa9llo\"", JVST_INVALID },
+    { newschema_p(&A, JSON_VALUE_STRING, "maxLength", 3, NULL),
+      JVST_VM_PROC_TLEN, "\"\xe6\x97\xa5\xe6\x9c\xac\"", JVST_VALID },
+    { newschema_p(&A, JSON_VALUE_STRING, "maxLength", 3, NULL),
+      JVST_VM_PROC_TLEN, "\"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9ex\"", JVST_INVALID },
+    { newschema_p(&A, JSON_VALUE_STRING, NULL),
+      0, "\"h\xc3\xa9llo w\xc3\xb6rld\"", JVST_VALID },
+    { newschema_p(&A, JSON_VALUE_STRING, "pattern", "h.*", NULL),
+      0, "\"h\xc3\xa9llo w\xc3\xb6rld\"", JVST_VALID },
+
+    { NULL, 0, NULL, 0 },
+  };
+
+  for (i=0; tests[i].schema != NULL; i++) {
+    struct jvst_vm_program *prog;
+    struct jvst_vm vm;
+    char buf[256];
+    enum jvst_result ret;
+    size_t off, n;
+    unsigned flags;
+
+    ntest++;
+
+    tests[i].schema->all_ids = &ids;
+    prog = jvst_compile_schema(tests[i].schema);
+
+    // the root proc is the only one
+    flags = jvst_vm_arg_tolit(jvst_vm_decode_arg1(prog->code[0]));
+    if (flags != tests[i].flags) {
+      printf("%s[%d]: expected PROC flags 0x%x, found 0x%x\n",
+          __func__, i+1, tests[i].flags, flags);
+      nfail++;
+    }
+
+    // two bytes at a time splits the multibyte characters
+    jvst_vm_init_defaults(&vm, prog);
+    strcpy(buf, tests[i].json);
+    n = strlen(buf);
+    ret = JVST_MORE;
+    for (off = 0; off < n && !JVST_IS_INVALID(ret); off += 2) {
+      ret = jvst_vm_more(&vm, buf + off, (n - off < 2) ? n - off : 2);
+    }
+    if (!JVST_IS_INVALID(ret)) {
+      ret = jvst_vm_close(&vm);
+    }
+
+    if (ret != tests[i].result) {
+      printf("%s[%d]: expected %s, found %s on %s\n",
+          __func__, i+1,
+          tests[i].result == JVST_VALID ? "valid" : "invalid",
+          ret == JVST_VALID ? "valid" : "invalid",
+          tests[i].json);
+      nfail++;
+    }
+
+    jvst_vm_finalize(&vm);
+    jvst_vm_program_free(prog);
+    tests[i].schema->all_ids = NULL;
+  }
+}
+
+void test_minimum(void)
+{
+  struct arena_info A = {0};
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "minimum", 1.1,
+      NULL);
+
+  const struct validation_test tests[] = {
+    // "description": "above the minimum is valid",
+    { true, "2.6", schema },
+
+    // "description": "boundary point is valid",
+    { true, "1.1", schema },
+
+    // "description": "below the minimum is invalid",
+    { false, "0.6", schema },
+
+    // "description": "ignores non-numbers",
+    { true, "\"x\"", schema },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_maximum_large_integers(void)
+{
+  struct arena_info A = {0};
+
+  // 2^53, the largest double that still represents every integer
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "maximum", 9007199254740992.0,
+      NULL);
+
+  const struct validation_test tests[] = {
+    { true, "9007199254740991", schema },
+    { true, "9007199254740992", schema },
+
+    // rounds to 2^53 as a double, but is larger
+    { false, "9007199254740993", schema },
+
+    { true, "-9223372036854775808", schema },
+    { false, "9223372036854775807", schema },
+
+    // too large for an int64, decided with the double value
+    { false, "18446744073709551616", schema },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_multiple_of(void)
+{
+  struct arena_info A = {0};
+  struct ast_schema *by_int = newschema_p(&A, 0,
+      "multipleOf", 3.0,
+      NULL);
+
+  struct ast_schema *by_float = newschema_p(&A, 0,
+      "multipleOf", 0.5,
+      NULL);
+
+  const struct validation_test tests[] = {
+    { true, "0", by_int },
+    { true, "9", by_int },
+    { true, "-9", by_int },
+    { false, "10", by_int },
+    { true, "9e0", by_int },
+    { true, "9.0", by_int },
+    { false, "9.5", by_int },
+    { true, "\"x\"", by_int },
+
+    // 2^53+1 is a multiple of 3, but 2^53 (its double value) is not
+    { true, "9007199254740993", by_int },
+    { false, "9007199254740992", by_int },
+    { true, "-9223372036854775806", by_int },
+
+    { true, "4.5", by_float },
+    { true, "4", by_float },
+    { false, "4.25", by_float },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_anyof_1(void)
+{
+  struct arena_info A = {0};
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "anyOf", schema_set(&A, 
+        newschema_p(&A, JSON_VALUE_INTEGER, NULL),
+        newschema_p(&A, 0, "minimum", 2.0, NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    // "description": "first anyOf valid",
+    { true, "1", schema, },
+    // "description": "second anyOf valid",
+    { true, "2.5", schema, },
+    // "description": "both anyOf valid",
+    { true, "3", schema, },
+    // "description": "neither anyOf valid",
+    { false, "1.5", schema, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_anyof_2(void)
+{
+  struct arena_info A = {0};
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "anyOf", schema_set(&A, 
+        newschema_p(&A, JSON_VALUE_OBJECT,
+          "properties", newprops(&A,
+            "foo", newschema_p(&A, JSON_VALUE_NUMBER, NULL),
+            "bar", newschema_p(&A, JSON_VALUE_STRING, NULL),
+            NULL),
+          NULL),
+        newschema_p(&A, JSON_VALUE_OBJECT,
+          "properties", newprops(&A,
+            "foo", newschema_p(&A, JSON_VALUE_STRING, NULL),
+            "bar", newschema_p(&A, JSON_VALUE_NUMBER, NULL),
+            NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    // "description": "empty object should be valid"
+    { true, "{}", schema, },
+
+    // "description": "both schemas require an object"
+    { false, "1", schema, },
+
+    // "description": "foo is a number"
+    { true, "{ \"foo\" : 5 }", schema, },
+
+    // "description": "bar is a string"
+    { true, "{ \"bar\" : \"baz\" }", schema, },
+
+    // "description": "foo is a string"
+    { true, "{ \"foo\" : \"quux\" }", schema, },
+
+    // "description": "bar is a number"
+    { true, "{ \"bar\" : 7 }", schema, },
+
+    // "description": "foo is a number and bar is a string"
+    { true, "{ \"bar\" : \"this\", \"foo\" : 0.3 }", schema, },
+
+    // "description": "foo is a string and bar is a number"
+    { true, "{ \"foo\" : \"that\", \"bar\" : 0.6 }", schema, },
+
+    // "description": "invalid: foo is a string and bar is a string"
+    { false, "{ \"foo\" : \"abc\", \"bar\" : \"def\" }", schema, },
+
+    // "description": "invalid: foo is a number and bar is a number"
+    { false, "{ \"foo\" : 4, \"bar\" : 0.25 }", schema, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_oneof_discriminator(void)
+{
+  struct arena_info A = {0};
+  // schema: { "oneOf": [
+  //   { "properties": { "kind": { "const": "circle" }, "r": { "type": "number" } }, "required": ["kind"] },
+  //   { "properties": { "kind": { "const": "square" }, "side": { "type": "number" } }, "required": ["kind"] }
+  // ] }
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "oneOf", schema_set(&A,
+        newschema_p(&A, 0,
+          "properties", newprops(&A,
+            "kind", newschema_p(&A, 0, "const", newjson_str(&A, "circle"), NULL),
+            "r", newschema_p(&A, JSON_VALUE_NUMBER, NULL),
+            NULL),
+          "required", stringset(&A, "kind", NULL),
+          NULL),
+        newschema_p(&A, 0,
+          "properties", newprops(&A,
+            "kind", newschema_p(&A, 0, "const", newjson_str(&A, "square"), NULL),
+            "side", newschema_p(&A, JSON_VALUE_NUMBER, NULL),
+            NULL),
+          "required", stringset(&A, "kind", NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    { true, "{ \"kind\" : \"circle\", \"r\" : 1.5 }", schema, },
+    { true, "{ \"side\" : 2, \"kind\" : \"square\" }", schema, },
+    { true, "{ \"kind\" : \"square\", \"r\" : \"big\" }", schema, },
+
+    { false, "{ \"kind\" : \"circle\", \"r\" : \"big\" }", schema, },
+    { false, "{ \"kind\" : \"triangle\" }", schema, },
+    { false, "{ \"r\" : 1.5 }", schema, },
+    { false, "{}", schema, },
+    { false, "\"circle\"", schema, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+
+  // the discriminator is checked while walking the object, without
+  // splitting the validator
+  ntest++;
+  if (schema_has_split(schema)) {
+    fprintf(stderr, "test_oneof_discriminator: oneOf should not SPLIT\n");
+    nfail++;
+  }
+}
+
+void test_oneof_with_anyof(void)
+{
+  struct arena_info A = {0};
+  // schema: { "type": "object", "allOf": [
+  //   { "anyOf": [ { "required": ["a"] }, { "required": ["b"] } ] },
+  //   { "oneOf": [ { "required": ["c"] }, { "required": ["d"] } ] }
+  // ] }
+  //
+  // the oneOf shares a split with the anyOf, so its frames are
+  // counted in the same bitvector
+  struct ast_schema *schema = newschema_p(&A, JSON_VALUE_OBJECT,
+      "allOf", schema_set(&A,
+        newschema_p(&A, 0,
+          "anyOf", schema_set(&A,
+            newschema_p(&A, 0, "required", stringset(&A, "a", NULL), NULL),
+            newschema_p(&A, 0, "required", stringset(&A, "b", NULL), NULL),
+            NULL),
+          NULL),
+        newschema_p(&A, 0,
+          "oneOf", schema_set(&A,
+            newschema_p(&A, 0, "required", stringset(&A, "c", NULL), NULL),
+            newschema_p(&A, 0, "required", stringset(&A, "d", NULL), NULL),
+            NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    { true, "{ \"a\" : 1, \"c\" : 1 }", schema, },
+    { true, "{ \"b\" : 1, \"d\" : 1 }", schema, },
+    { true, "{ \"a\" : 1, \"b\" : 1, \"d\" : 1 }", schema, },
+
+    { false, "{ \"a\" : 1, \"c\" : 1, \"d\" : 1 }", schema, },
+    { false, "{ \"a\" : 1 }", schema, },
+    { false, "{ \"c\" : 1 }", schema, },
+    { false, "{}", schema, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_oneof_discriminator_enum(void)
+{
+  struct arena_info A = {0};
+  // schema: { "oneOf": [
+  //   { "properties": { "kind": { "enum": [ "a", "b" ] }, "n": { "type": "integer" } }, "required": ["kind", "n"] },
+  //   { "properties": { "kind": { "const": "c" }, "n": { "maximum": 3 } }, "required": ["kind"] },
+  //   { "properties": { "kind": { "const": "d" }, "s": { "enum": [ "x", "y" ] } }, "required": ["kind"] }
+  // ] }
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "oneOf", schema_set(&A,
+        newschema_p(&A, 0,
+          "properties", newprops(&A,
+            "kind", newschema_p(&A, 0, "enum", newjson_str(&A, "a"), "enum", newjson_str(&A, "b"), NULL),
+            "n", newschema_p(&A, JSON_VALUE_INTEGER, NULL),
+            NULL),
+          "required", stringset(&A, "kind", "n", NULL),
+          NULL),
+        newschema_p(&A, 0,
+          "properties", newprops(&A,
+            "kind", newschema_p(&A, 0, "const", newjson_str(&A, "c"), NULL),
+            "n", newschema_p(&A, 0, "maximum", 3.0, NULL),
+            NULL),
+          "required", stringset(&A, "kind", NULL),
+          NULL),
+        newschema_p(&A, 0,
+          "properties", newprops(&A,
+            "kind", newschema_p(&A, 0, "const", newjson_str(&A, "d"), NULL),
+            "s", newschema_p(&A, 0, "enum", newjson_str(&A, "x"), "enum", newjson_str(&A, "y"), NULL),
+            NULL),
+          "required", stringset(&A, "kind", NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    { true, "{ \"kind\" : \"a\", \"n\" : 7 }", schema, },
+    { true, "{ \"n\" : 7, \"kind\" : \"b\" }", schema, },
+    { true, "{ \"kind\" : \"c\", \"n\" : 2.5 }", schema, },
+    { true, "{ \"kind\" : \"c\", \"n\" : \"many\" }", schema, },
+    { true, "{ \"kind\" : \"d\", \"s\" : \"y\", \"n\" : [] }", schema, },
+
+    { false, "{ \"kind\" : \"a\" }", schema, },
+    { false, "{ \"kind\" : \"a\", \"n\" : 7.5 }", schema, },
+    { false, "{ \"kind\" : \"c\", \"n\" : 4 }", schema, },
+    { false, "{ \"kind\" : \"d\", \"s\" : \"z\" }", schema, },
+    { false, "{ \"kind\" : \"d\", \"s\" : 1 }", schema, },
+    { false, "{ \"kind\" : \"e\" }", schema, },
+    { false, "{ \"kind\" : 1 }", schema, },
+    { false, "{ \"n\" : 1 }", schema, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+
+  ntest++;
+  if (schema_has_split(schema)) {
+    fprintf(stderr, "test_oneof_discriminator_enum: oneOf should not SPLIT\n");
+    nfail++;
+  }
+}
+
+void test_oneof_in_property(void)
+{
+  struct arena_info A = {0};
+  // schema: { "required": ["p"], "properties": { "g": { "oneOf": [
+  //   { "properties": { "type": { "const": "L" } }, "required": ["type"] },
+  //   { "properties": { "type": { "const": "P" }, "c": { "items": { "type": "number" } } }, "required": ["type"] }
+  // ] } } }
+  //
+  // the oneOf becomes an OR of two splits, and the object around it
+  // is translated twice, so the first translation must leave the OR
+  // intact
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "required", stringset(&A, "p", NULL),
+      "properties", newprops(&A,
+        "g", newschema_p(&A, 0,
+          "oneOf", schema_set(&A,
+            newschema_p(&A, 0,
+              "properties", newprops(&A,
+                "type", newschema_p(&A, 0, "const", newjson_str(&A, "L"), NULL),
+                NULL),
+              "required", stringset(&A, "type", NULL),
+              NULL),
+            newschema_p(&A, 0,
+              "properties", newprops(&A,
+                "type", newschema_p(&A, 0, "const", newjson_str(&A, "P"), NULL),
+                "c", newschema_p(&A, 0, "items_single", newschema(&A, JSON_VALUE_NUMBER), NULL),
+                NULL),
+              "required", stringset(&A, "type", NULL),
+              NULL),
+            NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    { true, "{ \"p\" : 1 }", schema, },
+    { true, "{ \"p\" : 1, \"g\" : { \"type\" : \"L\" } }", schema, },
+    { true, "{ \"p\" : 1, \"g\" : { \"type\" : \"P\", \"c\" : [ 1, 2 ] } }", schema, },
+
+    { false, "{ \"p\" : 1, \"g\" : { \"type\" : \"P\", \"c\" : [ \"x\" ] } }", schema, },
+    { false, "{ \"p\" : 1, \"g\" : { \"type\" : \"X\" } }", schema, },
+    { false, "{ \"p\" : 1, \"g\" : {} }", schema, },
+    { false, "{ \"g\" : { \"type\" : \"L\" } }", schema, },
+    { false, "{ \"p\" : 1, \"g\" : 5 }", schema, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_split_duplicates(void)
+{
+  struct arena_info A = {0};
+  // schema: { "items": { "oneOf": [ { "type": "integer" }, { "type": "integer" } ] } }
+  struct ast_schema *schema_oneof = newschema_p(&A, 0,
+      "items_single", newschema_p(&A, 0,
+        "oneOf", schema_set(&A,
+          newschema_p(&A, JSON_VALUE_INTEGER, NULL),
+          newschema_p(&A, JSON_VALUE_INTEGER, NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  // schema: { "items": { "anyOf": [
+  //   { "items": { "anyOf": [ { "type": "integer" }, { "type": "integer" } ] } },
+  //   { "items": { "anyOf": [ { "type": "integer" }, { "minimum": 2 } ] } }
+  // ] } }
+  struct ast_schema *schema_nested = newschema_p(&A, 0,
+      "items_single", newschema_p(&A, 0,
+        "anyOf", schema_set(&A,
+          newschema_p(&A, 0,
+            "items_single", newschema_p(&A, 0,
+              "anyOf", schema_set(&A,
+                newschema_p(&A, JSON_VALUE_INTEGER, NULL),
+                newschema_p(&A, JSON_VALUE_INTEGER, NULL),
+                NULL),
+              NULL),
+            NULL),
+          newschema_p(&A, 0,
+            "items_single", newschema_p(&A, 0,
+              "anyOf", schema_set(&A,
+                newschema_p(&A, JSON_VALUE_INTEGER, NULL),
+                newschema_p(&A, 0, "minimum", 2.0, NULL),
+                NULL),
+              NULL),
+            NULL),
+          NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    // splits that stay in the same state must still each count
+    // towards the oneOf
+    { true, "[]", schema_oneof, },
+    { false, "[ 1 ]", schema_oneof, },
+    { false, "[ 1.5 ]", schema_oneof, },
+    { false, "[ \"a\" ]", schema_oneof, },
+
+    { true, "[]", schema_nested, },
+    { true, "[ [], [ 1, 2 ], [ 3, 2.5 ] ]", schema_nested, },
+    { true, "[ [ 1, 2, 3 ], [ 4, 5 ], [ 6 ] ]", schema_nested, },
+    { false, "[ [ 1 ], [ 1.5 ] ]", schema_nested, },
+    { true, "[ [ 1, 2 ], [ 3, \"x\" ] ]", schema_nested, },
+    { false, "[ [ 1, 2 ], [ 3, 1.5 ] ]", schema_nested, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_shared_subschemas(void)
+{
+  struct arena_info A = {0};
+  // the same sub-schema appears under several properties and in both
+  // branches of an anyOf.
+  //
+  // schema: { "properties": {
+  //   "a": { "type": "string", "pattern": "id-.*", "minLength": 4 },
+  //   "b": { "type": "string", "pattern": "id-.*", "minLength": 4 },
+  //   "c": { "anyOf": [
+  //     { "type": "string", "pattern": "id-.*", "minLength": 4 },
+  //     { "type": "number", "minimum": 2.5 } ] },
+  //   "d": { "type": "number", "minimum": 2.5 }
+  // } }
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "properties", newprops(&A,
+        "a", newschema_p(&A, JSON_VALUE_STRING, "pattern", "id-.*", "minLength", 4, NULL),
+        "b", newschema_p(&A, JSON_VALUE_STRING, "pattern", "id-.*", "minLength", 4, NULL),
+        "c", newschema_p(&A, 0,
+          "anyOf", schema_set(&A,
+            newschema_p(&A, JSON_VALUE_STRING, "pattern", "id-.*", "minLength", 4, NULL),
+            newschema_p(&A, JSON_VALUE_NUMBER, "minimum", 2.5, NULL),
+            NULL),
+          NULL),
+        "d", newschema_p(&A, JSON_VALUE_NUMBER, "minimum", 2.5, NULL),
+        NULL),
+      NULL);
+
+  const struct validation_test tests[] = {
+    { true, "{}", schema, },
+    { true, "{ \"a\" : \"id-1\", \"b\" : \"id-22\" }", schema, },
+    { true, "{ \"c\" : \"id-3\", \"d\" : 2.5 }", schema, },
+    { true, "{ \"c\" : 3, \"b\" : \"id-x\" }", schema, },
+
+    { false, "{ \"a\" : \"id-1\", \"b\" : \"xx-22\" }", schema, },
+    { false, "{ \"a\" : \"id-\" }", schema, },
+    { false, "{ \"b\" : 7 }", schema, },
+    { false, "{ \"c\" : 2 }", schema, },
+    { false, "{ \"c\" : \"id\" }", schema, },
+    { false, "{ \"d\" : 1 }", schema, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+void test_dependencies_1(void)
+{
+  struct arena_info A = {0};
+  // schema: { "dependencies": {"quux": ["foo", "bar"], "this": ["that"]} }
+  struct ast_schema *schema = newschema_p(&A, 0,
+          "dep_strings", newpropnames(&A,
+                           "quux", stringset(&A, "foo", "bar", NULL),
+                           "this", stringset(&A, "that", NULL),
+                           NULL),
+          NULL);
+
+  const struct validation_test tests[] = {
+    // "description": "empty object should be valid"
+    { true, "{}", schema, },
+
+    // "description": "non-objects are valid"
+    { true, "1", schema, },
+    { true, "1.1", schema, },
+    { true, "[]", schema, },
+    { true, "true", schema, },
+    { true, "false", schema, },
+    { true, "null", schema, },
+
+    // "description": "foo by itself is valid"
+    { true, "{ \"foo\" : 5 }", schema, },
+
+    // "description": "bar by itself is valid"
+    { true, "{ \"bar\" : \"baz\" }", schema, },
+
+    // "description": "foo and bar by themselves are valid"
+    { true, "{ \"foo\" : \"quux\" }", schema, },
+
+    // "description": "quux and foo/bar without bar/foo is invalid"
+    { false, "{ \"quux\" : 3, \"foo\" : \"quux\" }", schema, },
+    { false, "{ \"quux\" : 3, \"bar\" : true }", schema, },
+
+    // "description": "quux and both foo and bar is valid"
+    { true, "{ \"quux\" : 3, \"foo\" : \"this\", \"bar\" : false }", schema, },
+
+    // "description": "that by itself is valid"
+    { true, "{ \"that\" : 7 }", schema, },
+
+    // "description": "this with that is valid"
+    { true, "{ \"this\" : 5, \"that\" : 0.3 }", schema, },
+
+    // "description": "this without that is invalid"
+    { false, "{ \"this\" : 5, \"foo\" : 0.3 }", schema, },
+
+    // "description": "this, that, and quux without both foo and bar is invalid"
+    { false, "{ \"this\" : 5, \"that\" : 0.6, \"quux\" : false }", schema, },
     { false, "{ \"this\" : 5, \"that\" : 0.6, \"quux\" : false, \"foo\" : 3 }", schema, },
     { false, "{ \"this\" : 5, \"that\" : 0.6, \"quux\" : false, \"bar\" : [1,2,3] }", schema, },
 
@@ -820,6 +2050,194 @@ void test_items_1(void)
   RUNTESTS(tests);
 }
 
+void test_unique_items(void)
+{
+  struct arena_info A = {0};
+  // schema: { "uniqueItems": true }
+  struct ast_schema *schema = newschema_p(&A, 0,
+      "uniqueItems", 1,
+      NULL);
+
+  // schema: { "items": { "type": "number" }, "uniqueItems": true }
+  struct ast_schema *numbers = newschema_p(&A, 0,
+      "items_single", newschema(&A, JSON_VALUE_NUMBER),
+      "uniqueItems", 1,
+      NULL);
+
+  // each test runs through the checked and verified interpreters and
+  // the JIT, so this covers the UNIQUE ops on all three
+  const struct validation_test tests[] = {
+    { true, "[]", schema, },
+    { true, "[ 1, 2, 3 ]", schema, },
+    { true, "[ 0, false ]", schema, },
+    { true, "[ 1, true ]", schema, },
+    { true, "[ \"a\", \"ab\" ]", schema, },
+    { true, "[ { \"a\" : 1 }, { \"a\" : 2 } ]", schema, },
+    { true, "[ [ 1, 2 ], [ 2, 1 ] ]", schema, },
+    { true, "[ [ 1 ], 1 ]", schema, },
+    { true, "{ \"a\" : 1, \"b\" : 1 }", schema, },
+
+    { false, "[ 1, 1 ]", schema, },
+    { false, "[ 1, 1.0 ]", schema, },
+    { false, "[ null, null ]", schema, },
+    { false, "[ 0, -0 ]", schema, },
+    { false, "[ [ 0 ], [ -0.0 ] ]", schema, },
+    { false, "[ \"a\", \"b\", \"a\" ]", schema, },
+    { false, "[ { \"a\" : 1, \"b\" : 2 }, { \"b\" : 2, \"a\" : 1 } ]", schema, },
+    { false, "[ [ 1, 2 ], [ 1, 2 ] ]", schema, },
+    { false, "[ { \"a\" : [ 1 ] }, { \"a\" : [ 1 ] }, 3 ]", schema, },
+
+    { true, "[ 1, 2.5, 3 ]", numbers, },
+    { false, "[ 1, 2.5, 1 ]", numbers, },
+    { false, "[ 1, \"x\" ]", numbers, },
+
+    { false, NULL, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+struct explain_test {
+  const char *json;
+  int code;                   // 0 if the document is valid
+  const char *instance;
+  const char *schema;
+  const char *keyword;
+  size_t offset;
+};
+
+// reads a document in pieces that end after each comma, so tokens
+// aren't split but the failures are in later pieces.  The parser's
+// offset is into the piece it was given, so the offsets only match
+// reading the document whole if explain adds up the pieces before.
+static size_t
+read_commas(void *opaque, char **bufp)
+{
+  char **pos = opaque;
+  char *comma;
+  size_t n;
+
+  *bufp = *pos;
+  comma = strchr(*pos, ',');
+  n = (comma != NULL) ? (size_t)(comma - *pos) + 1 : strlen(*pos);
+  *pos += n;
+
+  return n;
+}
+
+static int
+explain_matches(const struct explain_test *t, enum jvst_result ret, const struct jvst_vm_explain *ex)
+{
+  if (t->code == 0) {
+    return ret == JVST_VALID;
+  }
+
+  return ret == JVST_INVALID && ex->code == t->code &&
+    strcmp(ex->instance, t->instance) == 0 &&
+    ex->schema != NULL && strcmp(ex->schema, t->schema) == 0 &&
+    ex->keyword != NULL && strcmp(ex->keyword, t->keyword) == 0 &&
+    ex->offset == t->offset;
+}
+
+void test_explain(void)
+{
+  struct arena_info A = {0};
+  struct jvst_vm_program *prog;
+  int i;
+
+  struct ast_schema *schema = newschema_p(&A, JSON_VALUE_OBJECT,
+      "path", BASE_URI "#",
+      "properties", newprops(&A,
+        "foo", newschema_p(&A, JSON_VALUE_ARRAY,
+          "path", BASE_URI "#/properties/foo",
+          "items_single", newschema_p(&A, JSON_VALUE_INTEGER,
+            "path", BASE_URI "#/properties/foo/items",
+            NULL),
+          NULL),
+        "a/b", newschema_p(&A, JSON_VALUE_NUMBER,
+          "path", BASE_URI "#/properties/a~1b",
+          "minimum", 5.0,
+          "maximum", 10.0,
+          NULL),
+        "addr", newschema_p(&A, JSON_VALUE_OBJECT,
+          "path", BASE_URI "#/properties/addr",
+          "properties", newprops(&A,
+            "zip", newschema_p(&A, JSON_VALUE_STRING,
+              "path", BASE_URI "#/properties/addr/properties/zip",
+              "pattern", "[0-9]+",
+              "minLength", 5,
+              NULL),
+            NULL),
+          NULL),
+        NULL),
+      "required", stringset(&A, "foo", NULL),
+      NULL);
+
+  // each failure names the keyword that failed, even where several
+  // keywords of a schema fail with the same code
+  const struct explain_test tests[] = {
+    { "{ \"foo\" : [1, 2, \"x\"] }",
+      JVST_INVALID_UNEXPECTED_TOKEN, "/foo/2", "#/properties/foo/items", "type", 20 },
+
+    { "{ \"foo\" : [], \"a/b\" : 3 }",
+      JVST_INVALID_NUMBER, "/a~1b", "#/properties/a~1b", "minimum", 23 },
+
+    { "{ \"foo\" : [], \"a/b\" : 12 }",
+      JVST_INVALID_NUMBER, "/a~1b", "#/properties/a~1b", "maximum", 24 },
+
+    { "{ \"foo\" : [], \"addr\" : { \"zip\" : \"abcde\" } }",
+      JVST_INVALID_STRING, "/addr/zip", "#/properties/addr/properties/zip", "pattern", 40 },
+
+    { "{ \"foo\" : [], \"addr\" : { \"zip\" : \"123\" } }",
+      JVST_INVALID_LENGTH_TOO_SHORT, "/addr/zip", "#/properties/addr/properties/zip", "minLength", 38 },
+
+    // failures at the end of an object are at the object
+    { "{ \"a/b\" : 7 }",
+      JVST_INVALID_MISSING_REQUIRED_PROPERTIES, "", "#", "required", 13 },
+
+    { "{ \"foo\" : [1, 2], \"a/b\" : 7 }", 0 },
+
+    { NULL },
+  };
+
+  prog = jvst_compile_schema(schema);
+
+  for (i=0; tests[i].json != NULL; i++) {
+    struct jvst_vm_explain ex;
+    enum jvst_result ret;
+    char buf[256], *pos;
+
+    ntest++;
+
+    strcpy(buf, tests[i].json);
+    ret = jvst_vm_explain(prog, NULL, buf, strlen(buf), &ex);
+    if (!explain_matches(&tests[i], ret, &ex)) {
+      printf("%s[%d]: unexpected explanation of %s\n", __func__, i+1, tests[i].json);
+      if (ret == JVST_INVALID) {
+        jvst_vm_explain_print(stdout, &ex);
+      }
+      nfail++;
+    }
+    jvst_vm_explain_finalize(&ex);
+
+    ntest++;
+
+    strcpy(buf, tests[i].json);
+    pos = buf;
+    ret = jvst_vm_explain_read(prog, NULL, read_commas, &pos, &ex);
+    if (!explain_matches(&tests[i], ret, &ex)) {
+      printf("%s[%d]: unexpected explanation of %s read in pieces\n", __func__, i+1, tests[i].json);
+      if (ret == JVST_INVALID) {
+        jvst_vm_explain_print(stdout, &ex);
+      }
+      nfail++;
+    }
+    jvst_vm_explain_finalize(&ex);
+  }
+
+  jvst_vm_program_free(prog);
+}
+
 int main(void)
 {
   test_empty_schema();
@@ -829,8 +2247,18 @@ int main(void)
   test_type_object();
 
   test_minimum();
+  test_maximum_large_integers();
+  test_multiple_of();
 
   test_properties();
+  test_properties_many_names();
+  test_match_cache();
+  test_resource_limits();
+  test_early_exit();
+  test_profile();
+  test_split_merge_limits();
+  test_string_pieces();
+  test_explain();
 
   test_minproperties_1();
   test_minproperties_2();
@@ -840,13 +2268,22 @@ int main(void)
   test_minmaxproperties_1();
 
   test_required();
+  test_required_wide();
 
   test_anyof_1();
   test_anyof_2();
+  test_oneof_discriminator();
+  test_oneof_with_anyof();
+  test_oneof_discriminator_enum();
+  test_oneof_in_property();
+  test_split_duplicates();
+  test_shared_subschemas();
+  test_some_of_wide();
 
   test_dependencies_1();
 
   test_items_1();
+  test_unique_items();
 
   return report_tests();
 }
@@ -0,0 +1,440 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jvst_macros.h"
+
+#include "sjp_lexer.h"
+#include "sjp_testing.h"
+
+#include "parser.h"
+#include "validate.h"
+#include "validate_vm.h"
+#include "validate_verify.h"
+
+#include "validate_testing.h"
+
+struct verify_test {
+  bool verifies;
+  struct jvst_vm_program *prog;
+};
+
+#define RUNTESTS(testlist) runtests(__func__, (testlist))
+static void runtests(const char *testname, const struct verify_test tests[])
+{
+  int i;
+
+  for (i=0; tests[i].prog != NULL; i++) {
+    struct jvst_vm_verify_error err = { 0 };
+    bool verifies;
+
+    ntest++;
+
+    verifies = (jvst_vm_verify(tests[i].prog, &err) == 0);
+    if (verifies != tests[i].verifies) {
+      printf("%s[%d]: expected program to %s verification",
+          testname, i+1, tests[i].verifies ? "pass" : "fail");
+      if (!verifies) {
+        printf(" (pc %u: %s)", (unsigned)err.pc, err.msg);
+      }
+      printf("\n");
+      nfail++;
+      continue;
+    }
+
+    if (verifies != (tests[i].prog->verified != 0)) {
+      printf("%s[%d]: program verified flag not set\n", testname, i+1);
+      nfail++;
+    }
+  }
+}
+
+static struct jvst_vm_program *
+compile_schema(const char *schema)
+{
+  struct sjp_lexer l = { 0 };
+  struct ast_schema ast = { 0 };
+  struct json_string uribase = { "http://example.com/verify.json", 30 };
+  struct jvst_vm_program *prog;
+  char *buf;
+  size_t len;
+
+  len = strlen(schema);
+  buf = malloc(len);
+  assert(buf != NULL);
+  memcpy(buf, schema, len);
+
+  sjp_lexer_init(&l);
+  sjp_lexer_more(&l, buf, len);
+  parse(&l, &ast, uribase);
+
+  prog = jvst_compile_schema(&ast);
+  free(buf);
+
+  return prog;
+}
+
+static void test_verify_valid(void)
+{
+  struct arena_info A = {0};
+
+  const struct verify_test tests[] = {
+    {
+      true,
+      newvm_program(&A,
+          VM_FLOATS, 1, 1.1,
+
+          JVST_OP_PROC, VMLIT(2), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_ICMP, VMREG(JVST_VM_TT), VMLIT(SJP_NUMBER),
+          JVST_OP_JMP, JVST_VM_BR_EQ, "true_2",
+          JVST_OP_RETURN, VMLIT(1), 0,
+
+          VM_LABEL, "true_2",
+          JVST_OP_MOVE, VMSLOT(1), VMREG(JVST_VM_TNUM),
+          JVST_OP_FLOAD, VMSLOT(0), VMLIT(0),
+          JVST_OP_FCMP, VMSLOT(1), VMSLOT(0),
+          JVST_OP_JMP, JVST_VM_BR_GE, "true_4",
+
+          JVST_OP_RETURN, VMLIT(3), 0,
+
+          VM_LABEL, "true_4",
+          JVST_OP_CONSUME, 0, 0,
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    {
+      true,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(1), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_ICMP, VMREG(JVST_VM_TT), VMLIT(SJP_ARRAY_BEG),
+          JVST_OP_JMP, JVST_VM_BR_NE, "invalid",
+
+          VM_LABEL, "loop",
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_ICMP, VMREG(JVST_VM_TT), VMLIT(SJP_ARRAY_END),
+          JVST_OP_JMP, JVST_VM_BR_EQ, "valid",
+          JVST_OP_TOKEN, 0, VMLIT(-1),
+          JVST_OP_CALL, 2,
+          JVST_OP_INCR, VMSLOT(0), VMLIT(1),
+          JVST_OP_JMP, JVST_VM_BR_ALWAYS, "loop",
+
+          VM_LABEL, "valid",
+          JVST_OP_RETURN, 0, 0,
+
+          VM_LABEL, "invalid",
+          JVST_OP_RETURN, VMLIT(1), 0,
+
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_CONSUME, 0, 0,
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    // uniqueItems procs end with UNIQUE EVAL
+    {
+      true,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          JVST_OP_UNIQUE, VMLIT(JVST_VM_UNIQUE_EVAL), VMLIT(0),
+          VM_END)
+    },
+
+    { false, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_verify_invalid(void)
+{
+  struct arena_info A = {0};
+
+  const struct verify_test tests[] = {
+    // slot past the end of the frame
+    {
+      false,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(1), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_ICMP, VMSLOT(1), VMLIT(0),
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    // float pool index past the end of the pool
+    {
+      false,
+      newvm_program(&A,
+          VM_FLOATS, 1, 1.5,
+
+          JVST_OP_PROC, VMLIT(1), VMLIT(0),
+          JVST_OP_FLOAD, VMSLOT(0), VMLIT(1),
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    // MATCH without any DFAs
+    {
+      false,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_MATCH, VMLIT(0), VMLIT(0),
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    // branch into another proc
+    {
+      false,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_JMP, JVST_VM_BR_ALWAYS, "other",
+
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          VM_LABEL, "other",
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    // control runs off the end of the proc
+    {
+      false,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_CONSUME, 0, 0,
+          VM_END)
+    },
+
+    // FCMP with a literal argument
+    {
+      false,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(1), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_FCMP, VMREG(JVST_VM_TNUM), VMLIT(1),
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    // SPLIT without a split table
+    {
+      false,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(1), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_SPLIT, VMLIT(0), VMSLOT(0),
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    { false, NULL },
+  };
+
+  RUNTESTS(tests);
+}
+
+static void test_verify_call(void)
+{
+  struct arena_info A = {0};
+  struct jvst_vm_program *prog;
+
+  const struct verify_test tests[] = {
+    {
+      true,
+      newvm_program(&A,
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          JVST_OP_CALL, 2,
+          JVST_OP_RETURN, 0, 0,
+
+          JVST_OP_PROC, VMLIT(0), VMLIT(0),
+          JVST_OP_TOKEN, 0, 0,
+          JVST_OP_RETURN, 0, 0,
+          VM_END)
+    },
+
+    { false, NULL },
+  };
+
+  RUNTESTS(tests);
+
+  // retarget the CALL at the TOKEN after the PROC
+  prog = tests[0].prog;
+  prog->verified = 0;
+  prog->code[1] = VMBR(JVST_OP_CALL, JVST_VM_BR_ALWAYS, 3);
+
+  ntest++;
+  if (jvst_vm_verify(prog, NULL) == 0) {
+    printf("%s: CALL to a non-PROC passed verification\n", __func__);
+    nfail++;
+  }
+}
+
+static void test_stack_bound(void)
+{
+  struct arena_info A = {0};
+  struct jvst_vm_program *prog;
+  size_t bound;
+
+  // 4 registers in each frame, 2 slots in the caller and the return
+  // address and frame pointer pushed by the CALL
+  prog = newvm_program(&A,
+      JVST_OP_PROC, VMLIT(2), VMLIT(0),
+      JVST_OP_CALL, 2,
+      JVST_OP_RETURN, 0, 0,
+
+      JVST_OP_PROC, VMLIT(1), VMLIT(0),
+      JVST_OP_TOKEN, 0, 0,
+      JVST_OP_RETURN, 0, 0,
+      VM_END);
+
+  ntest++;
+  bound = jvst_vm_stack_bound(prog);
+  if (bound != 4+2 + 2 + 4+1) {
+    printf("%s: expected a stack bound of %d, found %zu\n",
+        __func__, 4+2 + 2 + 4+1, bound);
+    nfail++;
+  }
+
+  // a stack bound that's too small fails verification
+  ntest++;
+  prog->maxstack = bound-1;
+  if (jvst_vm_verify(prog, NULL) == 0) {
+    printf("%s: program with a short stack bound passed verification\n",
+        __func__);
+    nfail++;
+  }
+
+  // recursive programs have no bound
+  prog = newvm_program(&A,
+      JVST_OP_PROC, VMLIT(0), VMLIT(0),
+      JVST_OP_TOKEN, 0, 0,
+      JVST_OP_ICMP, VMREG(JVST_VM_TT), VMLIT(SJP_ARRAY_BEG),
+      JVST_OP_JMP, JVST_VM_BR_NE, "done",
+      JVST_OP_CALL, 1,
+
+      VM_LABEL, "done",
+      JVST_OP_RETURN, 0, 0,
+      VM_END);
+
+  ntest++;
+  bound = jvst_vm_stack_bound(prog);
+  if (bound != JVST_VM_STACK_UNBOUNDED) {
+    printf("%s: expected a recursive program to be unbounded, found %zu\n",
+        __func__, bound);
+    nfail++;
+  }
+}
+
+// returns the first DFA of the program with a string table (strtab
+// non-zero) or a literal, NULL if there isn't one
+static struct jvst_vm_dfa *find_dfa(struct jvst_vm_program *prog, int strtab)
+{
+  size_t i;
+
+  for (i=0; i < prog->ndfa; i++) {
+    struct jvst_vm_dfa *dfa = &prog->dfas[i];
+
+    if (strtab ? dfa->strtab != NULL : dfa->lit_kind != JVST_VM_DFA_LIT_NONE) {
+      return dfa;
+    }
+  }
+
+  return NULL;
+}
+
+static void expect_verify(const char *testname, const char *what,
+    struct jvst_vm_program *prog, bool verifies)
+{
+  ntest++;
+  prog->verified = 0;
+  if ((jvst_vm_verify(prog, NULL) == 0) != verifies) {
+    printf("%s: program with %s %s verification\n",
+        testname, what, verifies ? "failed" : "passed");
+    nfail++;
+  }
+}
+
+static void test_verify_dfa(void)
+{
+  struct jvst_vm_program *prog;
+  struct jvst_vm_strtab *tab;
+  struct jvst_vm_strtab_slot *slot;
+  struct jvst_vm_dfa *dfa;
+  uint32_t nslots, off;
+  size_t i;
+
+  prog = compile_schema("{ \"required\" : [ \"foo\", \"bar\", \"baz\" ] }");
+  dfa = find_dfa(prog, 1);
+
+  ntest++;
+  if (dfa == NULL) {
+    printf("%s: expected a DFA with a string table\n", __func__);
+    nfail++;
+  } else {
+    tab = dfa->strtab;
+    expect_verify(__func__, "a string table", prog, true);
+
+    nslots = tab->nslots;
+    tab->nslots = nslots + 1;
+    expect_verify(__func__, "a string table that isn't a power of two", prog, false);
+    tab->nslots = nslots;
+
+    for (slot = NULL, i=0; i < tab->nslots; i++) {
+      if (tab->slots[i].which != 0) {
+        slot = &tab->slots[i];
+        break;
+      }
+    }
+
+    assert(slot != NULL);
+    off = slot->off;
+    slot->off = tab->keylen - slot->len + 1;
+    expect_verify(__func__, "a string table key past the key buffer", prog, false);
+    slot->off = off;
+
+    expect_verify(__func__, "a restored string table", prog, true);
+  }
+
+  jvst_vm_program_free(prog);
+
+  prog = compile_schema(
+      "{ \"patternProperties\" : { \"x-.*\" : { \"type\" : \"number\" } } }");
+  dfa = find_dfa(prog, 0);
+
+  ntest++;
+  if (dfa == NULL) {
+    printf("%s: expected a DFA with a literal\n", __func__);
+    nfail++;
+  } else {
+    enum jvst_vm_dfa_literal kind;
+
+    expect_verify(__func__, "a literal", prog, true);
+
+    kind = dfa->lit_kind;
+    dfa->lit_kind = JVST_VM_DFA_LIT_SUBSTR + 1;
+    expect_verify(__func__, "an invalid literal kind", prog, false);
+    dfa->lit_kind = kind;
+  }
+
+  jvst_vm_program_free(prog);
+}
+
+int main(void)
+{
+  test_verify_valid();
+  test_verify_invalid();
+  test_verify_call();
+  test_stack_bound();
+  test_verify_dfa();
+
+  return report_tests();
+}
@@ -2397,6 +2397,7 @@ newop_cmp(struct arena_info *A, enum jvst_vm_op op,
 	case JVST_OP_INCR:
 	case JVST_OP_BSET:
 	case JVST_OP_BAND:
+	case JVST_OP_BCOUNT:
 	case JVST_OP_RETURN:
 	case JVST_OP_MOVE:
 	case JVST_OP_UNIQUE:
@@ -2518,6 +2519,7 @@ newop_load(struct arena_info *A, enum jvst_vm_op op,
 	case JVST_OP_INCR:
 	case JVST_OP_BSET:
 	case JVST_OP_BAND:
+	case JVST_OP_BCOUNT:
 	case JVST_OP_RETURN:
 	case JVST_OP_UNIQUE:
 		fprintf(stderr, "OP %s is not a load\n",